@@ -33,6 +33,8 @@ static void *TSDisplayedImageKVO = &TSDisplayedImageKVO;
 
 /// When set, the full-res image has already been displayed, so ignore the thumb.
 @property (nonatomic) BOOL hasShownFullResImage;
+/// When set, the embedded preview (which is larger than the thumb) is displayed.
+@property (nonatomic) BOOL hasShownPreviewImage;
 
 // Loading controller
 @property (nonatomic) TSDevelopLoadingIndicatorWindowController *loadController;
@@ -53,8 +55,9 @@ static void *TSDisplayedImageKVO = &TSDisplayedImageKVO;
 		[self addObserver:self forKeyPath:@"displayedImage"
 				  options:0 context:TSDisplayedImageKVO];
 		
-		// Set up rendering pipelines
-		self.pipelineRaw = [TSRawPipeline new];
+		// Set up rendering pipelines; only one image is edited at a time, so
+		// a single job (and set of buffers) is enough
+		self.pipelineRaw = [[TSRawPipeline alloc] initWithMaxConcurrentJobs:1];
 		
 		// Set up load controller
 		self.loadController = [TSDevelopLoadingIndicatorWindowController new];
@@ -113,13 +116,14 @@ static void *TSDisplayedImageKVO = &TSDisplayedImageKVO;
 		if(self.image != nil) {
 			// Cause the view to be resized
 			self.hasShownFullResImage = NO;
+			self.hasShownPreviewImage = NO;
 			self.shouldAdjustImageSize = YES;
 			
 			// Get a thumbnail
 			CGFloat s = MAX(NSWidth(self.view.bounds), NSHeight(self.view.bounds));
 			
 			[[TSThumbCache sharedInstance] getThumbForImage:self.image withSize:NSMakeSize(s, s) andCallback:^(NSImage *thumb, __unused void *userData) {
-				if(self.hasShownFullResImage == NO) {
+				if(self.hasShownFullResImage == NO && self.hasShownPreviewImage == NO) {
 					self.displayedImage = thumb;
 				}
 			} withUserData:nil];
@@ -195,8 +199,27 @@ static void *TSDisplayedImageKVO = &TSDisplayedImageKVO;
 	
 	// Actually process the image
 	if(self.image.fileTypeValue == TSLibraryImageRaw) {
+		// Only ask for the embedded preview if nothing's been rendered yet;
+		// re-renders (e.g. after an adjustment) keep showing the old image
+		TSRawPipelinePreviewCallback previewCallback = nil;
+		
+		if(self.hasShownFullResImage == NO) {
+			previewCallback = ^(NSImage *preview) {
+				// Show the embedded preview until the image is rendered
+				if(self.hasShownFullResImage == NO) {
+					self.hasShownPreviewImage = YES;
+					self.displayedImage = preview;
+				}
+			};
+		}
+		
 		// Submit the RAW image to the rendering pipeline
 		[self.pipelineRaw queueRawFile:self.image shouldCache:YES inhibitCachedResume:ignoreCache renderingIntent:TSRawPipelineIntentDisplayFast outputFormat:TSRawPipelineOutputFormatNSImage completionCallback:^(NSImage *img, NSError *err) {
+			// A newer job superseded this one; it will display its image
+			if([err.domain isEqualToString:NSCocoaErrorDomain] && err.code == NSUserCancelledError) {
+				return;
+			}
+			
 			// Display it
 			if(img) {
 				self.hasShownFullResImage = YES;
@@ -209,7 +232,7 @@ static void *TSDisplayedImageKVO = &TSDisplayedImageKVO;
 			self.shouldAdjustImageSize = NO;
 			
 			[self.loadController hideLoadingWindowWithAnimation:YES];
-		} progressCallback:^(TSRawPipelineStage stage) {
+		} previewCallback:previewCallback progressCallback:^(TSRawPipelineStage stage) {
 			
 		} conversionProgress:nil];
 	}
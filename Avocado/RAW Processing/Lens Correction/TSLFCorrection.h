@@ -0,0 +1,45 @@
+//
+//  TSLFCorrection.h
+//  Avocado
+//
+//	Applies lens corrections (vignetting, distortion and TCA) described by a
+//	remap grid to an image, spread over all cores.
+//
+//  Created by Tristan Seifert on 20160729.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#ifndef TSLFCorrection_h
+#define TSLFCorrection_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#import "TSRawPipeline.h"
+#import "TSLFRemapGrid.h"
+#import "lens_remap_kernels.h"
+
+/**
+ * Applies the corrections described by the given remap grid to an RGBX image,
+ * with 16 bits per component.
+ *
+ * Each output row is resampled from the input image at the coordinates given
+ * by the grid, and the vignetting gain for each component is applied to the
+ * sampled value, in a single pass.
+ *
+ * @param grid Remap grid, built for the size of the image.
+ * @param filter Filter with which the image is resampled
+ * @param inBuf Input image
+ * @param outBuf Output image; this may not be the same as the input.
+ * @param width Width of the image, in pixels
+ * @param height Height of the image, in pixels
+ */
+void TSLFApplyCorrections(const TSLFRemapGrid *grid, lens_remap_filter_t filter, const uint16_t *inBuf, uint16_t *outBuf, size_t width, size_t height);
+
+/**
+ * Returns the filter that should be used to resample the image for the given
+ * rendering intent.
+ */
+lens_remap_filter_t TSLFRemapFilterForIntent(TSRawPipelineIntent intent);
+
+#endif /* TSLFCorrection_h */
@@ -0,0 +1,144 @@
+//
+//  TSLFCorrection.mm
+//  Avocado
+//
+//  Created by Tristan Seifert on 20160729.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import "TSLFCorrection.h"
+
+#include <atomic>
+
+#include <unistd.h>
+
+#include <dispatch/dispatch.h>
+
+/// number of rows in each band that is corrected by a worker
+#define LENS_BAND_ROWS	16
+
+/**
+ * Interpolates the grid vertically at the given row, producing one row of
+ * nodes (six coordinates, followed by three gains, per node.)
+ */
+static void TSLFInterpolateNodeRow(const TSLFRemapGrid *grid, size_t y, float *nodeRow) {
+	const size_t gridWidth = grid->gridWidth;
+	
+	size_t j = y / grid->spacing;
+	float fy = ((float) (y % grid->spacing)) / grid->spacing;
+	
+	const float *coordsTop = TSLFRemapGridCoords(grid) + (j * gridWidth * 6);
+	const float *coordsBottom = coordsTop + (gridWidth * 6);
+	
+	const float *gainsTop = TSLFRemapGridGains(grid) + (j * gridWidth * 3);
+	const float *gainsBottom = gainsTop + (gridWidth * 3);
+	
+	for(size_t i = 0; i < gridWidth; i++) {
+		float *node = nodeRow + (i * 9);
+		
+		for(int k = 0; k < 6; k++) {
+			float top = coordsTop[(i * 6) + k];
+			node[k] = top + ((coordsBottom[(i * 6) + k] - top) * fy);
+		}
+		
+		for(int k = 0; k < 3; k++) {
+			float top = gainsTop[(i * 3) + k];
+			node[6 + k] = top + ((gainsBottom[(i * 3) + k] - top) * fy);
+		}
+	}
+}
+
+/**
+ * Interpolates a row of nodes horizontally, producing the source coordinates
+ * (six floats) and gains (three floats) for each pixel in the row.
+ */
+static void TSLFInterpolatePixelRow(const TSLFRemapGrid *grid, const float *nodeRow, size_t width, float *coords, float *gains) {
+	const size_t spacing = grid->spacing;
+	
+	for(size_t x = 0; x < width; x++) {
+		const float *left = nodeRow + ((x / spacing) * 9);
+		const float *right = left + 9;
+		
+		float fx = ((float) (x % spacing)) / spacing;
+		
+		for(int k = 0; k < 6; k++) {
+			coords[(x * 6) + k] = left[k] + ((right[k] - left[k]) * fx);
+		}
+		
+		for(int k = 0; k < 3; k++) {
+			gains[(x * 3) + k] = left[6 + k] + ((right[6 + k] - left[6 + k]) * fx);
+		}
+	}
+}
+
+/**
+ * Applies the corrections described by the given remap grid to an RGBX image,
+ * with 16 bits per component.
+ *
+ * Workers each take the next band of output rows. For each row, the grid is
+ * interpolated into per-pixel coordinates and gains in the worker's scratch
+ * buffers, from which the row is resampled by the kernel for the filter.
+ * Because the gains were evaluated at the source coordinates when the grid was
+ * built, the input image doesn't need to have vignetting removed from it.
+ */
+void TSLFApplyCorrections(const TSLFRemapGrid *grid, lens_remap_filter_t filter, const uint16_t *inBuf, uint16_t *outBuf, size_t width, size_t height) {
+	const size_t numBands = (height + LENS_BAND_ROWS - 1) / LENS_BAND_ROWS;
+	
+	long numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	numWorkers = MAX(1, MIN(numWorkers, (long) numBands));
+	
+	std::atomic<size_t> nextBand(0);
+	std::atomic<size_t> *nextBandPtr = &nextBand;
+	
+	lens_remap_row_fn kernel = lens_remap_row_select(filter);
+	
+	dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(numWorkers, queue, ^(size_t worker) {
+		// each worker has its own scratch buffers for a single row
+		float *nodeRow = (float *) valloc(sizeof(float) * 9 * grid->gridWidth);
+		float *coords = (float *) valloc(sizeof(float) * 6 * width);
+		float *gains = (float *) valloc(sizeof(float) * 3 * width);
+		
+		size_t band;
+		
+		while((band = nextBandPtr->fetch_add(1)) < numBands) {
+			size_t rowStart = band * LENS_BAND_ROWS;
+			size_t rowEnd = MIN(rowStart + LENS_BAND_ROWS, height);
+			
+			for(size_t y = rowStart; y < rowEnd; y++) {
+				TSLFInterpolateNodeRow(grid, y, nodeRow);
+				TSLFInterpolatePixelRow(grid, nodeRow, width, coords, gains);
+				
+				// resample the row, and apply the vignetting gain
+				uint16_t *dst = outBuf + (y * width * 4);
+				kernel(inBuf, (int) width, (int) height, coords, gains, (int) width, dst);
+			}
+		}
+		
+		free(nodeRow);
+		free(coords);
+		free(gains);
+	});
+}
+
+/**
+ * Returns the filter that should be used to resample the image for the given
+ * rendering intent:
+ *
+ * - Display intents use bilinear interpolation, which is fast, and softens
+ *	 the image only slightly.
+ * - Output uses Lanczos-3, which preserves the most detail.
+ */
+lens_remap_filter_t TSLFRemapFilterForIntent(TSRawPipelineIntent intent) {
+	switch(intent) {
+		case TSRawPipelineIntentOutput:
+			return LENS_REMAP_LANCZOS3;
+		
+		case TSRawPipelineIntentDisplayFast:
+		case TSRawPipelineIntentDisplaySlow:
+		case TSRawPipelineIntentUnknown:
+		default:
+			return LENS_REMAP_BILINEAR;
+	}
+}
@@ -33,7 +33,6 @@ typedef NS_ENUM(NSUInteger, TSLFLensSearchFlags) {
  */
 + (instancetype) sharedInstance;
 
-
 /**
  * Attempts to find a camera object for the given image. If no camera could be
  * found, nil is returned.
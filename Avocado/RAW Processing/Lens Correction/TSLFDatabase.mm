@@ -22,8 +22,26 @@ static TSLFDatabase *sharedDatabase = nil;
 
 - (void) loadLFDatabase;
 
+- (void) buildIndices;
+
+- (TSLFCamera *) cameraWithMaker:(const char *) maker andModel:(const char *) model;
+- (BOOL) lens:(const lfLens *) lens fitsCamera:(const lfCamera *) camera;
+- (NSArray<TSLFLens *> *) lensesForCamera:(TSLFCamera *) camera withMaker:(const char *) maker andSpecification:(const char *) spec;
+
 @property (nonatomic) lfDatabase *lensDb;
 
+/// cameras in the database, by normalized maker and model
+@property (nonatomic) NSDictionary<NSString *, NSValue *> *cameraIndex;
+/// lenses in the database, by normalized maker, model and crop factor
+@property (nonatomic) NSDictionary<NSString *, NSValue *> *lensIndex;
+
+/// cameras that were looked up by maker and model; NSNull if not found
+@property (nonatomic) NSCache *cameraMemo;
+/// lenses that were searched for, by camera, maker and specification
+@property (nonatomic) NSCache *lensMemo;
+/// cameras and lenses that were decoded from persistent data
+@property (nonatomic) NSCache *persistentMemo;
+
 @end
 
 @implementation TSLFDatabase
@@ -50,18 +68,32 @@ static TSLFDatabase *sharedDatabase = nil;
 		// create the DB object
 		self.lensDb = new lfDatabase();
 		
-		// initialize it (loading the database files)
+		// initialize it (loading the database files) and index it
 		[self loadLFDatabase];
+		[self buildIndices];
+		
+		self.cameraMemo = [NSCache new];
+		self.lensMemo = [NSCache new];
+		self.persistentMemo = [NSCache new];
 	}
 	
 	return self;
 }
 
+/**
+ * Releases the LensFun database.
+ */
+- (void) dealloc {
+	delete self.lensDb;
+}
+
 /**
  * Initializes the internal LensFun database object, by loading
  * all of the database files in the LensFunDB bundle.
  */
 - (void) loadLFDatabase {
+	NSDate *start = [NSDate date];
+	
 	// locate the LensfunDB bundle
 	NSBundle *mainBundle = [NSBundle mainBundle];
 	NSURL *dbBundleUrl = [mainBundle URLForResource:@"LensfunDB"
@@ -80,10 +112,142 @@ static TSLFDatabase *sharedDatabase = nil;
 	
 	if(success == NO) {
 		DDLogError(@"Couldn't load lens database; lens correction won't work.");
+		return;
 	}
+	
+	DDLogDebug(@"Loaded lens database from %@ in %f seconds", dbFilesUrl, -start.timeIntervalSinceNow);
+}
+
+#pragma mark Indexing
+/**
+ * Normalizes a name from the database, or from the metadata of an image, for
+ * use in an index key: it's converted to lowercase, and runs of whitespace are
+ * collapsed into a single space.
+ */
+static NSString *TSLFNormalizeName(const char *str) {
+	if(str == NULL) {
+		return @"";
+	}
+	
+	NSMutableData *buf = [NSMutableData dataWithLength:strlen(str)];
+	char *out = (char *) buf.mutableBytes;
+	size_t length = 0;
+	
+	BOOL space = NO;
+	
+	for(const char *c = str; *c; c++) {
+		if(isspace((unsigned char) *c)) {
+			space = (length != 0);
+		} else {
+			if(space) {
+				out[length++] = ' ';
+				space = NO;
+			}
+			
+			out[length++] = (char) tolower((unsigned char) *c);
+		}
+	}
+	
+	return [[NSString alloc] initWithBytes:out length:length encoding:NSUTF8StringEncoding] ?: @"";
+}
+
+/**
+ * Returns the index key for a camera with the given maker and model.
+ */
+static NSString *TSLFCameraKey(const char *maker, const char *model) {
+	return [NSString stringWithFormat:@"%@\n%@", TSLFNormalizeName(maker), TSLFNormalizeName(model)];
+}
+
+/**
+ * Returns the index key for a lens with the given maker, model and crop
+ * factor.
+ */
+static NSString *TSLFLensKey(const char *maker, const char *model, CGFloat crop) {
+	return [NSString stringWithFormat:@"%@\n%@\n%.3f", TSLFNormalizeName(maker), TSLFNormalizeName(model), crop];
+}
+
+/**
+ * Builds the indices of cameras (by maker and model) and lenses (by maker,
+ * model and crop factor) in the database. They point directly to the LensFun
+ * objects, which live as long as the database.
+ *
+ * If several objects have the same key, the first one in the database wins,
+ * which is what a search would have returned first as well.
+ */
+- (void) buildIndices {
+	NSMutableDictionary<NSString *, NSValue *> *cameras = [NSMutableDictionary new];
+	NSMutableDictionary<NSString *, NSValue *> *lenses = [NSMutableDictionary new];
+	
+	// index cameras
+	const lfCamera *const *allCameras = self.lensDb->GetCameras();
+	
+	for(NSUInteger i = 0; allCameras != NULL && allCameras[i] != NULL; i++) {
+		const lfCamera *cam = allCameras[i];
+		NSString *key = TSLFCameraKey(cam->Maker, cam->Model);
+		
+		if(cameras[key] == nil) {
+			cameras[key] = [NSValue valueWithPointer:cam];
+		}
+	}
+	
+	// index lenses
+	const lfLens *const *allLenses = self.lensDb->GetLenses();
+	
+	for(NSUInteger i = 0; allLenses != NULL && allLenses[i] != NULL; i++) {
+		const lfLens *lens = allLenses[i];
+		NSString *key = TSLFLensKey(lens->Maker, lens->Model, lens->CropFactor);
+		
+		if(lenses[key] == nil) {
+			lenses[key] = [NSValue valueWithPointer:lens];
+		}
+	}
+	
+	self.cameraIndex = [cameras copy];
+	self.lensIndex = [lenses copy];
+	
+	DDLogDebug(@"Indexed %lu cameras and %lu lenses", (unsigned long) cameras.count, (unsigned long) lenses.count);
 }
 
 #pragma mark Searching
+/**
+ * Finds the camera with the given maker and model. Exact matches (ignoring
+ * case and whitespace) are found in the index; anything else is searched for
+ * in the database. Either way, the result is memoized, so that subsequent
+ * lookups for the same camera are a single hash table lookup.
+ */
+- (TSLFCamera *) cameraWithMaker:(const char *) maker andModel:(const char *) model {
+	NSString *key = TSLFCameraKey(maker, model);
+	
+	// was this camera looked up before?
+	id memo = [self.cameraMemo objectForKey:key];
+	
+	if(memo != nil) {
+		return (memo == [NSNull null]) ? nil : memo;
+	}
+	
+	// look it up in the index, and fall back to a search otherwise
+	TSLFCamera *obj = nil;
+	const lfCamera *found = (const lfCamera *) [self.cameraIndex[key] pointerValue];
+	
+	if(found != NULL) {
+		obj = [[TSLFCamera alloc] initWithCamera:(void *) new lfCamera(*found)];
+	} else {
+		const lfCamera **cameras = self.lensDb->FindCameras(maker, model);
+		
+		// use the FIRST entry in the list, if there is one
+		if(cameras != NULL && cameras[0] != NULL) {
+			obj = [[TSLFCamera alloc] initWithCamera:(void *) new lfCamera(*cameras[0])];
+		} else {
+			DDLogVerbose(@"Couldn't find camera for maker = %s, model = %s", maker, model);
+		}
+		
+		lf_free(cameras);
+	}
+	
+	[self.cameraMemo setObject:(obj ?: [NSNull null]) forKey:key];
+	return obj;
+}
+
 /**
  * Attempts to find a camera object for the given image. If no camera could be
  * found, nil is returned.
@@ -99,30 +263,70 @@ static TSLFDatabase *sharedDatabase = nil;
 	NSString *model = image.metadata[TSLibraryImageMetadataKeyCameraModel];
 	const char *modelCStr = [model cStringUsingEncoding:NSASCIIStringEncoding];
 	
-	// Try to find a camera
-	const lfCamera** cameras = self.lensDb->FindCameras(makerCStr, modelCStr);
-	
-	// If NULL is returned, no camera was found
-	if(cameras == nil) {
-		return nil;
+	return [self cameraWithMaker:makerCStr andModel:modelCStr];
+}
+
+/**
+ * Checks whether the given lens can be mounted on the camera: that is, if one
+ * of its mounts is the camera's, or one that the camera's mount is compatible
+ * with. This is the same check a search for lenses for the camera performs.
+ */
+- (BOOL) lens:(const lfLens *) lens fitsCamera:(const lfCamera *) camera {
+	// cameras without a mount (e.g. fixed lens ones) don't restrict the search
+	if(camera->Mount == NULL) {
+		return YES;
 	}
 	
-	// If the first entry is nil, we couldn't find a camera; that's bad.
-	if(cameras[0] == nil) {
-		DDLogVerbose(@"Couldn't find camera for maker = %@, model = %@", maker, model);
+	const lfMount *mount = self.lensDb->FindMount(camera->Mount);
+	
+	for(NSUInteger i = 0; lens->Mounts != NULL && lens->Mounts[i] != NULL; i++) {
+		const char *lensMount = lens->Mounts[i];
 		
-		lf_free(cameras);
-		return nil;
-	}
-	// Otherwise, use the FIRST entry in the list.
-	else {
-		const lfCamera *camera = new lfCamera(*cameras[0]);
-		TSLFCamera *obj = [[TSLFCamera alloc] initWithCamera:(void *) camera];
+		if(strcasecmp(lensMount, camera->Mount) == 0) {
+			return YES;
+		}
 		
-		// Clean up
-		lf_free(cameras);
-		return obj;
+		for(NSUInteger j = 0; mount != NULL && mount->Compat != NULL && mount->Compat[j] != NULL; j++) {
+			if(strcasecmp(lensMount, mount->Compat[j]) == 0) {
+				return YES;
+			}
+		}
 	}
+	
+	return NO;
+}
+
+/**
+ * Returns all lenses that may be used with the given camera, matching the
+ * given maker and lens specification. The search is fuzzy, so it can't be
+ * answered from an index; instead, its results are memoized.
+ */
+- (NSArray<TSLFLens *> *) lensesForCamera:(TSLFCamera *) camera withMaker:(const char *) maker andSpecification:(const char *) spec {
+	NSString *key = [NSString stringWithFormat:@"%@\n%@\n%@",
+					 TSLFCameraKey(camera.camera->Maker, camera.camera->Model),
+					 TSLFNormalizeName(maker), TSLFNormalizeName(spec)];
+	
+	NSArray<TSLFLens *> *memo = [self.lensMemo objectForKey:key];
+	
+	if(memo != nil) {
+		return memo;
+	}
+	
+	// search the database, and create an object wrapper for each lens
+	NSMutableArray<TSLFLens *> *arr = [NSMutableArray new];
+	const lfLens **lenses = self.lensDb->FindLenses(camera.camera, maker, spec, LF_SEARCH_LOOSE);
+	
+	for(NSUInteger i = 0; lenses != NULL && lenses[i] != NULL; i++) {
+		TSLFLens *lensObj = [[TSLFLens alloc] initWithLens:(void *) new lfLens(*lenses[i])];
+		[arr addObject:lensObj];
+	}
+	
+	lf_free(lenses);
+	
+	memo = [arr copy];
+	[self.lensMemo setObject:memo forKey:key];
+	
+	return memo;
 }
 
 /**
@@ -136,8 +340,6 @@ static TSLFDatabase *sharedDatabase = nil;
 	__block CGFloat focalLength;
 	__block const char *makerCStr, *specCStr;
 	
-	TSLFLens *lensObj;
-	
 	// Get some data from the image
 	[image.managedObjectContext performBlockAndWait:^{
 		NSString *maker = image.metadata[TSLibraryImageMetadataKeyCameraMaker];
@@ -159,34 +361,21 @@ static TSLFDatabase *sharedDatabase = nil;
 		return nil;
 	}
 	
-	lfCamera *cam = cameraObj.camera;
-	
-	// Try to find the lens objects
-	NSMutableArray<TSLFLens *> *arr = [NSMutableArray new];
-	
-	const lfLens **lenses = self.lensDb->FindLenses(cam, makerCStr, specCStr, LF_SEARCH_LOOSE);
+	// Find all lenses for this camera and specification
+	NSArray<TSLFLens *> *lenses = [self lensesForCamera:cameraObj withMaker:makerCStr
+									  andSpecification:specCStr];
 	
-	// For each lens, create an object wrapper
-	do {
-		// Perform the focal length check
-		if(checkFocalLength) {
-			// Focal length must be MinFocal ≤ actualFocalLength ≤ MaxFocal
-			if(focalLength < lenses[0]->MinFocal || focalLength > lenses[0]->MaxFocal) {
-				goto nextLens;
-			}
-		}
-		
-		// Get lens and make object, then add to the array
-		lensObj = [[TSLFLens alloc] initWithLens:(void *) new lfLens(*lenses[0])];
-		[arr addObject:lensObj];
+	// Perform the focal length check
+	if(checkFocalLength) {
+		// Focal length must be MinFocal ≤ actualFocalLength ≤ MaxFocal
+		NSIndexSet *matching = [lenses indexesOfObjectsPassingTest:^BOOL(TSLFLens *lens, NSUInteger idx, BOOL *stop) {
+			return (focalLength >= lens.focalMin && focalLength <= lens.focalMax);
+		}];
 		
-		// Go to next lens
-	nextLens: ;
-		lenses++;
-	} while(*lenses != NULL);
+		return [lenses objectsAtIndexes:matching];
+	}
 	
-	// Copy array to return a non-mutable class
-	return [arr copy];
+	return lenses;
 }
 
 #pragma mark Helpers
@@ -249,6 +438,13 @@ static TSLFDatabase *sharedDatabase = nil;
 		return nil;
 	}
 	
+	// was this data decoded before?
+	id memo = [self.persistentMemo objectForKey:data];
+	
+	if(memo != nil) {
+		return (memo == [NSNull null]) ? nil : memo;
+	}
+	
 	// Unarchive the data
 	NSKeyedUnarchiver *archiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:data];
 	archiver.requiresSecureCoding = YES;
@@ -259,36 +455,34 @@ static TSLFDatabase *sharedDatabase = nil;
 	
 	[archiver finishDecoding];
 	
-	// Set up a database query
-	const char *makeStr = (const char *) make.bytes;
-	const char *modelStr = (const char *) model.bytes;
+	// Look up the camera
+	NSString *makeStr = [[NSString alloc] initWithData:make encoding:NSUTF8StringEncoding];
+	NSString *modelStr = [[NSString alloc] initWithData:model encoding:NSUTF8StringEncoding];
 	
-	// Query the database
-	const lfCamera** cameras = self.lensDb->FindCameras(makeStr, modelStr);
+	TSLFCamera *obj = [self cameraWithMaker:makeStr.UTF8String andModel:modelStr.UTF8String];
 	
-	// If NULL is returned, no camera was found
-	if(cameras == nil || cameras[0] == nil) {
-		DDLogWarn(@"Couldn't find camera for maker = %s, model = %s; archived data = %@", makeStr, modelStr, data);
-		
-		if(cameras[0] == nil) {
-			lf_free(cameras);
-		}
-		
-		return nil;
-	}
-	// Otherwise, use the FIRST entry in the list.
-	else {
-		const lfCamera *camera = new lfCamera(*cameras[0]);
-		TSLFCamera *obj = [[TSLFCamera alloc] initWithCamera:(void *) camera];
-		
-		return obj;
+	if(obj == nil) {
+		DDLogWarn(@"Couldn't find camera for maker = %@, model = %@; archived data = %@", makeStr, modelStr, data);
 	}
+	
+	[self.persistentMemo setObject:(obj ?: [NSNull null]) forKey:data];
+	return obj;
 }
 
 /**
  *  Finds a previously found lens, given the data blob generated by its
  *	`persistentData` method.
  *
+ *	The lens is looked up in the index by its maker, model and crop factor,
+ *	and used if it fits the camera. Otherwise, for example if the lens was
+ *	renamed in the database since the data was archived, the database is
+ *	searched for lenses for the camera that match the maker and model, and
+ *	the first one with the same crop factor is used.
+ *
+ *	The result is memoized for each combination of lens and camera, so that
+ *	the lens of an image is resolved only once, rather than every time the
+ *	image is processed.
+ *
  *  @param data Persistent data (as produced by NSKeyedArchiver)
  *	@param camera Camera object that was previously decoded
  *
@@ -299,6 +493,16 @@ static TSLFDatabase *sharedDatabase = nil;
 		return nil;
 	}
 	
+	// was this lens resolved for this camera before?
+	NSMutableData *memoKey = [data mutableCopy];
+	[memoKey appendData:[TSLFCameraKey(camera.camera->Maker, camera.camera->Model) dataUsingEncoding:NSUTF8StringEncoding]];
+	
+	id memo = [self.persistentMemo objectForKey:memoKey];
+	
+	if(memo != nil) {
+		return (memo == [NSNull null]) ? nil : memo;
+	}
+	
 	// Unarchive the data
 	NSKeyedUnarchiver *archiver = [[NSKeyedUnarchiver alloc] initForReadingWithData:data];
 	archiver.requiresSecureCoding = YES;
@@ -309,44 +513,43 @@ static TSLFDatabase *sharedDatabase = nil;
 	
 	[archiver finishDecoding];
 	
-	// Set up a database query
-	const char *makeStr = (const char *) make.bytes;
-	const char *modelStr = (const char *) model.bytes;
-	lfCamera *cam = camera.camera;
+	NSString *makeStr = [[NSString alloc] initWithData:make encoding:NSUTF8StringEncoding];
+	NSString *modelStr = [[NSString alloc] initWithData:model encoding:NSUTF8StringEncoding];
+	
+	// Look up the lens in the index
+	TSLFLens *lensObj = nil;
+	
+	NSString *key = TSLFLensKey(makeStr.UTF8String, modelStr.UTF8String, cropFactor);
+	const lfLens *found = (const lfLens *) [self.lensIndex[key] pointerValue];
+	
+	if(found != NULL && [self lens:found fitsCamera:camera.camera] == NO) {
+		found = NULL;
+	}
 	
-	// Run the query
-	const lfLens **lenses = self.lensDb->FindLenses(cam, makeStr, modelStr);
+	// Search for it otherwise, and find the lens with the matching crop factor
+	const lfLens **lenses = NULL;
 	
-	// If nil was returned, no matching lenses are found.
-	if(lenses == nil || lenses[0] == nil) {
-		DDLogWarn(@"Couldn't find lens for maker = %s, model = %s; archived data = %@, camera = %@", makeStr, modelStr, data, camera);
+	if(found == NULL) {
+		lenses = self.lensDb->FindLenses(camera.camera, makeStr.UTF8String, modelStr.UTF8String);
 		
-		if(lenses[0] == nil) {
-			lf_free(lenses);
+		for(NSUInteger i = 0; lenses != NULL && lenses[i] != NULL; i++) {
+			if(lenses[i]->CropFactor == cropFactor) {
+				found = lenses[i];
+				break;
+			}
 		}
-		
-		return nil;
 	}
-	// Otherwise, find the lens with the matching crop factor
-	else {
-		do {
-			// Does the crop factor match?
-			if(lenses[0]->CropFactor == cropFactor) {
-				// Create the object wrapper, if it does match.
-				const lfLens *lens = new lfLens(*lenses[0]);
-				TSLFLens *lensObj = [[TSLFLens alloc] initWithLens:(void *) lens];
-				
-				return lensObj;
-			}
-			
-			// Go to next lens
-			lenses++;
-		} while(*lenses != NULL);
+	
+	if(found != NULL) {
+		lensObj = [[TSLFLens alloc] initWithLens:(void *) new lfLens(*found)];
+	} else {
+		DDLogWarn(@"Couldn't find lens for maker = %@, model = %@, crop = %f; archived data = %@, camera = %@", makeStr, modelStr, cropFactor, data, camera);
 	}
 	
-	// No suitable lens was found… wat.
-	DDLogWarn(@"Couldn't find lens for maker = %s, model = %s, crop = %f; archived data = %@, camera = %@; however, FindLenses returned data (this should never happen)", makeStr, modelStr, cropFactor, data, camera);
-	return nil;
+	lf_free(lenses);
+	
+	[self.persistentMemo setObject:(lensObj ?: [NSNull null]) forKey:memoKey];
+	return lensObj;
 }
 
 @end
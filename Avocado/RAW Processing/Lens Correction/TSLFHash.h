@@ -0,0 +1,49 @@
+//
+//  TSLFHash.h
+//  Avocado
+//
+//	64-bit FNV-1a hashing, used by the lens correction code wherever a hash
+//	has to be stable between launches, e.g. in the names and headers of files
+//	in the caches directory. Unlike -[NSObject hash], the result only depends
+//	on the hashed bytes.
+//
+//  Created by Tristan Seifert on 20161018.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#ifndef TSLFHash_h
+#define TSLFHash_h
+
+#import <Foundation/Foundation.h>
+
+/// initial value of a hash, before any bytes have been hashed
+static const uint64_t TSLFHashInitial = 0xCBF29CE484222325ULL;
+
+/**
+ * Adds the given bytes to a hash.
+ *
+ * @param hash Hash so far; TSLFHashInitial for a new hash.
+ * @param bytes Bytes to add
+ * @param length Number of bytes to add
+ *
+ * @return The updated hash.
+ */
+static inline uint64_t TSLFHashBytes(uint64_t hash, const void *bytes, size_t length) {
+	for(size_t i = 0; i < length; i++) {
+		hash ^= ((const uint8_t *) bytes)[i];
+		hash *= 0x100000001B3ULL;
+	}
+	
+	return hash;
+}
+
+/**
+ * Hashes the UTF-8 representation of the given string, without the trailing
+ * zero byte.
+ */
+static inline uint64_t TSLFHashString(NSString *str) {
+	const char *bytes = str.UTF8String;
+	return TSLFHashBytes(TSLFHashInitial, bytes, strlen(bytes));
+}
+
+#endif /* TSLFHash_h */
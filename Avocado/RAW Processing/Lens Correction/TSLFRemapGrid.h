@@ -0,0 +1,73 @@
+//
+//  TSLFRemapGrid.h
+//  Avocado
+//
+//	Remap grids hold the distortion/TCA coordinate map, and the vignetting gain
+//	map, for a lens at a particular focal length and aperture. They're sampled
+//	at a coarse grid, which is interpolated when corrections are applied; this
+//	way, LensFun only has to be asked for a small number of points once per set
+//	of parameters, rather than for every pixel of every image.
+//
+//	Grids are kept in the shared LUT cache, and are also written to disk.
+//
+//  Created by Tristan Seifert on 20160730.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#include <stdint.h>
+
+@class TSRawLUT;
+@class TSLFLens, TSLFCamera;
+
+/**
+ * Header of a remap grid. It is directly followed by the coordinate map (six
+ * floats per node: the source x and y coordinates for the red, green and blue
+ * components) and then the gain map (three floats per node: the vignetting
+ * gain for each component, at its source coordinate.)
+ *
+ * Node (i, j) corresponds to the output pixel at (i * spacing, j * spacing);
+ * the grid extends past the right and bottom edges of the image, such that
+ * every pixel is surrounded by four nodes.
+ */
+typedef struct {
+	/// identifies the file format; TSLFRemapGridMagic
+	uint32_t magic;
+	/// version of the file format
+	uint32_t version;
+	/// hash over the parameters the grid was built for
+	uint64_t keyHash;
+	
+	/// size of the image, in pixels
+	uint32_t width, height;
+	/// distance between nodes, in pixels
+	uint32_t spacing;
+	/// number of nodes in each direction
+	uint32_t gridWidth, gridHeight;
+	
+	uint32_t reserved;
+} TSLFRemapGrid;
+
+/**
+ * Returns a pointer to the coordinate map of the given grid.
+ */
+static inline const float *TSLFRemapGridCoords(const TSLFRemapGrid *grid) {
+	return (const float *) (grid + 1);
+}
+
+/**
+ * Returns a pointer to the gain map of the given grid.
+ */
+static inline const float *TSLFRemapGridGains(const TSLFRemapGrid *grid) {
+	return TSLFRemapGridCoords(grid) + (grid->gridWidth * grid->gridHeight * 6);
+}
+
+/**
+ * Returns the remap grid for the given lens and camera, at the given focal
+ * length and aperture, for an image of the given size. If the grid isn't in
+ * memory, it's read from disk, or built and written to disk if needed.
+ *
+ * The table of the returned object is a TSLFRemapGrid.
+ */
+TSRawLUT *TSLFGetRemapGrid(TSLFLens *lens, TSLFCamera *camera, CGFloat focal, CGFloat aperture, NSUInteger width, NSUInteger height);
@@ -0,0 +1,201 @@
+//
+//  TSLFRemapGrid.mm
+//  Avocado
+//
+//  Created by Tristan Seifert on 20160730.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import "TSLFRemapGrid.h"
+#import "TSLFLens.h"
+#import "TSLFCamera.h"
+#import "TSLFHash.h"
+
+#import "TSRawLUTCache.h"
+#import "TSGroupContainerHelper.h"
+
+#import "lensfun.h"
+
+#include <dispatch/dispatch.h>
+
+/**
+ * Set to 1 to persist remap grids on disk, so they survive relaunches of the
+ * app. Grids are small (a few MB for a 24 MP image) so this is cheap.
+ */
+#define TSLFRemapGridPersist	1
+
+/// magic value at the start of each grid ('LFGR')
+static const uint32_t TSLFRemapGridMagic = 0x4C464752;
+/// current version of the grid format; bump when the contents change
+static const uint32_t TSLFRemapGridVersion = 1;
+
+/// distance between grid nodes, in pixels
+static const uint32_t TSLFRemapGridSpacing = 16;
+
+// TODO: Figure out a better way to expose this
+@interface TSLFLens ()
+@property (nonatomic) lfLens *lens;
+@end
+
+/**
+ * Returns the URL of the directory into which grids are persisted.
+ */
+static NSURL *TSLFRemapGridDirectory() {
+	NSURL *url = [TSGroupContainerHelper sharedInstance].caches;
+	return [url URLByAppendingPathComponent:@"TSLFRemapGrids" isDirectory:YES];
+}
+
+/**
+ * Fills in the header of the grid for an image of the given size.
+ */
+static void TSLFInitRemapGrid(TSLFRemapGrid *grid, uint64_t keyHash, NSUInteger width, NSUInteger height) {
+	grid->magic = TSLFRemapGridMagic;
+	grid->version = TSLFRemapGridVersion;
+	grid->keyHash = keyHash;
+	
+	grid->width = (uint32_t) width;
+	grid->height = (uint32_t) height;
+	grid->spacing = TSLFRemapGridSpacing;
+	
+	// add one node past the last pixel, so each pixel has neighbours on all sides
+	grid->gridWidth = (uint32_t) (((width - 1) / TSLFRemapGridSpacing) + 2);
+	grid->gridHeight = (uint32_t) (((height - 1) / TSLFRemapGridSpacing) + 2);
+}
+
+/**
+ * Asks LensFun for the coordinates and gains at every node of the grid. Gains
+ * are evaluated at the source coordinate of each component, since vignetting
+ * is a property of the distorted (input) image.
+ */
+static void TSLFBuildRemapGrid(TSLFRemapGrid *grid, lfLens *lens, float crop, float focal, float aperture) {
+	lfModifier *m = new lfModifier(lens, crop, grid->width, grid->height);
+	m->Initialize(lens, LF_PF_F32, focal, aperture, 1000.f, 0.f, LF_RECTILINEAR, LF_MODIFY_ALL, false);
+	
+	float *coords = (float *) TSLFRemapGridCoords(grid);
+	float *gains = (float *) TSLFRemapGridGains(grid);
+	
+	const uint32_t gridWidth = grid->gridWidth;
+	const uint32_t spacing = grid->spacing;
+	
+	dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(grid->gridHeight, queue, ^(size_t j) {
+		for(size_t i = 0; i < gridWidth; i++) {
+			float x = i * spacing;
+			float y = j * spacing;
+			
+			float *c = coords + (((j * gridWidth) + i) * 6);
+			float *g = gains + (((j * gridWidth) + i) * 3);
+			
+			// no geometry corrections means that every pixel maps to itself
+			if(!m->ApplySubpixelGeometryDistortion(x, y, 1, 1, c)) {
+				c[0] = c[2] = c[4] = x;
+				c[1] = c[3] = c[5] = y;
+			}
+			
+			// the gain is what vignetting removal multiplies a value of one with
+			for(int comp = 0; comp < 3; comp++) {
+				float pixel[3] = {1.f, 1.f, 1.f};
+				
+				m->ApplyColorModification(pixel, c[(comp * 2) + 0], c[(comp * 2) + 1],
+										  1, 1, LF_CR_3(RED,GREEN,BLUE),
+										  sizeof(pixel));
+				
+				g[comp] = pixel[comp];
+			}
+		}
+	});
+	
+	delete m;
+}
+
+/**
+ * Tries to read the grid for the given key from disk. Returns YES if the grid
+ * was read, and matches the expected header.
+ */
+static BOOL TSLFReadRemapGrid(TSLFRemapGrid *grid, size_t size, NSURL *url) {
+#if TSLFRemapGridPersist
+	NSData *data = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:nil];
+	
+	if(data == nil || data.length != size) {
+		return NO;
+	}
+	
+	const TSLFRemapGrid *stored = (const TSLFRemapGrid *) data.bytes;
+	
+	if(memcmp(stored, grid, sizeof(TSLFRemapGrid)) != 0) {
+		DDLogWarn(@"Ignoring stale remap grid at %@", url);
+		return NO;
+	}
+	
+	memcpy(grid, data.bytes, size);
+	return YES;
+#else
+	return NO;
+#endif
+}
+
+/**
+ * Writes the grid to disk.
+ */
+static void TSLFWriteRemapGrid(const TSLFRemapGrid *grid, size_t size, NSURL *url) {
+#if TSLFRemapGridPersist
+	NSError *err = nil;
+	NSFileManager *fm = [NSFileManager defaultManager];
+	
+	[fm createDirectoryAtURL:TSLFRemapGridDirectory() withIntermediateDirectories:YES
+				  attributes:nil error:&err];
+	
+	NSData *data = [NSData dataWithBytesNoCopy:(void *) grid length:size freeWhenDone:NO];
+	
+	if(err != nil || [data writeToURL:url options:NSDataWritingAtomic error:&err] == NO) {
+		DDLogWarn(@"Couldn't write remap grid to %@: %@", url, err);
+	}
+#endif
+}
+
+/**
+ * Returns the remap grid for the given lens and camera, at the given focal
+ * length and aperture, for an image of the given size. If the grid isn't in
+ * memory, it's read from disk, or built and written to disk if needed.
+ */
+TSRawLUT *TSLFGetRemapGrid(TSLFLens *lens, TSLFCamera *camera, CGFloat focal, CGFloat aperture, NSUInteger width, NSUInteger height) {
+	if(lens == nil || width == 0 || height == 0) {
+		return nil;
+	}
+	
+	// the key contains everything the grid depends on
+	NSString *lensId = [lens.persistentData base64EncodedStringWithOptions:0];
+	NSString *key = [NSString stringWithFormat:@"lensgrid:%@:%a:%a:%a:%lu:%lu:%u", lensId, camera.cropFactor, focal, aperture, (unsigned long) width, (unsigned long) height, TSLFRemapGridVersion];
+	
+	uint64_t keyHash = TSLFHashString(key);
+	
+	// figure out the size of the grid
+	TSLFRemapGrid header;
+	memset(&header, 0, sizeof(header));
+	
+	TSLFInitRemapGrid(&header, keyHash, width, height);
+	
+	size_t nodes = header.gridWidth * header.gridHeight;
+	size_t size = sizeof(TSLFRemapGrid) + (nodes * (6 + 3) * sizeof(float));
+	
+	NSString *name = [NSString stringWithFormat:@"%016llx.lfgrid", (unsigned long long) keyHash];
+	NSURL *url = [TSLFRemapGridDirectory() URLByAppendingPathComponent:name isDirectory:NO];
+	
+	lfLens *lensObj = lens.lens;
+	
+	return [[TSRawLUTCache sharedInstance] tableForKey:key size:size builder:^(void *table) {
+		TSLFRemapGrid *grid = (TSLFRemapGrid *) table;
+		memcpy(grid, &header, sizeof(header));
+		
+		if(TSLFReadRemapGrid(grid, size, url)) {
+			DDLogVerbose(@"Read remap grid from %@", url);
+			return;
+		}
+		
+		TSLFBuildRemapGrid(grid, lensObj, camera.cropFactor, focal, aperture);
+		TSLFWriteRemapGrid(grid, size, url);
+		
+		DDLogDebug(@"Built %ux%u remap grid for %@ at %.0f mm, ƒ/%.1f", grid->gridWidth, grid->gridHeight, lens.displayName, focal, aperture);
+	}];
+}
@@ -0,0 +1,336 @@
+//
+//  lens_remap_kernels.c
+//  Avocado
+//
+//	Every kernel clamps the sample coordinates to the image first, and then
+//	clamps the index of each tap, so no reads ever go past the edges of the
+//	image. Results are rounded, and clamped to the 16-bit range, after the gain
+//	is applied.
+//
+//  Created by Tristan Seifert on 20160731.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#include "lens_remap_kernels.h"
+
+#include <stdint.h>
+#include <math.h>
+
+#include <dispatch/dispatch.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define REMAP_MIN(a,b) ((a) < (b) ? (a) : (b))
+#define REMAP_MAX(a,b) ((a) > (b) ? (a) : (b))
+
+/// number of subpixel phases in the Lanczos weight table
+#define LANCZOS_PHASES	1024
+
+/**
+ * Clamps the coordinate to [0, size - 1], and splits it into the integer part
+ * and the fraction.
+ */
+static inline int remap_split(float v, int size, float *frac) {
+	v = REMAP_MAX(0.f, REMAP_MIN(v, (float) (size - 1)));
+	
+	int i = (int) v;
+	*frac = v - i;
+	
+	return i;
+}
+
+/**
+ * Applies the gain to a sampled value, and converts it to an output value.
+ */
+static inline uint16_t remap_output(float val, float gain) {
+	val *= gain;
+	val = REMAP_MAX(0.f, REMAP_MIN(val + 0.5f, 65535.f));
+	
+	return (uint16_t) val;
+}
+
+/**
+ * Samples a component with a separable filter of the given number of taps.
+ * The first tap is at (x - (taps / 2) + 1, y - (taps / 2) + 1); tap indices
+ * are clamped to the image.
+ */
+static inline float remap_sample_separable(const uint16_t *in, int width, int height, int x, int y, const float *wx, const float *wy, int taps) {
+	const int stride = width * 4;
+	const int first = 1 - (taps / 2);
+	
+	int cols[6];
+	float sum = 0.f;
+	
+	for(int i = 0; i < taps; i++) {
+		cols[i] = REMAP_MAX(0, REMAP_MIN(x + first + i, width - 1)) * 4;
+	}
+	
+	for(int j = 0; j < taps; j++) {
+		const uint16_t *row = in + (REMAP_MAX(0, REMAP_MIN(y + first + j, height - 1)) * stride);
+		float rowSum = 0.f;
+		
+		for(int i = 0; i < taps; i++) {
+			rowSum += wx[i] * row[cols[i]];
+		}
+		
+		sum += wy[j] * rowSum;
+	}
+	
+	return sum;
+}
+
+#pragma mark Bilinear
+/**
+ * Reference implementation of the bilinear kernel.
+ */
+void lens_remap_row_bilinear_scalar(const uint16_t *in, int width, int height, const float *coords, const float *gains, int count, uint16_t *out) {
+	const int stride = width * 4;
+	
+	for(int i = 0; i < count; i++, coords += 6, gains += 3, out += 4) {
+		for(int c = 0; c < 3; c++) {
+			float fx, fy;
+			int x0 = remap_split(coords[(c * 2) + 0], width, &fx);
+			int y0 = remap_split(coords[(c * 2) + 1], height, &fy);
+			
+			int x1 = REMAP_MIN(x0 + 1, width - 1);
+			int y1 = REMAP_MIN(y0 + 1, height - 1);
+			
+			const uint16_t *row0 = in + (y0 * stride) + c;
+			const uint16_t *row1 = in + (y1 * stride) + c;
+			
+			float p00 = row0[x0 * 4], p01 = row0[x1 * 4];
+			float p10 = row1[x0 * 4], p11 = row1[x1 * 4];
+			
+			float top = p00 + ((p01 - p00) * fx);
+			float bottom = p10 + ((p11 - p10) * fx);
+			
+			out[c] = remap_output(top + ((bottom - top) * fy), gains[c]);
+		}
+		
+		out[3] = 0;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#define REMAP_TARGET_AVX2	__attribute__((target("avx2")))
+
+/**
+ * Gathers the 16-bit samples at the given element indices. Each gather reads
+ * 32 bits, so the element after the sample is read as well; since only the
+ * red, green and blue components are sampled, that is at most the fourth
+ * component of the same pixel, and thus always in bounds.
+ */
+static inline REMAP_TARGET_AVX2 __m256 remap_gather_avx2(const uint16_t *in, __m256i idx) {
+	__m256i v = _mm256_i32gather_epi32((const int *) in, idx, 2);
+	v = _mm256_and_si256(v, _mm256_set1_epi32(0xFFFF));
+	
+	return _mm256_cvtepi32_ps(v);
+}
+
+/**
+ * AVX2 implementation of the bilinear kernel. Eight pixels are processed at a
+ * time, one component after another; the arithmetic is the same as that of
+ * the scalar kernel, so the output is identical.
+ */
+REMAP_TARGET_AVX2 void lens_remap_row_bilinear_avx2(const uint16_t *in, int width, int height, const float *coords, const float *gains, int count, uint16_t *out) {
+	const __m256i coordIdx = _mm256_setr_epi32(0, 6, 12, 18, 24, 30, 36, 42);
+	const __m256i gainIdx = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+	
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 maxVal = _mm256_set1_ps(65535.f);
+	
+	const __m256 maxX = _mm256_set1_ps((float) (width - 1));
+	const __m256 maxY = _mm256_set1_ps((float) (height - 1));
+	const __m256i maxXi = _mm256_set1_epi32(width - 1);
+	const __m256i maxYi = _mm256_set1_epi32(height - 1);
+	
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i stride = _mm256_set1_epi32(width * 4);
+	
+	int i;
+	
+	for(i = 0; i <= (count - 8); i += 8, coords += 48, gains += 24, out += 32) {
+		int32_t result[3][8];
+		
+		for(int c = 0; c < 3; c++) {
+			__m256 x = _mm256_i32gather_ps(coords + (c * 2) + 0, coordIdx, 4);
+			__m256 y = _mm256_i32gather_ps(coords + (c * 2) + 1, coordIdx, 4);
+			__m256 gain = _mm256_i32gather_ps(gains + c, gainIdx, 4);
+			
+			// clamp coordinates, and split into integer part and fraction
+			x = _mm256_max_ps(zero, _mm256_min_ps(x, maxX));
+			y = _mm256_max_ps(zero, _mm256_min_ps(y, maxY));
+			
+			__m256i x0 = _mm256_cvttps_epi32(x);
+			__m256i y0 = _mm256_cvttps_epi32(y);
+			
+			__m256 fx = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x0));
+			__m256 fy = _mm256_sub_ps(y, _mm256_cvtepi32_ps(y0));
+			
+			__m256i x1 = _mm256_min_epi32(_mm256_add_epi32(x0, one), maxXi);
+			__m256i y1 = _mm256_min_epi32(_mm256_add_epi32(y0, one), maxYi);
+			
+			// element indices of the four samples
+			__m256i comp = _mm256_set1_epi32(c);
+			
+			__m256i row0 = _mm256_add_epi32(_mm256_mullo_epi32(y0, stride), comp);
+			__m256i row1 = _mm256_add_epi32(_mm256_mullo_epi32(y1, stride), comp);
+			
+			__m256i col0 = _mm256_slli_epi32(x0, 2);
+			__m256i col1 = _mm256_slli_epi32(x1, 2);
+			
+			__m256 p00 = remap_gather_avx2(in, _mm256_add_epi32(row0, col0));
+			__m256 p01 = remap_gather_avx2(in, _mm256_add_epi32(row0, col1));
+			__m256 p10 = remap_gather_avx2(in, _mm256_add_epi32(row1, col0));
+			__m256 p11 = remap_gather_avx2(in, _mm256_add_epi32(row1, col1));
+			
+			// interpolate, apply gain, round and clamp
+			__m256 top = _mm256_add_ps(p00, _mm256_mul_ps(_mm256_sub_ps(p01, p00), fx));
+			__m256 bottom = _mm256_add_ps(p10, _mm256_mul_ps(_mm256_sub_ps(p11, p10), fx));
+			__m256 val = _mm256_add_ps(top, _mm256_mul_ps(_mm256_sub_ps(bottom, top), fy));
+			
+			val = _mm256_mul_ps(val, gain);
+			val = _mm256_max_ps(zero, _mm256_min_ps(_mm256_add_ps(val, half), maxVal));
+			
+			_mm256_storeu_si256((__m256i *) result[c], _mm256_cvttps_epi32(val));
+		}
+		
+		for(int k = 0; k < 8; k++) {
+			out[(k * 4) + 0] = result[0][k];
+			out[(k * 4) + 1] = result[1][k];
+			out[(k * 4) + 2] = result[2][k];
+			out[(k * 4) + 3] = 0;
+		}
+	}
+	
+	// handle the remaining pixels
+	lens_remap_row_bilinear_scalar(in, width, height, coords, gains, (count - i), out);
+}
+
+#endif
+
+#pragma mark Bicubic
+/**
+ * Calculates the Catmull-Rom weights for the four taps around a sample at the
+ * given fraction.
+ */
+static inline void remap_bicubic_weights(float t, float w[4]) {
+	w[0] = ((-0.5f * t + 1.f) * t - 0.5f) * t;
+	w[1] = (1.5f * t - 2.5f) * t * t + 1.f;
+	w[2] = ((-1.5f * t + 2.f) * t + 0.5f) * t;
+	w[3] = (0.5f * t - 0.5f) * t * t;
+}
+
+/**
+ * Bicubic kernel, using Catmull-Rom weights.
+ */
+void lens_remap_row_bicubic(const uint16_t *in, int width, int height, const float *coords, const float *gains, int count, uint16_t *out) {
+	for(int i = 0; i < count; i++, coords += 6, gains += 3, out += 4) {
+		for(int c = 0; c < 3; c++) {
+			float fx, fy, wx[4], wy[4];
+			int x = remap_split(coords[(c * 2) + 0], width, &fx);
+			int y = remap_split(coords[(c * 2) + 1], height, &fy);
+			
+			remap_bicubic_weights(fx, wx);
+			remap_bicubic_weights(fy, wy);
+			
+			float val = remap_sample_separable(in + c, width, height, x, y, wx, wy, 4);
+			out[c] = remap_output(val, gains[c]);
+		}
+		
+		out[3] = 0;
+	}
+}
+
+#pragma mark Lanczos
+/// weights of the six taps for each subpixel phase; each set is normalized
+static float lanczos3_weights[LANCZOS_PHASES + 1][6];
+
+/**
+ * Evaluates the Lanczos-3 window at the given distance.
+ */
+static float remap_lanczos3(float d) {
+	if(fabsf(d) < 1e-6f) {
+		return 1.f;
+	} else if(fabsf(d) >= 3.f) {
+		return 0.f;
+	}
+	
+	float pd = (float) M_PI * d;
+	return (3.f * sinf(pd) * sinf(pd / 3.f)) / (pd * pd);
+}
+
+/**
+ * Builds the table of Lanczos weights, if it hasn't been built yet.
+ */
+static void remap_lanczos3_init(void) {
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		for(int p = 0; p <= LANCZOS_PHASES; p++) {
+			float t = ((float) p) / LANCZOS_PHASES;
+			float sum = 0.f;
+			
+			// taps are at offsets -2 to 3 from the integer coordinate
+			for(int k = 0; k < 6; k++) {
+				lanczos3_weights[p][k] = remap_lanczos3(t - (k - 2));
+				sum += lanczos3_weights[p][k];
+			}
+			
+			for(int k = 0; k < 6; k++) {
+				lanczos3_weights[p][k] /= sum;
+			}
+		}
+	});
+}
+
+/**
+ * Lanczos-3 kernel; weights are looked up from a table with 1/1024 pixel
+ * resolution.
+ */
+void lens_remap_row_lanczos3(const uint16_t *in, int width, int height, const float *coords, const float *gains, int count, uint16_t *out) {
+	remap_lanczos3_init();
+	
+	for(int i = 0; i < count; i++, coords += 6, gains += 3, out += 4) {
+		for(int c = 0; c < 3; c++) {
+			float fx, fy;
+			int x = remap_split(coords[(c * 2) + 0], width, &fx);
+			int y = remap_split(coords[(c * 2) + 1], height, &fy);
+			
+			const float *wx = lanczos3_weights[(int) ((fx * LANCZOS_PHASES) + 0.5f)];
+			const float *wy = lanczos3_weights[(int) ((fy * LANCZOS_PHASES) + 0.5f)];
+			
+			float val = remap_sample_separable(in + c, width, height, x, y, wx, wy, 6);
+			out[c] = remap_output(val, gains[c]);
+		}
+		
+		out[3] = 0;
+	}
+}
+
+#pragma mark - Selection
+/**
+ * Returns the fastest kernel for the given filter supported by the CPU the
+ * code is running on.
+ */
+lens_remap_row_fn lens_remap_row_select(lens_remap_filter_t filter) {
+	switch(filter) {
+		case LENS_REMAP_BICUBIC:
+			return lens_remap_row_bicubic;
+		
+		case LENS_REMAP_LANCZOS3:
+			return lens_remap_row_lanczos3;
+		
+		case LENS_REMAP_BILINEAR:
+		default:
+#if defined(__x86_64__) || defined(__i386__)
+			if(__builtin_cpu_supports("avx2")) {
+				return lens_remap_row_bilinear_avx2;
+			}
+#endif
+			return lens_remap_row_bilinear_scalar;
+	}
+}
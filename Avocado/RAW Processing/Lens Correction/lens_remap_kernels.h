@@ -0,0 +1,88 @@
+//
+//  lens_remap_kernels.h
+//  Avocado
+//
+//	Kernels that resample one row of an RGBX image at arbitrary subpixel
+//	coordinates, as used by the lens geometry correction. All kernels clamp
+//	their samples to the edges of the image, so coordinates may lie anywhere.
+//
+//	The bilinear kernel has a scalar reference implementation and an AVX2
+//	version that produces identical output; the best one for the machine is
+//	selected at runtime. The higher quality kernels are blocked scalar code.
+//
+//  Created by Tristan Seifert on 20160731.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#ifndef lens_remap_kernels_h
+#define lens_remap_kernels_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Filters with which a row can be resampled.
+ */
+typedef enum {
+	/// bilinear interpolation over 2x2 pixels; fastest
+	LENS_REMAP_BILINEAR = 0,
+	/// bicubic (Catmull-Rom) interpolation over 4x4 pixels
+	LENS_REMAP_BICUBIC,
+	/// Lanczos interpolation over 6x6 pixels; sharpest, but slowest
+	LENS_REMAP_LANCZOS3,
+} lens_remap_filter_t;
+
+/**
+ * Resamples a run of pixels of an RGBX image. For each output pixel, the red,
+ * green and blue components are sampled at their own coordinate, multiplied
+ * by their gain, and written to the output; the fourth component is zeroed.
+ *
+ * @param in Input image, with four components per pixel.
+ * @param width Width of the input image, in pixels.
+ * @param height Height of the input image, in pixels.
+ * @param coords Source coordinates; six floats (x and y for red, green and
+ * blue) per output pixel.
+ * @param gains Gains; three floats (red, green and blue) per output pixel.
+ * @param count Number of pixels to resample.
+ * @param out Output pixels, four components per pixel.
+ */
+typedef void (*lens_remap_row_fn)(const uint16_t *in, int width, int height, const float *coords, const float *gains, int count, uint16_t *out);
+
+/**
+ * Reference implementation of the bilinear kernel.
+ */
+void lens_remap_row_bilinear_scalar(const uint16_t *in, int width, int height, const float *coords, const float *gains, int count, uint16_t *out);
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * AVX2 implementation of the bilinear kernel; processes eight pixels at a
+ * time, using gathers to load the samples.
+ */
+void lens_remap_row_bilinear_avx2(const uint16_t *in, int width, int height, const float *coords, const float *gains, int count, uint16_t *out);
+#endif
+
+/**
+ * Bicubic kernel, using Catmull-Rom weights.
+ */
+void lens_remap_row_bicubic(const uint16_t *in, int width, int height, const float *coords, const float *gains, int count, uint16_t *out);
+
+/**
+ * Lanczos-3 kernel; weights are looked up from a table with 1/1024 pixel
+ * resolution.
+ */
+void lens_remap_row_lanczos3(const uint16_t *in, int width, int height, const float *coords, const float *gains, int count, uint16_t *out);
+
+/**
+ * Returns the fastest kernel for the given filter supported by the CPU the
+ * code is running on.
+ */
+lens_remap_row_fn lens_remap_row_select(lens_remap_filter_t filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* lens_remap_kernels_h */
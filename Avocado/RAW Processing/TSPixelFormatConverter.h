@@ -5,7 +5,14 @@
 //	Specifies various functions that are used to convert between the different
 //	pixel formats used by the RAW processing pipeline.
 //
-//	They exist primarily as wrappers around the relevant vImage functions.
+//	They exist primarily as wrappers around the relevant vImage functions. A
+//	second, portable backend (see pixel_convert_kernels.h) can be selected for
+//	each converter, mainly to compare against vImage.
+//
+//	The planes are either 32-bit floats, or half precision floats to halve
+//	the memory the converter needs. In the latter case, values are converted
+//	to 32-bit floats whenever they're operated on, and the output buffer holds
+//	RGBX pixels with half precision components.
 //
 //	NOTE: This class is not thread safe. While one instance may be used from
 //	different threads, the caller is responsible for ensuring that only a single
@@ -21,6 +28,8 @@
 
 #import <Accelerate/Accelerate.h>
 
+#import "TSRawPipeline.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -32,6 +41,49 @@ extern "C" {
  */
 typedef struct TSPixelConverter* TSPixelConverterRef;
 
+/**
+ * Implementations that a converter can use to perform its operations.
+ */
+typedef NS_ENUM(NSUInteger, TSPixelConverterBackend) {
+	/// use the vImage functions from the Accelerate framework
+	TSPixelConverterBackendvImage = 0,
+	/// use the portable SIMD kernels
+	TSPixelConverterBackendPortable,
+};
+
+/**
+ * Formats in which a converter can store the components of its planes.
+ */
+typedef NS_ENUM(NSUInteger, TSPixelConverterPlaneFormat) {
+	/// 32 bit floating point components
+	TSPixelConverterPlaneFormatFloat32 = 0,
+	/// 16 bit (half precision) floating point components
+	TSPixelConverterPlaneFormatFloat16,
+};
+
+/**
+ * Orientations of an image, with the values of the EXIF orientation tag. Each
+ * describes the transformation that displays the stored image upright.
+ */
+typedef NS_ENUM(NSUInteger, TSPixelConverterOrientation) {
+	/// the image is already upright
+	TSPixelConverterOrientationNormal = 1,
+	/// mirror the image horizontally
+	TSPixelConverterOrientationMirrorHorizontal = 2,
+	/// rotate the image by 180°
+	TSPixelConverterOrientationRotate180 = 3,
+	/// mirror the image vertically
+	TSPixelConverterOrientationMirrorVertical = 4,
+	/// swap rows and columns (mirror along the main diagonal)
+	TSPixelConverterOrientationTranspose = 5,
+	/// rotate the image 90° clockwise
+	TSPixelConverterOrientationRotate90CW = 6,
+	/// mirror the image along the anti-diagonal
+	TSPixelConverterOrientationTransverse = 7,
+	/// rotate the image 90° counter-clockwise
+	TSPixelConverterOrientationRotate90CCW = 8,
+};
+
 #pragma mark Initializers
 /**
  * Sets up an instance of the conversion pipeline, with the given input data
@@ -48,6 +100,9 @@ void TSPixelConverterFree(TSPixelConverterRef converter);
 /**
  * Resizes the pixel converter to the given size. The old memory will be de-
  * allocated, and new buffers are allocated. No data is copied.
+ *
+ * Resizing to the same size keeps the buffers; this can be used to reset the
+ * converter after its planes were rotated.
  */
 void TSPixelConverterResize(TSPixelConverterRef converter, NSUInteger newWidth, NSUInteger newHeight);
 
@@ -60,7 +115,8 @@ void TSPixelConverterResize(TSPixelConverterRef converter, NSUInteger newWidth,
 void *TSPixelConverterGetOriginalData(TSPixelConverterRef converter);
 
 /**
- * Returns a pointer to the final RGBX data.
+ * Returns a pointer to the final RGBX data. If the planes are half precision,
+ * each component of the output is a half precision float as well.
  *
  * @param converter Converter whose info to return.
  */
@@ -83,13 +139,38 @@ size_t TSPixelConverterGetRGBXStride(TSPixelConverterRef converter);
 void TSPixelConverterGetSize(TSPixelConverterRef converter, NSUInteger *outWidth, NSUInteger *outHeight);
 
 /**
- * Returns the vImage buffer for a given plane.
+ * Returns the vImage buffer for a given plane. Its data is in the converter's
+ * plane format.
  *
  * @param converter Converter from which to get the information.
  * @param plane The numbered plane for which to get data, in the range [0..2].
  */
 vImage_Buffer TSPixelConverterGetPlanevImageBufferBuffer(TSPixelConverterRef converter, NSUInteger plane);
 
+/**
+ * Returns the number of bytes per row of a 32 bit floating point plane with
+ * the current size of the converter's planes, regardless of their format.
+ * This is the layout expected by `TSPixelConverterRGB16UToPlanarFBuffers` and
+ * `TSPixelConverterLoadPlaneF`.
+ *
+ * @param converter Converter whose info to return.
+ */
+size_t TSPixelConverterGetFloatPlaneStride(TSPixelConverterRef converter);
+
+/**
+ * Returns the backend used by the converter.
+ *
+ * @param converter Converter whose info to return.
+ */
+TSPixelConverterBackend TSPixelConverterGetBackend(TSPixelConverterRef converter);
+
+/**
+ * Returns the format of the converter's planes.
+ *
+ * @param converter Converter whose info to return.
+ */
+TSPixelConverterPlaneFormat TSPixelConverterGetPlaneFormat(TSPixelConverterRef converter);
+
 #pragma mark Setters
 /**
  * Sets the RGB data input buffer.
@@ -99,6 +180,30 @@ vImage_Buffer TSPixelConverterGetPlanevImageBufferBuffer(TSPixelConverterRef con
  */
 void TSPixelConverterSetInData(TSPixelConverterRef converter, void *inData);
 
+/**
+ * Sets the backend that the converter uses for all subsequent operations.
+ *
+ * @param converter Converter whose backend to set.
+ * @param backend Backend to use.
+ */
+void TSPixelConverterSetBackend(TSPixelConverterRef converter, TSPixelConverterBackend backend);
+
+/**
+ * Sets the format of the converter's planes. If it differs from the current
+ * format, the buffers are re-allocated; no data is copied.
+ *
+ * @param converter Converter whose plane format to set.
+ * @param format Format of the planes.
+ */
+void TSPixelConverterSetPlaneFormat(TSPixelConverterRef converter, TSPixelConverterPlaneFormat format);
+
+/**
+ * Returns the plane format that should be used for the given rendering intent.
+ * Display intents use half precision planes; everything else uses 32 bit
+ * floats, so output isn't limited to half precision.
+ */
+TSPixelConverterPlaneFormat TSPixelConverterPlaneFormatForIntent(TSRawPipelineIntent intent);
+
 #pragma mark Format Conversions
 /**
  * Converts input RGB data (in RGB, 48bpp format, unsigned int) to a interleaved
@@ -112,10 +217,55 @@ void TSPixelConverterSetInData(TSPixelConverterRef converter, void *inData);
  * @return YES if successful, NO otherwise.
  *
  * @note The output data will still be RGB format, but instead expanded to be
- * 32bit floating point per component.
+ * 32bit floating point per component. This isn't supported with half precision
+ * planes; use `TSPixelConverterRGB16UToPlanarF` instead.
  */
 BOOL TSPixelConverterRGB16UToFloat(TSPixelConverterRef converter, uint16_t maxValue);
 
+/**
+ * Converts input RGB data (in RGB, 48bpp format, unsigned int) directly to
+ * three floating point planes, one for each colour component. This is
+ * equivalent to `TSPixelConverterRGB16UToFloat` followed by
+ * `TSPixelConverterRGBFFFToPlanarF`, but only passes over the data once, and
+ * doesn't touch the output buffer.
+ *
+ * @param converter Converter object to use, containing the buffers into which
+ * data is written.
+ * @param maxValue Maximum value in the input pixel data. The planes are
+ * normalized, such that this value corresponds to 1.0.
+ *
+ * @return YES if successful, NO otherwise.
+ */
+BOOL TSPixelConverterRGB16UToPlanarF(TSPixelConverterRef converter, uint16_t maxValue);
+
+/**
+ * Converts input RGB data (in RGB, 48bpp format, unsigned int) to three 32bit
+ * floating point planes provided by the caller, regardless of the format of
+ * the converter's own planes. This can be used to keep a full precision copy
+ * of the image when the converter works in half precision.
+ *
+ * @param converter Converter object whose input and size to use.
+ * @param maxValue Maximum value in the input pixel data. The planes are
+ * normalized, such that this value corresponds to 1.0.
+ * @param planes Red, green and blue output planes.
+ * @param planeStride Bytes per row of each of the planes; usually the value
+ * returned by `TSPixelConverterGetFloatPlaneStride`.
+ *
+ * @return YES if successful, NO otherwise.
+ */
+BOOL TSPixelConverterRGB16UToPlanarFBuffers(TSPixelConverterRef converter, uint16_t maxValue, Pixel_F *planes[3], size_t planeStride);
+
+/**
+ * Copies a 32bit floating point plane, with the same size as the converter's
+ * planes, into one of them, converting it to the converter's plane format.
+ *
+ * @param converter Converter whose plane to fill.
+ * @param plane The numbered plane to fill, in the range [0..2].
+ * @param data Plane to copy.
+ * @param stride Bytes per row of the plane to copy.
+ */
+void TSPixelConverterLoadPlaneF(TSPixelConverterRef converter, NSUInteger plane, const Pixel_F *data, size_t stride);
+
 /**
  * Converts the interlaced 96bpp floating point RGB data to three distinct
  * 32bit planes; one for each of the three colour components.
@@ -125,13 +275,15 @@ BOOL TSPixelConverterRGB16UToFloat(TSPixelConverterRef converter, uint16_t maxVa
  * @return YES if successful, NO otherwise.
  *
  * @note This must be called after `TSRawPipelineConvertRGB16UToFloat` or the
- * results will be undefined.
+ * results will be undefined. Like that function, it's not supported with half
+ * precision planes.
  */
 BOOL TSPixelConverterRGBFFFToPlanarF(TSPixelConverterRef converter);
 
 /**
  * Converts the the three 32bit floating point planes to a single interleaved
- * 128bpp RGBX buffer. In this case, X is fixed at 1.0.
+ * 128bpp RGBX buffer. In this case, X is fixed at 1.0. Half precision planes
+ * are interleaved into a 64bpp RGBX buffer with half precision components.
  *
  * @param converter Converter object whose planes should be converted.
  *
@@ -155,6 +307,18 @@ BOOL TSPixelConverterPlanarFToRGBXFFFF(TSPixelConverterRef converter);
  */
 BOOL TSPixelConverterRotate90(TSPixelConverterRef converter, ssize_t rotation);
 
+/**
+ * Applies an EXIF orientation to the image, rotating and/or mirroring it. The
+ * orientations from `TSPixelConverterOrientationTranspose` onwards swap the
+ * width and height of the image.
+ *
+ * @param converter Converter object whose planes should be oriented.
+ * @param orientation Orientation to apply.
+ *
+ * @return YES if successful, NO otherwise.
+ */
+BOOL TSPixelConverterApplyOrientation(TSPixelConverterRef converter, TSPixelConverterOrientation orientation);
+
 #pragma mark Histogram Operations
 /**
  * Stretches the contrast of the image, such that all values between the
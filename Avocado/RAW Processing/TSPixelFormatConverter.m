@@ -11,16 +11,29 @@
 #import <Accelerate/Accelerate.h>
 
 #import "TSPixelFormatConverter.h"
+#import "pixel_convert_kernels.h"
 
 /**
  * Set to output log statements for memory allocations.
  */
 #define LogMemAlloc		0
 
+/**
+ * Backend used by newly created converters.
+ */
+#define DefaultBackend	TSPixelConverterBackendvImage
+
+/// number of rows converted by each iteration of the fused planar conversion
+#define PLANAR_BAND_ROWS	64
+/// number of input rows in each band of a plane that is oriented by a worker
+#define ORIENT_BAND_ROWS	64
+
 static void TSAllocateBuffers(TSPixelConverterRef info);
 static void TSFreeBuffers(TSPixelConverterRef converter);
 
 static inline vImage_Buffer TSRawPipelinevImageBufferForPlane(TSPixelConverterRef converter, NSUInteger plane);
+static inline size_t TSPixelConverterComponentSize(TSPixelConverterRef converter);
+static inline size_t TSAlignBytesPerLine(size_t bytesPerLine);
 
 #pragma mark Types
 /**
@@ -35,7 +48,13 @@ struct TSPixelConverter {
 	/// When set, the buffers are treated as rotated, i.e. width/height are swapped.
 	BOOL planesAreRotated;
 	
-	/// Buffer for final output (interleaved floating point RGBA, 128bpp)
+	/// Implementation used for all operations
+	TSPixelConverterBackend backend;
+	/// Format of the components in the planes and the output buffer
+	TSPixelConverterPlaneFormat planeFormat;
+	
+	/// Buffer for final output (interleaved floating point RGBA, 128bpp, or
+	/// 64bpp with half precision planes)
 	Pixel_FFFF *outData;
 	/// Size of the outData buffer
 	size_t outDataSize;
@@ -49,7 +68,8 @@ struct TSPixelConverter {
 	/// Number of bytes per line in the interleaved float data
 	size_t interleavedFloatDataBytesPerLine;
 	
-	/// Buffers for each of the R, G and B planes
+	/// Buffers for each of the R, G and B planes; with half precision planes,
+	/// each component is 16 bits, despite the type.
 	Pixel_F *plane[3];
 	/// Size of each of the planes
 	size_t planeSize;
@@ -87,6 +107,8 @@ TSPixelConverterRef TSPixelConverterCreate(void *inData, NSUInteger inWidth, NSU
 	// copy pointer
 	info->inData = inData;
 	
+	info->backend = DefaultBackend;
+	
 	// allocate the buffers
 	TSAllocateBuffers(info);
 	
@@ -99,11 +121,14 @@ TSPixelConverterRef TSPixelConverterCreate(void *inData, NSUInteger inWidth, NSU
 static void TSAllocateBuffers(TSPixelConverterRef info) {
 	size_t rotatedSize;
 	
+	// size of each component in the planes and output
+	size_t componentSize = TSPixelConverterComponentSize(info);
+	
 	// assume no additional packing in bytes/line for interleaved float data
 	info->interleavedFloatDataBytesPerLine = (info->inWidth * 3 * sizeof(Pixel_F));
 	
 	// calculate bytes/line and buffer size for output
-	info->outDataBytesPerLine = info->inWidth * sizeof(Pixel_FFFF);
+	info->outDataBytesPerLine = info->inWidth * 4 * componentSize;
 	
 	if((info->outDataBytesPerLine & 0x1F) != 0) {
 		// align to a 32 byte boundary
@@ -113,7 +138,7 @@ static void TSAllocateBuffers(TSPixelConverterRef info) {
 	info->outDataSize = info->outDataBytesPerLine * info->inHeight;
 	
 	// calculate bytes/line for output, if rotated
-	info->outDataBytesPerLineRotated = info->inHeight * sizeof(Pixel_FFFF);
+	info->outDataBytesPerLineRotated = info->inHeight * 4 * componentSize;
 	
 	if((info->outDataBytesPerLineRotated & 0x1F) != 0) {
 		// align to a 32 byte boundary
@@ -123,7 +148,7 @@ static void TSAllocateBuffers(TSPixelConverterRef info) {
 	// check if the rotated size is larger than the regular size
 	rotatedSize = info->outDataBytesPerLineRotated * info->inWidth;
 	
-	if(info->planeSize < rotatedSize) {
+	if(info->outDataSize < rotatedSize) {
 #if LogMemAlloc
 		DDLogDebug(@"TSPixelConverter: OutBuf rotated size (%lu) is larger than regular size (%li)", rotatedSize, info->outDataSize);
 #endif
@@ -133,7 +158,7 @@ static void TSAllocateBuffers(TSPixelConverterRef info) {
 	
 	
 	// calculate bytes/line and buffer size for each of the planes
-	info->planeBytesPerLine = info->inWidth * sizeof(Pixel_F);
+	info->planeBytesPerLine = info->inWidth * componentSize;
 	
 	if((info->planeBytesPerLine & 0x1F) != 0) {
 		// align to a 32 byte boundary
@@ -143,7 +168,7 @@ static void TSAllocateBuffers(TSPixelConverterRef info) {
 	info->planeSize = info->planeBytesPerLine * info->inHeight;
 	
 	// calculate swapped bytes/line of the plane
-	info->planeBytesPerLineRotated = info->inHeight * sizeof(Pixel_F);
+	info->planeBytesPerLineRotated = info->inHeight * componentSize;
 	
 	if((info->planeBytesPerLineRotated & 0x1F) != 0) {
 		// align to a 32 byte boundary
@@ -186,7 +211,8 @@ static void TSAllocateBuffers(TSPixelConverterRef info) {
 	/*
 	 * To save on memory, use the 4 component buffer for the 3 component
 	 * interleaved data, since that is only needed temporarily while the data
-	 * is converted to planar format.
+	 * is converted to planar format. (With half precision planes, the buffer
+	 * is too small for it, so it's not used at all.)
 	 */
 	info->interleavedFloatData = (Pixel_F *) info->outData;
 }
@@ -224,8 +250,17 @@ static void TSFreeBuffers(TSPixelConverterRef converter) {
 /**
  * Resizes the pixel converter to the given size. The old memory will be de-
  * allocated, and new buffers are allocated. No data is copied.
+ *
+ * If the size doesn't change, the buffers are kept, and the converter only
+ * forgets that its planes were rotated.
  */
 void TSPixelConverterResize(TSPixelConverterRef converter, NSUInteger newWidth, NSUInteger newHeight) {
+	// the buffers already fit both orientations of the same size
+	if(converter->inWidth == newWidth && converter->inHeight == newHeight) {
+		converter->planesAreRotated = NO;
+		return;
+	}
+	
 	// free old buffers
 	TSFreeBuffers(converter);
 	
@@ -241,6 +276,24 @@ void TSPixelConverterResize(TSPixelConverterRef converter, NSUInteger newWidth,
 }
 
 #pragma mark Helpers
+/**
+ * Returns the size of a single component of the planes and the output buffer.
+ */
+static inline size_t TSPixelConverterComponentSize(TSPixelConverterRef converter) {
+	if(converter->planeFormat == TSPixelConverterPlaneFormatFloat16) {
+		return sizeof(uint16_t);
+	} else {
+		return sizeof(Pixel_F);
+	}
+}
+
+/**
+ * Pads a number of bytes per line to a multiple of 32 bytes.
+ */
+static inline size_t TSAlignBytesPerLine(size_t bytesPerLine) {
+	return (bytesPerLine + 0x1F) & ~((size_t) 0x1F);
+}
+
 /**
  * Returns a prepopulated vImage struct for one of the three planes of a given
  * converter.
@@ -328,6 +381,37 @@ vImage_Buffer TSPixelConverterGetPlanevImageBufferBuffer(TSPixelConverterRef con
 	return TSRawPipelinevImageBufferForPlane(converter, plane);
 }
 
+/**
+ * Returns the backend used by the converter.
+ *
+ * @param converter Converter whose info to return.
+ */
+TSPixelConverterBackend TSPixelConverterGetBackend(TSPixelConverterRef converter) {
+	return converter->backend;
+}
+
+/**
+ * Returns the format of the converter's planes.
+ *
+ * @param converter Converter whose info to return.
+ */
+TSPixelConverterPlaneFormat TSPixelConverterGetPlaneFormat(TSPixelConverterRef converter) {
+	return converter->planeFormat;
+}
+
+/**
+ * Returns the number of bytes per row of a 32 bit floating point plane with
+ * the current size of the converter's planes, regardless of their format.
+ *
+ * @param converter Converter whose info to return.
+ */
+size_t TSPixelConverterGetFloatPlaneStride(TSPixelConverterRef converter) {
+	NSUInteger width;
+	TSPixelConverterGetSize(converter, &width, NULL);
+	
+	return TSAlignBytesPerLine(width * sizeof(Pixel_F));
+}
+
 #pragma mark Setters
 /**
  * Sets the RGB data input buffer.
@@ -339,6 +423,57 @@ void TSPixelConverterSetInData(TSPixelConverterRef converter, void *inData) {
 	converter->inData = inData;
 }
 
+/**
+ * Sets the backend that the converter uses for all subsequent operations.
+ *
+ * @param converter Converter whose backend to set.
+ * @param backend Backend to use.
+ */
+void TSPixelConverterSetBackend(TSPixelConverterRef converter, TSPixelConverterBackend backend) {
+	converter->backend = backend;
+}
+
+/**
+ * Sets the format of the converter's planes. If it differs from the current
+ * format, the buffers are re-allocated; no data is copied.
+ *
+ * @param converter Converter whose plane format to set.
+ * @param format Format of the planes.
+ */
+void TSPixelConverterSetPlaneFormat(TSPixelConverterRef converter, TSPixelConverterPlaneFormat format) {
+	if(converter->planeFormat == format) {
+		return;
+	}
+	
+	// the sizes of the buffers depend on the format
+	TSFreeBuffers(converter);
+	
+	converter->planeFormat = format;
+	converter->planesAreRotated = NO;
+	
+	TSAllocateBuffers(converter);
+}
+
+/**
+ * Returns the plane format that should be used for the given rendering intent:
+ *
+ * - Display intents use half precision planes, which halves the memory used
+ *	 by the converter, and still have more precision than the display.
+ * - Output uses 32 bit floats, so its precision isn't limited.
+ */
+TSPixelConverterPlaneFormat TSPixelConverterPlaneFormatForIntent(TSRawPipelineIntent intent) {
+	switch(intent) {
+		case TSRawPipelineIntentDisplayFast:
+		case TSRawPipelineIntentDisplaySlow:
+			return TSPixelConverterPlaneFormatFloat16;
+		
+		case TSRawPipelineIntentOutput:
+		case TSRawPipelineIntentUnknown:
+		default:
+			return TSPixelConverterPlaneFormatFloat32;
+	}
+}
+
 #pragma mark Format Conversions
 /**
  * Converts input RGB data (in RGB, 48bpp format, unsigned int) to a interleaved
@@ -362,9 +497,22 @@ BOOL TSPixelConverterRGB16UToFloat(TSPixelConverterRef converter, uint16_t maxVa
 	DDCAssert(converter != NULL, @"converter may not be NULL");
 	DDCAssert(maxValue > 0, @"maximum value may not be 0");
 	
+	// the interleaved buffer doesn't fit in a half precision output buffer
+	if(converter->planeFormat == TSPixelConverterPlaneFormatFloat16) {
+		DDLogError(@"Interleaved float conversion isn't supported with half precision planes");
+		return NO;
+	}
+	
 	// calculate the scale of input values
 	float scale = 1 / ((float) maxValue);
 	
+	if(converter->backend == TSPixelConverterBackendPortable) {
+		pixel_convert_16u_to_f(converter->inData, (converter->inWidth * 3 * sizeof(uint16_t)),
+							   converter->interleavedFloatData, converter->interleavedFloatDataBytesPerLine,
+							   (converter->inWidth * 3), converter->inHeight, scale);
+		return YES;
+	}
+	
 	// create a vImage buffer for the input and output
 	vImageBufIn = (vImage_Buffer) {
 		.data = converter->inData,
@@ -392,6 +540,126 @@ BOOL TSPixelConverterRGB16UToFloat(TSPixelConverterRef converter, uint16_t maxVa
 	return YES;
 }
 
+/**
+ * Converts the converter's input to three planes with the given format and
+ * stride. Bands of rows are converted in parallel.
+ */
+static void TSConvertRGB16UToPlanes(TSPixelConverterRef converter, float scale, TSPixelConverterPlaneFormat format, void *planes[3], size_t planeStride) {
+	// get the input
+	const uint16_t *inData = converter->inData;
+	const size_t inStride = converter->inWidth * 3 * sizeof(uint16_t);
+	
+	const size_t width = converter->inWidth;
+	const size_t height = converter->inHeight;
+	
+	// convert bands of rows in parallel
+	const size_t numBands = (height + PLANAR_BAND_ROWS - 1) / PLANAR_BAND_ROWS;
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(numBands, q, ^(size_t band) {
+		size_t rowStart = band * PLANAR_BAND_ROWS;
+		size_t rows = MIN(PLANAR_BAND_ROWS, height - rowStart);
+		
+		void *bandPlanes[3];
+		
+		for(int c = 0; c < 3; c++) {
+			bandPlanes[c] = ((uint8_t *) planes[c]) + (rowStart * planeStride);
+		}
+		
+		const uint16_t *bandIn = (const uint16_t *) (((const uint8_t *) inData) + (rowStart * inStride));
+		
+		if(format == TSPixelConverterPlaneFormatFloat16) {
+			pixel_convert_16u_to_planar_h(bandIn, inStride, 3, (uint16_t **) bandPlanes, planeStride,
+										  width, rows, scale);
+		} else {
+			pixel_convert_16u_to_planar_f(bandIn, inStride, 3, (float **) bandPlanes, planeStride,
+										  width, rows, scale);
+		}
+	});
+}
+
+/**
+ * Converts input RGB data (in RGB, 48bpp format, unsigned int) directly to
+ * three floating point planes, without going through the interleaved
+ * floating point buffer. Bands of rows are converted in parallel.
+ *
+ * vImage can't do this in one step, so this always uses the portable kernel,
+ * regardless of the converter's backend; it produces the same output as the
+ * two step conversion with the portable backend.
+ *
+ * @param converter Converter object to use, containing the buffers into which
+ * data is written.
+ * @param maxValue Maximum value in the input pixel data. The planes are
+ * normalized, such that this value corresponds to 1.0.
+ *
+ * @return YES if successful, NO otherwise.
+ */
+BOOL TSPixelConverterRGB16UToPlanarF(TSPixelConverterRef converter, uint16_t maxValue) {
+	// validate parameters
+	DDCAssert(converter != NULL, @"converter may not be NULL");
+	DDCAssert(maxValue > 0, @"maximum value may not be 0");
+	
+	float scale = 1 / ((float) maxValue);
+	
+	void *planes[3] = {
+		converter->plane[0], converter->plane[1], converter->plane[2]
+	};
+	
+	TSConvertRGB16UToPlanes(converter, scale, converter->planeFormat, planes, converter->planeBytesPerLine);
+	
+	return YES;
+}
+
+/**
+ * Converts input RGB data (in RGB, 48bpp format, unsigned int) to three 32bit
+ * floating point planes provided by the caller, regardless of the format of
+ * the converter's own planes.
+ *
+ * @param converter Converter object whose input and size to use.
+ * @param maxValue Maximum value in the input pixel data. The planes are
+ * normalized, such that this value corresponds to 1.0.
+ * @param planes Red, green and blue output planes.
+ * @param planeStride Bytes per row of each of the planes.
+ *
+ * @return YES if successful, NO otherwise.
+ */
+BOOL TSPixelConverterRGB16UToPlanarFBuffers(TSPixelConverterRef converter, uint16_t maxValue, Pixel_F *planes[3], size_t planeStride) {
+	// validate parameters
+	DDCAssert(converter != NULL, @"converter may not be NULL");
+	DDCAssert(maxValue > 0, @"maximum value may not be 0");
+	
+	float scale = 1 / ((float) maxValue);
+	
+	void *outPlanes[3] = { planes[0], planes[1], planes[2] };
+	TSConvertRGB16UToPlanes(converter, scale, TSPixelConverterPlaneFormatFloat32, outPlanes, planeStride);
+	
+	return YES;
+}
+
+/**
+ * Copies a 32bit floating point plane, with the same size as the converter's
+ * planes, into one of them, converting it to the converter's plane format.
+ *
+ * @param converter Converter whose plane to fill.
+ * @param plane The numbered plane to fill, in the range [0..2].
+ * @param data Plane to copy.
+ * @param stride Bytes per row of the plane to copy.
+ */
+void TSPixelConverterLoadPlaneF(TSPixelConverterRef converter, NSUInteger plane, const Pixel_F *data, size_t stride) {
+	vImage_Buffer buf = TSRawPipelinevImageBufferForPlane(converter, plane);
+	
+	for(NSUInteger y = 0; y < buf.height; y++) {
+		const Pixel_F *src = (const Pixel_F *) (((const uint8_t *) data) + (y * stride));
+		void *dst = ((uint8_t *) buf.data) + (y * buf.rowBytes);
+		
+		if(converter->planeFormat == TSPixelConverterPlaneFormatFloat16) {
+			pixel_convert_f_to_h(src, dst, buf.width);
+		} else {
+			memcpy(dst, src, buf.width * sizeof(Pixel_F));
+		}
+	}
+}
+
 /**
  * Converts the interlaced 96bpp floating point RGB data to three distinct
  * 32bit planes; one for each of the three colour components.
@@ -409,6 +677,12 @@ BOOL TSPixelConverterRGBFFFToPlanarF(TSPixelConverterRef converter) {
 	// validate parameters
 	DDCAssert(converter != NULL, @"converter may not be NULL");
 	
+	// there is no interleaved buffer with half precision planes
+	if(converter->planeFormat == TSPixelConverterPlaneFormatFloat16) {
+		DDLogError(@"Interleaved float conversion isn't supported with half precision planes");
+		return NO;
+	}
+	
 	// create vImage descriptors for all three planes
 	vImage_Buffer vImageBufR = TSRawPipelinevImageBufferForPlane(converter, 0);
 	vImage_Buffer vImageBufG = TSRawPipelinevImageBufferForPlane(converter, 1);
@@ -422,6 +696,15 @@ BOOL TSPixelConverterRGBFFFToPlanarF(TSPixelConverterRef converter) {
 		.rowBytes = converter->interleavedFloatDataBytesPerLine
 	};
 	
+	if(converter->backend == TSPixelConverterBackendPortable) {
+		float *planes[3] = { vImageBufR.data, vImageBufG.data, vImageBufB.data };
+		
+		pixel_convert_fff_to_planar_f(vImageBufIn.data, vImageBufIn.rowBytes,
+									  planes, vImageBufR.rowBytes,
+									  vImageBufIn.width, vImageBufIn.height);
+		return YES;
+	}
+	
 	// perform the conversion and check for errors
 	error = vImageConvert_RGBFFFtoPlanarF(&vImageBufIn, &vImageBufR, &vImageBufG, &vImageBufB, kvImageNoFlags);
 	
@@ -476,6 +759,25 @@ BOOL TSPixelConverterPlanarFToRGBXFFFF(TSPixelConverterRef converter) {
 	vImage_Buffer vImageBufG = TSRawPipelinevImageBufferForPlane(converter, 1);
 	vImage_Buffer vImageBufB = TSRawPipelinevImageBufferForPlane(converter, 2);
 	
+	// half precision planes are interleaved as they are, with X = 1.0
+	if(converter->planeFormat == TSPixelConverterPlaneFormatFloat16) {
+		const uint16_t *planes[3] = { vImageBufR.data, vImageBufG.data, vImageBufB.data };
+		
+		pixel_convert_planar_h_to_hhhh(planes, vImageBufR.rowBytes, 0x3C00,
+									   vImageBufDest.data, vImageBufDest.rowBytes,
+									   vImageBufDest.width, vImageBufDest.height);
+		return YES;
+	}
+	
+	if(converter->backend == TSPixelConverterBackendPortable) {
+		const float *planes[3] = { vImageBufR.data, vImageBufG.data, vImageBufB.data };
+		
+		pixel_convert_planar_f_to_ffff(planes, vImageBufR.rowBytes, 1.f,
+									   vImageBufDest.data, vImageBufDest.rowBytes,
+									   vImageBufDest.width, vImageBufDest.height);
+		return YES;
+	}
+	
 	// perform the conversion and check for errors
 	error = vImageConvert_PlanarFToRGBXFFFF(&vImageBufR, &vImageBufG, &vImageBufB, 1.f, &vImageBufDest, kvImageNoFlags);
 	
@@ -489,10 +791,47 @@ BOOL TSPixelConverterPlanarFToRGBXFFFF(TSPixelConverterRef converter) {
 }
 
 #pragma mark Geometric Operations
+/**
+ * Returns a vImage buffer for the temporary plane, laid out to receive the
+ * output of a geometric operation on the planes. If the operation transposes
+ * the image, its width and height are swapped.
+ */
+static inline vImage_Buffer TSPixelConverterTempBufferForOutput(TSPixelConverterRef converter, BOOL transposed) {
+	vImage_Buffer buf = TSRawPipelinevImageBufferForPlane(converter, 0);
+	buf.data = converter->planeTempBuffer;
+	
+	if(transposed) {
+		// the output has the opposite layout of the planes
+		buf.rowBytes = converter->planesAreRotated ? converter->planeBytesPerLine : converter->planeBytesPerLineRotated;
+		
+		NSUInteger width = buf.width, height = buf.height;
+		
+		buf.height = width;
+		buf.width = height;
+	}
+	
+	return buf;
+}
+
+/**
+ * Makes the temporary plane (holding the output of an operation) the given
+ * plane, and the plane's old buffer the temporary plane, so the output
+ * doesn't need to be copied.
+ */
+static inline void TSPixelConverterSwapTempBuffer(TSPixelConverterRef converter, NSUInteger plane) {
+	Pixel_F *oldPlane = converter->plane[plane];
+	
+	converter->plane[plane] = converter->planeTempBuffer;
+	converter->planeTempBuffer = oldPlane;
+}
+
 /**
  * Rotates the image by the given multiple of 90 degrees. 0 is no rotation, 1 is
  * 90° counter-clockwise, and so forth.
  *
+ * With the portable backend, or half precision planes, this applies the
+ * equivalent orientation instead.
+ *
  * @param converter Converter object whose planes should be rotated.
  * @param rotation Rotation, multiple of 90°.
  *
@@ -502,24 +841,31 @@ BOOL TSPixelConverterRotate90(TSPixelConverterRef converter, ssize_t rotation) {
 	vImage_Error error;
 	vImage_Buffer inBuf, outBuf;
 	
+	// orientations that are equivalent to each rotation
+	static const TSPixelConverterOrientation orientations[4] = {
+		TSPixelConverterOrientationNormal,
+		TSPixelConverterOrientationRotate90CCW,
+		TSPixelConverterOrientationRotate180,
+		TSPixelConverterOrientationRotate90CW
+	};
+	
+	// bring the rotation into [0, 3]; negative rotations are clockwise
+	rotation = ((rotation % 4) + 4) % 4;
+	
+	if(rotation == 0) {
+		return YES;
+	}
+	
+	if(converter->backend == TSPixelConverterBackendPortable || converter->planeFormat == TSPixelConverterPlaneFormatFloat16) {
+		return TSPixelConverterApplyOrientation(converter, orientations[rotation]);
+	}
+	
+	BOOL transposed = ((rotation & 1) != 0);
+	
 	// we need to rotate each plane separately
 	for(int c = 0; c < 3; c++) {
 		inBuf = TSRawPipelinevImageBufferForPlane(converter, c);
-		
-		// use the same specifications as the input buffer, but write to temp buffer
-		outBuf = inBuf;
-		outBuf.data = converter->planeTempBuffer;
-		
-		// see if the out buffer needs changes to its stride/
-		if(rotation != kRotate0DegreesClockwise && rotation != kRotate180DegreesClockwise) {
-			outBuf.rowBytes = converter->planeBytesPerLineRotated;
-			
-			// flip the width/heights
-			NSUInteger width = outBuf.width, height = outBuf.height;
-			
-			outBuf.height = width;
-			outBuf.width = height;
-		}
+		outBuf = TSPixelConverterTempBufferForOutput(converter, transposed);
 		
 		// do the rotation
 		error = vImageRotate90_PlanarF(&inBuf, &outBuf, (uint8_t) rotation, 1.f, kvImageNoFlags);
@@ -529,21 +875,82 @@ BOOL TSPixelConverterRotate90(TSPixelConverterRef converter, ssize_t rotation) {
 			return NO;
 		}
 		
-		// copy the data from the temp buffer to the actual buffer
-		memcpy(inBuf.data, outBuf.data, converter->planeSize);
+		// the temp buffer now holds the plane
+		TSPixelConverterSwapTempBuffer(converter, c);
 	}
 	
-	// set the rotated flag, if rotation changed the image dimensions
-	if(rotation != kRotate0DegreesClockwise && rotation != kRotate180DegreesClockwise) {
-		converter->planesAreRotated = YES;
-	} else {
-		converter->planesAreRotated = NO;
+	// odd rotations swap the image dimensions (again, if already rotated)
+	if(transposed) {
+		converter->planesAreRotated = !converter->planesAreRotated;
 	}
 	
 	// successed
 	return YES;
 }
 
+/**
+ * Applies an EXIF orientation to the image, rotating and/or mirroring it.
+ *
+ * Each plane is processed in bands of input rows in parallel, and written to
+ * the temporary plane, which then takes the place of the plane. This always
+ * uses the portable kernels, regardless of the converter's backend.
+ *
+ * @param converter Converter object whose planes should be oriented.
+ * @param orientation Orientation to apply.
+ *
+ * @return YES if successful, NO otherwise.
+ */
+BOOL TSPixelConverterApplyOrientation(TSPixelConverterRef converter, TSPixelConverterOrientation orientation) {
+	// validate parameters
+	DDCAssert(converter != NULL, @"converter may not be NULL");
+	
+	if(orientation < TSPixelConverterOrientationNormal || orientation > TSPixelConverterOrientationRotate90CCW) {
+		DDLogError(@"Invalid orientation: %lu", (unsigned long) orientation);
+		return NO;
+	}
+	
+	if(orientation == TSPixelConverterOrientationNormal) {
+		return YES;
+	}
+	
+	BOOL transposed = (orientation >= TSPixelConverterOrientationTranspose);
+	BOOL halfPrecision = (converter->planeFormat == TSPixelConverterPlaneFormatFloat16);
+	
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	for(NSUInteger c = 0; c < 3; c++) {
+		const vImage_Buffer inBuf = TSRawPipelinevImageBufferForPlane(converter, c);
+		const vImage_Buffer outBuf = TSPixelConverterTempBufferForOutput(converter, transposed);
+		
+		// orient bands of input rows in parallel
+		const size_t numBands = (inBuf.height + ORIENT_BAND_ROWS - 1) / ORIENT_BAND_ROWS;
+		
+		dispatch_apply(numBands, q, ^(size_t band) {
+			size_t firstRow = band * ORIENT_BAND_ROWS;
+			
+			if(halfPrecision) {
+				pixel_orient_planar_16(inBuf.data, inBuf.rowBytes, outBuf.data, outBuf.rowBytes,
+									   inBuf.width, inBuf.height, (int) orientation,
+									   firstRow, ORIENT_BAND_ROWS);
+			} else {
+				pixel_orient_planar_f(inBuf.data, inBuf.rowBytes, outBuf.data, outBuf.rowBytes,
+									  inBuf.width, inBuf.height, (int) orientation,
+									  firstRow, ORIENT_BAND_ROWS);
+			}
+		});
+		
+		// the temp buffer now holds the plane
+		TSPixelConverterSwapTempBuffer(converter, c);
+	}
+	
+	// transposing swaps the image dimensions (again, if already rotated)
+	if(transposed) {
+		converter->planesAreRotated = !converter->planesAreRotated;
+	}
+	
+	return YES;
+}
+
 #pragma mark Histogram Operations
 /**
  * Stretches the contrast of the image, such that all values between the
@@ -557,6 +964,25 @@ BOOL TSPixelConverterContrastStretch(TSPixelConverterRef converter, Pixel_F min,
 	vImage_Error error;
 	vImage_Buffer inBuf;
 	
+	// half precision planes are always stretched by the portable kernel
+	if(converter->planeFormat == TSPixelConverterPlaneFormatFloat16) {
+		for(int c = 0; c < 3; c++) {
+			inBuf = TSRawPipelinevImageBufferForPlane(converter, c);
+			pixel_contrast_stretch_planar_h(inBuf.data, inBuf.rowBytes, inBuf.width, inBuf.height, min, max);
+		}
+		
+		return YES;
+	}
+	
+	if(converter->backend == TSPixelConverterBackendPortable) {
+		for(int c = 0; c < 3; c++) {
+			inBuf = TSRawPipelinevImageBufferForPlane(converter, c);
+			pixel_contrast_stretch_planar_f(inBuf.data, inBuf.rowBytes, inBuf.width, inBuf.height, min, max);
+		}
+		
+		return YES;
+	}
+	
 	// calculate the size of the temporary buffer
 	inBuf = TSRawPipelinevImageBufferForPlane(converter, 0);
 	error = vImageContrastStretch_PlanarF(&inBuf, &inBuf, NULL, 0x2000, min, max, kvImageGetTempBufferSize);
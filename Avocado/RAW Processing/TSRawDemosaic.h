@@ -0,0 +1,114 @@
+//
+//  TSRawDemosaic.h
+//  Avocado
+//
+//	A registry of the demosaic (colour interpolation) engines available to the
+//	RAW pipeline, and the logic to pick one for a given rendering intent.
+//
+//  Created by Tristan Seifert on 20160722.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#ifndef TSRawDemosaic_h
+#define TSRawDemosaic_h
+
+#import <Foundation/Foundation.h>
+
+#include <stdint.h>
+
+#include "libraw.h"
+
+#import "TSRawPipeline.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#pragma mark Types
+/**
+ * Demosaic engines known to the pipeline.
+ */
+typedef NS_ENUM(NSUInteger, TSRawDemosaicEngine) {
+	/// Adaptive homogeneity-directed interpolation; good all-round quality.
+	TSRawDemosaicEngineAHD,
+	/// Directional LMMSE interpolation; best for noisy (high ISO) images.
+	TSRawDemosaicEngineLMMSE,
+	/// Bilinear interpolation; fast, but soft and prone to artifacts.
+	TSRawDemosaicEngineBilinear,
+	/// Combines each 2x2 block into one pixel; produces a half size image.
+	TSRawDemosaicEngineSuperpixel,
+	
+	TSRawDemosaicEngineCount
+};
+
+/**
+ * Signature of a demosaic function. It receives the white balanced Bayer data
+ * as a single component buffer, and writes every colour component of each
+ * pixel to the (four component) image buffer.
+ */
+typedef void (*TSRawDemosaicFunction)(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4]);
+
+/**
+ * Describes a single demosaic engine.
+ */
+typedef struct {
+	/// human readable name of the engine
+	const char *name;
+	/// function that performs the interpolation
+	TSRawDemosaicFunction interpolate;
+	
+	/**
+	 * Each dimension of the engine's output is the input's divided by two to
+	 * the power of this value; that is, 0 for engines that output a full size
+	 * image, 1 for half size. The sizes in the libraw struct are not changed,
+	 * and always describe the engine's input.
+	 */
+	unsigned int shrink;
+	
+	/**
+	 * Number of rows above and below a pixel that can affect its output,
+	 * including the rows at the edges of the image that are interpolated
+	 * differently. When the image is interpolated in strips, each strip is
+	 * extended by this many rows on both sides, so that the strip's own rows
+	 * come out the same as if the entire image were interpolated.
+	 */
+	unsigned int support;
+} TSRawDemosaicEngineInfo;
+
+#pragma mark Lookup
+/**
+ * Returns information about the given demosaic engine.
+ *
+ * @param engine Engine whose information to get; if it's invalid, AHD is
+ * returned instead.
+ */
+const TSRawDemosaicEngineInfo *TSRawDemosaicGetEngine(TSRawDemosaicEngine engine);
+
+/**
+ * Returns the demosaic engine that should be used for the given rendering
+ * intent.
+ *
+ * @param intent Rendering intent of the pipeline run.
+ */
+TSRawDemosaicEngine TSRawDemosaicEngineForIntent(TSRawPipelineIntent intent);
+
+/**
+ * Returns the demosaic engine with which the planar cache is filled for jobs
+ * of the given rendering intent. Since any intent may resume from the cache,
+ * this is always an engine that outputs a full size image.
+ *
+ * @param intent Rendering intent of the job whose output is cached.
+ */
+TSRawDemosaicEngine TSRawDemosaicEngineForCacheFill(TSRawPipelineIntent intent);
+
+/**
+ * Returns the size of the image that the given demosaic engine produces from
+ * an image of the given size.
+ */
+NSSize TSRawDemosaicGetOutputSize(TSRawDemosaicEngine engine, NSSize inSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TSRawDemosaic_h */
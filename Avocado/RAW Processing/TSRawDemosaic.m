@@ -0,0 +1,129 @@
+//
+//  TSRawDemosaic.m
+//  Avocado
+//
+//  Created by Tristan Seifert on 20160722.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import "TSRawDemosaic.h"
+
+#include "ahd_interpolate_mod.h"
+#include "lmmse_interpolate.h"
+#include "simple_interpolate.h"
+
+#import "TSRawLUTCache.h"
+
+#pragma mark Adapters
+/**
+ * Runs AHD, with its cube root table taken from the LUT cache.
+ */
+static void TSRawDemosaicAHD(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4]) {
+	NS_VALID_UNTIL_END_OF_SCOPE TSRawLUT *cbrtLUT = [[TSRawLUTCache sharedInstance] tableForKey:@"ahd:cbrt" size:(0x10000 * sizeof(float)) builder:^(void *table) {
+		ahd_build_cbrt_table((float *) table);
+	}];
+	
+	ahd_interpolate_mod_parallel(imageData, bayer, image, (const float *) cbrtLUT.table);
+}
+
+#pragma mark Registry
+/**
+ * All demosaic engines, indexed by their TSRawDemosaicEngine value.
+ */
+static const TSRawDemosaicEngineInfo TSRawDemosaicEngines[TSRawDemosaicEngineCount] = {
+	[TSRawDemosaicEngineAHD] = {
+		.name = "AHD",
+		.interpolate = TSRawDemosaicAHD,
+		.shrink = 0,
+		.support = 16	// 6 border rows, plus 5 rows of reach for the homogeneity map
+	},
+	[TSRawDemosaicEngineLMMSE] = {
+		.name = "LMMSE",
+		.interpolate = lmmse_interpolate,
+		.shrink = 0,
+		.support = 16	// same as the halo of its own bands
+	},
+	[TSRawDemosaicEngineBilinear] = {
+		.name = "Bilinear",
+		.interpolate = bilinear_interpolate,
+		.shrink = 0,
+		.support = 1
+	},
+	[TSRawDemosaicEngineSuperpixel] = {
+		.name = "Superpixel",
+		.interpolate = superpixel_interpolate,
+		.shrink = 1,
+		.support = 0
+	},
+};
+
+/**
+ * Returns information about the given demosaic engine.
+ *
+ * @param engine Engine whose information to get; if it's invalid, AHD is
+ * returned instead.
+ */
+const TSRawDemosaicEngineInfo *TSRawDemosaicGetEngine(TSRawDemosaicEngine engine) {
+	if(engine >= TSRawDemosaicEngineCount) {
+		DDLogWarn(@"Invalid demosaic engine %lu; using AHD", (unsigned long) engine);
+		engine = TSRawDemosaicEngineAHD;
+	}
+	
+	return &TSRawDemosaicEngines[engine];
+}
+
+#pragma mark Selection
+/**
+ * Returns the demosaic engine that should be used for the given rendering
+ * intent:
+ *
+ * - Fast display produces a half size image anyways, so interpolation is
+ *	 skipped entirely, and each 2x2 block becomes one pixel.
+ * - Slow display uses AHD, which gives good results at a reasonable speed.
+ * - Output uses LMMSE (with its median refinement), which holds up best on
+ *	 noisy images.
+ *
+ * @param intent Rendering intent of the pipeline run.
+ */
+TSRawDemosaicEngine TSRawDemosaicEngineForIntent(TSRawPipelineIntent intent) {
+	switch(intent) {
+		case TSRawPipelineIntentDisplayFast:
+			return TSRawDemosaicEngineSuperpixel;
+		
+		case TSRawPipelineIntentOutput:
+			return TSRawDemosaicEngineLMMSE;
+		
+		case TSRawPipelineIntentDisplaySlow:
+		case TSRawPipelineIntentUnknown:
+		default:
+			return TSRawDemosaicEngineAHD;
+	}
+}
+
+/**
+ * Returns the demosaic engine with which the planar cache is filled for jobs
+ * of the given rendering intent. Fast display skips interpolation, but its
+ * output is too small to cache; the cache is filled with the engine for slow
+ * display instead. Later fast display jobs then resume from the cache, and
+ * scale the cached planes down.
+ *
+ * @param intent Rendering intent of the job whose output is cached.
+ */
+TSRawDemosaicEngine TSRawDemosaicEngineForCacheFill(TSRawPipelineIntent intent) {
+	if(intent == TSRawPipelineIntentDisplayFast) {
+		return TSRawDemosaicEngineForIntent(TSRawPipelineIntentDisplaySlow);
+	}
+	
+	return TSRawDemosaicEngineForIntent(intent);
+}
+
+/**
+ * Returns the size of the image that the given demosaic engine produces from
+ * an image of the given size.
+ */
+NSSize TSRawDemosaicGetOutputSize(TSRawDemosaicEngine engine, NSSize inSize) {
+	unsigned int shrink = TSRawDemosaicGetEngine(engine)->shrink;
+	
+	return NSMakeSize(floor(inSize.width / (1 << shrink)),
+					  floor(inSize.height / (1 << shrink)));
+}
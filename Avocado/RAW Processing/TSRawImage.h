@@ -33,16 +33,33 @@ extern NSString *const TSRawImageErrorIsFatalKey;
 - (BOOL) unpackRawData:(NSError **) outErr;
 
 /**
- * Copies the raw data from the file into the four colour buffer given as
- * an input. This is usually in the single component Bayer format, which
- * must be processed before it can be displayed meaningfully, though some
- * RAW files may contain data in a different format.
+ * Extracts and decodes the preview image that the camera embedded in the raw
+ * file. It is rotated and flipped according to the orientation of the image.
  *
- * @param outBuffer A buffer at least (width * height) * 4 * 2 bytes in
- * length. Assume each row has (width * 8) bytes.
+ * @return The preview, or nil if the file doesn't contain a usable one.
+ */
+- (NSImage *) embeddedPreviewImage:(NSError **) outErr;
+
+/**
+ * Copies the raw data from the file into the buffer given as an input. This
+ * is in the single component Bayer format, i.e. one sample per pixel, which
+ * must be processed before it can be displayed meaningfully.
+ *
+ * @param outBuffer A buffer at least (width * height) * 2 bytes in length.
+ * Assume each row has (width * 2) bytes.
  */
 - (void) copyRawDataToBuffer:(void *) outBuffer;
 
+/**
+ * Copies the raw data from the file into the buffer given as an input, like
+ * copyRawDataToBuffer: does, but also subtracts black, applies white balance
+ * and prepares the data for interpolation in the same pass. The black level
+ * must have been adjusted beforehand.
+ *
+ * @param outBuffer A buffer at least (width * height) * 2 bytes in length.
+ */
+- (void) copyBalancedRawDataToBuffer:(void *) outBuffer;
+
 /// pointer to the libraw struct; shouldn't be usually accessible
 @property (nonatomic, readonly) libraw_data_t *libRaw;
 
@@ -80,6 +97,8 @@ extern NSString *const TSRawImageErrorIsFatalKey;
 
 /// rotation of the image
 @property (nonatomic, readonly, getter=getImageRotation) NSInteger rotation;
+/// orientation of the image, as an EXIF orientation value (1 through 8)
+@property (nonatomic, readonly, getter=getImageOrientation) NSUInteger orientation;
 
 
 /// camera colour space
@@ -11,6 +11,8 @@
 #import "TSRawImageDataHelpers.h"
 #import "libraw.h"
 
+#import <CoreImage/CoreImage.h>
+
 NSString *const TSRawImageErrorDomain = @"TSRawImageErrorDomain";
 NSString *const TSRawImageErrorIsFatalKey = @"TSRawImageErrorIsFatal";
 
@@ -168,15 +170,76 @@ NSString *const TSRawImageErrorIsFatalKey = @"TSRawImageErrorIsFatal";
 	return YES;
 }
 
+/**
+ * Extracts and decodes the embedded preview image. LibRaw either provides
+ * the JPEG data as it is stored in the file, or an 8 bit RGB bitmap; previews
+ * in any other format are ignored.
+ */
+- (NSImage *) embeddedPreviewImage:(NSError **) outErr {
+	int err = 0;
+	CIImage *preview = nil;
+	
+	// unpack and decode the preview
+	if((err = libraw_unpack_thumb(self.libRaw)) != LIBRAW_SUCCESS) {
+		if(outErr) *outErr = [self errorFromCode:err];
+		return nil;
+	}
+	
+	libraw_processed_image_t *thumb = libraw_dcraw_make_mem_thumb(self.libRaw, &err);
+	
+	if(thumb == NULL) {
+		if(outErr) *outErr = [self errorFromCode:err];
+		return nil;
+	}
+	
+	// create a CIImage from it; the data is copied, since it's decoded lazily
+	if(thumb->type == LIBRAW_IMAGE_JPEG) {
+		NSData *data = [NSData dataWithBytes:thumb->data length:thumb->data_size];
+		preview = [CIImage imageWithData:data];
+	} else if(thumb->type == LIBRAW_IMAGE_BITMAP && thumb->bits == 8 && thumb->colors == 3) {
+		NSBitmapImageRep *bm = [[NSBitmapImageRep alloc]
+								initWithBitmapDataPlanes:NULL
+								pixelsWide:thumb->width
+								pixelsHigh:thumb->height
+								bitsPerSample:8
+								samplesPerPixel:3
+								hasAlpha:NO
+								isPlanar:NO
+								colorSpaceName:NSCalibratedRGBColorSpace
+								bytesPerRow:(thumb->width * 3)
+								bitsPerPixel:24];
+		
+		memcpy(bm.bitmapData, thumb->data, MIN(thumb->data_size, (size_t) (bm.bytesPerRow * thumb->height)));
+		preview = [[CIImage alloc] initWithBitmapImageRep:bm];
+	} else {
+		DDLogWarn(@"Unsupported embedded preview format: type = %i, bits = %u, colours = %u", thumb->type, thumb->bits, thumb->colors);
+	}
+	
+	libraw_dcraw_clear_mem(thumb);
+	
+	if(preview == nil) {
+		return nil;
+	}
+	
+	// the preview is stored like the raw data, so apply the image's orientation
+	preview = [preview imageByApplyingOrientation:(int) self.orientation];
+	
+	NSCIImageRep *rep = [NSCIImageRep imageRepWithCIImage:preview];
+	
+	NSImage *image = [[NSImage alloc] initWithSize:rep.size];
+	[image addRepresentation:rep];
+	
+	return image;
+}
+
 #pragma mark Raw data copying
 /**
- * Copies the raw data from the file into the four colour buffer given as
- * an input. This is usually in the single component Bayer format, which
- * must be processed before it can be displayed meaningfully, though some
- * RAW files may contain data in a different format.
+ * Copies the raw data from the file into the buffer given as an input. This
+ * is in the single component Bayer format, i.e. one sample per pixel, which
+ * must be processed before it can be displayed meaningfully.
  *
- * @param outBuffer A buffer at least (width * height) * 4 * 2 bytes in
- * length. Assume each row has (width * 8) bytes.
+ * @param outBuffer A buffer at least (width * height) * 2 bytes in length.
+ * Assume each row has (width * 2) bytes.
  */
 - (void) copyRawDataToBuffer:(void *) outBuffer {
 	// adjust black levels
@@ -192,6 +255,23 @@ NSString *const TSRawImageErrorIsFatalKey = @"TSRawImageErrorIsFatal";
 	}
 }
 
+/**
+ * Copies the raw data from the file into the buffer given as an input, like
+ * copyRawDataToBuffer: does, but also subtracts black, applies white balance
+ * and prepares the data for interpolation in the same pass. The black level
+ * must have been adjusted beforehand.
+ *
+ * @param outBuffer A buffer at least (width * height) * 2 bytes in length.
+ */
+- (void) copyBalancedRawDataToBuffer:(void *) outBuffer {
+	if(self.libRaw->idata.filters || self.libRaw->idata.colors == 1) { // bayer, one component
+		TSRawPrepareBayerData(self.libRaw, outBuffer);
+	} else {
+		DDLogError(@"Got an unsupported RAW format: filters = 0x%08x, colours = %i", self.libRaw->idata.filters, self.libRaw->idata.colors);
+		DDAssert(false, @"Unsupported RAW format provided: %@", self.fileUrl);
+	}
+}
+
 #pragma mark Helpers
 /**
  * Creates an NSError object from a LibRaw error. Positive error codes are
@@ -360,6 +440,27 @@ NSString *const TSRawImageErrorIsFatalKey = @"TSRawImageErrorIsFatal";
 	return 0;
 }
 
+/**
+ * Returns the EXIF orientation of the image. Unlike the rotation, this also
+ * accounts for mirrored images.
+ *
+ * LibRaw's flip value is a bitmask of a transpose (4), a vertical flip (2) and
+ * a horizontal flip (1), applied in that order.
+ */
+- (NSUInteger) getImageOrientation {
+	static const NSUInteger orientations[8] = {
+		1, 2, 4, 3, 5, 8, 6, 7
+	};
+	
+	int flip = self.libRaw->sizes.flip;
+	
+	if(flip < 0 || flip > 7) {
+		return 1;
+	}
+	
+	return orientations[flip];
+}
+
 /**
  * Returns an NSColorSpace object for the camera's embedded ICC profile.
  */
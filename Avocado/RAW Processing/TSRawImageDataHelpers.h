@@ -9,6 +9,7 @@
 #ifndef TSRawImageDataHelpers_h
 #define TSRawImageDataHelpers_h
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "libraw.h"
@@ -24,41 +25,109 @@ extern "C" {
  * @param libRaw LibRaw instance from which to copy data
  * @param cblack Black levels for each component
  * @param dmaxp Pointer to a variable in which to store the maximum pixel value.
- * @param outBuf Output buffer; this should be a 16-bit, four component buffer.
+ * @param outBuf Output buffer; this holds a single 16-bit sample per pixel.
  */
-void TSRawCopyBayerData(libraw_data_t *libRaw, unsigned short cblack[4], unsigned short *dmaxp, uint16_t (*outBuf)[4]);
+void TSRawCopyBayerData(libraw_data_t *libRaw, unsigned short cblack[4], unsigned short *dmaxp, uint16_t *outBuf);
 
 /**
  * Adjusts the black level of the image.
  *
  * @param libRaw LibRaw instance from which to acquire some image info
- * @param image Image buffer
+ * @param image Single component Bayer data
  */
-void TSRawAdjustBlackLevel(libraw_data_t *libRaw, uint16_t (*image)[4]);
+void TSRawAdjustBlackLevel(libraw_data_t *libRaw, uint16_t *image);
 
 /**
  * Subtracts black to bring the image's black level into whack.
  *
  * @param libRaw LibRaw instance from which to acquire some image info
- * @param image Image buffer
+ * @param image Single component Bayer data
  */
-void TSRawSubtractBlack(libraw_data_t *libRaw, uint16_t (*image)[4]);
+void TSRawSubtractBlack(libraw_data_t *libRaw, uint16_t *image);
 
 /**
  * Performs pre-interpolation tasks on the colour data.
  *
  * @param libRaw LibRaw instance from which to acquire some image info
- * @param image Image buffer
+ * @param image Single component Bayer data
  */
-void TSRawPreInterpolation(libraw_data_t *libRaw, uint16_t (*image)[4]);
+void TSRawPreInterpolation(libraw_data_t *libRaw, uint16_t *image);
 
 /**
  * Applies contrast and scaling to colour data; this applies white balance.
  *
  * @param libRaw LibRaw instance from which to acquire some image info
- * @param image Image buffer
+ * @param image Single component Bayer data
  */
-void TSRawPreInterpolationApplyWB(libraw_data_t *libRaw, uint16_t (*image)[4]);
+void TSRawPreInterpolationApplyWB(libraw_data_t *libRaw, uint16_t *image);
+
+/**
+ * Copies single component Bayer data from the given LibRaw instance into the
+ * given output buffer, subtracts black, applies white balance and performs the
+ * pre-interpolation tasks, all in a single pass over the image. The output is
+ * identical to that of calling TSRawCopyBayerData, TSRawSubtractBlack,
+ * TSRawPreInterpolationApplyWB and TSRawPreInterpolation in turn.
+ *
+ * TSRawAdjustBlackLevel should have been called before.
+ *
+ * @param libRaw LibRaw instance from which to copy data
+ * @param outBuf Output buffer; this holds a single 16-bit sample per pixel.
+ */
+void TSRawPrepareBayerData(libraw_data_t *libRaw, uint16_t *outBuf);
+
+/**
+ * State for preparing Bayer data in several steps, such as one strip of rows
+ * at a time; see TSRawBeginBayerPreparation.
+ */
+typedef struct {
+	/// black level for each position in the 16x16 filter pattern
+	int cblk[16][16];
+	/// white balance multiplier for each position in the 16x16 filter pattern
+	float scale[16][16];
+	
+	/// pattern black levels (cblack[6+]), or NULL if the image has none
+	int *pattern;
+	/// number of rows and columns of the pattern black levels
+	int patternRows, patternCols;
+	
+	/// largest sample (before scaling) in the rows prepared so far
+	int dataMaximum;
+} TSRawBayerPreparation;
+
+/**
+ * Begins preparing Bayer data in several steps. Everything that depends only
+ * on the image's metadata is calculated, and the libraw struct is updated as
+ * by TSRawPrepareBayerData; rows can then be prepared in any order with
+ * TSRawPrepareBayerRows, with the same output as preparing the entire image.
+ *
+ * TSRawAdjustBlackLevel should have been called before.
+ *
+ * @param libRaw LibRaw instance from which to copy data
+ * @param prep Preparation state to fill in; TSRawEndBayerPreparation must be
+ * called with it once all rows are prepared.
+ */
+void TSRawBeginBayerPreparation(libraw_data_t *libRaw, TSRawBayerPreparation *prep);
+
+/**
+ * Copies the given rows of Bayer data from the LibRaw instance into the
+ * output buffer, and prepares them for interpolation.
+ *
+ * @param libRaw LibRaw instance from which to copy data
+ * @param prep Preparation state
+ * @param firstRow First row of the image to prepare
+ * @param numRows Number of rows to prepare
+ * @param outBuf Output buffer; the first row is written to its start.
+ */
+void TSRawPrepareBayerRows(libraw_data_t *libRaw, TSRawBayerPreparation *prep, size_t firstRow, size_t numRows, uint16_t *outBuf);
+
+/**
+ * Finishes preparing Bayer data; this stores the maximum sample in the libraw
+ * struct, and frees the preparation state.
+ *
+ * @param libRaw LibRaw instance from which the data was copied
+ * @param prep Preparation state
+ */
+void TSRawEndBayerPreparation(libraw_data_t *libRaw, TSRawBayerPreparation *prep);
 
 /**
  * Performs post-interpolation green channel mixing.
@@ -85,25 +154,77 @@ void TSRawPostInterpolationMedianFilter(libraw_data_t *libRaw, uint16_t (*image)
  * @param libRaw LibRaw instance from which to acquire some image info
  * @param image Image buffer (after interpolation)
  * @param outBuf Output data buffer
+ * @param width Width of the interpolated image; this is the output size of
+ * the demosaic engine, which may be smaller than the sizes in libRaw.
+ * @param height Height of the interpolated image
  * @param histogram Pointer to the histogram to be created. Has 0x2000 bins,
  * times four for four possible colours.
- * @param gammaCurve Gamma curve buffer
+ * @param gammaCurveOut If not NULL, the gamma curve that was applied (0x10000
+ * entries) is copied here; this is intended for debugging.
+ */
+void TSRawConvertToRGB(libraw_data_t *libRaw, uint16_t (*image)[4], uint16_t (*outBuf)[3], size_t width, size_t height, int *histogram, uint16_t *gammaCurveOut);
+
+/**
+ * State for converting to RGB in several steps; see TSRawBeginRGBConversion.
+ */
+typedef struct {
+	/// camera to output colour space matrix; 3 rows, one column per colour
+	float matrix[3][4];
+	/// number of colours in the image
+	int colors;
+} TSRawRGBConversion;
+
+/**
+ * Begins converting interpolated data to RGB in several steps, such as one
+ * strip of rows at a time. Since the gamma curve depends on the histogram of
+ * the entire image, this happens in two passes: first, all rows are converted
+ * to the output colour space with TSRawConvertRowsToRGB, which also builds the
+ * histogram. Then, the lookup table from TSRawCreateOutputCurve is applied
+ * with TSRawApplyOutputCurve. The output is identical to TSRawConvertToRGB.
+ *
+ * @param libRaw LibRaw instance from which to acquire some image info
+ * @param conv Conversion state to fill in
+ */
+void TSRawBeginRGBConversion(libraw_data_t *libRaw, TSRawRGBConversion *conv);
+
+/**
+ * Converts the given rows to the output colour space, in place, and adds them
+ * to the histogram.
+ *
+ * @param conv Conversion state
+ * @param image First pixel of the rows to convert
+ * @param outBuf If not NULL, the converted pixels are also packed into this
+ * three component buffer.
+ * @param width Number of pixels in each row
+ * @param numRows Number of rows to convert
+ * @param histogram Histogram to add the pixels to; 0x2000 bins, times four for
+ * four possible colours. It should be cleared before the first rows.
  */
-void TSRawConvertToRGB(libraw_data_t *libRaw, uint16_t (*image)[4], uint16_t (*outBuf)[3], int *histogram, uint16_t *gammaCurve);
+void TSRawConvertRowsToRGB(const TSRawRGBConversion *conv, uint16_t (*image)[4], uint16_t (*outBuf)[3], size_t width, size_t numRows, int *histogram);
 
 /**
- * Uses bilinear interpolation to interpolate the value of a single component at
- * a fractional coordinate. The component is assumed to be at position 0 of the
- * input pointer.
+ * Builds the lookup table that applies the gamma curve and the output curve.
  *
- * @param buffer Input buffer on which to interpolate.
- * @param stride Number of elements (for example, width * 3) per row.
- * @param x Floating point X coordinate
- * @param y Floating point Y coordinate
+ * @param libRaw LibRaw instance from which to acquire some image info
+ * @param histogram Histogram of the entire image, from TSRawConvertRowsToRGB
+ * @param numPixels Number of pixels in the image the histogram covers
+ * @param gammaCurveOut If not NULL, the gamma curve (0x10000 entries) is
+ * copied here; this is intended for debugging.
+ *
+ * @return Lookup table with 0x10000 entries; it must be freed by the caller.
+ */
+uint16_t *TSRawCreateOutputCurve(libraw_data_t *libRaw, const int *histogram, size_t numPixels, uint16_t *gammaCurveOut);
+
+/**
+ * Applies a lookup table from TSRawCreateOutputCurve to three component RGB
+ * data, in place.
  *
- * @return The value of the component, as interpolated.
+ * @param curve Lookup table
+ * @param image Image buffer
+ * @param width Width of the image, in pixels
+ * @param height Height of the image, in pixels
  */
-uint16_t TSInterpolatePixelBilinear(uint16_t *buffer, size_t stride, float x, float y);
+void TSRawApplyOutputCurve(const uint16_t *curve, uint16_t (*image)[3], size_t width, size_t height);
 
 #ifdef __cplusplus
 }
@@ -9,18 +9,32 @@
 #include "TSRawImageDataHelpers.h"
 #include "interpolation_shared.h"
 
+#import "TSRawLUTCache.h"
+
 #include <float.h>
 #include <string.h>
 #include <memory.h>
 #include <stdlib.h>
 #include <math.h>
 
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include <dispatch/dispatch.h>
+
 /**
  * Set to 1 to print out some additional debugging information, such as
  * conversion matrices and other variables.
  */
 #define PRINT_DEBUG_INFO	0
 
+/// number of rows processed by each iteration of the fused pre-interpolation
+#define PREPARE_BAND_ROWS	64
+/// number of rows processed by each iteration of the median filter
+#define MEDIAN_BAND_ROWS	64
+/// number of rows processed by each iteration of the RGB conversion
+#define CONVERT_BAND_ROWS	64
+
 // define some shorthands
 /// size struct
 #define S libRaw->sizes
@@ -29,6 +43,8 @@
 
 #pragma mark Helpers
 static void TSBuildGammaCurve(double pwr, double ts, int mode, int imax, uint16_t *curve, double *gamm);
+static TSRawLUT *TSGetGammaCurve(double pwr, double ts, int mode, int imax);
+static void TSRawCalculateWBScale(libraw_data_t *libRaw, float scale_mul[4]);
 
 #pragma mark Conversion and Copying
 /**
@@ -38,9 +54,9 @@ static void TSBuildGammaCurve(double pwr, double ts, int mode, int imax, uint16_
  * @param libRaw LibRaw instance from which to copy data
  * @param cblack Black levels for each component
  * @param dmaxp Pointer to a variable in which to store the maximum pixel value.
- * @param outBuf Output buffer; this should be a 16-bit, four component buffer.
+ * @param outBuf Output buffer; this holds a single 16-bit sample per pixel.
  */
-void TSRawCopyBayerData(libraw_data_t *libRaw, unsigned short cblack[4], unsigned short *dmaxp, uint16_t (*outBuf)[4]) {
+void TSRawCopyBayerData(libraw_data_t *libRaw, unsigned short cblack[4], unsigned short *dmaxp, uint16_t *outBuf) {
 	size_t row;
 	
 	// get some caches
@@ -72,7 +88,7 @@ void TSRawCopyBayerData(libraw_data_t *libRaw, unsigned short cblack[4], unsigne
 			}
 			
 			// store the pixel value
-			outBuf[(row * S.iwidth) + col][cc] = val;
+			outBuf[(row * S.iwidth) + col] = val;
 		}
 		
 		// store the highest pixel value
@@ -89,9 +105,9 @@ void TSRawCopyBayerData(libraw_data_t *libRaw, unsigned short cblack[4], unsigne
  * This corresponds to LibRaw::adjust_bl().
  *
  * @param libRaw LibRaw instance from which to acquire some image info
- * @param image Image buffer
+ * @param image Single component Bayer data
  */
-void TSRawAdjustBlackLevel(libraw_data_t *libRaw, uint16_t (*image)[4]) {
+void TSRawAdjustBlackLevel(libraw_data_t *libRaw, uint16_t *image) {
 	int c;
 	
 	// Add common part to cblack[] early
@@ -160,34 +176,36 @@ void TSRawAdjustBlackLevel(libraw_data_t *libRaw, uint16_t (*image)[4]) {
  * Subtracts black to bring the image's black level into whack.
  *
  * @param libRaw LibRaw instance from which to acquire some image info
- * @param image Image buffer
+ * @param image Single component Bayer data
  */
-void TSRawSubtractBlack(libraw_data_t *libRaw, uint16_t (*image)[4]) {
+void TSRawSubtractBlack(libraw_data_t *libRaw, uint16_t *image) {
+	size_t row, col;
+	
+	// get some data from the struct
+	unsigned int filters = libRaw->idata.filters;
+	ushort top_margin = S.top_margin;
+	ushort left_margin = S.left_margin;
+	
 	if((C.cblack[0] || C.cblack[1] || C.cblack[2] || C.cblack[3] || (C.cblack[4] && C.cblack[5]) )) {
-#define BAYERC(row,col,c) imgdata.image[((row) >> IO.shrink)*S.iwidth + ((col) >> IO.shrink)][c]
 		int cblk[4], i;
 		for(i = 0; i < 4; i++)
 			cblk[i] = C.cblack[i];
 		
-		int size = S.iheight * S.iwidth;
-		
 		int dmax = 0;
-		if(C.cblack[4] && C.cblack[5]) {
-			for(i = 0; i< (size * 4); i++) {
-				int val = image[0][i];
+		
+		for(row = 0; row < S.iheight; row++) {
+			uint16_t *p = image + (row * S.iwidth);
+			
+			for(col = 0; col < S.iwidth; col++) {
+				int val = p[col];
 				
-				val -= C.cblack[6 + i/4 / S.iwidth % C.cblack[4] * C.cblack[5] +
-								i/4 % S.iwidth % C.cblack[5]];
-				val -= cblk[i & 3];
+				if(C.cblack[4] && C.cblack[5]) {
+					val -= C.cblack[6 + row % C.cblack[4] * C.cblack[5] +
+									col % C.cblack[5]];
+				}
+				val -= cblk[fcol(row, col, filters, top_margin, left_margin)];
 				
-				image[0][i] = CLIP(val);
-				if(dmax < val) dmax = val;
-			}
-		} else {
-			for(i = 0; i < (size * 4); i++) {
-				int val = image[0][i];
-				val -= cblk[i & 3];
-				image[0][i] = CLIP(val);
+				p[col] = CLIP(val);
 				if(dmax < val) dmax = val;
 			}
 		}
@@ -198,17 +216,14 @@ void TSRawSubtractBlack(libraw_data_t *libRaw, uint16_t (*image)[4]) {
 		// clear the values to zero
 		memset(&C.cblack, 0, sizeof(C.cblack));
 		C.black = 0;
-		
-#undef BAYERC
 	} else {
 		// Nothing to do, maximum is already calculated, black level is 0, so no change
 		// only calculate channel maximum;
-		int idx;
-		ushort *p = (ushort*) image;
+		size_t idx;
 		int dmax = 0;
 		
-		for(idx=0; idx < (S.iheight * S.iwidth * 4); idx++) {
-			if(dmax < p[idx]) dmax = p[idx];
+		for(idx=0; idx < (S.iheight * S.iwidth); idx++) {
+			if(dmax < image[idx]) dmax = image[idx];
 		}
 		
 		C.data_maximum = dmax;
@@ -219,24 +234,16 @@ void TSRawSubtractBlack(libraw_data_t *libRaw, uint16_t (*image)[4]) {
 /**
  * Performs pre-interpolation tasks on the colour data.
  *
+ * For three colour images, the second green is treated as the same colour as
+ * the first; since each pixel only has a single sample, the data itself stays
+ * as is, and only the filter pattern changes.
+ *
  * @param libRaw LibRaw instance from which to acquire some image info
- * @param image Image buffer
+ * @param image Single component Bayer data
  */
-void TSRawPreInterpolation(libraw_data_t *libRaw, uint16_t (*image)[4]) {
-	size_t row, col;
-	
-	// get some data from the struct
-	ushort width = libRaw->sizes.width;
-	ushort height = libRaw->sizes.height;
-	
-	unsigned int filters = libRaw->idata.filters;
-	
+void TSRawPreInterpolation(libraw_data_t *libRaw, uint16_t *image) {
 	// if there's filters AND three colours, make the first G the same as the second G
 	if(libRaw->idata.filters && libRaw->idata.colors == 3) {
-		for (row = FC(1, 0, filters) >> 1; row < height; row+=2)
-			for (col = FC(row, 1, filters) & 1; col < width; col+=2)
-				image[row*width+col][1] = image[row*width+col][3];
-		
 		libRaw->idata.filters &= ~((libRaw->idata.filters & 0x55555555) << 1);
 	}
 }
@@ -245,33 +252,52 @@ void TSRawPreInterpolation(libraw_data_t *libRaw, uint16_t (*image)[4]) {
 /**
  * Inner colour scaling loop.
  */
-static inline void TSRawScaleColourLoop(libraw_data_t *libRaw, uint16_t (*image)[4], float scale_mul[4]) {
-	unsigned size = S.iheight * S.iwidth;
+static inline void TSRawScaleColourLoop(libraw_data_t *libRaw, uint16_t *image, float scale_mul[4]) {
+	size_t row, col;
+	int c, val;
+	
+	// get some data from the struct
+	unsigned int filters = libRaw->idata.filters;
+	ushort top_margin = S.top_margin;
+	ushort left_margin = S.left_margin;
 	
 	if(C.cblack[4] && C.cblack[5]) {
-		int val;
-		
-		for(size_t i = 0; i < size * 4; i++) {
-			if (!(val = image[0][i])) continue;
+		for(row = 0; row < S.iheight; row++) {
+			uint16_t *p = image + (row * S.iwidth);
 			
-			val -= C.cblack[6 + i/4 / S.iwidth % C.cblack[4] * C.cblack[5] + i/4 % S.iwidth % C.cblack[5]];
-			val -= C.cblack[i & 3];
-			val *= scale_mul[i & 3];
-			image[0][i] = CLIP(val);
+			for(col = 0; col < S.iwidth; col++) {
+				if (!(val = p[col])) continue;
+				
+				c = fcol(row, col, filters, top_margin, left_margin);
+				val -= C.cblack[6 + row % C.cblack[4] * C.cblack[5] + col % C.cblack[5]];
+				val -= C.cblack[c];
+				val *= scale_mul[c];
+				p[col] = CLIP(val);
+			}
 		}
 	} else if(C.cblack[0] || C.cblack[1] || C.cblack[2] || C.cblack[3]) {
-		for(size_t i=0; i < size*4; i++) {
-			int val = image[0][i];
-			if (!val) continue;
-			val -= C.cblack[i & 3];
-			val *= scale_mul[i & 3];
-			image[0][i] = CLIP(val);
+		for(row = 0; row < S.iheight; row++) {
+			uint16_t *p = image + (row * S.iwidth);
+			
+			for(col = 0; col < S.iwidth; col++) {
+				if (!(val = p[col])) continue;
+				
+				c = fcol(row, col, filters, top_margin, left_margin);
+				val -= C.cblack[c];
+				val *= scale_mul[c];
+				p[col] = CLIP(val);
+			}
 		}
 	} else { // BL is zero
-		for(size_t i=0; i < size*4; i++) {
-			int val = image[0][i];
-			val *= scale_mul[i & 3];
-			image[0][i] = CLIP(val);
+		for(row = 0; row < S.iheight; row++) {
+			uint16_t *p = image + (row * S.iwidth);
+			
+			for(col = 0; col < S.iwidth; col++) {
+				c = fcol(row, col, filters, top_margin, left_margin);
+				val = p[col];
+				val *= scale_mul[c];
+				p[col] = CLIP(val);
+			}
 		}
 	}
 }
@@ -282,13 +308,28 @@ static inline void TSRawScaleColourLoop(libraw_data_t *libRaw, uint16_t (*image)
  * @note This corresponds to scale_colors() in LibRaw.
  *
  * @param libRaw LibRaw instance from which to acquire some image info
- * @param image Image buffer
+ * @param image Single component Bayer data
+ */
+void TSRawPreInterpolationApplyWB(libraw_data_t *libRaw, uint16_t *image) {
+	float scale_mul[4];
+	
+	TSRawCalculateWBScale(libRaw, scale_mul);
+	
+	// perform the scaling loop
+	TSRawScaleColourLoop(libRaw, image, scale_mul);
+}
+
+/**
+ * Calculates the white balance multipliers for each colour, and updates the
+ * maximum and black levels in the libraw struct accordingly.
+ *
+ * @param libRaw LibRaw instance from which to acquire some image info
+ * @param scale_mul Multipliers for each colour are written here
  */
-void TSRawPreInterpolationApplyWB(libraw_data_t *libRaw, uint16_t (*image)[4]) {
+static void TSRawCalculateWBScale(libraw_data_t *libRaw, float scale_mul[4]) {
 	unsigned int row, col, c, sum[8];
 	int val, dark, sat;
 	double dmin, dmax;
-	float scale_mul[4];
 	
 	// get some data from the struct
 	unsigned int filters = libRaw->idata.filters;
@@ -342,9 +383,196 @@ void TSRawPreInterpolationApplyWB(libraw_data_t *libRaw, uint16_t (*image)[4]) {
 		FORC4 libRaw->color.cblack[FC(c/2,c%2, filters)] += libRaw->color.cblack[6 + c/2 % libRaw->color.cblack[4] * libRaw->color.cblack[5] + c%2 % libRaw->color.cblack[5]];
 		libRaw->color.cblack[4] = libRaw->color.cblack[5] = 0;
 	}
+}
+
+#pragma mark Fused Pre-Interpolation
+/**
+ * Copies single component Bayer data from the given LibRaw instance into the
+ * given output buffer, and prepares it for interpolation. This is equivalent
+ * to (and produces the same output as) calling, in order:
+ *
+ * 1. TSRawCopyBayerData (with zero black levels)
+ * 2. TSRawSubtractBlack
+ * 3. TSRawPreInterpolationApplyWB
+ * 4. TSRawPreInterpolation
+ *
+ * All calculations that depend only on the image's metadata are done ahead of
+ * time, so each pixel is read and written only once. The black levels and
+ * multipliers for each position in the 16x16 filter pattern are looked up per
+ * row, and the pattern black (cblack[6+]) is indexed with a running counter
+ * rather than a modulo. Bands of rows are processed on all cores.
+ *
+ * This prepares the entire image at once; the individual steps are available
+ * for callers that process the image in strips.
+ *
+ * TSRawAdjustBlackLevel should have been called before.
+ *
+ * @param libRaw LibRaw instance from which to copy data
+ * @param outBuf Output buffer; this holds a single 16-bit sample per pixel.
+ */
+void TSRawPrepareBayerData(libraw_data_t *libRaw, uint16_t *outBuf) {
+	TSRawBayerPreparation prep;
 	
-	// perform the scaling loop
-	TSRawScaleColourLoop(libRaw, image, scale_mul);
+	TSRawBeginBayerPreparation(libRaw, &prep);
+	TSRawPrepareBayerRows(libRaw, &prep, 0, S.height, outBuf);
+	TSRawEndBayerPreparation(libRaw, &prep);
+}
+
+/**
+ * Begins preparing Bayer data in several steps. The black levels and white
+ * balance multipliers for each position in the 16x16 filter pattern are
+ * calculated, and the black levels in the libraw struct are cleared, as in
+ * TSRawPrepareBayerData.
+ *
+ * The filter pattern is also updated for interpolation right away (as
+ * TSRawPreInterpolation does); the lookup tables already hold the values for
+ * the original pattern, so rows can be interpolated as soon as they've been
+ * prepared.
+ *
+ * @param libRaw LibRaw instance from which to copy data
+ * @param prep Preparation state to fill in
+ */
+void TSRawBeginBayerPreparation(libraw_data_t *libRaw, TSRawBayerPreparation *prep) {
+	int i, c;
+	
+	// get some data from the struct
+	const unsigned int filters = libRaw->idata.filters;
+	const ushort top_margin = S.top_margin;
+	const ushort left_margin = S.left_margin;
+	
+	// take a copy of the black levels, then clear them (as black subtraction does)
+	int cblk[4];
+	for(i = 0; i < 4; i++)
+		cblk[i] = C.cblack[i];
+	
+	prep->patternRows = (C.cblack[4] && C.cblack[5]) ? C.cblack[4] : 0;
+	prep->patternCols = (C.cblack[4] && C.cblack[5]) ? C.cblack[5] : 0;
+	prep->pattern = NULL;
+	
+	if(prep->patternRows) {
+		prep->pattern = (int *) malloc(prep->patternRows * prep->patternCols * sizeof(int));
+		
+		for(i = 0; i < (prep->patternRows * prep->patternCols); i++)
+			prep->pattern[i] = C.cblack[6 + i];
+	}
+	
+	C.maximum -= C.black;
+	
+	memset(&C.cblack, 0, sizeof(C.cblack));
+	C.black = 0;
+	
+	// calculate the white balance multipliers
+	float scale_mul[4];
+	TSRawCalculateWBScale(libRaw, scale_mul);
+	
+	// per colour values for each position in the filter pattern
+	for(i = 0; i < 256; i++) {
+		c = fcol(i / 16, i % 16, filters, top_margin, left_margin);
+		
+		prep->cblk[i / 16][i % 16] = cblk[c];
+		prep->scale[i / 16][i % 16] = scale_mul[c];
+	}
+	
+	prep->dataMaximum = 0;
+	
+	// treat the second green the same as the first; this only changes the filters
+	TSRawPreInterpolation(libRaw, NULL);
+}
+
+/**
+ * Prepares the given rows of Bayer data. Each band of rows finds its own
+ * maximum, which are then combined with the maximum of the rows that were
+ * prepared before.
+ *
+ * @param libRaw LibRaw instance from which to copy data
+ * @param prep Preparation state
+ * @param firstRow First row of the image to prepare
+ * @param numRows Number of rows to prepare
+ * @param outBuf Output buffer; the first row is written to its start.
+ */
+void TSRawPrepareBayerRows(libraw_data_t *libRaw, TSRawBayerPreparation *prep, size_t firstRow, size_t numRows, uint16_t *outBuf) {
+	// get some data from the struct
+	const ushort top_margin = S.top_margin;
+	const ushort left_margin = S.left_margin;
+	
+	const size_t width = S.width;
+	const size_t outWidth = S.iwidth;
+	const size_t rawPitch = S.raw_pitch / 2;
+	const ushort *raw = libRaw->rawdata.raw_image;
+	
+	// process the rows in bands; each band finds its own maximum
+	const size_t numBands = (numRows + PREPARE_BAND_ROWS - 1) / PREPARE_BAND_ROWS;
+	int *bandMax = (int *) calloc(MAX(numBands, 1), sizeof(int));
+	
+	const int *patternPtr = prep->pattern;
+	const int patternRows = prep->patternRows;
+	const int patternCols = prep->patternCols;
+	int (*cblkPtr)[16] = prep->cblk;
+	float (*scalePtr)[16] = prep->scale;
+	
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(numBands, q, ^(size_t band) {
+		size_t row, col;
+		int val, dmax = 0;
+		
+		size_t rowStart = firstRow + (band * PREPARE_BAND_ROWS);
+		size_t rowEnd = MIN(rowStart + PREPARE_BAND_ROWS, firstRow + numRows);
+		
+		for(row = rowStart; row < rowEnd; row++) {
+			const ushort *in = raw + ((row + top_margin) * rawPitch) + left_margin;
+			uint16_t *out = outBuf + ((row - firstRow) * outWidth);
+			
+			const int *blk = cblkPtr[row & 15];
+			const float *scale = scalePtr[row & 15];
+			
+			if(patternPtr) {
+				const int *patternRow = patternPtr + ((row % patternRows) * patternCols);
+				int p = 0;
+				
+				for(col = 0; col < width; col++) {
+					val = in[col] - patternRow[p] - blk[col & 15];
+					if(++p == patternCols) p = 0;
+					
+					if(dmax < val) dmax = val;
+					
+					val = CLIP(val) * scale[col & 15];
+					out[col] = CLIP(val);
+				}
+			} else {
+				for(col = 0; col < width; col++) {
+					val = in[col] - blk[col & 15];
+					
+					if(dmax < val) dmax = val;
+					
+					val = CLIP(val) * scale[col & 15];
+					out[col] = CLIP(val);
+				}
+			}
+		}
+		
+		bandMax[band] = dmax;
+	});
+	
+	// find the overall maximum
+	for(size_t band = 0; band < numBands; band++) {
+		if(prep->dataMaximum < bandMax[band]) prep->dataMaximum = bandMax[band];
+	}
+	
+	free(bandMax);
+}
+
+/**
+ * Finishes preparing Bayer data.
+ *
+ * @param libRaw LibRaw instance from which the data was copied
+ * @param prep Preparation state; its memory is freed.
+ */
+void TSRawEndBayerPreparation(libraw_data_t *libRaw, TSRawBayerPreparation *prep) {
+	C.data_maximum = prep->dataMaximum & 0xffff;
+	
+	free(prep->pattern);
+	prep->pattern = NULL;
 }
 
 #pragma mark - Post-interpolation
@@ -366,24 +594,77 @@ void TSRawPostInterpolationMixGreen(libraw_data_t *libRaw, uint16_t (*image)[4])
 	}
 }
 
+/**
+ * Sorts two values, such that a <= b.
+ */
+#define MED_SORT(a, b) { int32_t tmp = MIN(a, b); b = MAX(a, b); a = tmp; }
+
+/**
+ * Filters a single row: finds the median of the (colour - green) differences
+ * in the 3x3 block around each pixel, and adds the pixel's green value back
+ * to it. The pixels are independent of one another, and the median is found
+ * with a network of min/max operations, so the loop is vectorized.
+ *
+ * @param above Differences for the row above, starting at the first pixel.
+ * @param mid Differences for the row being filtered.
+ * @param below Differences for the row below.
+ * @param pix First pixel of the row in the image.
+ * @param c Colour component to write.
+ * @param count Number of pixels to filter; pixels [1, count] are written.
+ */
+static inline void TSRawMedianFilterRow(const int32_t *above, const int32_t *mid, const int32_t *below, uint16_t (*pix)[4], int c, size_t count) {
+#if defined(__clang__)
+#pragma clang loop vectorize(enable)
+#endif
+	for(size_t i = 1; i <= count; i++) {
+		int32_t p0 = above[i-1], p1 = above[i], p2 = above[i+1];
+		int32_t p3 = mid[i-1], p4 = mid[i], p5 = mid[i+1];
+		int32_t p6 = below[i-1], p7 = below[i], p8 = below[i+1];
+		
+		// optimal 9-element median search
+		MED_SORT(p1, p2); MED_SORT(p4, p5); MED_SORT(p7, p8);
+		MED_SORT(p0, p1); MED_SORT(p3, p4); MED_SORT(p6, p7);
+		MED_SORT(p1, p2); MED_SORT(p4, p5); MED_SORT(p7, p8);
+		MED_SORT(p0, p3); MED_SORT(p5, p8); MED_SORT(p4, p7);
+		MED_SORT(p3, p6); MED_SORT(p1, p4); MED_SORT(p2, p5);
+		MED_SORT(p4, p7); MED_SORT(p4, p2); MED_SORT(p6, p4);
+		MED_SORT(p4, p2);
+		
+		int32_t val = p4 + pix[i][1];
+		pix[i][c] = CLIP(val);
+	}
+}
+
 /**
  * Performs a median filter on the image to remove any anomalies.
  *
+ * Each pass filters the red and blue channels. The differences between each
+ * channel and green are calculated for the entire image first; rows are then
+ * filtered in parallel, since they only read from the differences.
+ *
+ * @note Unlike LibRaw's median_filter(), the fourth component of the image is
+ * not used as scratch space, and is left untouched.
+ *
  * @param libRaw LibRaw instance from which to acquire some image info
  * @param image Image buffer
  * @param med_passes How many passes of the median filter to go through.
  */
 void TSRawPostInterpolationMedianFilter(libraw_data_t *libRaw, uint16_t (*image)[4], int med_passes) {
-	ushort (*pix)[4];
-	int pass, c, i, j, k, med[9];
+	int pass, c;
 	
 	// get some data from the struct
-	ushort width = libRaw->sizes.width;
-	ushort height = libRaw->sizes.height;
+	const size_t width = libRaw->sizes.width;
+	const size_t height = libRaw->sizes.height;
+	
+	if(width < 3 || height < 3) {
+		return;
+	}
 	
-	static const uchar opt[] =	/* Optimal 9-element median search */
-	{ 1,2, 4,5, 7,8, 0,1, 3,4, 6,7, 1,2, 4,5, 7,8,
-		0,3, 5,8, 4,7, 3,6, 1,4, 2,5, 4,7, 4,2, 6,4, 4,2 };
+	// differences between the channel being filtered and green
+	int32_t *diff = (int32_t *) valloc(width * height * sizeof(int32_t));
+	
+	const size_t numBands = (height + MEDIAN_BAND_ROWS - 1) / MEDIAN_BAND_ROWS;
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
 	
 	for (pass=1; pass <= med_passes; pass++) {
 #if PRINT_DEBUG_INFO
@@ -391,27 +672,109 @@ void TSRawPostInterpolationMedianFilter(libraw_data_t *libRaw, uint16_t (*image)
 #endif
 		
 		for (c = 0; c < 3; c += 2) {
-			for (pix = image; pix < image+width*height; pix++)
-				pix[0][3] = pix[0][c];
-			for (pix = image+width; pix < image+width*(height-1); pix++) {
-				if ((pix-image+1) % width < 2) continue;
-				for (k=0, i = -width; i <= width; i += width)
-					for (j = i-1; j <= i+1; j++)
-						med[k++] = pix[j][3] - pix[j][1];
-				for (i=0; i < sizeof opt; i+=2)
-					if     (med[opt[i]] > med[opt[i+1]])
-						SWAP (med[opt[i]] , med[opt[i+1]]);
-				pix[0][c] = CLIP(med[4] + pix[0][1]);
-			}
+			const int comp = c;
+			
+			// calculate differences
+			dispatch_apply(numBands, q, ^(size_t band) {
+				size_t rowStart = band * MEDIAN_BAND_ROWS;
+				size_t rowEnd = MIN(rowStart + MEDIAN_BAND_ROWS, height);
+				
+				for(size_t i = (rowStart * width); i < (rowEnd * width); i++) {
+					diff[i] = (int32_t) image[i][comp] - (int32_t) image[i][1];
+				}
+			});
+			
+			// filter all rows, except for the first and last
+			dispatch_apply(numBands, q, ^(size_t band) {
+				size_t rowStart = MAX(1, band * MEDIAN_BAND_ROWS);
+				size_t rowEnd = MIN((band + 1) * MEDIAN_BAND_ROWS, height - 1);
+				
+				for(size_t row = rowStart; row < rowEnd; row++) {
+					const int32_t *mid = diff + (row * width);
+					
+					TSRawMedianFilterRow(mid - width, mid, mid + width, image + (row * width), comp, width - 2);
+				}
+			});
 		}
 		
 #if PRINT_DEBUG_INFO
 		DDLogDebug(@"Completed median filter pass %i", pass);
 #endif
 	}
+	
+	free(diff);
 }
 
 #pragma mark - Output
+/**
+ * Converts a row of pixels to the output colour space, in place. The result
+ * for each component is clipped, and truncated to an integer.
+ *
+ * The sums are accumulated in the same order, and with the same statements,
+ * as with an arbitrary number of colours. Floating point contraction only
+ * fuses a multiply and an add within a single statement, so it affects both
+ * loops in the same way, and the specialised three colour loop gives identical
+ * results, but can be vectorized.
+ *
+ * @param pix First pixel of the row
+ * @param count Number of pixels in the row
+ * @param matrix Conversion matrix; 3 rows, one column per colour.
+ * @param colors Number of colours in the image
+ */
+static inline void TSRawConvertRowToRGB(uint16_t (*pix)[4], size_t count, float (*matrix)[4], int colors) {
+	size_t col;
+	int c;
+	
+	if(colors == 3) {
+		const float m00 = matrix[0][0], m01 = matrix[0][1], m02 = matrix[0][2];
+		const float m10 = matrix[1][0], m11 = matrix[1][1], m12 = matrix[1][2];
+		const float m20 = matrix[2][0], m21 = matrix[2][1], m22 = matrix[2][2];
+
+#if defined(__clang__)
+#pragma clang loop vectorize(enable)
+#endif
+		for(col = 0; col < count; col++) {
+			const float r = pix[col][0], g = pix[col][1], b = pix[col][2];
+			float out0, out1, out2;
+			
+			// the same multiply-adds as the generic loop: with contraction
+			// enabled, each += may become a fused multiply-add in both loops
+			// alike; the first product is rounded the same either way
+			out0 = m00 * r;
+			out0 += m01 * g;
+			out0 += m02 * b;
+			
+			out1 = m10 * r;
+			out1 += m11 * g;
+			out1 += m12 * b;
+			
+			out2 = m20 * r;
+			out2 += m21 * g;
+			out2 += m22 * b;
+			
+			pix[col][0] = CLIP((int) out0);
+			pix[col][1] = CLIP((int) out1);
+			pix[col][2] = CLIP((int) out2);
+		}
+	} else {
+		float out[3];
+		
+		for(col = 0; col < count; col++) {
+			out[0] = out[1] = out[2] = 0;
+			
+			for(c = 0; c < colors; c++) {
+				out[0] += matrix[0][c] * pix[col][c];
+				out[1] += matrix[1][c] * pix[col][c];
+				out[2] += matrix[2][c] * pix[col][c];
+			}
+			
+			for(c = 0; c < 3; c++) {
+				pix[col][c] = CLIP((int) out[c]);
+			}
+		}
+	}
+}
+
 /**
  * Converts the output data to RGB format. This should be run after
  * interpolation.
@@ -419,52 +782,84 @@ void TSRawPostInterpolationMedianFilter(libraw_data_t *libRaw, uint16_t (*image)
  * @param libRaw LibRaw instance from which to acquire some image info
  * @param image Image buffer (after interpolation)
  * @param outBuf Output data buffer
+ * @param width Width of the interpolated image; this is the output size of
+ * the demosaic engine, which may be smaller than the sizes in libRaw.
+ * @param height Height of the interpolated image
  * @param histogram Pointer to the histogram to be created. Has 0x2000 bins,
  * times four for four possible colours.
- * @param gammaCurve Gamma curve buffer
+ * @param gammaCurveOut If not NULL, the gamma curve that was applied (0x10000
+ * entries) is copied here; this is intended for debugging.
  */
-void TSRawConvertToRGB(libraw_data_t *libRaw, uint16_t (*image)[4], uint16_t (*outBuf)[3], int *histogram, uint16_t *gammaCurve) {
-	size_t i, j, k;
-	size_t row, col, c;
+void TSRawConvertToRGB(libraw_data_t *libRaw, uint16_t (*image)[4], uint16_t (*outBuf)[3], size_t width, size_t height, int *histogram, uint16_t *gammaCurveOut) {
+	size_t i;
 	uint16_t *img;
 	uint16_t *outPtr;
 	
-	// fill the gamma array
-	double gamm[6];
+	// convert to the output colour space, and build the histogram
+	TSRawRGBConversion conv;
+	TSRawBeginRGBConversion(libRaw, &conv);
 	
-	// sRGB gamma
-//	gamm[0] = (1.f / 2.2f);
-//	gamm[1] = 12.92;
-	// Adobe RGB gamma
-//	gamm[0] = (1.f / 2.2f);
-//	gamm[1] = 0.f;
-	// ProPhoto gamma
-	gamm[0] = (1.f / 1.8f);
-	gamm[1] = 0.f;
+	memset(histogram, 0, sizeof(int) * 0x2000 * 4);
+	TSRawConvertRowsToRGB(&conv, image, NULL, width, height, histogram);
 	
-	TSBuildGammaCurve(gamm[0], gamm[1], 0, 0, gammaCurve, gamm);
+	// combine the gamma curve and output curve into a single lookup table
+	uint16_t *lut = TSRawCreateOutputCurve(libRaw, histogram, (width * height), gammaCurveOut);
 	
-#if PRINT_DEBUG_INFO
-	printf("gamm: \n");
-	for(int i = 0; i < 6; i++) {
-		printf("%5.5f ", gamm[i]);
-	}
-	printf("\n");
+	// do gamma correction
+	const size_t numBands = (height + CONVERT_BAND_ROWS - 1) / CONVERT_BAND_ROWS;
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
 	
-	printf("gamm (output): \n");
-	for(int i = 0; i < 6; i++) {
-		printf("%5.5f ", libRaw->params.gamm[i]);
+	if((void *) outBuf == (void *) image) {
+		/*
+		 * When converting in place, the output of a band overlaps the input of
+		 * the bands before it, so the curve is applied in place in parallel,
+		 * and the pixels are then packed to three components serially.
+		 */
+		dispatch_apply(numBands, q, ^(size_t band) {
+			size_t rowStart = band * CONVERT_BAND_ROWS;
+			size_t rowEnd = MIN(rowStart + CONVERT_BAND_ROWS, height);
+			
+			for(size_t idx = (rowStart * width); idx < (rowEnd * width); idx++) {
+				image[idx][0] = lut[image[idx][0]];
+				image[idx][1] = lut[image[idx][1]];
+				image[idx][2] = lut[image[idx][2]];
+			}
+		});
+		
+		img = image[0];
+		outPtr = outBuf[0];
+		
+		for(i = 0; i < (width * height); i++, img += 4, outPtr += 3) {
+			outPtr[0] = img[0];
+			outPtr[1] = img[1];
+			outPtr[2] = img[2];
+		}
+	} else {
+		dispatch_apply(numBands, q, ^(size_t band) {
+			size_t rowStart = band * CONVERT_BAND_ROWS;
+			size_t rowEnd = MIN(rowStart + CONVERT_BAND_ROWS, height);
+			
+			for(size_t idx = (rowStart * width); idx < (rowEnd * width); idx++) {
+				outBuf[idx][0] = lut[image[idx][0]];
+				outBuf[idx][1] = lut[image[idx][1]];
+				outBuf[idx][2] = lut[image[idx][2]];
+			}
+		});
 	}
-	printf("\n");
-#endif
-	
-	// get some data from the struct
-	ushort width = libRaw->sizes.width;
-	ushort height = libRaw->sizes.height;
-	
-	// build the camera output profile
-	float out[3], out_cam[3][4];
 	
+	free(lut);
+}
+
+/**
+ * Begins converting to RGB in several steps, by calculating the matrix that
+ * converts from the camera's colour space to the output colour space.
+ *
+ * @param libRaw LibRaw instance from which to acquire some image info
+ * @param conv Conversion state to fill in
+ */
+void TSRawBeginRGBConversion(libraw_data_t *libRaw, TSRawRGBConversion *conv) {
+	size_t i, j, k;
+
 #if PRINT_DEBUG_INFO
 	// print gamma curves
 	printf("cam_xyz: \n");
@@ -487,51 +882,151 @@ void TSRawConvertToRGB(libraw_data_t *libRaw, uint16_t (*image)[4], uint16_t (*o
 #endif
 	
 	// calculate the output camera matrix
-	memcpy(out_cam, libRaw->color.rgb_cam, sizeof out_cam);
+	memcpy(conv->matrix, libRaw->color.rgb_cam, sizeof conv->matrix);
 	
 	for(i = 0; i < 3; i++) {
 		for(j = 0; j < libRaw->idata.colors; j++) {
-			for(out_cam[i][j] = k = 0; k < 3; k++) {
-				out_cam[i][j] += prophoto_rgb[i][k] * libRaw->color.rgb_cam[k][j];
+			for(conv->matrix[i][j] = k = 0; k < 3; k++) {
+				conv->matrix[i][j] += prophoto_rgb[i][k] * libRaw->color.rgb_cam[k][j];
 			}
 		}
 	}
 	
-	// Set up for conversion to RGB
-	img = image[0];
-	
+	conv->colors = libRaw->idata.colors;
+
 #if PRINT_DEBUG_INFO
 	DDLogVerbose(@"Colours: %i", libRaw->idata.colors);
 #endif
+}
+
+/**
+ * Converts the given rows to the output colour space, in place, and adds them
+ * to the histogram. Each worker builds its own histogram, which are merged
+ * once all bands are done.
+ *
+ * @param conv Conversion state
+ * @param image First pixel of the rows to convert
+ * @param outBuf If not NULL, the first three components of each converted
+ * pixel are also copied here.
+ * @param width Number of pixels in each row
+ * @param numRows Number of rows to convert
+ * @param histogram Histogram to which the converted pixels are added; it has
+ * 0x2000 bins for each of four colours.
+ */
+void TSRawConvertRowsToRGB(const TSRawRGBConversion *conv, uint16_t (*image)[4], uint16_t (*outBuf)[3], size_t width, size_t numRows, int *histogram) {
+	size_t i;
 	
-	memset(histogram, 0, sizeof(int) * 0x2000 * 4);
+	// figure out how many workers to use; each has its own histogram
+	const int colors = conv->colors;
+	const size_t numBands = (numRows + CONVERT_BAND_ROWS - 1) / CONVERT_BAND_ROWS;
 	
-	for(row = 0; row < height; row++) {
-		for(col = 0; col < width; col++, img += 4) {
-			// perform conversion
-			out[0] = out[1] = out[2] = 0;
-			
-			for(c = 0; c < libRaw->idata.colors; c++) {
-				out[0] += out_cam[0][c] * img[c];
-				out[1] += out_cam[1][c] * img[c];
-				out[2] += out_cam[2][c] * img[c];
-			}
-			
-			// write it back into the image buffer, as an integer value
-			for(c = 0; c < 3; c++) {
-				img[c] = CLIP((int) out[c]);
-			}
+	long numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	numWorkers = LIM(numWorkers, 1, (long) MAX(numBands, 1));
+	
+	int *histograms = (int *) calloc(numWorkers * 4 * 0x2000, sizeof(int));
+	
+	// convert to the output colour space, in bands of rows
+	atomic_size_t nextBand = 0;
+	atomic_size_t *nextBandPtr = &nextBand;
+	
+	float (*matrix)[4] = (float (*)[4]) conv->matrix;
+	
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(numWorkers, q, ^(size_t worker) {
+		int *histo = histograms + (worker * 4 * 0x2000);
+		size_t band;
+		
+		while((band = atomic_fetch_add(nextBandPtr, 1)) < numBands) {
+			size_t rowStart = band * CONVERT_BAND_ROWS;
+			size_t rowEnd = MIN(rowStart + CONVERT_BAND_ROWS, numRows);
 			
-			// update histogram
-			for(c = 0; c < libRaw->idata.colors; c++) {
-				histogram[(c * 0x2000) + (img[c] >> 3)]++;
+			for(size_t row = rowStart; row < rowEnd; row++) {
+				uint16_t (*pix)[4] = image + (row * width);
+				
+				TSRawConvertRowToRGB(pix, width, matrix, colors);
+				
+				// update histogram
+				for(size_t col = 0; col < width; col++) {
+					for(int c = 0; c < colors; c++) {
+						histo[(c * 0x2000) + (pix[col][c] >> 3)]++;
+					}
+				}
+				
+				// pack the pixels, while they're still in cache
+				if(outBuf) {
+					uint16_t (*out)[3] = outBuf + (row * width);
+					
+					for(size_t col = 0; col < width; col++) {
+						out[col][0] = pix[col][0];
+						out[col][1] = pix[col][1];
+						out[col][2] = pix[col][2];
+					}
+				}
 			}
 		}
+	});
+	
+	// merge the histograms of all workers
+	for(long worker = 0; worker < numWorkers; worker++) {
+		int *histo = histograms + (worker * 4 * 0x2000);
+		
+		for(i = 0; i < (0x2000 * 4); i++) {
+			histogram[i] += histo[i];
+		}
 	}
 	
+	free(histograms);
+}
+
+/**
+ * Builds the lookup table that applies the gamma curve, followed by the
+ * image's output curve. The white point of the gamma curve is taken from the
+ * histogram, so it must cover the entire image.
+ *
+ * @param libRaw LibRaw instance from which to acquire some image info
+ * @param histogram Histogram of the image, after converting to RGB
+ * @param numPixels Number of pixels in the image the histogram covers
+ * @param gammaCurveOut If not NULL, the gamma curve (0x10000 entries) is
+ * copied here; this is intended for debugging.
+ *
+ * @return Lookup table with 0x10000 entries; the caller must free it.
+ */
+uint16_t *TSRawCreateOutputCurve(libraw_data_t *libRaw, const int *histogram, size_t numPixels, uint16_t *gammaCurveOut) {
+	size_t i, c;
+	
+	// fill the gamma array
+	double gamm[6];
+	
+	// sRGB gamma
+//	gamm[0] = (1.f / 2.2f);
+//	gamm[1] = 12.92;
+	// Adobe RGB gamma
+//	gamm[0] = (1.f / 2.2f);
+//	gamm[1] = 0.f;
+	// ProPhoto gamma
+	gamm[0] = (1.f / 1.8f);
+	gamm[1] = 0.f;
+	
+	TSBuildGammaCurve(gamm[0], gamm[1], 0, 0, NULL, gamm);
+
+#if PRINT_DEBUG_INFO
+	printf("gamm: \n");
+	for(int i = 0; i < 6; i++) {
+		printf("%5.5f ", gamm[i]);
+	}
+	printf("\n");
+	
+	printf("gamm (output): \n");
+	for(int i = 0; i < 6; i++) {
+		printf("%5.5f ", libRaw->params.gamm[i]);
+	}
+	printf("\n");
+#endif
+	
 	// calculate gamma curve based off histogram? idk
 	int perc, val, total, t_white = 0x2000;
-	perc = S.width * S.height;
+	perc = (int) numPixels;
 	
 	for (t_white = c = 0; c < libRaw->idata.colors; c++) {
 		for (val = 0x2000, total = 0; --val > 32;) {
@@ -543,21 +1038,60 @@ void TSRawConvertToRGB(libraw_data_t *libRaw, uint16_t (*image)[4], uint16_t (*o
 #if PRINT_DEBUG_INFO
 	DDLogDebug(@"t_white = 0x%08x", t_white);
 #endif
-	TSBuildGammaCurve(gamm[0], gamm[1], 2, (t_white << 3), gammaCurve, gamm);
+	NS_VALID_UNTIL_END_OF_SCOPE TSRawLUT *gammaLUT = TSGetGammaCurve(gamm[0], gamm[1], 2, (t_white << 3));
+	const uint16_t *gammaCurve = (const uint16_t *) gammaLUT.table;
 	
-	// do gamma correction
-	img = image[0];
-	outPtr = outBuf[0];
+	if(gammaCurveOut) {
+		memcpy(gammaCurveOut, gammaCurve, 0x10000 * sizeof(uint16_t));
+	}
 	
-	for(row = 0; row < height; row++) {
-		for(col = 0; col < width; col++, img += 4, outPtr += 3) {
-			for(c = 0; c < 3; c++) {
-				// apply curve
-				outPtr[c] = libRaw->color.curve[gammaCurve[img[c]]];
-				//				outPtr[c] = libRaw->color.curve[img[c]];
-			}
-		}
+	// combine the gamma curve and output curve into a single lookup table
+	uint16_t *lut = (uint16_t *) malloc(0x10000 * sizeof(uint16_t));
+	
+	for(i = 0; i < 0x10000; i++) {
+		lut[i] = libRaw->color.curve[gammaCurve[i]];
 	}
+	
+	return lut;
+}
+
+/**
+ * Applies the given lookup table to each component of the RGB data, in
+ * place; bands of rows are processed on all cores.
+ *
+ * @param curve Lookup table with 0x10000 entries
+ * @param image Three component image to modify
+ * @param width Width of the image, in pixels
+ * @param height Height of the image, in pixels
+ */
+void TSRawApplyOutputCurve(const uint16_t *curve, uint16_t (*image)[3], size_t width, size_t height) {
+	const size_t numBands = (height + CONVERT_BAND_ROWS - 1) / CONVERT_BAND_ROWS;
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(numBands, q, ^(size_t band) {
+		size_t rowStart = band * CONVERT_BAND_ROWS;
+		size_t rowEnd = MIN(rowStart + CONVERT_BAND_ROWS, height);
+		
+		for(size_t idx = (rowStart * width); idx < (rowEnd * width); idx++) {
+			image[idx][0] = curve[image[idx][0]];
+			image[idx][1] = curve[image[idx][1]];
+			image[idx][2] = curve[image[idx][2]];
+		}
+	});
+}
+
+/**
+ * Returns the gamma curve for the given parameters from the LUT cache,
+ * building it if needed.
+ */
+static TSRawLUT *TSGetGammaCurve(double pwr, double ts, int mode, int imax) {
+	// %a prints the exact value of the doubles
+	NSString *key = [NSString stringWithFormat:@"gamma:%a:%a:%i:%i", pwr, ts, mode, imax];
+	
+	return [[TSRawLUTCache sharedInstance] tableForKey:key size:(0x10000 * sizeof(uint16_t)) builder:^(void *table) {
+		double gamm[6];
+		TSBuildGammaCurve(pwr, ts, mode, imax, (uint16_t *) table, gamm);
+	}];
 }
 
 /**
@@ -618,54 +1152,3 @@ static void TSBuildGammaCurve(double pwr, double ts, int mode, int imax, uint16_
 								  : (r < g[2] ? r/g[1] : (g[0] ? pow((r+g[4])/(1+g[4]),1/g[0]) : exp((r-1)/g[2]))));
 	}
 }
-
-#pragma mark - Lens Correction Helpers
-/**
- * Uses bilinear interpolation to interpolate the value of a single component at
- * a fractional coordinate. The component is assumed to be at position 0 of the
- * input pointer.
- *
- * @param buffer Input buffer on which to interpolate.
- * @param stride Number of elements (for example, width * 3) per row.
- * @param x Floating point X coordinate
- * @param y Floating point Y coordinate
- *
- * @return The value of the component, as interpolated.
- */
-uint16_t TSInterpolatePixelBilinear(uint16_t *buffer, size_t stride, float x, float y) {
-	DDCAssert(buffer != nil, @"input buffer may not be nil");
-	DDCAssert(stride != 0, @"stride may not be 0");
-	
-	// Calculate the integer coordinate of the given pixel.
-	const unsigned int compsPerPixel = 4;
-	
-	unsigned int px = (unsigned int) x;
-	unsigned int py = (unsigned int) y;
-	
-	// Get a pointer into the buffer at the given integer coordinate
-	const uint16_t* p0 = buffer + (px * compsPerPixel) + (py * stride);
-	
-	/*
-	 * Sample the input buffer. This samples it rectangularly four times, with
-	 * the original coordinate's floor being the top left corner of this rect.
-	 */
-	const uint16_t p1 = p0[0			 + (0 * stride)];
-	const uint16_t p2 = p0[compsPerPixel + (0 * stride)];
-	const uint16_t p3 = p0[0			 + (1 * stride)];
-	const uint16_t p4 = p0[compsPerPixel + (1 * stride)];
-	
-	// Calculate wposition of the four samples
-	float fx = x - px;
-	float fy = y - py;
-	float fx1 = 1.0f - fx;
-	float fy1 = 1.0f - fy;
-	
-	// From the positions, calculate weights for each pixel
-	int w1 = fx1 * fy1 * 65536.0f;
-	int w2 = fx  * fy1 * 65536.0f;
-	int w3 = fx1 * fy  * 65536.0f;
-	int w4 = fx  * fy  * 65536.0f;
-	
-	// Calculate the output pixel value
-	return (p1 * w1 + p2 * w2 + p3 * w3 + p4 * w4) >> 16;
-}
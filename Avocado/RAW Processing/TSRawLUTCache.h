@@ -0,0 +1,61 @@
+//
+//  TSRawLUTCache.h
+//  Avocado
+//
+//	A process-wide cache of lookup tables (such as gamma curves) used by the
+//	RAW pipeline. Tables are built once for a given set of parameters, and
+//	are then shared, read-only, between all pipeline runs; when processing a
+//	batch of images from the same camera, most tables will be identical.
+//
+//  Created by Tristan Seifert on 20160728.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * A single, immutable lookup table. The table's memory stays valid for as long
+ * as a reference to this object is held, even if the cache evicts it; when
+ * using the table pointer directly, declare the variable holding the object
+ * with NS_VALID_UNTIL_END_OF_SCOPE.
+ */
+@interface TSRawLUT : NSObject
+
+/// pointer to the table's data; this may not be modified.
+@property (nonatomic, readonly) const void *table;
+/// size of the table, in bytes
+@property (nonatomic, readonly) size_t size;
+
+@end
+
+/**
+ * Block used to build a table; it's passed a zeroed buffer of the requested
+ * size, which it should fill in.
+ */
+typedef void (^TSRawLUTBuilder)(void *table);
+
+@interface TSRawLUTCache : NSObject
+
++ (instancetype) sharedInstance;
+
+/**
+ * Returns the table for the given key. If it is not in the cache, it's built
+ * with the given block, and added to the cache.
+ *
+ * This is safe to call from any thread. If two threads request the same table
+ * at the same time, it may be built twice, but both get an identical table.
+ *
+ * @param key Uniquely identifies the table; it should contain every parameter
+ * that the table's contents depend on.
+ * @param size Size of the table, in bytes
+ * @param builder Block invoked to fill in the table, if needed
+ */
+- (TSRawLUT *) tableForKey:(NSString *) key size:(size_t) size builder:(TSRawLUTBuilder) builder;
+
+/**
+ * Removes all tables from the cache. Tables that are still referenced stay
+ * valid.
+ */
+- (void) removeAllTables;
+
+@end
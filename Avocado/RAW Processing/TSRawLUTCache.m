@@ -0,0 +1,109 @@
+//
+//  TSRawLUTCache.m
+//  Avocado
+//
+//  Created by Tristan Seifert on 20160728.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import "TSRawLUTCache.h"
+
+/// maximum number of tables to keep in the cache
+static const NSUInteger TSRawLUTCacheMaxTables = 64;
+
+static TSRawLUTCache *sharedInstance = nil;
+
+@interface TSRawLUT ()
+
+@property (nonatomic) const void *table;
+@property (nonatomic) size_t size;
+
+- (instancetype) initWithSize:(size_t) size builder:(TSRawLUTBuilder) builder;
+
+@end
+
+@interface TSRawLUTCache ()
+
+/// backing store of tables; NSCache is thread safe, and evicts by itself.
+@property (nonatomic) NSCache<NSString *, TSRawLUT *> *tables;
+
+@end
+
+@implementation TSRawLUT
+
+/**
+ * Allocates the table, and builds it with the given block.
+ */
+- (instancetype) initWithSize:(size_t) size builder:(TSRawLUTBuilder) builder {
+	if(self = [super init]) {
+		void *table = calloc(1, size);
+		builder(table);
+		
+		self.table = table;
+		self.size = size;
+	}
+	
+	return self;
+}
+
+/**
+ * Releases the table's memory.
+ */
+- (void) dealloc {
+	free((void *) self.table);
+}
+
+@end
+
+@implementation TSRawLUTCache
+
+#pragma mark Initialization
+/**
+ * Returns the singleton instance, creating it if necessary.
+ */
++ (instancetype) sharedInstance {
+	static dispatch_once_t onceToken;
+	dispatch_once(&onceToken, ^{
+		sharedInstance = [TSRawLUTCache new];
+	});
+	
+	return sharedInstance;
+}
+
+/**
+ * Sets up the backing cache.
+ */
+- (instancetype) init {
+	if(self = [super init]) {
+		self.tables = [NSCache new];
+		self.tables.name = @"TSRawLUTCache";
+		self.tables.countLimit = TSRawLUTCacheMaxTables;
+	}
+	
+	return self;
+}
+
+#pragma mark Lookup
+/**
+ * Returns the table for the given key. If it is not in the cache, it's built
+ * with the given block, and added to the cache.
+ */
+- (TSRawLUT *) tableForKey:(NSString *) key size:(size_t) size builder:(TSRawLUTBuilder) builder {
+	TSRawLUT *lut = [self.tables objectForKey:key];
+	
+	if(lut == nil || lut.size != size) {
+		lut = [[TSRawLUT alloc] initWithSize:size builder:builder];
+		[self.tables setObject:lut forKey:key cost:size];
+	}
+	
+	return lut;
+}
+
+/**
+ * Removes all tables from the cache.
+ */
+- (void) removeAllTables {
+	[self.tables removeAllObjects];
+}
+
+@end
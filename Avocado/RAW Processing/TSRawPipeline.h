@@ -43,6 +43,12 @@
  *
  * The output of stage 5 is cached.
  *
+ * Stages 2, 4 and 5 can also be streamed: they then run on one horizontal
+ * strip of the image at a time, so the memory they need is proportional to
+ * the height of a strip, rather than that of the image. Lens corrections can
+ * move pixels between strips, so images with lens corrections are always
+ * processed in full.
+ *
  * Pipeline plugins can chose to process data at any major numbered
  * position in the pipeline. They are called _before_ the built-in pipeline
  * step.
@@ -116,6 +122,30 @@ typedef NS_ENUM(NSUInteger, TSRawPipelineIntent) {
 	TSRawPipelineIntentOutput
 };
 
+/**
+ * Determines how the stages up to the conversion to planar floating point
+ * process the image. The output is the same in all modes.
+ */
+typedef NS_ENUM(NSUInteger, TSRawPipelineExecutionMode) {
+	/**
+	 * Streams images that are large enough for their full frame buffers to
+	 * take up a considerable amount of memory; smaller images are processed
+	 * in full.
+	 */
+	TSRawPipelineExecutionModeAutomatic,
+	
+	/**
+	 * Each stage processes the entire image before the next one starts.
+	 */
+	TSRawPipelineExecutionModeFullFrame,
+	
+	/**
+	 * The stages are run on one strip of the image at a time, unless lens
+	 * corrections are applied.
+	 */
+	TSRawPipelineExecutionModeStreaming
+};
+
 /**
  * An enumeration declaring the current stage in the processing pipeline. As
  * some steps may have sub-steps that each can take a considerable amount of
@@ -124,6 +154,7 @@ typedef NS_ENUM(NSUInteger, TSRawPipelineIntent) {
  */
 typedef NS_ENUM(NSUInteger, TSRawPipelineStage) {
 	TSRawPipelineStageInitializing			= 0,
+	TSRawPipelineStageEmbeddedPreview		= 1,
 	
 	TSRawPipelineStageDebayering			= (1 << 16),
 	
@@ -171,10 +202,43 @@ typedef void (^TSRawPipelineCompletionCallback)(NSImage * _Nullable, NSError * _
  */
 typedef void (^TSRawPipelineProgressCallback)(TSRawPipelineStage);
 
+/**
+ * Callback to be executed with a preview of the image, while the full quality
+ * image is still being processed.
+ */
+typedef void (^TSRawPipelinePreviewCallback)(NSImage * _Nonnull);
+
 
-@class TSRawImage, TSLibraryImage;
+@class TSRawImage, TSLibraryImage, TSRawPipelineTelemetry;
 @interface TSRawPipeline : NSObject
 
+/**
+ * Returns the number of jobs processed at once by pipelines created with
+ * -init; it depends on the number of cores and the amount of memory.
+ */
++ (NSUInteger) defaultMaxConcurrentJobs;
+
+/**
+ * Initializes a pipeline that processes up to the given number of images at
+ * once. Each job checks out its own converter and buffers from a pool owned
+ * by the pipeline; jobs beyond the limit wait, without holding any buffers,
+ * until an earlier one finishes. Jobs on the same image are always processed
+ * in the order they were queued.
+ */
+- (nonnull instancetype) initWithMaxConcurrentJobs:(NSUInteger) jobs;
+
+/// maximum number of jobs that are processed at once
+@property (nonatomic, readonly) NSUInteger maxConcurrentJobs;
+
+/// how jobs queued from now on are processed; automatic by default
+@property (nonatomic) TSRawPipelineExecutionMode executionMode;
+
+/**
+ * Performance metrics of recently finished jobs, and aggregates of each stage
+ * over them. Jobs that were cancelled, or failed, are not included.
+ */
+@property (nonatomic, readonly, nonnull) TSRawPipelineTelemetry *telemetry;
+
 /**
  * Queues the given library image (must be a RAW file) onto the processing
  * queue, with the given callback.
@@ -185,7 +249,9 @@ typedef void (^TSRawPipelineProgressCallback)(TSRawPipelineStage);
  * @param cache When set, intermediate results of the RAW processing are
  * stored at various steps, so that later adjustments need not cause
  * everything to be recomputed. This should only be used if the user is
- * in the interactive editing mode for that particular image.
+ * in the interactive editing mode for that particular image. If the intent's
+ * output is smaller than the image, the image is delivered at that size
+ * first, and the cache is filled by a separate job at background priority.
  *
  * @param inhibitCacheResume Prevents the pipeline to resume the processing with
  * cached data; instead, it will restart with the RAW file. This can be handy
@@ -205,11 +271,37 @@ typedef void (^TSRawPipelineProgressCallback)(TSRawPipelineStage);
  * necessary to copy the image to the CPU, in which case an NSImage will be
  * produced.
  *
+ * @param previewCallback This optional callback is invoked with a quick, low
+ * quality preview of the image, before the full quality image is rendered and
+ * passed to the completion callback. The preview is the one the camera
+ * embedded in the raw file, so it doesn't reflect any adjustments; it's only
+ * produced when the job starts from the raw file, rather than from cached
+ * data, and only if the file has a preview.
+ *
  * @param progressCallback This optional callback is invoked every time the
  * pipeline moves on to a later stage.
  *
  * @param outProgress Stores the address of an NSProgress object that tracks
  * the progress of the RAW processing.
+ *
+ * @note Any job on the same image that hasn't completed yet is superseded: it
+ * stops at the next stage boundary, and its completion callback is invoked
+ * with a NSUserCancelledError. Only the most recently queued state of the
+ * image is rendered.
+ */
+- (void) queueRawFile:(nonnull TSLibraryImage *) image
+		  shouldCache:(BOOL) cache
+  inhibitCachedResume:(BOOL) inhibitCacheResume
+	  renderingIntent:(TSRawPipelineIntent) intent
+		 outputFormat:(TSRawPipelineOutputFormat) outFormat
+   completionCallback:(nonnull TSRawPipelineCompletionCallback) complete
+	  previewCallback:(nullable TSRawPipelinePreviewCallback) preview
+	 progressCallback:(nullable TSRawPipelineProgressCallback) progress
+   conversionProgress:(NSProgress * _Nonnull * _Nullable) outProgress;
+
+/**
+ * Queues the given library image, like the variant with a preview callback,
+ * but without delivering a preview.
  */
 - (void) queueRawFile:(nonnull TSLibraryImage *) image
 		  shouldCache:(BOOL) cache
@@ -12,12 +12,16 @@
 #import "TSRawPipelineState.h"
 #import "TSRawCache.h"
 #import "TSLFDatabase.h"
+#import "TSLFCorrection.h"
+#import "TSLFRemapGrid.h"
+#import "TSRawLUTCache.h"
+#import "TSRawPipelineBufferPool.h"
+#import "TSRawPipelineTelemetry.h"
 
 #import "TSPixelFormatConverter.h"
 #import "TSRawImageDataHelpers.h"
-
-#import "ahd_interpolate_mod.h"
-#import "lmmse_interpolate.h"
+#import "TSRawDemosaic.h"
+#import "TSRawStreaming.h"
 
 #import "TSCoreDataStore.h"
 #import "TSHumanModels.h"
@@ -34,8 +38,8 @@
 #import <Accelerate/Accelerate.h>
 
 /**
- * When set to a non-zero value, information about the time taken for each of
- * the RAW processing steps is printed.
+ * When set to a non-zero value, the metrics of each of the RAW processing
+ * steps are also printed.
  */
 #define	TSWriteStepTiming	1
 
@@ -45,50 +49,102 @@
  */
 #define	WriteDebugData		0
 
+/**
+ * Rough upper bound on the number of bytes of buffers that a job needs for
+ * each pixel of the image, and the size of a typical image; these are used to
+ * decide how many jobs can run at once by default.
+ */
+static const NSUInteger TSRawPipelineJobBytesPerPixel = 48;
+static const NSUInteger TSRawPipelineTypicalImagePixels = (24 * 1000 * 1000);
+
+/**
+ * Images with at least this many pixels are streamed in the automatic
+ * execution mode; their full frame buffers would take up several hundred
+ * megabytes.
+ */
+static const NSUInteger TSRawPipelineStreamingThresholdPixels = (50 * 1000 * 1000);
+
 #define TSAddOperation(operation, state) \
 	[state addOperation:operation]; \
 	[self.queue addOperation:operation];
 
-#if TSWriteStepTiming
-	#define TSBeginOperation(name) \
-		time_t __tBegin = clock(); \
-		NSString *__opName = name;
+/**
+ * Skips the rest of a stage if its job was cancelled; since every stage starts
+ * with this, a superseded job stops at the next stage boundary.
+ */
+#define TSReturnIfCancelled(state) \
+	if(state.isCancelled) { \
+		return; \
+	}
+
+/**
+ * Measure a stage, and add its metrics to the job's; these expect the job's
+ * state to be in scope as `state`.
+ */
+#define TSBeginOperation(name) \
+	const TSRawPipelineSample __sBegin = TSRawPipelineSampleNow(); \
+	NSString *__opName = name;
 
+#if TSWriteStepTiming
 	#define TSEndOperation() \
-		DDLogDebug(@"Finished %@: %fs", __opName, ((double)(clock() - __tBegin)) / CLOCKS_PER_SEC);
+		DDLogDebug(@"Finished %@: %@", __opName, [state.metrics recordStage:__opName since:__sBegin]);
 #else
-	#define TSBeginOperation(name)
-	#define TSEndOperation()
+	#define TSEndOperation() \
+		[state.metrics recordStage:__opName since:__sBegin];
 #endif
 
 // TODO: Figure out a way to more better expose this from a header?
 @interface TSLibraryImage ()
 @property (nonatomic, readonly) TSRawImage *libRawHandle;
 @end
-// TODO: Figure out a better way to expose this
-@interface TSLFLens ()
-@property (nonatomic) lfLens *lens;
-@end
 
 @interface TSRawPipeline ()
 
 /// Operation queue for RAW processing; a TSRawPipelineJob is queued on it.
 @property (nonatomic) NSOperationQueue *queue;
-
-/// Pixel format converter
-@property (nonatomic) TSPixelConverterRef pixelConverter;
-
-/// Internal buffer for the temporary storage of interpolated RGB data
-@property (nonatomic) void *interpolatedColourBuf;
-/// Size (in bytes) of the interpolated colour buffer
-@property (nonatomic) size_t interpolatedColourBufSz;
+/// Maximum number of jobs that are processed at once
+@property (nonatomic, readwrite) NSUInteger maxConcurrentJobs;
+
+/// Serial queue on which jobs wait for a free slot, before being queued
+@property (nonatomic, retain) dispatch_queue_t admissionQueue;
+/// Counts the free job slots; a job holds one from checking out its buffers until it's cleaned up
+@property (nonatomic, retain) dispatch_semaphore_t jobSlots;
+/// Pool from which jobs check out their converter and buffers
+@property (nonatomic) TSRawPipelineBufferPool *bufferPool;
+/// Number of image rows in each strip of a streamed job
+@property (nonatomic) NSUInteger stripRows;
+/// Collects the metrics of finished jobs
+@property (nonatomic, readwrite) TSRawPipelineTelemetry *telemetry;
+
+/// Last operation of the most recent job for each image (uuid -> op); only accessed on the admission queue
+@property (nonatomic) NSMapTable<NSString *, NSOperation *> *lastJobOperations;
+
+/// Most recent job for each image (uuid -> state); only accessed on the job tracking queue
+@property (nonatomic) NSMapTable<NSString *, TSRawPipelineState *> *latestJobs;
+/// Serial queue used to synchronize access to the latest jobs
+@property (nonatomic, retain) dispatch_queue_t jobTrackingQueue;
+/// Pending job that fills the cache for each image (uuid -> state); only accessed on the job tracking queue
+@property (nonatomic) NSMapTable<NSString *, TSRawPipelineState *> *pendingCacheFills;
 
 /// CoreImage pipeline
 @property (nonatomic) TSCoreImagePipeline *ciPipeline;
 
+// Job Scheduling
+- (TSRawPipelineState *) stateForImage:(TSLibraryImage *) image intent:(TSRawPipelineIntent) intent;
+- (BOOL) setUpDemosaicEngineWithState:(TSRawPipelineState *) state;
+- (void) queueCacheFillForImage:(TSLibraryImage *) image intent:(TSRawPipelineIntent) intent;
+- (void) submitJobWithState:(TSRawPipelineState *) state imageSize:(NSSize) imageSize resumeFromCache:(BOOL) resume shouldCacheResults:(BOOL) cache;
+- (BOOL) shouldStreamState:(TSRawPipelineState *) state imageSize:(NSSize) imageSize;
+- (void) checkOutBuffersForState:(TSRawPipelineState *) state imageSize:(NSSize) imageSize;
+- (void) orderJobWithState:(TSRawPipelineState *) state firstOperation:(NSOperation *) first lastOperation:(NSOperation *) last;
+- (BOOL) supersedeJobsWithState:(TSRawPipelineState *) state;
+
 // Helpers
+- (NSBlockOperation *) opPrepare:(TSRawPipelineState *) state;
+- (NSBlockOperation *) opEmbeddedPreview:(TSRawPipelineState *) state;
 - (NSBlockOperation *) opDebayer:(TSRawPipelineState *) state;
 - (NSBlockOperation *) opDemosaic:(TSRawPipelineState *) state;
+- (NSBlockOperation *) opStreamToPlanar:(TSRawPipelineState *) state;
 
 - (void) setUpLensCorrectionsWithState:(TSRawPipelineState *) state;
 - (NSBlockOperation *) opLensCorrect:(TSRawPipelineState *) state;
@@ -113,6 +169,7 @@
 @property (nonatomic) TSRawCache *cache;
 
 - (void) beginFullPipelineRunWithState:(TSRawPipelineState *) state shouldCacheResults:(BOOL) cache;
+- (void) beginCacheFillWithState:(TSRawPipelineState *) state;
 - (void) resumePipelineRunWithCachedData:(TSRawPipelineState *) state shouldCacheResults:(BOOL) cache;
 
 - (void) storeFloatDataCached:(TSRawPipelineState *) state;
@@ -137,18 +194,70 @@
 
 #pragma mark - Initialization
 /**
- * Initializes the RAW pipeline.
+ * Returns the number of jobs that are processed at once by default.
+ *
+ * Most stages already spread their work over all cores, so running more jobs
+ * than half the number of cores mostly adds memory pressure. Additionally,
+ * the buffers of all jobs (for a typical image) should take no more than a
+ * quarter of the physical memory.
+ */
++ (NSUInteger) defaultMaxConcurrentJobs {
+	NSProcessInfo *info = [NSProcessInfo processInfo];
+	
+	NSUInteger byCores = info.activeProcessorCount / 2;
+	
+	unsigned long long bytesPerJob = TSRawPipelineJobBytesPerPixel * TSRawPipelineTypicalImagePixels;
+	NSUInteger byMemory = (NSUInteger) ((info.physicalMemory / 4) / bytesPerJob);
+	
+	return MAX(MIN(byCores, byMemory), 1);
+}
+
+/**
+ * Initializes the RAW pipeline, with the default number of concurrent jobs.
  */
 - (instancetype) init {
+	return [self initWithMaxConcurrentJobs:[TSRawPipeline defaultMaxConcurrentJobs]];
+}
+
+/**
+ * Initializes the RAW pipeline.
+ *
+ * @param jobs Maximum number of jobs to process at once.
+ */
+- (instancetype) initWithMaxConcurrentJobs:(NSUInteger) jobs {
 	if(self = [super init]) {
-		// Set up operation queue
+		self.maxConcurrentJobs = MAX(jobs, 1);
+		
+		// Set up operation queue; the operations of a job depend on each
+		// other, so only one of them runs at a time.
 		self.queue = [NSOperationQueue new];
 		
 		self.queue.qualityOfService = NSQualityOfServiceUserInitiated;
-		self.queue.maxConcurrentOperationCount = 1;
+		self.queue.maxConcurrentOperationCount = self.maxConcurrentJobs;
 		
 		self.queue.name = @"TSRawPipeline";
 		
+		// Set up job admission, and the pool of buffers for the jobs
+		self.admissionQueue = dispatch_queue_create("me.tseifert.Avocado.TSRawPipeline.admission", DISPATCH_QUEUE_SERIAL);
+		self.jobSlots = dispatch_semaphore_create(self.maxConcurrentJobs);
+		
+		self.bufferPool = [[TSRawPipelineBufferPool alloc] initWithMaxIdleBuffers:self.maxConcurrentJobs];
+		self.telemetry = [TSRawPipelineTelemetry new];
+		
+		// Streamed strips are tall enough for every core to get a band of rows
+		self.executionMode = TSRawPipelineExecutionModeAutomatic;
+		self.stripRows = MAX((NSUInteger) TSRawStreamDefaultStripRows, 64 * [NSProcessInfo processInfo].activeProcessorCount);
+		
+		self.lastJobOperations = [NSMapTable strongToWeakObjectsMapTable];
+		
+		// Set up tracking of the latest job for each image
+		self.latestJobs = [NSMapTable strongToWeakObjectsMapTable];
+		self.jobTrackingQueue = dispatch_queue_create("me.tseifert.Avocado.TSRawPipeline.jobs", DISPATCH_QUEUE_SERIAL);
+		
+		self.pendingCacheFills = [NSMapTable strongToWeakObjectsMapTable];
+		
+		DDLogDebug(@"Processing up to %lu RAW pipeline jobs at once", self.maxConcurrentJobs);
+		
 		// Create CoreImage pipeline
 		self.ciPipeline = [TSCoreImagePipeline new];
 		
@@ -159,16 +268,25 @@
 	return self;
 }
 
+#pragma mark Job Submission
 /**
- * Cleans up various buffers.
+ * Queues the given library image, like the variant with a preview callback,
+ * but without delivering a preview.
  */
-- (void) dealloc {
-	// Clear allocated memory
-	TSPixelConverterFree(self.pixelConverter);
-	free(self.interpolatedColourBuf);
+- (void) queueRawFile:(nonnull TSLibraryImage *) image
+		  shouldCache:(BOOL) cache
+  inhibitCachedResume:(BOOL) inhibitCacheResume
+	  renderingIntent:(TSRawPipelineIntent) intent
+		 outputFormat:(TSRawPipelineOutputFormat) outFormat
+   completionCallback:(nonnull TSRawPipelineCompletionCallback) complete
+	 progressCallback:(nullable TSRawPipelineProgressCallback) progress
+   conversionProgress:(NSProgress * _Nonnull * _Nullable) outProgress {
+	[self queueRawFile:image shouldCache:cache inhibitCachedResume:inhibitCacheResume
+	   renderingIntent:intent outputFormat:outFormat
+	completionCallback:complete previewCallback:nil progressCallback:progress
+	conversionProgress:outProgress];
 }
 
-#pragma mark Job Submission
 /**
  * Queues the given library image (must be a RAW file) onto the processing
  * queue, with the given callback.
@@ -179,7 +297,9 @@
  * @param cache When set, intermediate results of the RAW processing are
  * stored at various steps, so that later adjustments need not cause
  * everything to be recomputed. This should only be used if the user is
- * in the interactive editing mode for that particular image.
+ * in the interactive editing mode for that particular image. If the intent's
+ * output is smaller than the image, the image is delivered at that size
+ * first, and the cache is filled by a separate job at background priority.
  *
  * @param inhibitCacheResume Prevents the pipeline to resume the processing with
  * cached data; instead, it will restart with the RAW file. This can be handy
@@ -199,11 +319,23 @@
  * necessary to copy the image to the CPU, in which case an NSImage will be
  * produced.
  *
+ * @param previewCallback This optional callback is invoked with a quick, low
+ * quality preview of the image, before the full quality image is rendered and
+ * passed to the completion callback. The preview is the one the camera
+ * embedded in the raw file, so it doesn't reflect any adjustments; it's only
+ * produced when the job starts from the raw file, rather than from cached
+ * data, and only if the file has a preview.
+ *
  * @param progressCallback This optional callback is invoked every time the
  * pipeline moves on to a later stage.
  *
  * @param outProgress Stores the address of an NSProgress object that tracks
  * the progress of the RAW processing.
+ *
+ * @note Any job on the same image that hasn't completed yet is superseded: it
+ * stops at the next stage boundary, and its completion callback is invoked
+ * with a NSUserCancelledError. Only the most recently queued state of the
+ * image is rendered.
  */
 - (void) queueRawFile:(nonnull TSLibraryImage *) image
 		  shouldCache:(BOOL) cache
@@ -211,6 +343,7 @@
 	  renderingIntent:(TSRawPipelineIntent) intent
 		 outputFormat:(TSRawPipelineOutputFormat) outFormat
    completionCallback:(nonnull TSRawPipelineCompletionCallback) complete
+	  previewCallback:(nullable TSRawPipelinePreviewCallback) preview
 	 progressCallback:(nullable TSRawPipelineProgressCallback) progress
    conversionProgress:(NSProgress * _Nonnull * _Nullable) outProgress {
 	// Debugging info about the file
@@ -221,67 +354,80 @@
 	
 	// Initialize some variables
 	TSRawPipelineState *state;
+	NSSize imageSize = image.imageSize;
 	
-	// Reset RAW handle
-	if([image.libRawHandle recycle] != YES) {
-		DDLogWarn(@"Couldn't recycle raw file: this might cause issues later on, but continuing anyways.");
-	}
+	// Create the pipeline state; its buffers are checked out once it starts
+	state = [self stateForImage:image intent:intent];
 	
-	// Figure out whether we can use the existing converter
-	if(self.pixelConverter != nil) {
-		NSUInteger w, h;
-		TSPixelConverterGetSize(self.pixelConverter, &w, &h);
-		
-		// Resize if the size isn't identical
-		if(w != image.imageSize.width || h != image.imageSize.height) {
-			TSPixelConverterResize(self.pixelConverter, image.imageSize.width, image.imageSize.height);
-		}
-	} else {
-		// There is no pixel converter; create one
-		self.pixelConverter = TSPixelConverterCreate(NULL, image.imageSize.width, image.imageSize.height);
+	state.shouldCache = cache;
+	state.outFormat = outFormat;
+	
+	state.completionCallback = complete;
+	state.previewCallback = preview;
+	state.progressCallback = progress;
+	
+	// Cancel older jobs on this image; if they would have refreshed the cache,
+	// this job has to do so instead
+	if([self supersedeJobsWithState:state]) {
+		DDLogDebug(@"Superseded job would not have resumed from cache; inhibiting for %p", image);
+		inhibitCacheResume = YES;
 	}
 	
-	// Allocate the temporary buffer for interpolated colour
-	size_t newColourBufSz = (image.imageSize.width * image.imageSize.height) * 4 * sizeof(uint16_t);
+	state.inhibitCachedResume = inhibitCacheResume;
 	
-	if(self.interpolatedColourBuf != nil) {
-		// Is the buffer large enough?
-		if(self.interpolatedColourBufSz < newColourBufSz) {
-			// Free old buffer
-			free(self.interpolatedColourBuf);
-			
-			// Allocate new buffer
-			self.interpolatedColourBuf = valloc(newColourBufSz);
-			self.interpolatedColourBufSz = newColourBufSz;
-			
-			DDLogDebug(@"Re-allocated %lu bytes for interpolated colour buffer", self.interpolatedColourBufSz);
+	// Check if we can resume the processing operation
+	if(cache && [self.cache hasDataForUuid:state.imageUuid] == YES && (inhibitCacheResume == NO)) {
+		DDLogVerbose(@"Resuming RAW processing for %@ from stage 5", image.uuid);
+		
+		state.metrics.cacheResult = TSRawPipelineCacheResultHit;
+		
+		state.progress = [NSProgress progressWithTotalUnitCount:6];
+		if(outProgress) *outProgress = state.progress;
+		
+		[self submitJobWithState:state imageSize:imageSize resumeFromCache:YES shouldCacheResults:cache];
+	}
+	// No cached data (or cache resumption is inhibited) so start a full run
+	else {
+		state.progress = [NSProgress progressWithTotalUnitCount:11];
+		if(outProgress) *outProgress = state.progress;
+		
+		if(cache && inhibitCacheResume == NO) {
+			state.metrics.cacheResult = TSRawPipelineCacheResultMiss;
 		}
-	} else {
-		self.interpolatedColourBuf = valloc(newColourBufSz);
-		self.interpolatedColourBufSz = newColourBufSz;
 		
-		DDLogDebug(@"Allocated %lu bytes for interpolated colour buffer", self.interpolatedColourBufSz);
+		// Select the demosaic engine; everything after it uses its output size
+		BOOL fillCache = [self setUpDemosaicEngineWithState:state];
+		
+		// Set up for lens corrections
+		[self setUpLensCorrectionsWithState:state];
+		
+		state.streamsStrips = [self shouldStreamState:state imageSize:imageSize];
+		
+		state.metrics.demosaicEngine = @(TSRawDemosaicGetEngine(state.demosaicEngine)->name);
+		state.metrics.streamed = state.streamsStrips;
+		
+		// Begin the pipeline run
+		[self submitJobWithState:state imageSize:imageSize resumeFromCache:NO shouldCacheResults:state.shouldCache];
+		
+		// The image is delivered at the engine's reduced size first; the cache
+		// is filled afterwards, in a separate job at full size
+		if(fillCache) {
+			[self queueCacheFillForImage:image intent:intent];
+		}
 	}
-	
-	
-	// Create the pipeline state
-	state = [TSRawPipelineState new];
+}
+
+/**
+ * Creates the state for a job on the given image, and starts measuring it.
+ * The caller sets up the remaining properties of the job.
+ */
+- (TSRawPipelineState *) stateForImage:(TSLibraryImage *) image intent:(TSRawPipelineIntent) intent {
+	TSRawPipelineState *state = [TSRawPipelineState new];
 	
 	state.stage = TSRawPipelineStageInitializing;
-	state.shouldCache = cache;
-	
 	state.intent = intent;
-	state.outFormat = outFormat;
-	
-	state.converter = self.pixelConverter;
-	
-	state.completionCallback = complete;
-	state.progressCallback = progress;
-	
-	state.interpolatedColourBuf = self.interpolatedColourBuf;
 	
 	state.histogramBuf = (int *) valloc(sizeof(int) * 4 * 0x2000);
-	state.gammaCurveBuf = (uint16_t *) valloc(sizeof(uint16_t) * 0x10000);
 	
 	// Create a temporary managed object context
 	NSString *name = [NSString stringWithFormat:@"%@//%@//Image %p", [self className], self, image];
@@ -294,40 +440,300 @@
 		state.imageUuid = state.image.uuid;
 		state.rawImage = state.image.libRawHandle;
 		
-		state.outputSize = state.rawImage.size;
+		// the raw handle is shared with earlier jobs on the image, and isn't
+		// recycled until the job starts, so take the size from the library
 		state.rawSize = state.image.imageSize;
+		state.outputSize = state.rawSize;
 	}];
 	
-	// Check if we can resume the processing operation
-	if(cache && [self.cache hasDataForUuid:state.imageUuid] == YES && (inhibitCacheResume == NO)) {
-		DDLogVerbose(@"Resuming RAW processing for %@ from stage 5", image.uuid);
+	// Start measuring the job; its wall time includes waiting for a job slot
+	NSSize imageSize = image.imageSize;
+	double megapixels = (imageSize.width * imageSize.height) / 1000000.0;
+	state.metrics = [[TSRawPipelineJobMetrics alloc] initWithImageUuid:state.imageUuid megapixels:megapixels];
+	
+	return state;
+}
+
+/**
+ * Selects the demosaic engine for a job that starts from the raw file, and
+ * updates the sizes in its state to the engine's output size.
+ *
+ * Some engines output an image that is too small to be cached; a job that
+ * should cache its output then doesn't, so that its image can be delivered as
+ * quickly as the engine allows. Instead, the cache should be filled by a job
+ * of its own (with an engine that outputs a full size image) afterwards.
+ *
+ * @return Whether the cache should be filled by a separate job.
+ */
+- (BOOL) setUpDemosaicEngineWithState:(TSRawPipelineState *) state {
+	if(state.fillsCache) {
+		state.demosaicEngine = TSRawDemosaicEngineForCacheFill(state.intent);
+	} else {
+		state.demosaicEngine = TSRawDemosaicEngineForIntent(state.intent);
+	}
+	
+	NSSize demosaicSize = TSRawDemosaicGetOutputSize(state.demosaicEngine, state.rawSize);
+	
+	if(NSEqualSizes(demosaicSize, state.rawSize) == NO) {
+		state.rawSize = demosaicSize;
+		state.outputSize = TSRawDemosaicGetOutputSize(state.demosaicEngine, state.outputSize);
 		
-		state.progress = [NSProgress progressWithTotalUnitCount:6];
-		if(outProgress) *outProgress = state.progress;
+		if(state.shouldCache) {
+			state.shouldCache = NO;
+			return YES;
+		}
+	}
+	
+	return NO;
+}
+
+/**
+ * Queues a job that fills the planar cache of the given image, without
+ * producing an image. Its operations run at background priority, so they
+ * don't hold up jobs that deliver an image.
+ *
+ * Any earlier cache fill job on the image that hasn't completed is
+ * cancelled; the caller queued a new job because the image changed, so the
+ * cache is filled after that job instead. If the cache holds data for the
+ * image, it's stale (the caller's job couldn't resume from it) and is
+ * evicted, so that no job resumes from it in the meantime.
+ */
+- (void) queueCacheFillForImage:(TSLibraryImage *) image intent:(TSRawPipelineIntent) intent {
+	TSRawPipelineState *state = [self stateForImage:image intent:intent];
+	
+	state.shouldCache = YES;
+	state.fillsCache = YES;
+	
+	// Nobody waits for the job, so only report errors
+	state.completionCallback = ^(NSImage *img, NSError *err) {
+		if(err != nil && err.code != NSUserCancelledError) {
+			DDLogWarn(@"Couldn't fill the cache for %@: %@", image.uuid, err);
+		}
+	};
+	
+	// Replace the pending cache fill job, if any
+	__block TSRawPipelineState *previous = nil;
+	
+	dispatch_sync(self.jobTrackingQueue, ^{
+		previous = [self.pendingCacheFills objectForKey:state.imageUuid];
+		[self.pendingCacheFills setObject:state forKey:state.imageUuid];
+	});
+	
+	if(previous != nil && [previous cancel]) {
+		DDLogDebug(@"Superseded cache fill job %p for image %@", previous, state.imageUuid);
+	}
+	
+	if([self.cache hasDataForUuid:state.imageUuid]) {
+		[self.cache evictDataForUuid:state.imageUuid];
+	}
+	
+	// Set up the job like any other that starts from the raw file
+	[self setUpDemosaicEngineWithState:state];
+	[self setUpLensCorrectionsWithState:state];
+	
+	state.streamsStrips = [self shouldStreamState:state imageSize:image.imageSize];
+	
+	state.metrics.demosaicEngine = @(TSRawDemosaicGetEngine(state.demosaicEngine)->name);
+	state.metrics.streamed = state.streamsStrips;
+	
+	DDLogDebug(@"Filling cache for %@ with %s", state.imageUuid, TSRawDemosaicGetEngine(state.demosaicEngine)->name);
+	
+	[self submitJobWithState:state imageSize:image.imageSize resumeFromCache:NO shouldCacheResults:YES];
+}
+
+#pragma mark Job Scheduling
+/**
+ * Queues the operations of a job, once fewer than the maximum number of jobs
+ * are being processed. Until then, the job holds no buffers; this way,
+ * queueing a large batch of images doesn't allocate buffers for all of them.
+ */
+- (void) submitJobWithState:(TSRawPipelineState *) state imageSize:(NSSize) imageSize resumeFromCache:(BOOL) resume shouldCacheResults:(BOOL) cache {
+	dispatch_async(self.admissionQueue, ^{
+		// wait for a free slot; it's returned when the job is cleaned up
+		dispatch_semaphore_wait(self.jobSlots, DISPATCH_TIME_FOREVER);
+		
+		// if the job was superseded while waiting, don't start it at all
+		if(state.isCancelled) {
+			[self cleanUpState:state];
+			dispatch_semaphore_signal(self.jobSlots);
+			
+			return;
+		}
 		
-		[self resumePipelineRunWithCachedData:state shouldCacheResults:cache];
+		[self checkOutBuffersForState:state imageSize:imageSize];
+		
+		if(resume) {
+			[self resumePipelineRunWithCachedData:state shouldCacheResults:cache];
+		} else if(state.fillsCache) {
+			[self beginCacheFillWithState:state];
+		} else {
+			[self beginFullPipelineRunWithState:state shouldCacheResults:cache];
+		}
+	});
+}
+
+/**
+ * Decides whether a full run of the pipeline should stream the image in
+ * strips, based on the execution mode and the size of the image. Lens
+ * corrections need the entire image, so those jobs are never streamed.
+ */
+- (BOOL) shouldStreamState:(TSRawPipelineState *) state imageSize:(NSSize) imageSize {
+	if(state.applyLensCorrections) {
+		return NO;
 	}
-	// No cached data (or cache resumption is inhibited) so start a full run
-	else {
-		state.progress = [NSProgress progressWithTotalUnitCount:11];
-		if(outProgress) *outProgress = state.progress;
+	
+	switch(self.executionMode) {
+		case TSRawPipelineExecutionModeStreaming:
+			return YES;
 		
-		// Set up for lens corrections
-		[self setUpLensCorrectionsWithState:state];
+		case TSRawPipelineExecutionModeFullFrame:
+			return NO;
 		
-		// Begin the pipeline run
-		[self beginFullPipelineRunWithState:state shouldCacheResults:cache];
+		case TSRawPipelineExecutionModeAutomatic:
+		default:
+			return ((imageSize.width * imageSize.height) >= TSRawPipelineStreamingThresholdPixels);
 	}
 }
 
+/**
+ * Checks out the converter and buffers for a job from the pool. The converter
+ * is sized for the job's raw size, which accounts for the demosaic engine.
+ * Streamed jobs only hold the Bayer and interpolated data of a single strip,
+ * so they check out buffers for a strip, rather than the entire image.
+ */
+- (void) checkOutBuffersForState:(TSRawPipelineState *) state imageSize:(NSSize) imageSize {
+	// Display intents work on half precision planes
+	TSPixelConverterPlaneFormat format = TSPixelConverterPlaneFormatForIntent(state.intent);
+	
+	if(state.streamsStrips) {
+		NSUInteger stripHeight = TSRawStreamGetSourceRows(state.demosaicEngine, self.stripRows);
+		imageSize.height = MIN(imageSize.height, (CGFloat) stripHeight);
+	}
+	
+	state.buffers = [self.bufferPool checkOutBuffersForImageSize:imageSize
+												   converterSize:state.rawSize
+													 planeFormat:format];
+	state.converter = state.buffers.converter;
+	
+	/*
+	 * The image starts out in the interpolated colour buffer. The converter's
+	 * RGBX buffer is at least as large as a 64bpp frame (even with half
+	 * precision planes), and is only used for the final conversion, so it
+	 * serves as the back buffer; this way, no memory beyond what the job
+	 * already holds is needed.
+	 */
+	state.frontBuf = state.buffers.interpolatedColourBuf;
+	state.backBuf = TSPixelConverterGetRGBXPointer(state.converter);
+}
+
+/**
+ * Makes the first operation of a job wait for the most recent job on the same
+ * image to finish, since both use the image's raw file handle. Jobs on
+ * different images are processed concurrently.
+ *
+ * @note This may only be called on the admission queue.
+ */
+- (void) orderJobWithState:(TSRawPipelineState *) state firstOperation:(NSOperation *) first lastOperation:(NSOperation *) last {
+	NSOperation *previous = [self.lastJobOperations objectForKey:state.imageUuid];
+	
+	if(previous != nil && previous.isFinished == NO) {
+		[first addDependency:previous];
+	}
+	
+	[self.lastJobOperations setObject:last forKey:state.imageUuid];
+}
+
+/**
+ * Makes the given job the latest one for its image, and cancels the previous
+ * latest job, if any. Queued stages of that job are skipped, and a stage that
+ * is in progress finishes, but no further stages run; its completion callback
+ * is invoked with a NSUserCancelledError.
+ *
+ * Only the previous latest job needs to be cancelled, since any older ones
+ * were cancelled when it was queued.
+ *
+ * @return Whether the cancelled job was not going to resume from cached data;
+ * the new job then mustn't either, since it might have been queued because of
+ * changes that invalidate the cache.
+ */
+- (BOOL) supersedeJobsWithState:(TSRawPipelineState *) state {
+	__block TSRawPipelineState *previous = nil;
+	
+	dispatch_sync(self.jobTrackingQueue, ^{
+		previous = [self.latestJobs objectForKey:state.imageUuid];
+		[self.latestJobs setObject:state forKey:state.imageUuid];
+	});
+	
+	if(previous == nil || [previous cancel] == NO) {
+		return NO;
+	}
+	
+	DDLogDebug(@"Superseded job %p for image %@", previous, state.imageUuid);
+	
+	return previous.inhibitCachedResume;
+}
+
 #pragma mark - RAW Processing Steps
 #pragma mark Interpolation and Data Reading
+/**
+ * Resets the raw file handle to the state it was in right after the file was
+ * loaded, in case a previous job on the image changed it.
+ */
+- (NSBlockOperation *) opPrepare:(TSRawPipelineState *) state {
+	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
+		TSBeginOperation(@"Preparing");
+		
+		// Reset RAW handle
+		if([state.rawImage recycle] != YES) {
+			DDLogWarn(@"Couldn't recycle raw file: this might cause issues later on, but continuing anyways.");
+		}
+		
+		TSEndOperation();
+	}];
+	
+	op.name = @"Preparing";
+	return op;
+}
+
+/**
+ * Delivers the preview that the camera embedded in the raw file to the
+ * preview callback. It is usually much smaller than the image, and already
+ * compressed, so it can be displayed long before the full render is done.
+ */
+- (NSBlockOperation *) opEmbeddedPreview:(TSRawPipelineState *) state {
+	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
+		TSBeginOperation(@"Embedded Preview");
+		
+		state.stage = TSRawPipelineStageEmbeddedPreview;
+		
+		NSError *err = nil;
+		NSImage *preview = [state.rawImage embeddedPreviewImage:&err];
+		
+		if(preview != nil) {
+			state.previewCallback(preview);
+		} else {
+			DDLogWarn(@"Couldn't extract embedded preview: %@", err);
+		}
+		
+		TSEndOperation();
+	}];
+	
+	op.name = @"Embedded Preview";
+	return op;
+}
+
 /**
  * Creates the block operation to debayer the RAW data. This is accomplished
  * by calling the "unpackRawData" method on the RAW file handle.
  */
 - (NSBlockOperation *) opDebayer:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Debayering");
 		
 		NSError *err = nil;
@@ -340,6 +746,9 @@
 			
 			[state terminateWithError:err];
 			
+			// the clean up operation was cancelled, so return the buffers now
+			[self cleanUpState:state];
+			
 			TSEndOperation();
 			return;
 		}
@@ -359,34 +768,37 @@
  * 1. Subtracting a dark frame (hot pixel removal)
  * 2. Adjusting the black level
  * 3. Performing interpolation
+ *
+ * The interpolation is done by the demosaic engine selected for the rendering
+ * intent; some engines produce a smaller image than the input.
  */
 - (NSBlockOperation *) opDemosaic:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Demosaic");
 		
 		state.stage = TSRawPipelineStageDemosaicing;
 		libraw_data_t *libRaw = state.rawImage.libRaw;
 		
-		// copy RAW data into buffer
-		[state.rawImage copyRawDataToBuffer:self.interpolatedColourBuf];
-		
 		// adjust black level
-		TSRawAdjustBlackLevel(libRaw, (uint16_t (*)[4]) self.interpolatedColourBuf);
-		TSRawSubtractBlack(libRaw, (uint16_t (*)[4]) self.interpolatedColourBuf);
+		TSRawAdjustBlackLevel(libRaw, state.buffers.bayerBuf);
 		
 		
-		// white balance (colour scaling) and pre-interpolation
+		// copy RAW data into the Bayer buffer, subtracting black, applying
+		// white balance (colour scaling) and pre-interpolation as it goes
 		state.stage = TSRawPipelineStageWhiteBalance;
 		
-		TSRawPreInterpolationApplyWB(libRaw, (uint16_t (*)[4]) self.interpolatedColourBuf);
-		TSRawPreInterpolation(libRaw, (uint16_t (*)[4]) self.interpolatedColourBuf);
+		[state.rawImage copyBalancedRawDataToBuffer:state.buffers.bayerBuf];
 		
 		
-		// interpolate colour data
+		// interpolate colour data, with the engine selected for the intent
 		state.stage = TSRawPipelineStageInterpolateColour;
 		
-		ahd_interpolate_mod(libRaw, (uint16_t (*)[4]) self.interpolatedColourBuf);
-//		lmmse_interpolate(libRaw, (uint16_t (*)[4]) self.interpolatedColourBuf);
+		const TSRawDemosaicEngineInfo *engine = TSRawDemosaicGetEngine(state.demosaicEngine);
+		DDLogDebug(@"Interpolating with %s", engine->name);
+		
+		engine->interpolate(libRaw, state.buffers.bayerBuf, (uint16_t (*)[4]) state.frontBuf);
 		
 		TSEndOperation();
 	}];
@@ -395,30 +807,88 @@
 	return op;
 }
 
+/**
+ * Takes the image from the raw data to planar floating point, a strip at a
+ * time; this replaces the demosaic, colour conversion and planar conversion
+ * stages for streamed jobs. Since each strip stays in cache between those
+ * stages, and only a strip's worth of buffers is needed, this is faster and
+ * uses much less memory for large images.
+ */
+- (NSBlockOperation *) opStreamToPlanar:(TSRawPipelineState *) state {
+	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
+		TSBeginOperation(@"Streamed Demosaic and Conversion");
+		
+		state.stage = TSRawPipelineStageDemosaicing;
+		libraw_data_t *libRaw = state.rawImage.libRaw;
+		
+		// adjust black level
+		TSRawAdjustBlackLevel(libRaw, state.buffers.bayerBuf);
+		
+		// stream the strips through all stages, and into the converter's planes
+		const TSRawDemosaicEngineInfo *engine = TSRawDemosaicGetEngine(state.demosaicEngine);
+		DDLogDebug(@"Streaming in strips of %lu rows; interpolating with %s", self.stripRows, engine->name);
+		
+		TSRawStreamToPlanar(libRaw, state.demosaicEngine, self.stripRows,
+							state.buffers.bayerBuf,
+							(uint16_t (*)[4]) state.buffers.interpolatedColourBuf,
+							state.converter, state.histogramBuf, NULL);
+		
+		state.stage = TSRawPipelineStageConvertToPlanar;
+		
+		TSEndOperation();
+	}];
+	
+	op.name = @"Streamed Demosaicing and Conversion to Planar";
+	return op;
+}
+
 /**
  * Converts from the (potentially lens corrected) camera colour space to the
  * internal working colour space, and corrects the gamma curve of the image.
  */
 - (NSBlockOperation *) opGammaColourSpaceCorrect:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Colour Profile Conversion and Gamma Adjustment");
 		
 		state.stage = TSRawPipelineStageConvertToRGB;
 		libraw_data_t *libRaw = state.rawImage.libRaw;
 		
-		// Convert to RGB
+		// the gamma curve comes from the LUT cache; only copy it when debugging
+#if WriteDebugData
+		uint16_t *gammaCurveBuf = (uint16_t *) valloc(sizeof(uint16_t) * 0x10000);
+#else
+		uint16_t *gammaCurveBuf = NULL;
+#endif
+		
+		/*
+		 * Convert to RGB. The planar conversion writes into the converter's
+		 * buffers, so the RGB data always has to end up in the interpolated
+		 * colour buffer: if the image is in there already, it's converted in
+		 * place; otherwise, it's written there and becomes the front buffer.
+		 */
 		state.stage = TSRawPipelineStageConvertToRGB;
-		TSRawConvertToRGB(libRaw,
-						  (uint16_t (*)[4]) self.interpolatedColourBuf, // input -> RGBX
-						  (uint16_t (*)[3]) self.interpolatedColourBuf, // output -> RGB
-						  state.histogramBuf, state.gammaCurveBuf);
+		void *rgbBuf = state.buffers.interpolatedColourBuf;
 		
+		TSRawConvertToRGB(libRaw,
+						  (uint16_t (*)[4]) state.frontBuf, // input -> RGBX
+						  (uint16_t (*)[3]) rgbBuf, // output -> RGB
+						  (size_t) state.rawSize.width, (size_t) state.rawSize.height,
+						  state.histogramBuf, gammaCurveBuf);
 		
+		if(state.frontBuf != rgbBuf) {
+			[state swapFrameBuffers];
+		}
+
+
 #if WriteDebugData
 		// Save buffers to disk (debug testing)
 		NSURL *appSupportURL = [TSGroupContainerHelper sharedInstance].appSupport;
 		
-		NSData *rawData = [NSData dataWithBytesNoCopy:self.interpolatedColourBuf length:(state.rawImage.size.width * 3 * 2) * state.rawImage.size.height freeWhenDone:NO];
+		NSData *rawData = [NSData dataWithBytesNoCopy:state.frontBuf length:(state.rawSize.width * 3 * 2) * state.rawSize.height freeWhenDone:NO];
 		[rawData writeToURL:[appSupportURL URLByAppendingPathComponent:@"test_raw_data.raw"] atomically:NO];
 	
 		// write histogram and curves
@@ -426,7 +896,7 @@
 		[rawData writeToURL:[appSupportURL URLByAppendingPathComponent:@"test_raw_histo.bin"] atomically:NO];
 		
 		
-		rawData = [NSData dataWithBytesNoCopy:state.gammaCurveBuf length:0x10000 * sizeof(uint16_t) freeWhenDone:NO];
+		rawData = [NSData dataWithBytesNoCopy:gammaCurveBuf length:0x10000 * sizeof(uint16_t) freeWhenDone:YES];
 		[rawData writeToURL:[appSupportURL URLByAppendingPathComponent:@"test_raw_gcurv.bin"] atomically:NO];
 		
 		
@@ -445,7 +915,7 @@
 
 #pragma mark Lens Corrections
 /**
- * Loads the required data, and initializes the modifier object, if lens
+ * Loads the required data, and looks up the remap grid for the lens, if lens
  * corrections are desired.
  */
 - (void) setUpLensCorrectionsWithState:(TSRawPipelineState *) state {
@@ -454,8 +924,6 @@
 	__block TSLFLens *lens = nil;
 	__block BOOL willApplyLensCorrections = NO;
 	
-	int outModFlags = 0;
-	
 	// Fetch some data from the context
 	[state.mocCtx performBlockAndWait:^{
 		if(state.image.correctionData.enabled.boolValue == YES) {
@@ -474,8 +942,7 @@
 		} else {
 			// No lens correction data/lens correction is not enabled
 			state.applyLensCorrections = NO;
-			state.lcLens = nil;
-			state.lcModifier = nil;
+			state.lcGrid = nil;
 		}
 	}];
 	
@@ -485,28 +952,16 @@
 	}
 	
 	
-	// Check that the lens data is valid
-	if(lens != nil) {
-		state.lcLens = lens.lens;
-	} else {
-		state.applyLensCorrections = NO;
-		return;
-	}
-	
-	// Create a modifier object
-	state.lcModifier = new lfModifier(state.lcLens, cam.cropFactor,
-									  (int) state.rawSize.width,
-									  (int) state.rawSize.height);
-	state.applyLensCorrections = YES;
-	
-	// Initialize the modifier with image data
+	// Get the remap grid for the lens and shooting parameters
 	CGFloat focal = [metadata[TSLibraryImageMetadataKeyLensFocalLength] floatValue];
 	CGFloat aperture = [metadata[TSLibraryImageMetadataKeyAperture] floatValue];
-	CGFloat distance = 1000.f; // We don't have distance available; tell LensFun to ignore it
 	
-	outModFlags = state.lcModifier->Initialize(state.lcLens, LF_PF_U16, focal, aperture, distance, 0.f, LF_RECTILINEAR, LF_MODIFY_ALL, NO);
+	state.lcGrid = TSLFGetRemapGrid(lens, cam, focal, aperture,
+									(NSUInteger) state.rawSize.width,
+									(NSUInteger) state.rawSize.height);
+	state.applyLensCorrections = (state.lcGrid != nil);
 	
-	DDLogDebug(@"Initialized lens corrector %p with focal = %f mm, ƒ/%.1f, distance = %f m; converting to rectilinear, modifying all", state.lcModifier, focal, aperture, distance);
+	DDLogDebug(@"Using lens remap grid %p for focal = %f mm, ƒ/%.1f; converting to rectilinear, modifying all", state.lcGrid, focal, aperture);
 }
 
 /**
@@ -514,103 +969,29 @@
  */
 - (NSBlockOperation *) opLensCorrect:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Lens Corrections");
 		
 		// Only perform lens corrections if, well… they're desired
 		if(state.applyLensCorrections) {
 			state.stage = TSRawPipelineStageLensCorrection;
 			
-			NSUInteger x, y, step;
-			
-			lfModifier *m = state.lcModifier;
-			
-			// Allocate the coordinate buffer for subpixel coordinates
-			size_t subPixelCoordsSz = sizeof(float) * 3 * 2 * state.rawSize.width;
-			
-			float *subPixelCoords = (float *) valloc(subPixelCoordsSz);
-			memset(subPixelCoords, 0, subPixelCoordsSz);
-			
 			/**
-			 * Lens corrections consist of two steps: First, vignetting removal,
-			 * then geometry/distortion and TCA correction. Each step operates
-			 * on a single scanline in the image at a time. After all scanlines
-			 * for a particular step have been operated on, the next step will
-			 * be operated on.
+			 * Lens corrections (vignetting removal, and geometry/distortion and
+			 * TCA correction) are applied in a single pass, with the remap grid
+			 * providing the source coordinates and vignetting gain for each
+			 * pixel.
 			 */
-			for(step = 0; step < 2; step++) {
-				// Set up some variables
-				BOOL ok = YES;
-				
-				// dst will be filled by 64bpp RGB data
-				uint16_t *dst = (uint16_t *) TSPixelConverterGetRGBXPointer(state.converter);
-				// imgData is the original 64bpp RGB data
-				uint16_t *imgData = (uint16_t *) self.interpolatedColourBuf;
-				
-				// Perform the step for each scanline separately
-				for(y = 0; (ok && (y < state.rawSize.height)); y++) {
-					// Remove vignetting
-					if(step == 0) {
-						// Calculate image stride, in BYTES
-						int imgDataStrideBytes = state.rawSize.width * 4 * sizeof(uint16_t);
-						
-						// Perform colour modifications
-						ok = m->ApplyColorModification(imgData, 0, y,
-													   state.rawSize.width, 1,
-													   LF_CR_4(RED,GREEN,BLUE,UNKNOWN),
-													   imgDataStrideBytes);
-						
-						// Advance to the next row in the input pointer
-						imgData += ((size_t) (4 * state.rawSize.width));
-					}
-					
-					// Correct geometry and TCA
-					else if(step == 1) {
-						// Calculate image stride, in ELEMENTS
-						int imgDataStrideElements = state.rawSize.width * 4;
-						
-						// Perform subpixel distortion correction
-						ok = m->ApplySubpixelGeometryDistortion(0, y,
-																state.rawSize.width, 1,
-																subPixelCoords);
-						
-						// Interpolate the pixels into output buffer
-						if(ok) {
-							float *src = subPixelCoords;
-							
-							for(x = 0; x < state.rawSize.width; x++) {
-								// Read the R, G, B components separately, increment coordinate buffer
-								*dst++ = TSInterpolatePixelBilinear(imgData + 0, imgDataStrideElements, src[0], src[1]);
-								*dst++ = TSInterpolatePixelBilinear(imgData + 1, imgDataStrideElements, src[2], src[3]);
-								*dst++ = TSInterpolatePixelBilinear(imgData + 2, imgDataStrideElements, src[4], src[5]);
-								src += (3 * 2);
-								
-								// Set the X component (buffer is RGBX) to zero
-								*dst++ = 0;
-							}
-						}
-					}
-					
-					// Unknown step
-					else {
-						DDLogWarn(@"Invalid lens correction step: %lu", (unsigned long) step);
-					}
-				}
-			}
+			const TSLFRemapGrid *grid = (const TSLFRemapGrid *) state.lcGrid.table;
 			
-			// Free the buffers previously allocated
-			free(subPixelCoords);
-	
-			/*
-			 * Because lens corrections require sampling from the colour-corrected
-			 * input data (in self.interpolatedColourBuf,) and writing the resultant
-			 * data elsewhere, that is stored in the converter's RGBX data. However,
-			 * the rest of the code expects the pixel data to be in the interpolated
-			 * colour buffer. This copies it, if lens corrections were performed.
-			 */
-			size_t num_bytes = (state.rawSize.width * 4 * sizeof(uint16_t)) * state.rawSize.height;
-			void *correctedData = TSPixelConverterGetRGBXPointer(state.converter);
-				
-			memcpy(self.interpolatedColourBuf, correctedData, num_bytes);
+			TSLFApplyCorrections(grid, TSLFRemapFilterForIntent(state.intent),
+								 (uint16_t *) state.frontBuf,
+								 (uint16_t *) state.backBuf,
+								 state.rawSize.width, state.rawSize.height);
+			
+			// the corrected image is in the back buffer, so make it current
+			[state swapFrameBuffers];
 		}
 		
 		TSEndOperation();
@@ -623,20 +1004,21 @@
 #pragma mark Pixel Format Conversions
 /**
  * Converts the image from the 16 bit/component unsigned short RGB format to
- * a 32 bit/component floating-point RGBA format.
+ * three 32 bit floating-point planes, in a single pass.
  */
 - (NSBlockOperation *) opConvertToPlanar:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Convert to Planar Floating Point");
 		
 		state.stage = TSRawPipelineStageConvertToPlanar;
 		
 		// set the input buffer and begin converting
-		TSPixelConverterSetInData(state.converter, self.interpolatedColourBuf);
+		TSPixelConverterSetInData(state.converter, state.frontBuf);
 		
 		// convert; the gamma curve normalized values with a max of 0xFFFF
-		TSPixelConverterRGB16UToFloat(state.converter, 0xFFFF);
-		TSPixelConverterRGBFFFToPlanarF(state.converter);
+		TSPixelConverterRGB16UToPlanarF(state.converter, 0xFFFF);
 		
 		TSEndOperation();
 	}];
@@ -651,6 +1033,8 @@
  */
 - (NSBlockOperation *) opConvertToInterleaved:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Convert to Interleaved Floating Point");
 		
 		state.stage = TSRawPipelineStageConvertToInterleaved;
@@ -685,6 +1069,13 @@
 	NSUInteger bytesPerRow = TSPixelConverterGetRGBXStride(converter);
 	void *buf = TSPixelConverterGetRGBXPointer(converter);
 	
+	// half precision planes are interleaved into 16 bit floats
+	NSInteger bitsPerSample = 32;
+	
+	if(TSPixelConverterGetPlaneFormat(converter) == TSPixelConverterPlaneFormatFloat16) {
+		bitsPerSample = 16;
+	}
+	
 	// create bitmap representation, and re-tag with colour space
 	unsigned char *ptrs = { ((unsigned char *) buf) };
 	
@@ -692,14 +1083,14 @@
 		  initWithBitmapDataPlanes:&ptrs
 		  pixelsWide:outputSize.width
 		  pixelsHigh:outputSize.height
-		  bitsPerSample:32
+		  bitsPerSample:bitsPerSample
 		  samplesPerPixel:4
 		  hasAlpha:YES
 		  isPlanar:NO
 		  colorSpaceName:NSCalibratedRGBColorSpace
 		  bitmapFormat:NSFloatingPointSamplesBitmapFormat
 		  bytesPerRow:bytesPerRow
-		  bitsPerPixel:128];
+		  bitsPerPixel:(bitsPerSample * 4)];
 	
 	// DDLogVerbose(@"Output size = %@, bytes/row = %lu", NSStringFromSize(outputSize), bytesPerRow);
 	
@@ -738,31 +1129,28 @@
  */
 - (NSBlockOperation *) opRotateFlip:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Rotation and Flipping");
 		
 		state.stage = TSRawPipelineStageRotationFlip;
 		
-		// do we need to apply rotation?
-		if(state.rawImage.rotation == 0) {
+		// do we need to rotate or flip the image?
+		TSPixelConverterOrientation orientation = (TSPixelConverterOrientation) state.rawImage.orientation;
+		
+		if(orientation == TSPixelConverterOrientationNormal) {
 			TSEndOperation();
 			return;
 		}
 		
-		// calculate the correct rotation angle
-		NSInteger rotation = state.rawImage.rotation;
-		
-		if(rotation < 0) {
-			rotation = 360 - rotation;
-		}
-		
-		// if rotation is not 0° or 180°, swap size
-		if(rotation != 0 && rotation != 180) {
+		// orientations that transpose the image swap its size
+		if(orientation >= TSPixelConverterOrientationTranspose) {
 			NSSize regularSize = state.outputSize;
 			state.outputSize = NSMakeSize(regularSize.height, regularSize.width);
 		}
 		
-		// perform the rotation
-		TSPixelConverterRotate90(state.converter, (rotation / 90));
+		// perform the rotation and/or flip
+		TSPixelConverterApplyOrientation(state.converter, orientation);
 		
 		TSEndOperation();
 	}];
@@ -776,6 +1164,8 @@
  */
 - (NSBlockOperation *) opConvolve:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Convolution");
 		
 		state.stage = TSRawPipelineStageConvolution;
@@ -794,6 +1184,8 @@
  */
 - (NSBlockOperation *) opMorphological:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Morphological");
 		
 		state.stage = TSRawPipelineStageMorphological;
@@ -810,6 +1202,8 @@
  */
 - (NSBlockOperation *) opHistogramAdjust:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Histogram Adjustment");
 		
 		state.stage = TSRawPipelineStageHistogramModification;
@@ -827,6 +1221,8 @@
  */
 - (NSBlockOperation *) opCoreImageFilters:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"CoreImage Filters");
 		
 		NSImage *im;
@@ -885,18 +1281,25 @@
  * previously cached data.
  */
 - (void) beginFullPipelineRunWithState:(TSRawPipelineState *) state shouldCacheResults:(BOOL) cache {
-	NSBlockOperation *opDebayer, *opDemosaic, *opLensCorrect, *opConvertPlanar;
+	NSBlockOperation *opPrepare, *opPreview, *opDebayer, *opDemosaic, *opLensCorrect, *opConvertPlanar;
 	NSBlockOperation *opRotate, *opConvolute, *opMorphological, *opHisto;
 	NSBlockOperation *opConvertInterleaved, *opCoreImage, *opConvertRGBGamma;
 	NSBlockOperation *opUpdateCache, *opCleanUp;
 	
 	// Set up the various operations
+	opPrepare = [self opPrepare:state];
 	opDebayer = [self opDebayer:state];
-	opDemosaic = [self opDemosaic:state];
-	opLensCorrect = [self opLensCorrect:state];
-	opConvertRGBGamma = [self opGammaColourSpaceCorrect:state];
 	
-	opConvertPlanar = [self opConvertToPlanar:state];
+	// Streamed jobs go from the raw data to the planes in a single operation
+	if(state.streamsStrips) {
+		opConvertPlanar = [self opStreamToPlanar:state];
+	} else {
+		opDemosaic = [self opDemosaic:state];
+		opLensCorrect = [self opLensCorrect:state];
+		opConvertRGBGamma = [self opGammaColourSpaceCorrect:state];
+		
+		opConvertPlanar = [self opConvertToPlanar:state];
+	}
 	
 	opRotate = [self opRotateFlip:state];
 	opConvolute = [self opConvolve:state];
@@ -914,12 +1317,31 @@
 		opUpdateCache = [self opStorePlanarInCache:state];
 	}
 	
+	// If a preview is desired, extract it before doing anything else
+	if(state.previewCallback) {
+		opPreview = [self opEmbeddedPreview:state];
+	}
+	
 	// Set up interdependencies between the operations
-	[opDemosaic addDependency:opDebayer];
-	[opLensCorrect addDependency:opDemosaic];
-	[opConvertRGBGamma addDependency:opLensCorrect];
+	[self orderJobWithState:state firstOperation:opPrepare lastOperation:opCleanUp];
+	
+	// the preview uses the raw file handle, so it can't run during debayering
+	if(state.previewCallback) {
+		[opPreview addDependency:opPrepare];
+		[opDebayer addDependency:opPreview];
+	} else {
+		[opDebayer addDependency:opPrepare];
+	}
 	
-	[opConvertPlanar addDependency:opConvertRGBGamma];
+	if(state.streamsStrips) {
+		[opConvertPlanar addDependency:opDebayer];
+	} else {
+		[opDemosaic addDependency:opDebayer];
+		[opLensCorrect addDependency:opDemosaic];
+		[opConvertRGBGamma addDependency:opLensCorrect];
+		
+		[opConvertPlanar addDependency:opConvertRGBGamma];
+	}
 	
 	if(cache) {
 		[opUpdateCache addDependency:opConvertPlanar];
@@ -939,10 +1361,20 @@
 	[opCleanUp addDependency:opCoreImage];
 	
 	// Add them to the queue to vamenos the operations
+	TSAddOperation(opPrepare, state);
+	
+	if(state.previewCallback) {
+		TSAddOperation(opPreview, state);
+	}
+	
 	TSAddOperation(opDebayer, state);
-	TSAddOperation(opDemosaic, state);
-	TSAddOperation(opLensCorrect, state);
-	TSAddOperation(opConvertRGBGamma, state);
+	
+	if(state.streamsStrips == NO) {
+		TSAddOperation(opDemosaic, state);
+		TSAddOperation(opLensCorrect, state);
+		TSAddOperation(opConvertRGBGamma, state);
+	}
+	
 	TSAddOperation(opConvertPlanar, state);
 	
 	if(cache) {
@@ -961,6 +1393,66 @@
 	TSAddOperation(opCleanUp, state);
 }
 
+/**
+ * Runs the stages of the pipeline up to the conversion to planar floating
+ * point, and stores the result in the cache; no image is produced. All of the
+ * job's operations run at background priority.
+ */
+- (void) beginCacheFillWithState:(TSRawPipelineState *) state {
+	NSBlockOperation *opPrepare, *opDebayer, *opDemosaic, *opLensCorrect, *opConvertPlanar;
+	NSBlockOperation *opConvertRGBGamma, *opUpdateCache, *opCleanUp;
+	
+	// Set up the various operations
+	opPrepare = [self opPrepare:state];
+	opDebayer = [self opDebayer:state];
+	
+	if(state.streamsStrips) {
+		opConvertPlanar = [self opStreamToPlanar:state];
+	} else {
+		opDemosaic = [self opDemosaic:state];
+		opLensCorrect = [self opLensCorrect:state];
+		opConvertRGBGamma = [self opGammaColourSpaceCorrect:state];
+		
+		opConvertPlanar = [self opConvertToPlanar:state];
+	}
+	
+	opUpdateCache = [self opStorePlanarInCache:state];
+	opCleanUp = [self opCleanUp:state];
+	
+	// Set up interdependencies between the operations
+	[self orderJobWithState:state firstOperation:opPrepare lastOperation:opCleanUp];
+	
+	[opDebayer addDependency:opPrepare];
+	
+	if(state.streamsStrips) {
+		[opConvertPlanar addDependency:opDebayer];
+	} else {
+		[opDemosaic addDependency:opDebayer];
+		[opLensCorrect addDependency:opDemosaic];
+		[opConvertRGBGamma addDependency:opLensCorrect];
+		
+		[opConvertPlanar addDependency:opConvertRGBGamma];
+	}
+	
+	[opUpdateCache addDependency:opConvertPlanar];
+	[opCleanUp addDependency:opUpdateCache];
+	
+	// Run all of them at background priority
+	NSMutableArray<NSOperation *> *ops = [NSMutableArray arrayWithObjects:opPrepare, opDebayer, nil];
+	
+	if(state.streamsStrips == NO) {
+		[ops addObjectsFromArray:@[opDemosaic, opLensCorrect, opConvertRGBGamma]];
+	}
+	
+	[ops addObjectsFromArray:@[opConvertPlanar, opUpdateCache, opCleanUp]];
+	
+	for(NSOperation *op in ops) {
+		op.qualityOfService = NSQualityOfServiceBackground;
+		
+		TSAddOperation(op, state);
+	}
+}
+
 /**
  * Resumes RAW processing with the cached output of stage 5; this will run
  * all vImage and CoreImage operations.
@@ -968,9 +1460,10 @@
 - (void) resumePipelineRunWithCachedData:(TSRawPipelineState *) state shouldCacheResults:(BOOL) cache {
 	NSBlockOperation *opRotate, *opConvolute, *opMorphological, *opHisto;
 	NSBlockOperation *opConvertInterleaved, *opCoreImage,  *opRestoreCache;
-	NSBlockOperation *opCleanUp;
+	NSBlockOperation *opPrepare, *opCleanUp;
 	
 	// Set up the various operations
+	opPrepare = [self opPrepare:state];
 	opRestoreCache = [self opRestorePlanarFromCache:state];
 	
 	opRotate = [self opRotateFlip:state];
@@ -984,6 +1477,9 @@
 	opCleanUp = [self opCleanUp:state];
 	
 	// set up interdependencies between the operations
+	[self orderJobWithState:state firstOperation:opPrepare lastOperation:opCleanUp];
+	
+	[opRestoreCache addDependency:opPrepare];
 	[opRotate addDependency:opRestoreCache];
 	
 	[opConvolute addDependency:opRotate];
@@ -996,6 +1492,7 @@
 	[opCleanUp addDependency:opCoreImage];
 	
 	// Add them to the queue to vamenos the operations
+	TSAddOperation(opPrepare, state);
 	TSAddOperation(opRestoreCache, state);
 	
 	TSAddOperation(opRotate, state);
@@ -1021,21 +1518,36 @@
 
 #pragma mark Cache Encoding
 /**
- * Stores a copy of the image buffer into the cache.
+ * Stores a copy of the image buffer into the cache. The cache always holds
+ * 32 bit floating point planes, so that any intent can resume from it; if the
+ * converter works in half precision, they're converted again from the input
+ * rather than from its (less precise) planes.
  */
 - (void) storeFloatDataCached:(TSRawPipelineState *) state {
 	// get how many kerjiggers each plane is
 	vImage_Buffer plane = TSPixelConverterGetPlanevImageBufferBuffer(state.converter, 0);
-	NSUInteger planeBytes = plane.rowBytes * plane.height;
 	
-	NSMutableData *buffer = [NSMutableData dataWithCapacity:planeBytes * 3];
+	size_t stride = TSPixelConverterGetFloatPlaneStride(state.converter);
+	NSUInteger planeBytes = stride * plane.height;
+	
+	NSMutableData *buffer = [NSMutableData dataWithLength:planeBytes * 3];
 	
 	DDLogDebug(@"Allocated %lu bytes for raw cache", planeBytes * 3);
 	
-	// make a copy of each of the planes
-	for(NSUInteger idx = 0; idx < 3; idx++) {
-		plane = TSPixelConverterGetPlanevImageBufferBuffer(state.converter, idx);
-		[buffer appendBytes:plane.data length:planeBytes];
+	if(TSPixelConverterGetPlaneFormat(state.converter) == TSPixelConverterPlaneFormatFloat16) {
+		Pixel_F *planes[3];
+		
+		for(NSUInteger idx = 0; idx < 3; idx++) {
+			planes[idx] = (Pixel_F *) (((uint8_t *) buffer.mutableBytes) + (idx * planeBytes));
+		}
+		
+		TSPixelConverterRGB16UToPlanarFBuffers(state.converter, 0xFFFF, planes, stride);
+	} else {
+		// make a copy of each of the planes
+		for(NSUInteger idx = 0; idx < 3; idx++) {
+			plane = TSPixelConverterGetPlanevImageBufferBuffer(state.converter, idx);
+			memcpy(((uint8_t *) buffer.mutableBytes) + (idx * planeBytes), plane.data, planeBytes);
+		}
 	}
 	
 	// store in the cache
@@ -1055,18 +1567,21 @@
 	
 	if(cachedData == nil) {
 		DDLogError(@"Cache lost its data for this image since operation was started… this is bad.");
+		return;
 	}
 	
-	// calculate plane size and get buffer
+	// calculate the size of the cached planes
 	vImage_Buffer plane = TSPixelConverterGetPlanevImageBufferBuffer(state.converter, 0);
-	planeBytes = plane.rowBytes * plane.height;
 	
-	// make a copy of each of the planes
+	size_t stride = TSPixelConverterGetFloatPlaneStride(state.converter);
+	planeBytes = stride * plane.height;
+	
+	// copy each of the planes, converting them to the converter's format
 	for(NSUInteger idx = 0; idx < 3; idx++) {
-		plane = TSPixelConverterGetPlanevImageBufferBuffer(state.converter, idx);
 		offset = idx * planeBytes;
 		
-		[cachedData getBytes:plane.data range:NSMakeRange(offset, planeBytes)];
+		const Pixel_F *data = (const Pixel_F *) (((const uint8_t *) cachedData.bytes) + offset);
+		TSPixelConverterLoadPlaneF(state.converter, idx, data, stride);
 	}
 }
 
@@ -1084,10 +1599,13 @@
 	 
 	 if(cachedData == nil) {
 		DDLogError(@"Cache lost its data for this image since operation was started… this is bad.");
+		return;
 	 }
 	
-	// calculate the size of a large, original-sized plane
+	// calculate the size of a large, original-sized plane, as cached
 	vImage_Buffer planeIn = TSPixelConverterGetPlanevImageBufferBuffer(state.converter, 0);
+	
+	planeIn.rowBytes = TSPixelConverterGetFloatPlaneStride(state.converter);
 	planeBytes = planeIn.rowBytes * planeIn.height;
 	
 	
@@ -1114,6 +1632,20 @@
 	// calculate size of temporary vImage buffer and allocate it
 	vImage_Buffer planeOut = TSPixelConverterGetPlanevImageBufferBuffer(state.converter, 0);
 	
+	/*
+	 * vImage can only scale into 32 bit float planes; half precision planes
+	 * are scaled into a temporary plane, which is then converted.
+	 */
+	BOOL halfPrecision = (TSPixelConverterGetPlaneFormat(state.converter) == TSPixelConverterPlaneFormatFloat16);
+	Pixel_F *scaledPlane = NULL;
+	
+	if(halfPrecision) {
+		planeOut.rowBytes = TSPixelConverterGetFloatPlaneStride(state.converter);
+		
+		scaledPlane = (Pixel_F *) valloc(planeOut.rowBytes * planeOut.height);
+		planeOut.data = scaledPlane;
+	}
+	
 	void *vImageTemp = NULL;
 	err = vImageScale_PlanarF(&planeIn, &planeOut, NULL, kvImageGetTempBufferSize);
 	
@@ -1121,6 +1653,8 @@
 		vImageTemp = (void *) valloc(err);
 	} else {
 		DDLogError(@"Couldn't get size of temp buffer for scaling, error %lu", err);
+		
+		free(scaledPlane);
 		return;
 	}
 	
@@ -1128,7 +1662,9 @@
 	// read out full size data in, scale, copy into pixel converter's buffer
 	for(NSUInteger idx = 0; idx < 3; idx++) {
 		// get the output plane
-		planeOut = TSPixelConverterGetPlanevImageBufferBuffer(state.converter, idx);
+		if(halfPrecision == NO) {
+			planeOut = TSPixelConverterGetPlanevImageBufferBuffer(state.converter, idx);
+		}
 		
 		// set the input plane up
 		offset = idx * planeBytes;
@@ -1143,12 +1679,19 @@
 			
 			// clean up and exit
 			free(vImageTemp);
+			free(scaledPlane);
 			return;
 		}
+		
+		// convert the scaled plane to half precision
+		if(halfPrecision) {
+			TSPixelConverterLoadPlaneF(state.converter, idx, scaledPlane, planeOut.rowBytes);
+		}
 	}
 	
 	// clean up
 	free(vImageTemp);
+	free(scaledPlane);
 }
 
 #pragma mark Cache Operations
@@ -1158,6 +1701,8 @@
  */
 - (NSBlockOperation *) opStorePlanarInCache:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Update Cache");
 		
 		// if not caching, exit
@@ -1166,6 +1711,15 @@
 			return;
 		}
 		
+		// the cache must hold full size data, since any intent may resume from
+		// it; jobs with a smaller engine don't cache, so this shouldn't happen
+		if(TSRawDemosaicGetEngine(state.demosaicEngine)->shrink != 0) {
+			DDLogDebug(@"Not caching reduced size output of %s demosaic", TSRawDemosaicGetEngine(state.demosaicEngine)->name);
+			
+			TSEndOperation();
+			return;
+		}
+		
 		[self storeFloatDataCached:state];
 		
 		TSEndOperation();
@@ -1181,6 +1735,8 @@
  */
 - (NSBlockOperation *) opRestorePlanarFromCache:(TSRawPipelineState *) state {
 	NSBlockOperation *op = [NSBlockOperation blockOperationWithBlock:^{
+		TSReturnIfCancelled(state);
+		
 		TSBeginOperation(@"Restore Cached State");
 		
 		// if not caching, exit
@@ -1215,6 +1771,13 @@
 		[self cleanUpState:state];
 		
 		TSEndOperation();
+		
+		[state.metrics finish];
+		
+		// cancelled jobs didn't run all stages, so they'd skew the aggregates
+		if(state.isCancelled == NO) {
+			[self.telemetry addJob:state.metrics];
+		}
 	}];
 	
 	op.name = @"Clean Up";
@@ -1226,6 +1789,20 @@
  * object.
  */
 - (void) cleanUpState:(TSRawPipelineState *) state {
+	// let the caller know if the job was cancelled before it completed
+	[state completeIfCancelled];
+	
+	// the job is no longer the latest (or pending cache fill) for its image
+	dispatch_sync(self.jobTrackingQueue, ^{
+		if([self.latestJobs objectForKey:state.imageUuid] == state) {
+			[self.latestJobs removeObjectForKey:state.imageUuid];
+		}
+		
+		if([self.pendingCacheFills objectForKey:state.imageUuid] == state) {
+			[self.pendingCacheFills removeObjectForKey:state.imageUuid];
+		}
+	});
+	
 	// de-reference the images
 	state.image = nil;
 	state.rawImage = nil;
@@ -1233,9 +1810,21 @@
 	state.coreImageInput = nil;
 	state.cpuResult = nil;
 	
+	// return the buffers to the pool, and let the next job start
+	if(state.buffers != nil) {
+		state.converter = NULL;
+		state.frontBuf = NULL;
+		state.backBuf = NULL;
+		
+		[self.bufferPool checkInBuffers:state.buffers];
+		state.buffers = nil;
+		
+		dispatch_semaphore_signal(self.jobSlots);
+	}
+	
 	// free various other allocated buffers
 	free(state.histogramBuf);
-	free(state.gammaCurveBuf);
+	state.histogramBuf = NULL;
 }
 
 #pragma mark - Debugging Helpers
@@ -1248,6 +1837,12 @@
 	
 	void *buffer = TSPixelConverterGetRGBXPointer(state.converter);
 	
+	NSInteger bitsPerSample = 32;
+	
+	if(TSPixelConverterGetPlaneFormat(state.converter) == TSPixelConverterPlaneFormatFloat16) {
+		bitsPerSample = 16;
+	}
+	
 	// create a bitmap rep
 	NSBitmapImageRep *bm;
 	unsigned char *ptrs = { ((unsigned char*) buffer) };
@@ -1256,14 +1851,14 @@
 		  initWithBitmapDataPlanes:&ptrs
 		  pixelsWide:state.outputSize.width
 		  pixelsHigh:state.outputSize.height
-		  bitsPerSample:32
+		  bitsPerSample:bitsPerSample
 		  samplesPerPixel:4
 		  hasAlpha:YES
 		  isPlanar:NO
 		  colorSpaceName:NSCalibratedRGBColorSpace
 		  bitmapFormat:NSFloatingPointSamplesBitmapFormat
 		  bytesPerRow:TSPixelConverterGetRGBXStride(state.converter)
-		  bitsPerPixel:128];
+		  bitsPerPixel:(bitsPerSample * 4)];
 	
 	// tag it with the colour space
 	NSColorSpace *colourSpace = [NSColorSpace proPhotoRGBColorSpace];
@@ -0,0 +1,81 @@
+//
+//  TSRawPipelineBufferPool.h
+//  Avocado
+//
+//	A pool of the large buffers needed by a single RAW pipeline job: the
+//	pixel format converter, the interpolated colour buffer and the Bayer
+//	buffer. Jobs check out a set of buffers when they start, and return it
+//	when they finish, so that concurrent jobs never share buffers, while
+//	consecutive jobs don't have to allocate them again.
+//
+//	Buffers are sorted into buckets by image size, and are allocated to fit
+//	any image in their bucket; this way, images from cameras with slightly
+//	different sensor sizes can still share buffers.
+//
+//  Created by Tristan Seifert on 20160807.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+#import "TSPixelFormatConverter.h"
+
+/**
+ * A set of buffers for a single pipeline job. It's owned by the job between
+ * checking it out, and checking it back in.
+ */
+@interface TSRawPipelineBuffers : NSObject
+
+/// pixel format converter
+@property (nonatomic, readonly) TSPixelConverterRef converter;
+
+/// buffer for interpolated colour data; four 16 bit components per pixel
+@property (nonatomic, readonly) void *interpolatedColourBuf;
+/// size (in bytes) of the interpolated colour buffer
+@property (nonatomic, readonly) size_t interpolatedColourBufSz;
+
+/// buffer for the single component Bayer data, before demosaicing
+@property (nonatomic, readonly) uint16_t *bayerBuf;
+/// size (in bytes) of the Bayer buffer
+@property (nonatomic, readonly) size_t bayerBufSz;
+
+@end
+
+@interface TSRawPipelineBufferPool : NSObject
+
+/**
+ * Initializes a pool that keeps at most the given number of unused sets of
+ * buffers around; once that is exceeded, the least recently used set is
+ * freed.
+ */
+- (instancetype) initWithMaxIdleBuffers:(NSUInteger) maxIdle;
+
+/**
+ * Checks out a set of buffers for an image. Its converter is resized to the
+ * given size, and set to the given plane format.
+ *
+ * This is safe to call from any thread.
+ *
+ * @param imageSize Size of the raw image; the interpolated colour and Bayer
+ * buffers are at least large enough for it.
+ * @param converterSize Size of the image the converter will hold. This may be
+ * smaller than the raw image, if the demosaic engine scales it.
+ * @param format Format of the converter's planes.
+ */
+- (TSRawPipelineBuffers *) checkOutBuffersForImageSize:(NSSize) imageSize
+										 converterSize:(NSSize) converterSize
+										   planeFormat:(TSPixelConverterPlaneFormat) format;
+
+/**
+ * Returns a set of buffers to the pool. It may not be used afterwards.
+ *
+ * This is safe to call from any thread.
+ */
+- (void) checkInBuffers:(TSRawPipelineBuffers *) buffers;
+
+/**
+ * Frees all unused buffers. Buffers that are checked out are unaffected.
+ */
+- (void) removeIdleBuffers;
+
+@end
@@ -0,0 +1,181 @@
+//
+//  TSRawPipelineBufferPool.m
+//  Avocado
+//
+//  Created by Tristan Seifert on 20160807.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import "TSRawPipelineBufferPool.h"
+
+/// number of pixels covered by each bucket; about four megapixels
+static const NSUInteger TSRawPipelineBufferPoolBucketPixels = (1 << 22);
+
+@interface TSRawPipelineBuffers ()
+
+@property (nonatomic) TSPixelConverterRef converter;
+
+@property (nonatomic) void *interpolatedColourBuf;
+@property (nonatomic) size_t interpolatedColourBufSz;
+
+@property (nonatomic) uint16_t *bayerBuf;
+@property (nonatomic) size_t bayerBufSz;
+
+/// bucket into which the buffers were sorted
+@property (nonatomic) NSUInteger bucket;
+
+- (instancetype) initWithBucket:(NSUInteger) bucket converterSize:(NSSize) size;
+
+@end
+
+@interface TSRawPipelineBufferPool ()
+
+/// buffers that aren't checked out; the least recently used are first.
+@property (nonatomic) NSMutableArray<TSRawPipelineBuffers *> *idleBuffers;
+/// maximum number of idle buffers to keep around
+@property (nonatomic) NSUInteger maxIdleBuffers;
+
+/// access queue; used to synchronize access to the idle buffers
+@property (nonatomic, retain) dispatch_queue_t accessQueue;
+
+@end
+
+@implementation TSRawPipelineBuffers
+
+/**
+ * Allocates buffers large enough for any image in the given bucket, and a
+ * converter of the given size.
+ */
+- (instancetype) initWithBucket:(NSUInteger) bucket converterSize:(NSSize) size {
+	if(self = [super init]) {
+		const NSUInteger pixels = bucket * TSRawPipelineBufferPoolBucketPixels;
+		
+		self.bucket = bucket;
+		
+		self.converter = TSPixelConverterCreate(NULL, size.width, size.height);
+		
+		self.interpolatedColourBufSz = pixels * 4 * sizeof(uint16_t);
+		self.interpolatedColourBuf = valloc(self.interpolatedColourBufSz);
+		
+		self.bayerBufSz = pixels * sizeof(uint16_t);
+		self.bayerBuf = (uint16_t *) valloc(self.bayerBufSz);
+		
+		DDLogDebug(@"Allocated %lu bytes of buffers for bucket %lu", (self.interpolatedColourBufSz + self.bayerBufSz), bucket);
+	}
+	
+	return self;
+}
+
+/**
+ * Frees all buffers.
+ */
+- (void) dealloc {
+	TSPixelConverterFree(self.converter);
+	free(self.interpolatedColourBuf);
+	free(self.bayerBuf);
+}
+
+@end
+
+@implementation TSRawPipelineBufferPool
+
+#pragma mark Initialization
+/**
+ * Sets up the pool.
+ */
+- (instancetype) initWithMaxIdleBuffers:(NSUInteger) maxIdle {
+	if(self = [super init]) {
+		self.idleBuffers = [NSMutableArray new];
+		self.maxIdleBuffers = maxIdle;
+		
+		self.accessQueue = dispatch_queue_create("me.tseifert.Avocado.TSRawPipelineBufferPool", DISPATCH_QUEUE_SERIAL);
+	}
+	
+	return self;
+}
+
+/**
+ * Creates a pool that keeps a single set of idle buffers.
+ */
+- (instancetype) init {
+	return [self initWithMaxIdleBuffers:1];
+}
+
+#pragma mark Buffers
+/**
+ * Checks out a set of buffers for an image. Buffers from the right bucket
+ * whose converter already has the right size are preferred, since they don't
+ * need to be resized at all.
+ */
+- (TSRawPipelineBuffers *) checkOutBuffersForImageSize:(NSSize) imageSize
+										 converterSize:(NSSize) converterSize
+										   planeFormat:(TSPixelConverterPlaneFormat) format {
+	const NSUInteger pixels = ((NSUInteger) imageSize.width) * ((NSUInteger) imageSize.height);
+	const NSUInteger bucket = MAX((pixels + TSRawPipelineBufferPoolBucketPixels - 1) / TSRawPipelineBufferPoolBucketPixels, 1);
+	
+	__block TSRawPipelineBuffers *buffers = nil;
+	
+	dispatch_sync(self.accessQueue, ^{
+		NSUInteger match = NSNotFound;
+		
+		// find the most recently used buffers in the bucket
+		for(NSUInteger i = self.idleBuffers.count; i > 0; i--) {
+			TSRawPipelineBuffers *candidate = self.idleBuffers[i - 1];
+			
+			if(candidate.bucket != bucket) {
+				continue;
+			}
+			
+			// stop looking if the converter has the right size
+			NSUInteger w, h;
+			TSPixelConverterGetSize(candidate.converter, &w, &h);
+			
+			match = i - 1;
+			
+			if(w == converterSize.width && h == converterSize.height) {
+				break;
+			}
+		}
+		
+		if(match != NSNotFound) {
+			buffers = self.idleBuffers[match];
+			[self.idleBuffers removeObjectAtIndex:match];
+		}
+	});
+	
+	// allocate new buffers if there were no suitable ones
+	if(buffers == nil) {
+		buffers = [[TSRawPipelineBuffers alloc] initWithBucket:bucket converterSize:converterSize];
+	}
+	
+	// set up the converter; this also resets it if its planes were rotated
+	TSPixelConverterResize(buffers.converter, converterSize.width, converterSize.height);
+	TSPixelConverterSetPlaneFormat(buffers.converter, format);
+	
+	return buffers;
+}
+
+/**
+ * Returns a set of buffers to the pool; if there are too many idle buffers
+ * afterwards, the least recently used ones are freed.
+ */
+- (void) checkInBuffers:(TSRawPipelineBuffers *) buffers {
+	dispatch_sync(self.accessQueue, ^{
+		[self.idleBuffers addObject:buffers];
+		
+		while(self.idleBuffers.count > self.maxIdleBuffers) {
+			[self.idleBuffers removeObjectAtIndex:0];
+		}
+	});
+}
+
+/**
+ * Frees all unused buffers.
+ */
+- (void) removeIdleBuffers {
+	dispatch_sync(self.accessQueue, ^{
+		[self.idleBuffers removeAllObjects];
+	});
+}
+
+@end
@@ -11,13 +11,15 @@
 #import "TSRawPipeline.h"
 #import "TSPixelFormatConverter.h"
 #import "TSRawPipeline.h"
-
-#import "lensfun.h"
+#import "TSRawDemosaic.h"
+#import "TSRawPipelineTelemetry.h"
 
 @class NSManagedObjectContext;
 @class CIImage;
 @class TSLibraryImage;
 @class TSRawImage;
+@class TSRawLUT;
+@class TSRawPipelineBuffers;
 @interface TSRawPipelineState : NSObject
 
 /// the current processing step
@@ -36,35 +38,53 @@
 @property (nonatomic) TSRawImage *rawImage;
 /// whether results of this processing step should be cached or naw
 @property (nonatomic) BOOL shouldCache;
+/// whether the job was prevented from resuming with cached data
+@property (nonatomic) BOOL inhibitCachedResume;
+/// when set, the job only fills the planar cache, and doesn't produce an image
+@property (nonatomic) BOOL fillsCache;
 /// rendering intent for the pipeline
 @property (nonatomic) TSRawPipelineIntent intent;
+/// demosaic engine used to interpolate colour data; chosen based on the intent
+@property (nonatomic) TSRawDemosaicEngine demosaicEngine;
+/// when set, the image is streamed in strips up to the planar conversion
+@property (nonatomic) BOOL streamsStrips;
+
+/// performance metrics of the job; each stage adds its own as it finishes
+@property (nonatomic) TSRawPipelineJobMetrics *metrics;
 
-/// 64bpp buffer for the interpolated RGBX data; used by converter.
-@property (nonatomic) void *interpolatedColourBuf;
+/**
+ * Frame buffers for 64bpp RGBX data, between which stages ping-pong: a stage
+ * reads the front buffer, and either modifies it in place, or writes its
+ * output to the back buffer and then swaps the two. Later stages thus always
+ * find the current image in the front buffer, and no copies are needed.
+ */
+@property (nonatomic) void *frontBuf;
+/// back buffer; its contents are undefined between stages.
+@property (nonatomic) void *backBuf;
 /// histogram buffer; 0x2000 bins for each of the four possible colours, 32-bit int value per
 @property (nonatomic) int *histogramBuf;
-/// gamma curve buffer, 0x10000 * sizeof(uint16_t)
-@property (nonatomic) uint16_t *gammaCurveBuf;
 
 /// size of the image being processed
 @property (nonatomic) NSSize rawSize;
 /// output size of the image; if rotation is applied, this is changed as needed.
 @property (nonatomic) NSSize outputSize;
 
-/// pixel format converter (may be shared/re-used)
+/// buffers checked out of the pipeline's pool for this job
+@property (nonatomic) TSRawPipelineBuffers *buffers;
+/// pixel format converter; part of the buffers
 @property (nonatomic) TSPixelConverterRef converter;
 
 /// completion callback
 @property (nonatomic) TSRawPipelineCompletionCallback completionCallback;
+/// preview callback; may be nil
+@property (nonatomic) TSRawPipelinePreviewCallback previewCallback;
 /// progress callback
 @property (nonatomic) TSRawPipelineProgressCallback progressCallback;
 
 /// when yes, lens corrections will be applied
 @property (nonatomic) BOOL applyLensCorrections;
-/// lens for which correction is applied
-@property (nonatomic) lfLens *lcLens;
-/// image modifier for lens corrections, based on the above lens
-@property (nonatomic) lfModifier *lcModifier;
+/// remap grid for lens corrections; its table is a TSLFRemapGrid
+@property (nonatomic) TSRawLUT *lcGrid;
 
 /// desired output format
 @property (nonatomic) TSRawPipelineOutputFormat outFormat;
@@ -79,6 +99,12 @@
  */
 -(void) addOperation:(NSOperation *) op;
 
+/**
+ * Swaps the front and back frame buffers; call this after a stage has written
+ * its output to the back buffer.
+ */
+- (void) swapFrameBuffers;
+
 /**
  * Executes the success callback with the given image.
  */
@@ -89,4 +115,23 @@
  */
 - (void) terminateWithError:(NSError *) err;
 
+/**
+ * Set once the job is cancelled; each stage checks this before it starts.
+ */
+@property (atomic, readonly, getter=isCancelled) BOOL cancelled;
+
+/**
+ * Cancels the job, unless it has already completed.
+ *
+ * @return Whether the job was cancelled.
+ */
+- (BOOL) cancel;
+
+/**
+ * Executes the completion callback with a NSUserCancelledError, if the job
+ * was cancelled before it completed. This is called when the job is cleaned
+ * up.
+ */
+- (void) completeIfCancelled;
+
 @end
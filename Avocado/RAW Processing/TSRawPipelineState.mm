@@ -15,6 +15,10 @@ void *TSStageKVOCtx = &TSStageKVOCtx;
 /// All operations associated with this invocation of the pipeline.
 @property (nonatomic) NSMutableSet<NSOperation *> *operations;
 
+@property (atomic, readwrite, getter=isCancelled) BOOL cancelled;
+/// set once the completion callback has been executed
+@property (atomic) BOOL completed;
+
 @end
 
 @implementation TSRawPipelineState
@@ -57,10 +61,24 @@ void *TSStageKVOCtx = &TSStageKVOCtx;
 	}
 }
 
+/**
+ * Swaps the front and back frame buffers.
+ */
+- (void) swapFrameBuffers {
+	void *buf = self.frontBuf;
+	
+	self.frontBuf = self.backBuf;
+	self.backBuf = buf;
+}
+
 /**
  * Executes the success callback with the given image.
  */
 - (void) completeWithImage:(NSImage *) image {
+	@synchronized(self) {
+		self.completed = YES;
+	}
+	
 	self.completionCallback(image, nil);
 }
 
@@ -91,6 +109,46 @@ void *TSStageKVOCtx = &TSStageKVOCtx;
 	}];
 	
 	// run the cancel handler
+	@synchronized(self) {
+		self.completed = YES;
+	}
+	
+	self.completionCallback(nil, err);
+}
+
+/**
+ * Cancels the job, unless it has already completed. Operations are not
+ * cancelled themselves, since a cancelled operation no longer waits for the
+ * operations it depends on; instead, they check the flag when they start.
+ */
+- (BOOL) cancel {
+	@synchronized(self) {
+		if(self.completed || self.cancelled) {
+			return NO;
+		}
+		
+		self.cancelled = YES;
+	}
+	
+	return YES;
+}
+
+/**
+ * Executes the completion callback with a NSUserCancelledError, if the job
+ * was cancelled before it completed.
+ */
+- (void) completeIfCancelled {
+	@synchronized(self) {
+		if(self.cancelled == NO || self.completed) {
+			return;
+		}
+		
+		self.completed = YES;
+	}
+	
+	NSError *err = [NSError errorWithDomain:NSCocoaErrorDomain
+									   code:NSUserCancelledError
+								   userInfo:nil];
 	self.completionCallback(nil, err);
 }
 
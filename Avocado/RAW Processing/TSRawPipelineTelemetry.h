@@ -0,0 +1,239 @@
+//
+//  TSRawPipelineTelemetry.h
+//  Avocado
+//
+//	Performance telemetry for the RAW pipeline. Each job records the wall
+//	time of every stage it runs, along with the size of its input and whether
+//	it was resumed from the cache. The CPU time and heap growth of the process
+//	during each stage are recorded too, but can only be attributed to the
+//	stage if no other job was in flight at the time. Finished jobs are
+//	collected by the pipeline, which keeps a rolling window of them to compute
+//	per-stage aggregates, and can dump them as JSON so they can be compared
+//	across releases.
+//
+//  Created by Tristan Seifert on 20160810.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ * Whether a job could use the data cache.
+ */
+typedef NS_ENUM(NSUInteger, TSRawPipelineCacheResult) {
+	/// Caching was disabled for the job, or resuming from the cache was inhibited.
+	TSRawPipelineCacheResultNotApplicable,
+	/// The job resumed from cached data.
+	TSRawPipelineCacheResultHit,
+	/// There was no cached data; the job ran the full pipeline.
+	TSRawPipelineCacheResultMiss,
+};
+
+/**
+ * A point in time at which resource usage was sampled; the difference between
+ * two samples is what a stage used.
+ */
+typedef struct {
+	/// monotonic wall clock time, in nanoseconds
+	uint64_t wallTime;
+	/// user and system CPU time of the whole process, in nanoseconds
+	uint64_t processCpuTime;
+	/// bytes of heap memory in use by the whole process
+	int64_t heapBytes;
+	
+	/// number of jobs in flight (queued or running) in the process
+	uint32_t jobsInFlight;
+	/// number of jobs that have been queued in the process so far
+	uint64_t jobsStarted;
+} TSRawPipelineSample;
+
+/**
+ * Samples the current resource usage.
+ *
+ * Stages are spread over all cores, so CPU time and heap usage are measured
+ * for the entire process, rather than the calling thread. The number of jobs
+ * in flight is sampled as well, so that a stage can tell whether another job
+ * may have contributed to them.
+ */
+TSRawPipelineSample TSRawPipelineSampleNow(void);
+
+/**
+ * Measurements of a single stage of a job.
+ */
+@interface TSRawPipelineStageMetrics : NSObject
+
+/// name of the stage
+@property (nonatomic, readonly) NSString *name;
+
+/// time from the start to the end of the stage, in seconds
+@property (nonatomic, readonly) NSTimeInterval wallTime;
+/// CPU time used by the whole process during the stage, in seconds
+@property (nonatomic, readonly) NSTimeInterval processCpuTime;
+/// growth of the process' heap during the stage, in bytes; negative if memory
+/// was freed
+@property (nonatomic, readonly) int64_t heapGrowth;
+/// whether the stage's job was the only one in flight for the entire stage;
+/// only then can the process CPU time and heap growth be attributed to it
+@property (nonatomic, readonly, getter=isExclusive) BOOL exclusive;
+
+/// size of the job's input image, in megapixels
+@property (nonatomic, readonly) double megapixels;
+/// whether the job the stage belongs to resumed from the cache
+@property (nonatomic, readonly) TSRawPipelineCacheResult cacheResult;
+
+/**
+ * Returns the metrics as a dictionary that can be serialized to JSON.
+ */
+- (NSDictionary<NSString *, id> *) dictionaryRepresentation;
+
+@end
+
+/**
+ * Measurements of a single pipeline job. Stages may record their metrics from
+ * any thread.
+ */
+@interface TSRawPipelineJobMetrics : NSObject
+
+/**
+ * Initializes the metrics of a job that is queued now. The job counts as in
+ * flight until it's finished, or the metrics are deallocated.
+ *
+ * @param uuid UUID of the image processed by the job.
+ * @param megapixels Size of the raw image, in megapixels.
+ */
+- (instancetype) initWithImageUuid:(NSString *) uuid megapixels:(double) megapixels;
+
+/// UUID of the image processed by the job
+@property (nonatomic, readonly) NSString *imageUuid;
+/// size of the raw image, in megapixels
+@property (nonatomic, readonly) double megapixels;
+/// whether the job resumed from the cache; set when the job is queued
+@property (atomic) TSRawPipelineCacheResult cacheResult;
+/// name of the demosaic engine, if the job demosaiced the image
+@property (atomic) NSString *demosaicEngine;
+/// whether the early stages were streamed in strips
+@property (atomic) BOOL streamed;
+
+/// all stages that have finished so far, in the order in which they finished
+@property (atomic, readonly) NSArray<TSRawPipelineStageMetrics *> *stages;
+
+/// time from queueing the job until it finished, in seconds; 0 until then
+@property (atomic, readonly) NSTimeInterval wallTime;
+/// sum of the process CPU time of all stages, in seconds
+@property (atomic, readonly) NSTimeInterval processCpuTime;
+/// sum of the process heap growth of all stages, in bytes
+@property (atomic, readonly) int64_t heapGrowth;
+/// whether all stages were exclusive, i.e. the sums above belong to this job
+@property (atomic, readonly, getter=isExclusive) BOOL exclusive;
+
+/**
+ * Records a stage that began at the given sample, and ends now.
+ *
+ * @return The metrics of the stage.
+ */
+- (TSRawPipelineStageMetrics *) recordStage:(NSString *) name since:(TSRawPipelineSample) begin;
+
+/**
+ * Marks the job as finished; this sets its wall time, and it no longer counts
+ * as in flight. Only the first call has any effect.
+ */
+- (void) finish;
+
+/**
+ * Returns the metrics, including those of all stages, as a dictionary that can
+ * be serialized to JSON.
+ */
+- (NSDictionary<NSString *, id> *) dictionaryRepresentation;
+
+@end
+
+/**
+ * Aggregated measurements of all runs of one stage.
+ */
+@interface TSRawPipelineStageAggregate : NSObject
+
+/// name of the stage
+@property (nonatomic, readonly) NSString *name;
+/// number of runs of the stage
+@property (nonatomic, readonly) NSUInteger count;
+
+/// mean, minimum and maximum wall time of a run, in seconds
+@property (nonatomic, readonly) NSTimeInterval meanWallTime;
+@property (nonatomic, readonly) NSTimeInterval minWallTime;
+@property (nonatomic, readonly) NSTimeInterval maxWallTime;
+/// mean wall time per megapixel of input, in seconds
+@property (nonatomic, readonly) NSTimeInterval meanWallTimePerMegapixel;
+
+/// number of runs during which no other job was in flight
+@property (nonatomic, readonly) NSUInteger exclusiveCount;
+/// mean process CPU time of the exclusive runs, in seconds; 0 if there are none
+@property (nonatomic, readonly) NSTimeInterval meanProcessCpuTime;
+/// mean process heap growth of the exclusive runs, in bytes; 0 if there are none
+@property (nonatomic, readonly) double meanHeapGrowth;
+
+/// number of runs that belonged to jobs that resumed from the cache
+@property (nonatomic, readonly) NSUInteger cacheHits;
+/// number of runs that belonged to jobs that found no cached data
+@property (nonatomic, readonly) NSUInteger cacheMisses;
+
+/**
+ * Returns the aggregate as a dictionary that can be serialized to JSON.
+ */
+- (NSDictionary<NSString *, id> *) dictionaryRepresentation;
+
+@end
+
+/**
+ * Collects the metrics of finished jobs. This is safe to use from any thread.
+ */
+@interface TSRawPipelineTelemetry : NSObject
+
+/**
+ * Initializes telemetry that keeps the given number of recent jobs.
+ */
+- (instancetype) initWithMaxRecentJobs:(NSUInteger) maxJobs;
+
+/// maximum number of jobs that aggregates are computed over
+@property (nonatomic, readonly) NSUInteger maxRecentJobs;
+
+/**
+ * If set, the metrics of each finished job are appended to this file, as a
+ * single line of JSON.
+ */
+@property (atomic) NSURL *jobLogURL;
+
+/**
+ * Adds the metrics of a finished job; if there are more than the maximum
+ * number of recent jobs afterwards, the oldest one is removed.
+ */
+- (void) addJob:(TSRawPipelineJobMetrics *) job;
+
+/**
+ * Returns the recent jobs, oldest first.
+ */
+- (NSArray<TSRawPipelineJobMetrics *> *) recentJobs;
+
+/**
+ * Aggregates the stages of all recent jobs, by name.
+ */
+- (NSDictionary<NSString *, TSRawPipelineStageAggregate *> *) stageAggregates;
+
+/**
+ * Removes all recent jobs.
+ */
+- (void) reset;
+
+/**
+ * Returns the stage aggregates and all recent jobs as a dictionary that can be
+ * serialized to JSON.
+ */
+- (NSDictionary<NSString *, id> *) dictionaryRepresentation;
+
+/**
+ * Writes the dictionary representation to the given file as JSON.
+ *
+ * @return Whether the file was written; if not, the error is returned in err.
+ */
+- (BOOL) writeJSONToURL:(NSURL *) url error:(NSError **) err;
+
+@end
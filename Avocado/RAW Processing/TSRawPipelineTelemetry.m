@@ -0,0 +1,602 @@
+//
+//  TSRawPipelineTelemetry.m
+//  Avocado
+//
+//  Created by Tristan Seifert on 20160810.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import "TSRawPipelineTelemetry.h"
+
+#import <mach/mach_time.h>
+#import <malloc/malloc.h>
+#import <sys/resource.h>
+#import <stdatomic.h>
+
+/// number of recent jobs kept by default
+static const NSUInteger TSRawPipelineTelemetryDefaultMaxJobs = 64;
+
+/// number of jobs in flight in the process, across all pipelines
+static atomic_uint TSRawPipelineJobsInFlight = 0;
+/// number of jobs that have been queued in the process, across all pipelines
+static atomic_ullong TSRawPipelineJobsStarted = 0;
+
+/**
+ * Returns the string used for a cache result in the JSON output.
+ */
+static NSString *TSRawPipelineCacheResultName(TSRawPipelineCacheResult result) {
+	switch(result) {
+		case TSRawPipelineCacheResultHit:
+			return @"hit";
+		case TSRawPipelineCacheResultMiss:
+			return @"miss";
+		case TSRawPipelineCacheResultNotApplicable:
+		default:
+			return @"n/a";
+	}
+}
+
+/**
+ * Converts a timeval to nanoseconds.
+ */
+static inline uint64_t TSTimevalToNanos(struct timeval tv) {
+	return (((uint64_t) tv.tv_sec) * NSEC_PER_SEC) + (((uint64_t) tv.tv_usec) * NSEC_PER_USEC);
+}
+
+/**
+ * Samples the wall clock, the CPU time of the process (from getrusage), the
+ * number of bytes in use in all malloc zones, and the job counters.
+ */
+TSRawPipelineSample TSRawPipelineSampleNow(void) {
+	static mach_timebase_info_data_t timebase;
+	static dispatch_once_t onceToken;
+	
+	dispatch_once(&onceToken, ^{
+		mach_timebase_info(&timebase);
+	});
+	
+	TSRawPipelineSample sample;
+	
+	// wall clock
+	sample.wallTime = (mach_absolute_time() * timebase.numer) / timebase.denom;
+	
+	// jobs that may be using the CPU and heap
+	sample.jobsInFlight = atomic_load(&TSRawPipelineJobsInFlight);
+	sample.jobsStarted = atomic_load(&TSRawPipelineJobsStarted);
+	
+	// CPU time of all threads
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	
+	sample.processCpuTime = TSTimevalToNanos(usage.ru_utime) + TSTimevalToNanos(usage.ru_stime);
+	
+	// heap usage, across all zones
+	malloc_statistics_t stats;
+	malloc_zone_statistics(NULL, &stats);
+	
+	sample.heapBytes = (int64_t) stats.size_in_use;
+	
+	return sample;
+}
+
+#pragma mark - Stage Metrics
+@interface TSRawPipelineStageMetrics ()
+
+@property (nonatomic, readwrite) NSString *name;
+
+@property (nonatomic, readwrite) NSTimeInterval wallTime;
+@property (nonatomic, readwrite) NSTimeInterval processCpuTime;
+@property (nonatomic, readwrite) int64_t heapGrowth;
+@property (nonatomic, readwrite, getter=isExclusive) BOOL exclusive;
+
+@property (nonatomic, readwrite) double megapixels;
+@property (nonatomic, readwrite) TSRawPipelineCacheResult cacheResult;
+
+@end
+
+@implementation TSRawPipelineStageMetrics
+
+/**
+ * Returns the metrics as a dictionary.
+ */
+- (NSDictionary<NSString *, id> *) dictionaryRepresentation {
+	return @{
+		@"name": self.name,
+		@"wallTime": @(self.wallTime),
+		@"processCpuTime": @(self.processCpuTime),
+		@"heapGrowth": @(self.heapGrowth),
+		@"exclusive": @(self.exclusive),
+		@"megapixels": @(self.megapixels),
+		@"cache": TSRawPipelineCacheResultName(self.cacheResult)
+	};
+}
+
+/**
+ * Returns a short, human readable summary of the metrics.
+ */
+- (NSString *) description {
+	return [NSString stringWithFormat:@"%.4fs wall, %.4fs process CPU, %lld bytes heap growth%@", self.wallTime, self.processCpuTime, self.heapGrowth, (self.exclusive) ? @"" : @" (other jobs in flight)"];
+}
+
+@end
+
+#pragma mark - Job Metrics
+@interface TSRawPipelineJobMetrics ()
+
+@property (nonatomic, readwrite) NSString *imageUuid;
+@property (nonatomic, readwrite) double megapixels;
+
+/// stages that have finished; only accessed while synchronized on self
+@property (nonatomic) NSMutableArray<TSRawPipelineStageMetrics *> *finishedStages;
+
+/// wall clock time at which the job was queued, in nanoseconds
+@property (nonatomic) uint64_t queuedAt;
+@property (atomic, readwrite) NSTimeInterval wallTime;
+/// set once the job no longer counts as in flight
+@property (atomic) BOOL finished;
+
+@end
+
+@implementation TSRawPipelineJobMetrics
+
+/**
+ * Initializes the metrics, and takes note of the time.
+ */
+- (instancetype) initWithImageUuid:(NSString *) uuid megapixels:(double) megapixels {
+	if(self = [super init]) {
+		self.imageUuid = uuid;
+		self.megapixels = megapixels;
+		
+		self.finishedStages = [NSMutableArray new];
+		
+		atomic_fetch_add(&TSRawPipelineJobsStarted, 1);
+		atomic_fetch_add(&TSRawPipelineJobsInFlight, 1);
+		
+		self.queuedAt = TSRawPipelineSampleNow().wallTime;
+	}
+	
+	return self;
+}
+
+/**
+ * Ensures that a job that was never finished doesn't count as in flight
+ * forever.
+ */
+- (void) dealloc {
+	if(self.finished == NO) {
+		atomic_fetch_sub(&TSRawPipelineJobsInFlight, 1);
+	}
+}
+
+/**
+ * Returns a copy of the stages that have finished.
+ */
+- (NSArray<TSRawPipelineStageMetrics *> *) stages {
+	@synchronized(self) {
+		return [self.finishedStages copy];
+	}
+}
+
+/**
+ * Sums up the process CPU time of all stages.
+ */
+- (NSTimeInterval) processCpuTime {
+	NSTimeInterval total = 0;
+	
+	for(TSRawPipelineStageMetrics *stage in self.stages) {
+		total += stage.processCpuTime;
+	}
+	
+	return total;
+}
+
+/**
+ * Sums up the process heap growth of all stages.
+ */
+- (int64_t) heapGrowth {
+	int64_t total = 0;
+	
+	for(TSRawPipelineStageMetrics *stage in self.stages) {
+		total += stage.heapGrowth;
+	}
+	
+	return total;
+}
+
+/**
+ * Checks whether all stages were exclusive.
+ */
+- (BOOL) isExclusive {
+	for(TSRawPipelineStageMetrics *stage in self.stages) {
+		if(stage.exclusive == NO) {
+			return NO;
+		}
+	}
+	
+	return YES;
+}
+
+/**
+ * Calculates the difference between the given sample and now, and adds it to
+ * the job as a stage.
+ *
+ * The stage is exclusive if this job was the only one in flight both at the
+ * start and at the end, and no job was queued in between; a job that was
+ * queued and finished during the stage would otherwise go unnoticed.
+ */
+- (TSRawPipelineStageMetrics *) recordStage:(NSString *) name since:(TSRawPipelineSample) begin {
+	TSRawPipelineSample end = TSRawPipelineSampleNow();
+	
+	TSRawPipelineStageMetrics *stage = [TSRawPipelineStageMetrics new];
+	stage.name = name;
+	
+	stage.wallTime = ((double) (end.wallTime - begin.wallTime)) / NSEC_PER_SEC;
+	stage.processCpuTime = ((double) (end.processCpuTime - begin.processCpuTime)) / NSEC_PER_SEC;
+	stage.heapGrowth = end.heapBytes - begin.heapBytes;
+	
+	stage.exclusive = (begin.jobsInFlight == 1 && end.jobsInFlight == 1 &&
+					   begin.jobsStarted == end.jobsStarted);
+	
+	stage.megapixels = self.megapixels;
+	stage.cacheResult = self.cacheResult;
+	
+	@synchronized(self) {
+		[self.finishedStages addObject:stage];
+	}
+	
+	return stage;
+}
+
+/**
+ * Sets the wall time of the job, and removes it from the jobs in flight.
+ */
+- (void) finish {
+	@synchronized(self) {
+		if(self.finished) {
+			return;
+		}
+		
+		self.finished = YES;
+	}
+	
+	uint64_t now = TSRawPipelineSampleNow().wallTime;
+	self.wallTime = ((double) (now - self.queuedAt)) / NSEC_PER_SEC;
+	
+	atomic_fetch_sub(&TSRawPipelineJobsInFlight, 1);
+}
+
+/**
+ * Returns the metrics as a dictionary.
+ */
+- (NSDictionary<NSString *, id> *) dictionaryRepresentation {
+	NSMutableArray *stages = [NSMutableArray new];
+	
+	for(TSRawPipelineStageMetrics *stage in self.stages) {
+		[stages addObject:stage.dictionaryRepresentation];
+	}
+	
+	return @{
+		@"imageUuid": self.imageUuid ?: [NSNull null],
+		@"megapixels": @(self.megapixels),
+		@"cache": TSRawPipelineCacheResultName(self.cacheResult),
+		@"demosaicEngine": self.demosaicEngine ?: [NSNull null],
+		@"streamed": @(self.streamed),
+		@"wallTime": @(self.wallTime),
+		@"processCpuTime": @(self.processCpuTime),
+		@"heapGrowth": @(self.heapGrowth),
+		@"exclusive": @(self.exclusive),
+		@"stages": stages
+	};
+}
+
+@end
+
+#pragma mark - Stage Aggregates
+@interface TSRawPipelineStageAggregate ()
+
+@property (nonatomic, readwrite) NSString *name;
+@property (nonatomic, readwrite) NSUInteger count;
+
+@property (nonatomic) NSTimeInterval totalWallTime;
+@property (nonatomic, readwrite) NSTimeInterval minWallTime;
+@property (nonatomic, readwrite) NSTimeInterval maxWallTime;
+@property (nonatomic) NSTimeInterval totalWallTimePerMegapixel;
+/// number of runs whose input size was known
+@property (nonatomic) NSUInteger sizedCount;
+
+@property (nonatomic, readwrite) NSUInteger exclusiveCount;
+@property (nonatomic) NSTimeInterval totalProcessCpuTime;
+@property (nonatomic) double totalHeapGrowth;
+
+@property (nonatomic, readwrite) NSUInteger cacheHits;
+@property (nonatomic, readwrite) NSUInteger cacheMisses;
+
+- (instancetype) initWithName:(NSString *) name;
+- (void) addStage:(TSRawPipelineStageMetrics *) stage;
+
+@end
+
+@implementation TSRawPipelineStageAggregate
+
+/**
+ * Initializes an empty aggregate.
+ */
+- (instancetype) initWithName:(NSString *) name {
+	if(self = [super init]) {
+		self.name = name;
+		self.minWallTime = DBL_MAX;
+	}
+	
+	return self;
+}
+
+/**
+ * Adds a single run of the stage. Its process CPU time and heap growth are
+ * only included if no other job was in flight during the run, since they'd
+ * otherwise include the other jobs' usage as well.
+ */
+- (void) addStage:(TSRawPipelineStageMetrics *) stage {
+	self.count++;
+	
+	self.totalWallTime += stage.wallTime;
+	self.minWallTime = MIN(self.minWallTime, stage.wallTime);
+	self.maxWallTime = MAX(self.maxWallTime, stage.wallTime);
+	
+	if(stage.megapixels > 0) {
+		self.totalWallTimePerMegapixel += stage.wallTime / stage.megapixels;
+		self.sizedCount++;
+	}
+	
+	if(stage.exclusive) {
+		self.exclusiveCount++;
+		
+		self.totalProcessCpuTime += stage.processCpuTime;
+		self.totalHeapGrowth += stage.heapGrowth;
+	}
+	
+	if(stage.cacheResult == TSRawPipelineCacheResultHit) {
+		self.cacheHits++;
+	} else if(stage.cacheResult == TSRawPipelineCacheResultMiss) {
+		self.cacheMisses++;
+	}
+}
+
+/**
+ * Returns the mean wall time of a run.
+ */
+- (NSTimeInterval) meanWallTime {
+	return (self.count) ? (self.totalWallTime / self.count) : 0;
+}
+
+/**
+ * Returns the mean wall time per megapixel, over all runs with a known size.
+ */
+- (NSTimeInterval) meanWallTimePerMegapixel {
+	return (self.sizedCount) ? (self.totalWallTimePerMegapixel / self.sizedCount) : 0;
+}
+
+/**
+ * Returns the mean process CPU time of the exclusive runs.
+ */
+- (NSTimeInterval) meanProcessCpuTime {
+	return (self.exclusiveCount) ? (self.totalProcessCpuTime / self.exclusiveCount) : 0;
+}
+
+/**
+ * Returns the mean process heap growth of the exclusive runs.
+ */
+- (double) meanHeapGrowth {
+	return (self.exclusiveCount) ? (self.totalHeapGrowth / self.exclusiveCount) : 0;
+}
+
+/**
+ * Returns the aggregate as a dictionary. The process CPU time and heap growth
+ * are left out if there were no exclusive runs.
+ */
+- (NSDictionary<NSString *, id> *) dictionaryRepresentation {
+	NSMutableDictionary *dict = [@{
+		@"name": self.name,
+		@"count": @(self.count),
+		@"meanWallTime": @(self.meanWallTime),
+		@"minWallTime": @((self.count) ? self.minWallTime : 0),
+		@"maxWallTime": @(self.maxWallTime),
+		@"meanWallTimePerMegapixel": @(self.meanWallTimePerMegapixel),
+		@"exclusiveCount": @(self.exclusiveCount),
+		@"cacheHits": @(self.cacheHits),
+		@"cacheMisses": @(self.cacheMisses)
+	} mutableCopy];
+	
+	if(self.exclusiveCount) {
+		dict[@"meanProcessCpuTime"] = @(self.meanProcessCpuTime);
+		dict[@"meanHeapGrowth"] = @(self.meanHeapGrowth);
+	}
+	
+	return dict;
+}
+
+@end
+
+#pragma mark - Telemetry
+@interface TSRawPipelineTelemetry ()
+
+@property (nonatomic, readwrite) NSUInteger maxRecentJobs;
+
+/// finished jobs, oldest first
+@property (nonatomic) NSMutableArray<TSRawPipelineJobMetrics *> *jobs;
+
+/// access queue; used to synchronize access to the jobs
+@property (nonatomic, retain) dispatch_queue_t accessQueue;
+/// queue on which the job log is written
+@property (nonatomic, retain) dispatch_queue_t logQueue;
+
+- (void) appendJobToLog:(TSRawPipelineJobMetrics *) job;
+
+@end
+
+@implementation TSRawPipelineTelemetry
+
+#pragma mark Initialization
+/**
+ * Sets up the telemetry.
+ */
+- (instancetype) initWithMaxRecentJobs:(NSUInteger) maxJobs {
+	if(self = [super init]) {
+		self.maxRecentJobs = MAX(maxJobs, 1);
+		self.jobs = [NSMutableArray new];
+		
+		self.accessQueue = dispatch_queue_create("me.tseifert.Avocado.TSRawPipelineTelemetry", DISPATCH_QUEUE_SERIAL);
+		self.logQueue = dispatch_queue_create("me.tseifert.Avocado.TSRawPipelineTelemetry.log", DISPATCH_QUEUE_SERIAL);
+	}
+	
+	return self;
+}
+
+/**
+ * Creates telemetry that keeps the default number of recent jobs.
+ */
+- (instancetype) init {
+	return [self initWithMaxRecentJobs:TSRawPipelineTelemetryDefaultMaxJobs];
+}
+
+#pragma mark Jobs
+/**
+ * Adds a job, removing the oldest ones if needed, and writes it to the job
+ * log, if one is set.
+ */
+- (void) addJob:(TSRawPipelineJobMetrics *) job {
+	dispatch_sync(self.accessQueue, ^{
+		[self.jobs addObject:job];
+		
+		while(self.jobs.count > self.maxRecentJobs) {
+			[self.jobs removeObjectAtIndex:0];
+		}
+	});
+	
+	if(self.jobLogURL != nil) {
+		[self appendJobToLog:job];
+	}
+}
+
+/**
+ * Returns a copy of the recent jobs.
+ */
+- (NSArray<TSRawPipelineJobMetrics *> *) recentJobs {
+	__block NSArray *jobs = nil;
+	
+	dispatch_sync(self.accessQueue, ^{
+		jobs = [self.jobs copy];
+	});
+	
+	return jobs;
+}
+
+/**
+ * Builds aggregates for each stage from the recent jobs.
+ */
+- (NSDictionary<NSString *, TSRawPipelineStageAggregate *> *) stageAggregates {
+	NSMutableDictionary<NSString *, TSRawPipelineStageAggregate *> *aggregates = [NSMutableDictionary new];
+	
+	for(TSRawPipelineJobMetrics *job in self.recentJobs) {
+		for(TSRawPipelineStageMetrics *stage in job.stages) {
+			TSRawPipelineStageAggregate *aggregate = aggregates[stage.name];
+			
+			if(aggregate == nil) {
+				aggregate = [[TSRawPipelineStageAggregate alloc] initWithName:stage.name];
+				aggregates[stage.name] = aggregate;
+			}
+			
+			[aggregate addStage:stage];
+		}
+	}
+	
+	return aggregates;
+}
+
+/**
+ * Removes all recent jobs.
+ */
+- (void) reset {
+	dispatch_sync(self.accessQueue, ^{
+		[self.jobs removeAllObjects];
+	});
+}
+
+#pragma mark JSON Output
+/**
+ * Returns the aggregates and recent jobs as a dictionary.
+ */
+- (NSDictionary<NSString *, id> *) dictionaryRepresentation {
+	NSMutableDictionary *stages = [NSMutableDictionary new];
+	NSMutableArray *jobs = [NSMutableArray new];
+	
+	[self.stageAggregates enumerateKeysAndObjectsUsingBlock:^(NSString *name, TSRawPipelineStageAggregate *aggregate, BOOL *stop) {
+		stages[name] = aggregate.dictionaryRepresentation;
+	}];
+	
+	for(TSRawPipelineJobMetrics *job in self.recentJobs) {
+		[jobs addObject:job.dictionaryRepresentation];
+	}
+	
+	NSDictionary *info = [NSBundle mainBundle].infoDictionary;
+	
+	return @{
+		@"version": info[@"CFBundleShortVersionString"] ?: [NSNull null],
+		@"build": info[@"CFBundleVersion"] ?: [NSNull null],
+		@"date": @([NSDate date].timeIntervalSince1970),
+		@"stages": stages,
+		@"jobs": jobs
+	};
+}
+
+/**
+ * Serializes the dictionary representation, and writes it to the file.
+ */
+- (BOOL) writeJSONToURL:(NSURL *) url error:(NSError **) err {
+	NSData *data = [NSJSONSerialization dataWithJSONObject:self.dictionaryRepresentation
+												   options:NSJSONWritingPrettyPrinted
+													 error:err];
+	
+	if(data == nil) {
+		return NO;
+	}
+	
+	return [data writeToURL:url options:NSDataWritingAtomic error:err];
+}
+
+/**
+ * Appends the job to the job log, as a single line of JSON. This happens on a
+ * background queue, so that finishing a job isn't held up by disk I/O.
+ */
+- (void) appendJobToLog:(TSRawPipelineJobMetrics *) job {
+	NSURL *url = self.jobLogURL;
+	
+	dispatch_async(self.logQueue, ^{
+		NSError *err = nil;
+		NSData *data = [NSJSONSerialization dataWithJSONObject:job.dictionaryRepresentation
+													   options:0 error:&err];
+		
+		if(data == nil) {
+			DDLogError(@"Couldn't serialize job metrics: %@", err);
+			return;
+		}
+		
+		// create the log file if needed, then append to it
+		if([[NSFileManager defaultManager] fileExistsAtPath:url.path] == NO) {
+			[[NSData data] writeToURL:url atomically:NO];
+		}
+		
+		NSFileHandle *handle = [NSFileHandle fileHandleForWritingToURL:url error:&err];
+		
+		if(handle == nil) {
+			DDLogError(@"Couldn't open job log %@: %@", url, err);
+			return;
+		}
+		
+		[handle seekToEndOfFile];
+		[handle writeData:data];
+		[handle writeData:[NSData dataWithBytes:"\n" length:1]];
+		[handle closeFile];
+	});
+}
+
+@end
@@ -0,0 +1,84 @@
+//
+//  TSRawStreaming.h
+//  Avocado
+//
+//	Runs the first stages of the RAW pipeline (pre-interpolation, demosaicing,
+//	colour conversion and conversion to planar format) on horizontal strips
+//	of the image, rather than on the entire image, one stage after another.
+//	Each strip is interpolated together with a halo of rows above and below
+//	it, sized to the reach of the demosaic engine, so that the output is the
+//	same as when processing the entire image. Only the Bayer and interpolated
+//	data of a single strip are held in memory, and they stay in cache from
+//	one stage to the next.
+//
+//  Created by Tristan Seifert on 20160809.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#ifndef TSRawStreaming_h
+#define TSRawStreaming_h
+
+#import <Foundation/Foundation.h>
+
+#include <stdint.h>
+
+#include "libraw.h"
+
+#import "TSRawDemosaic.h"
+#import "TSPixelFormatConverter.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default number of image rows in each strip. Strips always start on a row
+ * that is a multiple of 16 (the height of the filter pattern), so the number
+ * of rows is rounded up to a multiple of 16.
+ */
+#define TSRawStreamDefaultStripRows	256
+
+/**
+ * Returns the number of raw image rows in the largest strip, including its
+ * halos; the Bayer and image buffers passed to TSRawStreamToPlanar must be at
+ * least this many rows high.
+ *
+ * @param engine Demosaic engine used to interpolate the strips.
+ * @param stripRows Number of image rows in each strip.
+ */
+NSUInteger TSRawStreamGetSourceRows(TSRawDemosaicEngine engine, NSUInteger stripRows);
+
+/**
+ * Prepares, interpolates and converts the image a strip at a time, and writes
+ * the result into the converter's planes. The histogram (and with it, the
+ * gamma curve) covers the entire image, so the gamma curve is applied once
+ * all strips are done. Until then, the converted image is kept as 16 bit RGB
+ * in the converter's output buffer, which isn't needed before the planes are
+ * interleaved at the end of the pipeline.
+ *
+ * The output, and the changes made to the libraw struct, are identical to
+ * calling TSRawPrepareBayerData, the demosaic engine, TSRawConvertToRGB, and
+ * TSPixelConverterRGB16UToPlanarF in turn.
+ *
+ * TSRawAdjustBlackLevel should have been called before.
+ *
+ * @param libRaw LibRaw instance containing the unpacked raw data
+ * @param engine Demosaic engine with which to interpolate
+ * @param stripRows Number of image rows in each strip
+ * @param bayerBuf Buffer for the Bayer data of a strip; one sample per pixel.
+ * @param imageBuf Buffer for the interpolated data of a strip; four
+ * components per pixel.
+ * @param converter Pixel converter into whose planes the image is written; it
+ * must have the size of the demosaic engine's output.
+ * @param histogram Histogram of the image; 0x2000 bins, times four for four
+ * possible colours.
+ * @param gammaCurveOut If not NULL, the gamma curve that was applied (0x10000
+ * entries) is copied here; this is intended for debugging.
+ */
+void TSRawStreamToPlanar(libraw_data_t *libRaw, TSRawDemosaicEngine engine, NSUInteger stripRows, uint16_t *bayerBuf, uint16_t (*imageBuf)[4], TSPixelConverterRef converter, int *histogram, uint16_t *gammaCurveOut);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TSRawStreaming_h */
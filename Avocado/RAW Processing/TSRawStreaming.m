@@ -0,0 +1,116 @@
+//
+//  TSRawStreaming.m
+//  Avocado
+//
+//  Created by Tristan Seifert on 20160809.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import "TSRawStreaming.h"
+
+#import "TSRawImageDataHelpers.h"
+
+/// strips (and their halos above) start on a multiple of this many rows
+#define TSRawStreamRowAlignment	16
+
+/**
+ * Rounds the given number of rows up to a multiple of the row alignment.
+ */
+static inline NSUInteger TSRawStreamAlignRows(NSUInteger rows) {
+	return (rows + (TSRawStreamRowAlignment - 1)) & ~((NSUInteger) (TSRawStreamRowAlignment - 1));
+}
+
+/**
+ * Returns the number of raw image rows in the largest strip, including its
+ * halos. The halo above the strip is rounded up, so that the strip starts on
+ * the same row of the filter pattern as the image.
+ *
+ * @param engine Demosaic engine used to interpolate the strips.
+ * @param stripRows Number of image rows in each strip.
+ */
+NSUInteger TSRawStreamGetSourceRows(TSRawDemosaicEngine engine, NSUInteger stripRows) {
+	const TSRawDemosaicEngineInfo *info = TSRawDemosaicGetEngine(engine);
+	
+	return TSRawStreamAlignRows(info->support) + TSRawStreamAlignRows(MAX(stripRows, 1)) + info->support;
+}
+
+/**
+ * Streams the image through pre-interpolation, demosaicing and colour
+ * conversion, a strip at a time.
+ *
+ * The demosaic engine interpolates each strip (with its halos) as if it were
+ * the entire image: the height in the libraw struct is temporarily set to that
+ * of the strip. Only the rows of the strip itself are then converted to RGB,
+ * and packed into the converter's output buffer.
+ */
+void TSRawStreamToPlanar(libraw_data_t *libRaw, TSRawDemosaicEngine engine, NSUInteger stripRows, uint16_t *bayerBuf, uint16_t (*imageBuf)[4], TSPixelConverterRef converter, int *histogram, uint16_t *gammaCurveOut) {
+	const TSRawDemosaicEngineInfo *info = TSRawDemosaicGetEngine(engine);
+	
+	// strips start on an aligned row, so the filter pattern lines up
+	const NSUInteger rows = TSRawStreamAlignRows(MAX(stripRows, 1));
+	const NSUInteger haloAbove = TSRawStreamAlignRows(info->support);
+	const NSUInteger haloBelow = info->support;
+	
+	// size of the image; the demosaic engine only ever sees a single strip
+	const ushort width = libRaw->sizes.width, iwidth = libRaw->sizes.iwidth;
+	const ushort height = libRaw->sizes.height, iheight = libRaw->sizes.iheight;
+	
+	const unsigned int shrink = info->shrink;
+	const size_t outWidth = width >> shrink;
+	const size_t outHeight = height >> shrink;
+	
+	NSUInteger convWidth, convHeight;
+	TSPixelConverterGetSize(converter, &convWidth, &convHeight);
+	
+	DDCAssert(convWidth == outWidth && convHeight == outHeight, @"converter is %lux%lu, but the image is %zux%zu", convWidth, convHeight, outWidth, outHeight);
+	
+	// the RGB image is assembled in the converter's output buffer (64bpp or larger)
+	uint16_t (*frame)[3] = (uint16_t (*)[3]) TSPixelConverterGetRGBXPointer(converter);
+	
+	TSRawBayerPreparation prep;
+	TSRawBeginBayerPreparation(libRaw, &prep);
+	
+	TSRawRGBConversion conv;
+	TSRawBeginRGBConversion(libRaw, &conv);
+	
+	memset(histogram, 0, sizeof(int) * 0x2000 * 4);
+	
+	// process each strip, with its halos
+	for(NSUInteger top = 0; top < height; top += rows) {
+		const NSUInteger bottom = MIN(top + rows, (NSUInteger) height);
+		
+		const NSUInteger first = (top > haloAbove) ? (top - haloAbove) : 0;
+		const NSUInteger last = MIN(bottom + haloBelow, (NSUInteger) height);
+		
+		// prepare and interpolate the strip
+		TSRawPrepareBayerRows(libRaw, &prep, first, (last - first), bayerBuf);
+		
+		libRaw->sizes.height = libRaw->sizes.iheight = (ushort) (last - first);
+		
+		info->interpolate(libRaw, bayerBuf, imageBuf);
+		
+		// restore the size of the image
+		libRaw->sizes.width = width;
+		libRaw->sizes.iwidth = iwidth;
+		libRaw->sizes.height = height;
+		libRaw->sizes.iheight = iheight;
+		
+		// convert the rows of the strip itself, leaving out the halos
+		const size_t outTop = top >> shrink;
+		const size_t outRows = (bottom >> shrink) - outTop;
+		const size_t stripOffset = ((top - first) >> shrink) * outWidth;
+		
+		TSRawConvertRowsToRGB(&conv, imageBuf + stripOffset, frame + (outTop * outWidth), outWidth, outRows, histogram);
+	}
+	
+	TSRawEndBayerPreparation(libRaw, &prep);
+	
+	// now that the histogram is complete, apply the gamma and output curves
+	uint16_t *curve = TSRawCreateOutputCurve(libRaw, histogram, (outWidth * outHeight), gammaCurveOut);
+	TSRawApplyOutputCurve(curve, frame, outWidth, outHeight);
+	free(curve);
+	
+	// lastly, split the image into planes
+	TSPixelConverterSetInData(converter, frame);
+	TSPixelConverterRGB16UToPlanarF(converter, 0xFFFF);
+}
@@ -0,0 +1,339 @@
+//
+//  ahd_green_kernels.c
+//  Avocado
+//
+//	The vectorized kernels all compute every one of the clamp fallbacks of the
+//	scalar code for several pixels at once, and then select the first one that
+//	is in range. All arithmetic is done on 32-bit integers, so the results are
+//	identical to those of the scalar code.
+//
+//  Created by Tristan Seifert on 20160715.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#include "ahd_green_kernels.h"
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#pragma mark Scalar
+/**
+ * Reference implementation of the green interpolation kernel. This is the
+ * loop body of the original AHD code; since each pixel of the mosaic only has
+ * a sample of its own colour, the neighbours at odd offsets are green, and
+ * those at even offsets are the same colour as the pixel.
+ */
+void ahd_green_row_scalar(const uint16_t *pix, int width, int count, uint16_t (*outH)[3], uint16_t (*outV)[3]) {
+	int i, val;
+	
+	for(i = 0; i < count; i++, pix += 2, outH += 2, outV += 2) {
+		val = ((pix[-1] + pix[0] + pix[1]) * 2
+			- pix[-2] - pix[2] + 2) >> 2;
+		if (val < 0 || val > 65535) {
+			val = (pix[-3] + pix[3] +
+				18*(2*pix[0] - pix[-2] - pix[2]) +
+				63*(pix[-1] + pix[1]) + 64) >> 7;
+			if (val < 0 || val > 65535) {
+				val = (4*(pix[-1] + pix[1]) +
+					2*pix[0]-pix[-2]-pix[2] + 4) >> 3;
+				if (val < 0 || val > 65535)
+					val = (pix[-1] + pix[1] + 1) >> 1; }}
+		outH[0][1] = val;
+		val = ((pix[-width] + pix[0] + pix[width]) * 2
+			- pix[-2*width] - pix[2*width] + 2) >> 2;
+		if (val < 0 || val > 65535) {
+			val = (pix[-3*width] + pix[3*width] +
+				18*(2*pix[0] - pix[-2*width] - pix[2*width]) +
+				63*(pix[-width] + pix[width]) + 64) >> 7;
+			if (val < 0 || val > 65535) {
+				val = (4*(pix[-width] + pix[width]) +
+					2*pix[0]-pix[-2*width]-pix[2*width] + 4) >> 3;
+				if (val < 0 || val > 65535)
+					val = (pix[-width] + pix[width] + 1) >> 1; }}
+		outV[0][1] = val;
+	}
+}
+
+#pragma mark - x86
+#if defined(__x86_64__) || defined(__i386__)
+
+#define AHD_TARGET_SSE41	__attribute__((target("sse4.1")))
+#define AHD_TARGET_AVX2		__attribute__((target("avx2")))
+
+/**
+ * Loads the eight samples starting at p, and splits them into the four even
+ * (even) and four odd (odd) samples, widened to 32 bits.
+ */
+static inline AHD_TARGET_SSE41 void ahd_load_sse41(const uint16_t *p, __m128i *even, __m128i *odd) {
+	__m128i v = _mm_loadu_si128((const __m128i *) p);
+	
+	*even = _mm_and_si128(v, _mm_set1_epi32(0xFFFF));
+	*odd = _mm_srli_epi32(v, 16);
+}
+
+/**
+ * Evaluates the green estimate and its fallbacks, given the samples at the
+ * -3...+3 positions along one direction; n is green, and m the colour of the
+ * center pixel.
+ */
+static inline AHD_TARGET_SSE41 __m128i ahd_estimate_sse41(__m128i n3, __m128i m2, __m128i n1, __m128i m0, __m128i p1, __m128i p2, __m128i p3) {
+	const __m128i rangeMask = _mm_set1_epi32((int) 0xFFFF0000);
+	const __m128i zero = _mm_setzero_si128();
+	
+	__m128i n = _mm_add_epi32(n1, p1);
+	__m128i m = _mm_sub_epi32(_mm_sub_epi32(_mm_slli_epi32(m0, 1), m2), p2);
+	
+	// (n1 + m0 + p1) * 2 - m2 - p2 + 2 >> 2
+	__m128i v1 = _mm_add_epi32(_mm_slli_epi32(_mm_add_epi32(n, m0), 1), _mm_set1_epi32(2));
+	v1 = _mm_srai_epi32(_mm_sub_epi32(_mm_sub_epi32(v1, m2), p2), 2);
+	// n3 + p3 + 18 * m + 63 * n + 64 >> 7
+	__m128i v2 = _mm_add_epi32(_mm_add_epi32(n3, p3), _mm_mullo_epi32(m, _mm_set1_epi32(18)));
+	v2 = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(v2, _mm_mullo_epi32(n, _mm_set1_epi32(63))), _mm_set1_epi32(64)), 7);
+	// 4 * n + m + 4 >> 3
+	__m128i v3 = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(n, 2), m), _mm_set1_epi32(4)), 3);
+	// n + 1 >> 1
+	__m128i v4 = _mm_srai_epi32(_mm_add_epi32(n, _mm_set1_epi32(1)), 1);
+	
+	// select the first estimate that's in range
+	__m128i val = v4;
+	val = _mm_blendv_epi8(val, v3, _mm_cmpeq_epi32(_mm_and_si128(v3, rangeMask), zero));
+	val = _mm_blendv_epi8(val, v2, _mm_cmpeq_epi32(_mm_and_si128(v2, rangeMask), zero));
+	val = _mm_blendv_epi8(val, v1, _mm_cmpeq_epi32(_mm_and_si128(v1, rangeMask), zero));
+	
+	return val;
+}
+
+/**
+ * SSE4.1 implementation of the green interpolation kernel; processes four
+ * pixels at a time.
+ */
+AHD_TARGET_SSE41 void ahd_green_row_sse41(const uint16_t *pix, int width, int count, uint16_t (*outH)[3], uint16_t (*outV)[3]) {
+	int i, k;
+	__m128i n3, m2, n1, m0, p1, p2, p3, unused;
+	int32_t res[4];
+	
+	for(i = 0; (i + 4) <= count; i += 4, pix += 8, outH += 8, outV += 8) {
+		// horizontal: the odd samples of -3 are -2, those of -1 are 0, etc.;
+		// +3 is loaded as the odd samples of +2, to not read past +3
+		ahd_load_sse41(pix - 3, &n3, &m2);
+		ahd_load_sse41(pix - 1, &n1, &m0);
+		ahd_load_sse41(pix + 1, &p1, &p2);
+		ahd_load_sse41(pix + 2, &unused, &p3);
+		
+		__m128i h = ahd_estimate_sse41(n3, m2, n1, m0, p1, p2, p3);
+		
+		_mm_storeu_si128((__m128i *) res, h);
+		for(k = 0; k < 4; k++) outH[2*k][1] = (uint16_t) res[k];
+		
+		// vertical: -3w, -2w, -w, +w, +2w, +3w; loading from one sample to the
+		// left makes them the odd samples, so nothing past the last pixel is
+		// read
+		ahd_load_sse41(pix - 3*width - 1, &unused, &n3);
+		ahd_load_sse41(pix - 2*width - 1, &unused, &m2);
+		ahd_load_sse41(pix - width - 1, &unused, &n1);
+		ahd_load_sse41(pix + width - 1, &unused, &p1);
+		ahd_load_sse41(pix + 2*width - 1, &unused, &p2);
+		ahd_load_sse41(pix + 3*width - 1, &unused, &p3);
+		
+		__m128i v = ahd_estimate_sse41(n3, m2, n1, m0, p1, p2, p3);
+		
+		_mm_storeu_si128((__m128i *) res, v);
+		for(k = 0; k < 4; k++) outV[2*k][1] = (uint16_t) res[k];
+	}
+	
+	// handle the remaining pixels
+	ahd_green_row_scalar(pix, width, (count - i), outH, outV);
+}
+
+/**
+ * Same as ahd_load_sse41(), but for the sixteen samples starting at p.
+ */
+static inline AHD_TARGET_AVX2 void ahd_load_avx2(const uint16_t *p, __m256i *even, __m256i *odd) {
+	__m256i v = _mm256_loadu_si256((const __m256i *) p);
+	
+	*even = _mm256_and_si256(v, _mm256_set1_epi32(0xFFFF));
+	*odd = _mm256_srli_epi32(v, 16);
+}
+
+/**
+ * AVX2 version of ahd_estimate_sse41().
+ */
+static inline AHD_TARGET_AVX2 __m256i ahd_estimate_avx2(__m256i n3, __m256i m2, __m256i n1, __m256i m0, __m256i p1, __m256i p2, __m256i p3) {
+	const __m256i rangeMask = _mm256_set1_epi32((int) 0xFFFF0000);
+	const __m256i zero = _mm256_setzero_si256();
+	
+	__m256i n = _mm256_add_epi32(n1, p1);
+	__m256i m = _mm256_sub_epi32(_mm256_sub_epi32(_mm256_slli_epi32(m0, 1), m2), p2);
+	
+	__m256i v1 = _mm256_add_epi32(_mm256_slli_epi32(_mm256_add_epi32(n, m0), 1), _mm256_set1_epi32(2));
+	v1 = _mm256_srai_epi32(_mm256_sub_epi32(_mm256_sub_epi32(v1, m2), p2), 2);
+	__m256i v2 = _mm256_add_epi32(_mm256_add_epi32(n3, p3), _mm256_mullo_epi32(m, _mm256_set1_epi32(18)));
+	v2 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(v2, _mm256_mullo_epi32(n, _mm256_set1_epi32(63))), _mm256_set1_epi32(64)), 7);
+	__m256i v3 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(n, 2), m), _mm256_set1_epi32(4)), 3);
+	__m256i v4 = _mm256_srai_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(1)), 1);
+	
+	__m256i val = v4;
+	val = _mm256_blendv_epi8(val, v3, _mm256_cmpeq_epi32(_mm256_and_si256(v3, rangeMask), zero));
+	val = _mm256_blendv_epi8(val, v2, _mm256_cmpeq_epi32(_mm256_and_si256(v2, rangeMask), zero));
+	val = _mm256_blendv_epi8(val, v1, _mm256_cmpeq_epi32(_mm256_and_si256(v1, rangeMask), zero));
+	
+	return val;
+}
+
+/**
+ * AVX2 implementation of the green interpolation kernel; processes eight
+ * pixels at a time.
+ */
+AHD_TARGET_AVX2 void ahd_green_row_avx2(const uint16_t *pix, int width, int count, uint16_t (*outH)[3], uint16_t (*outV)[3]) {
+	int i, k;
+	__m256i n3, m2, n1, m0, p1, p2, p3, unused;
+	int32_t res[8];
+	
+	for(i = 0; (i + 8) <= count; i += 8, pix += 16, outH += 16, outV += 16) {
+		// horizontal, loaded as for SSE4.1
+		ahd_load_avx2(pix - 3, &n3, &m2);
+		ahd_load_avx2(pix - 1, &n1, &m0);
+		ahd_load_avx2(pix + 1, &p1, &p2);
+		ahd_load_avx2(pix + 2, &unused, &p3);
+		
+		__m256i h = ahd_estimate_avx2(n3, m2, n1, m0, p1, p2, p3);
+		
+		_mm256_storeu_si256((__m256i *) res, h);
+		for(k = 0; k < 8; k++) outH[2*k][1] = (uint16_t) res[k];
+		
+		// vertical, loaded as for SSE4.1
+		ahd_load_avx2(pix - 3*width - 1, &unused, &n3);
+		ahd_load_avx2(pix - 2*width - 1, &unused, &m2);
+		ahd_load_avx2(pix - width - 1, &unused, &n1);
+		ahd_load_avx2(pix + width - 1, &unused, &p1);
+		ahd_load_avx2(pix + 2*width - 1, &unused, &p2);
+		ahd_load_avx2(pix + 3*width - 1, &unused, &p3);
+		
+		__m256i v = ahd_estimate_avx2(n3, m2, n1, m0, p1, p2, p3);
+		
+		_mm256_storeu_si256((__m256i *) res, v);
+		for(k = 0; k < 8; k++) outV[2*k][1] = (uint16_t) res[k];
+	}
+	
+	// handle the remaining pixels
+	ahd_green_row_sse41(pix, width, (count - i), outH, outV);
+}
+
+#endif
+
+#pragma mark - ARM
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+/**
+ * Evaluates the green estimate and its fallbacks for four pixels; the
+ * arguments are the same as for the x86 version.
+ */
+static inline int32x4_t ahd_estimate_neon(int32x4_t n3, int32x4_t m2, int32x4_t n1, int32x4_t m0, int32x4_t p1, int32x4_t p2, int32x4_t p3) {
+	const uint32x4_t rangeMask = vdupq_n_u32(0xFFFF0000);
+	
+	int32x4_t n = vaddq_s32(n1, p1);
+	int32x4_t m = vsubq_s32(vsubq_s32(vshlq_n_s32(m0, 1), m2), p2);
+	
+	int32x4_t v1 = vaddq_s32(vshlq_n_s32(vaddq_s32(n, m0), 1), vdupq_n_s32(2));
+	v1 = vshrq_n_s32(vsubq_s32(vsubq_s32(v1, m2), p2), 2);
+	int32x4_t v2 = vaddq_s32(vaddq_s32(n3, p3), vmulq_n_s32(m, 18));
+	v2 = vshrq_n_s32(vaddq_s32(vaddq_s32(v2, vmulq_n_s32(n, 63)), vdupq_n_s32(64)), 7);
+	int32x4_t v3 = vshrq_n_s32(vaddq_s32(vaddq_s32(vshlq_n_s32(n, 2), m), vdupq_n_s32(4)), 3);
+	int32x4_t v4 = vshrq_n_s32(vaddq_s32(n, vdupq_n_s32(1)), 1);
+	
+	int32x4_t val = v4;
+	val = vbslq_s32(vceqq_u32(vandq_u32(vreinterpretq_u32_s32(v3), rangeMask), vdupq_n_u32(0)), v3, val);
+	val = vbslq_s32(vceqq_u32(vandq_u32(vreinterpretq_u32_s32(v2), rangeMask), vdupq_n_u32(0)), v2, val);
+	val = vbslq_s32(vceqq_u32(vandq_u32(vreinterpretq_u32_s32(v1), rangeMask), vdupq_n_u32(0)), v1, val);
+	
+	return val;
+}
+
+/// Widens the low/high four values of an unsigned 16-bit vector to signed 32-bit
+#define AHD_LO_NEON(x) vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(x)))
+#define AHD_HI_NEON(x) vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(x)))
+
+/**
+ * Evaluates eight estimates, and writes them to every second pixel of out.
+ */
+static inline void ahd_estimate_store_neon(uint16x8_t n3, uint16x8_t m2, uint16x8_t n1, uint16x8_t m0, uint16x8_t p1, uint16x8_t p2, uint16x8_t p3, uint16_t (*out)[3]) {
+	int32_t res[8];
+	
+	vst1q_s32(res + 0, ahd_estimate_neon(AHD_LO_NEON(n3), AHD_LO_NEON(m2),
+										 AHD_LO_NEON(n1), AHD_LO_NEON(m0),
+										 AHD_LO_NEON(p1), AHD_LO_NEON(p2),
+										 AHD_LO_NEON(p3)));
+	vst1q_s32(res + 4, ahd_estimate_neon(AHD_HI_NEON(n3), AHD_HI_NEON(m2),
+										 AHD_HI_NEON(n1), AHD_HI_NEON(m0),
+										 AHD_HI_NEON(p1), AHD_HI_NEON(p2),
+										 AHD_HI_NEON(p3)));
+	
+	for(int k = 0; k < 8; k++) out[2*k][1] = (uint16_t) res[k];
+}
+
+/**
+ * NEON implementation of the green interpolation kernel; processes eight
+ * pixels at a time. Each load splits sixteen consecutive samples into the
+ * even and odd ones.
+ */
+void ahd_green_row_neon(const uint16_t *pix, int width, int count, uint16_t (*outH)[3], uint16_t (*outV)[3]) {
+	int i;
+	uint16x8x2_t a, b, d, e;
+	
+	for(i = 0; (i + 8) <= count; i += 8, pix += 16, outH += 16, outV += 16) {
+		// horizontal: odd samples of -3 are -2, those of -1 are 0, etc.; +3 is
+		// the odd samples of +2
+		a = vld2q_u16(pix - 3);
+		b = vld2q_u16(pix - 1);
+		d = vld2q_u16(pix + 1);
+		e = vld2q_u16(pix + 2);
+		
+		uint16x8_t m0 = b.val[1];
+		
+		ahd_estimate_store_neon(a.val[0], a.val[1], b.val[0], m0, d.val[0], d.val[1], e.val[1], outH);
+		
+		// vertical; as on x86, the loads start one sample to the left
+		a = vld2q_u16(pix - 3*width - 1);
+		b = vld2q_u16(pix - 2*width - 1);
+		d = vld2q_u16(pix - width - 1);
+		e = vld2q_u16(pix + width - 1);
+		
+		uint16x8_t n3 = a.val[1], m2 = b.val[1], n1 = d.val[1], p1 = e.val[1];
+		
+		a = vld2q_u16(pix + 2*width - 1);
+		b = vld2q_u16(pix + 3*width - 1);
+		
+		ahd_estimate_store_neon(n3, m2, n1, m0, p1, a.val[1], b.val[1], outV);
+	}
+	
+	// handle the remaining pixels
+	ahd_green_row_scalar(pix, width, (count - i), outH, outV);
+}
+
+#endif
+
+#pragma mark - Selection
+/**
+ * Returns the fastest green interpolation kernel supported by the CPU the
+ * code is running on.
+ */
+ahd_green_row_fn ahd_green_row_select(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	if(__builtin_cpu_supports("avx2")) {
+		return ahd_green_row_avx2;
+	} else if(__builtin_cpu_supports("sse4.1")) {
+		return ahd_green_row_sse41;
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	return ahd_green_row_neon;
+#endif
+	
+	return ahd_green_row_scalar;
+}
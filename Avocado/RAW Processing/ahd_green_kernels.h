@@ -0,0 +1,74 @@
+//
+//  ahd_green_kernels.h
+//  Avocado
+//
+//	Kernels for the directional green interpolation step of the AHD demosaic.
+//	The scalar kernel is the reference implementation; the vectorized kernels
+//	produce identical output, and the best one for the machine is selected at
+//	runtime.
+//
+//  Created by Tristan Seifert on 20160715.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#ifndef ahd_green_kernels_h
+#define ahd_green_kernels_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Interpolates green horizontally and vertically for a run of non-green
+ * pixels in a single row. Pixels are processed two apart, i.e. only the red
+ * or blue pixels in the row, starting at the given pixel.
+ *
+ * @param pix Pointer to the first pixel to interpolate in the Bayer mosaic.
+ * @param width Width of the image, in pixels.
+ * @param count Number of pixels to interpolate.
+ * @param outH Output for the horizontally interpolated green; the green
+ * component of every second pixel is written, starting at the first one.
+ * @param outV Output for the vertically interpolated green, as above.
+ */
+typedef void (*ahd_green_row_fn)(const uint16_t *pix, int width, int count, uint16_t (*outH)[3], uint16_t (*outV)[3]);
+
+/**
+ * Reference implementation of the green interpolation kernel.
+ */
+void ahd_green_row_scalar(const uint16_t *pix, int width, int count, uint16_t (*outH)[3], uint16_t (*outV)[3]);
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * SSE4.1 implementation of the green interpolation kernel; processes four
+ * pixels at a time.
+ */
+void ahd_green_row_sse41(const uint16_t *pix, int width, int count, uint16_t (*outH)[3], uint16_t (*outV)[3]);
+
+/**
+ * AVX2 implementation of the green interpolation kernel; processes eight
+ * pixels at a time.
+ */
+void ahd_green_row_avx2(const uint16_t *pix, int width, int count, uint16_t (*outH)[3], uint16_t (*outV)[3]);
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+/**
+ * NEON implementation of the green interpolation kernel; processes eight
+ * pixels at a time.
+ */
+void ahd_green_row_neon(const uint16_t *pix, int width, int count, uint16_t (*outH)[3], uint16_t (*outV)[3]);
+#endif
+
+/**
+ * Returns the fastest green interpolation kernel supported by the CPU the
+ * code is running on.
+ */
+ahd_green_row_fn ahd_green_row_select(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ahd_green_kernels_h */
@@ -1,7 +1,8 @@
 /**
  * This file came directly from the LibRAW GPL2 demosaic pack. It has only been
  * modified to not rely on the manner in which LibRAW operates, instead taking
- * a 16-bit RGB buffer as input.
+ * a single component, 16-bit Bayer mosaic as input, and writing to a 16-bit
+ * RGBX buffer.
  */
 #include "ahd_interpolate_mod.h"
 
@@ -11,8 +12,13 @@
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include <dispatch/dispatch.h>
 
 #include "interpolation_shared.h"
+#include "ahd_green_kernels.h"
 
 /* This file was taken from modified dcraw published by Paul Lee
    on January 23, 2009, taking dcraw ver.8.90/rev.1.417
@@ -56,194 +62,367 @@ AHD interpolation with built-in anti-aliasing feature
 
 static const float d65_white[3] =  { 0.950456f, 1.0f, 1.088754f };
 
-static inline void border_interpolate(int border, int width, int height, ushort (*image)[4], int filters, ushort top_margin, ushort left_margin, ushort colors) {
-	unsigned row, col, y, x, f, c, sum[8];
-	
-	for(row=0; row < height; row++)
-		for(col=0; col < width; col++) {
-			if(col==border && row >= border && row < height-border)
-				col = width-border;
-			memset(sum, 0, sizeof sum);
-			for(y=row-1; y != row+2; y++)
-				for(x=col-1; x != col+2; x++)
-					if(y < height && x < width) {
-						f = fcol(y,x, filters, top_margin, left_margin);
-						sum[f] += image[y*width+x][f];
-						sum[f+4]++;
-					}
-			f = fcol(row, col, filters, top_margin, left_margin);
+/**
+ * Builds the lookup table for the cube root function used by the CIELab
+ * conversion. It only depends on constants, so callers should build it once,
+ * and share it between all runs.
+ *
+ * @param cbrt Table to fill, with 0x10000 entries
+ */
+void ahd_build_cbrt_table(float *cbrt) {
+	int i;
+	float r;
+	
+	for (i=0; i < 0x10000; i++) {
+		r = i / 65535.0;
+		cbrt[i] = r > 0.008856 ? pow((double)r,1/3.0) : 7.787*r + 16/116.0;
+	}
+}
+
+/**
+ * State shared between all tiles of a single AHD run. Everything in here is
+ * read-only once the tiles start being processed, so it may be shared between
+ * multiple worker threads without any locking.
+ */
+typedef struct {
+	/// Bayer mosaic being interpolated
+	const ushort *bayer;
+	/// output image
+	ushort (*image)[4];
+	
+	/// width of the image
+	int width;
+	/// height of the image
+	int height;
+	/// filter pattern
+	unsigned int filters;
+	/// number of colours
+	int colors;
+	
+	/// camera -> XYZ conversion matrix
+	float xyz_cam[3][4];
+	/// cube root lookup table, 0x10000 entries
+	const float *cbrt;
+	
+	/// green interpolation kernel
+	ahd_green_row_fn greenRow;
+} ahd_state_t;
+
+/**
+ * Converts a run of interpolated pixels in one row of a tile to CIELab. The
+ * arithmetic is exactly that of the original per-pixel conversion, so the Lab
+ * values (and thus the homogeneity maps) are identical to it; a difference of
+ * a single LSB is enough to tip the choice of interpolation direction.
+ *
+ * @param st Shared interpolation state
+ * @param rix First pixel in the tile's RGB buffer to convert
+ * @param count Number of pixels to convert
+ * @param L Output for the L component
+ * @param A Output for the a component
+ * @param B Output for the b component
+ */
+static inline void ahd_lab_row(const ahd_state_t *st, const ushort (*rix)[3], int count, short *L, short *A, short *B) {
+	int i, c;
+	float xyz[3];
+	
+	const int colors = st->colors;
+	const float *cbrt = st->cbrt;
+	
+	for (i=0; i < count; i++) {
+		xyz[0] = xyz[1] = xyz[2] = 0.5;
+		FORCC {
+			xyz[0] += st->xyz_cam[0][c] * rix[i][c];
+			xyz[1] += st->xyz_cam[1][c] * rix[i][c];
+			xyz[2] += st->xyz_cam[2][c] * rix[i][c];
+		}
+		xyz[0] = cbrt[CLIP((int) xyz[0])];
+		xyz[1] = cbrt[CLIP((int) xyz[1])];
+		xyz[2] = cbrt[CLIP((int) xyz[2])];
+		L[i] = 64 * (116 * xyz[1] - 16);
+		A[i] = 64 * 500 * (xyz[0] - xyz[1]);
+		B[i] = 64 * 200 * (xyz[1] - xyz[2]);
+	}
+}
+
+/**
+ * Builds one row of both homogeneity maps. For each pixel, the luminance and
+ * chrominance differences to all four neighbours are computed in both of the
+ * interpolated images, and each neighbour that is within the adaptive
+ * thresholds is counted.
+ *
+ * The Lab buffers are planar, so all loads are contiguous, and the loop has no
+ * data-dependent branches; this allows the compiler to vectorize it. The
+ * chrominance differences use unsigned arithmetic, so they wrap exactly as
+ * the original int arithmetic did.
+ *
+ * @param lab Planar Lab buffer of the tile, [direction][component][row][col]
+ * @param tr Row in the tile to process
+ * @param start First column in the tile to process
+ * @param end Column in the tile at which to stop
+ * @param homo Homogeneity maps of the tile
+ */
+static inline void ahd_homogeneity_row(short (*lab)[3][TS][TS], int tr, int start, int end, char (*homo)[TS][TS]) {
+	int tc;
+	
+	const short *hL = lab[0][0][tr], *hA = lab[0][1][tr], *hB = lab[0][2][tr];
+	const short *vL = lab[1][0][tr], *vA = lab[1][1][tr], *vB = lab[1][2][tr];
+	char *homoH = homo[0][tr], *homoV = homo[1][tr];
+	
+// luminance difference to the neighbour at offset o
+#define LDIFF(P, o) ((unsigned) ABS(P##L[tc] - P##L[tc+(o)]))
+// chrominance difference to the neighbour at offset o
+#define ABDIFF(P, o) (SQR((unsigned) (P##A[tc] - P##A[tc+(o)])) + \
+					  SQR((unsigned) (P##B[tc] - P##B[tc+(o)])))
+	
+#if defined(__clang__)
+#pragma clang loop vectorize(enable)
+#endif
+	for (tc=start; tc < end; tc++) {
+		unsigned lh0 = LDIFF(h, -1), lh1 = LDIFF(h, 1), lh2 = LDIFF(h, -TS), lh3 = LDIFF(h, TS);
+		unsigned lv0 = LDIFF(v, -1), lv1 = LDIFF(v, 1), lv2 = LDIFF(v, -TS), lv3 = LDIFF(v, TS);
+		unsigned abh0 = ABDIFF(h, -1), abh1 = ABDIFF(h, 1), abh2 = ABDIFF(h, -TS), abh3 = ABDIFF(h, TS);
+		unsigned abv0 = ABDIFF(v, -1), abv1 = ABDIFF(v, 1), abv2 = ABDIFF(v, -TS), abv3 = ABDIFF(v, TS);
+		
+		unsigned leps = MIN(MAX(lh0, lh1), MAX(lv2, lv3));
+		unsigned abeps = MIN(MAX(abh0, abh1), MAX(abv2, abv3));
+		
+		homoH[tc] = (lh0 <= leps & abh0 <= abeps) + (lh1 <= leps & abh1 <= abeps) +
+					(lh2 <= leps & abh2 <= abeps) + (lh3 <= leps & abh3 <= abeps);
+		homoV[tc] = (lv0 <= leps & abv0 <= abeps) + (lv1 <= leps & abv1 <= abeps) +
+					(lv2 <= leps & abv2 <= abeps) + (lv3 <= leps & abv3 <= abeps);
+	}
+	
+#undef LDIFF
+#undef ABDIFF
+}
+
+/**
+ * Interpolates a single TS x TS tile, whose top left corner is at the given
+ * position in the image.
+ *
+ * Samples are only ever read from the mosaic, and the output image is only
+ * ever written. Additionally, each tile writes only the pixels that no later
+ * tile (in row-major order) would overwrite. As a result, tiles are completely
+ * independent of each other and may run in any order, or concurrently, and
+ * still produce output identical to running them serially.
+ *
+ * @param st Shared interpolation state
+ * @param top Y coordinate of the tile's top left corner
+ * @param left X coordinate of the tile's top left corner
+ * @param buffer Scratch buffer for the tile, 26*TS*TS bytes.
+ */
+static void ahd_interpolate_tile(const ahd_state_t *st, int top, int left, char *buffer) {
+	int i, j, row, col, tr, tc, c, d, val, hm[2], count;
+	const ushort *pix;
+	ushort (*rix)[3];
+	ushort (*rgb)[TS][TS][3];
+	short (*lab)[3][TS][TS];
+	char (*homo)[TS][TS];
+	
+	// read out a bunch of data
+	const ushort *bayer = st->bayer;
+	ushort (*image)[4] = st->image;
+	int width = st->width;
+	int height = st->height;
+	unsigned int filters = st->filters;
+	
+	// the last row/column of each tile is overwritten by the next tile
+	int rowEnd = MIN(top+TS-4, height-6);
+	int colEnd = MIN(left+TS-4, width-6);
+	
+	rgb  = (ushort(*)[TS][TS][3]) buffer;
+	lab  = (short (*)[3][TS][TS])(buffer + 12*TS*TS);
+	homo = (char  (*)[TS][TS])   (buffer + 24*TS*TS);
+	
+	/*  Interpolate green horizontally and vertically: */
+	for (row = top; row < top+TS && row < height-3; row++) {
+		col = left + (FC(row, left, filters) & 1);
+		
+		// number of (non-green) pixels in this row of the tile
+		count = (MIN(left+TS, width-3) - col + 1) / 2;
+		
+		if (count > 0) {
+			st->greenRow(bayer + row*width+col, width, count,
+						 &rgb[0][row-top][col-left], &rgb[1][row-top][col-left]);
+		}
+	}
+	
+	/*  Interpolate red and blue, and convert to CIELab: */
+	for (d=0; d < 2; d++)
+		for (row=top+1; row < top+TS-1 && row < height-4; row++) {
+			for (col=left+1; col < left+TS-1 && col < width-4; col++) {
+				pix = bayer + row*width+col;
+				rix = &rgb[d][row-top][col-left];
+				if ((c = 2 - FC(row, col, filters)) == 1) {
+					c = FC(row+1, col, filters);
+					val = pix[0] + (( pix[-1] + pix[1]
+					- rix[-1][1] - rix[1][1] + 1) >> 1);
+					if (val < 0 || val > 65535)
+						val = (pix[-1] + pix[1] + 1) >> 1;
+					rix[0][2-c] = val;
+					val = pix[0] + (( pix[-width] + pix[width]
+					- rix[-TS][1] - rix[TS][1] + 1) >> 1);
+					if (val < 0 || val > 65535)
+						val = (pix[-width] + pix[width] + 1) >> 1;
+				} else {
+					val = rix[0][1] + (( pix[-width-1] + pix[-width+1]
+					+ pix[+width-1] + pix[+width+1]
+					- rix[-TS-1][1] - rix[-TS+1][1]
+					- rix[+TS-1][1] - rix[+TS+1][1] + 2) >> 2);
+					if (val < 0 || val > 65535)
+						val = (pix[-width-1] + pix[-width+1] +
+						pix[ width-1] + pix[ width+1] + 2) >> 2; }
+				rix[0][c] = val;
+				c = FC(row, col, filters);
+				rix[0][c] = pix[0];
+			}
+			
+			// convert the row that was just interpolated
+			tr = row-top;
+			count = MIN(left+TS-1, width-4) - (left+1);
 			
-			FORCC {
-				if(c != f && sum[c+4]) {
-					image[row*width+col][c] = sum[c] / sum[c+4];
-				}
+			if (count > 0) {
+				ahd_lab_row(st, (const ushort (*)[3]) &rgb[d][tr][1], count,
+							&lab[d][0][tr][1], &lab[d][1][tr][1], &lab[d][2][tr][1]);
 			}
 		}
+	
+	/*  Build homogeneity maps from the CIELab images: */
+	memset (homo, 0, 2*TS*TS);
+	for (row=top+2; row < top+TS-2 && row < height-5; row++) {
+		ahd_homogeneity_row(lab, row-top, 2, MIN(left+TS-2, width-5) - left, homo);
+	}
+	
+	/* Combine the most homogenous pixels for the final result: */
+	for (row=top+3; row < rowEnd; row++) {
+		tr = row-top;
+		for (col=left+3; col < colEnd; col++) {
+			tc = col-left;
+			for (d=0; d < 2; d++)
+				for (hm[d]=0, i=tr-1; i <= tr+1; i++)
+					for (j=tc-1; j <= tc+1; j++)
+						hm[d] += homo[d][i][j];
+			if (hm[0] != hm[1])
+				FORC3 image[row*width+col][c] = rgb[hm[1] > hm[0]][tr][tc][c];
+			else
+				FORC3 image[row*width+col][c] =
+				(rgb[0][tr][tc][c] + rgb[1][tr][tc][c] + 1) >> 1;
+			image[row*width+col][3] = 0;
+		}
+	}
 }
 
 /**
- * @param imageData Pointer to the libraw structure
- * @param image Image pointer, input
+ * Prepares the shared state for an AHD run, and interpolates the border of
+ * the image.
+ *
+ * @param st State struct to fill
  */
-void ahd_interpolate_mod(libraw_data_t *imageData, uint16_t (*image)[4]) {
-	int i, j, k, top, left, row, col, tr, tc, c, d, val, hm[2];
-	ushort (*pix)[4], (*rix)[3];
-	static const int dir[4] = { -1, 1, -TS, TS };
-	unsigned ldiff[2][4], abdiff[2][4], leps, abeps;
-	float r, cbrt[0x10000], xyz[3], xyz_cam[3][4];
-	ushort (*rgb)[TS][TS][3];
-	short (*lab)[TS][TS][3], (*lix)[3];
-	char (*homo)[TS][TS], *buffer;
+static void ahd_prepare(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4], const float *cbrt, ahd_state_t *st) {
+	int i, j, k;
 	
 	// read out a bunch of data
-	ushort width = imageData->sizes.width;
-	ushort height = imageData->sizes.height;
-	unsigned int filters = imageData->idata.filters;
+	st->bayer = bayer;
+	st->image = image;
+	st->width = imageData->sizes.width;
+	st->height = imageData->sizes.height;
+	st->filters = imageData->idata.filters;
+	st->colors = imageData->idata.colors;
+	st->cbrt = cbrt;
+	st->greenRow = ahd_green_row_select();
+	
 	ushort top_margin = imageData->sizes.top_margin;
 	ushort left_margin = imageData->sizes.left_margin;
-	
-	int colors = imageData->idata.colors;
 
-	// some sort of thingie generated
-	for (i=0; i < 0x10000; i++) {
-		r = i / 65535.0;
-		cbrt[i] = r > 0.008856 ? pow((double)r,1/3.0) : 7.787*r + 16/116.0;
-	}
-	
 	// do some interpolation?
 	for (i=0; i < 3; i++)
-		for (j=0; j < colors; j++)
-			for (xyz_cam[i][j] = k=0; k < 3; k++)
-				xyz_cam[i][j] += xyz_rgb[i][k] * imageData->color.rgb_cam[k][j] / d65_white[i];
+		for (j=0; j < st->colors; j++)
+			for (st->xyz_cam[i][j] = k=0; k < 3; k++)
+				st->xyz_cam[i][j] += xyz_rgb[i][k] * imageData->color.rgb_cam[k][j] / d65_white[i];
 
-	border_interpolate(6, width, height, image, filters, top_margin, left_margin, colors);
+	border_interpolate_bayer(6, st->width, st->height, bayer, image, st->filters, top_margin, left_margin, st->colors);
+}
+
+/**
+ * @param imageData Pointer to the libraw structure
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
+ * @param cbrt Cube root table, as built by ahd_build_cbrt_table()
+ */
+void ahd_interpolate_mod(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4], const float *cbrt) {
+	int top, left;
+	char *buffer;
+	ahd_state_t st;
+	
+	ahd_prepare(imageData, bayer, image, cbrt, &st);
+	
 	buffer = (char *) malloc (26*TS*TS);		/* 1664 kB */
 //	merror (buffer, "ahd_interpolate()");
-	rgb  = (ushort(*)[TS][TS][3]) buffer;
-	lab  = (short (*)[TS][TS][3])(buffer + 12*TS*TS);
-	homo = (char  (*)[TS][TS])   (buffer + 24*TS*TS);
 
-	for (top=3; top < height-6; top += TS-7)
-		for (left=3; left < width-6; left += TS-7) {
-			/*  Interpolate green horizontally and vertically: */
-			for (row = top; row < top+TS && row < height-3; row++) {
-				col = left + (FC(row, left, filters) & 1);
-				for (c = FC(row, col, filters); col < left+TS && col < width-3; col+=2) {
-					pix = image + row*width+col;
-					val = ((pix[-1][1] + pix[0][c] + pix[1][1]) * 2
-						- pix[-2][c] - pix[2][c] + 2) >> 2;
-					if (val < 0 || val > 65535) {
-						val = (pix[-3][1] + pix[3][1] +
-							18*(2*pix[0][c] - pix[-2][c] - pix[2][c]) +
-							63*(pix[-1][1] + pix[1][1]) + 64) >> 7;
-						if (val < 0 || val > 65535) {
-							val = (4*(pix[-1][1] + pix[1][1]) +
-								2*pix[0][c]-pix[-2][c]-pix[2][c] + 4) >> 3;
-							if (val < 0 || val > 65535)
-								val = (pix[-1][1] + pix[1][1] + 1) >> 1; }}
-					rgb[0][row-top][col-left][1] = val;
-					val = ((pix[-width][1] + pix[0][c] + pix[width][1]) * 2
-						- pix[-2*width][c] - pix[2*width][c] + 2) >> 2;
-					if (val < 0 || val > 65535) {
-						val = (pix[-3*width][1] + pix[3*width][1] +
-							18*(2*pix[0][c] - pix[-2*width][c] - pix[2*width][c]) +
-							63*(pix[-width][1] + pix[width][1]) + 64) >> 7;
-						if (val < 0 || val > 65535) {
-							val = (4*(pix[-width][1] + pix[width][1]) +
-								2*pix[0][c]-pix[-2*width][c]-pix[2*width][c] + 4) >> 3;
-							if (val < 0 || val > 65535)
-								val = (pix[-width][1] + pix[width][1] + 1) >> 1; }}
-					rgb[1][row-top][col-left][1] = val;
-				}
-			}
-			
-			/*  Interpolate red and blue, and convert to CIELab: */
-			for (d=0; d < 2; d++)
-				for (row=top+1; row < top+TS-1 && row < height-4; row++)
-					for (col=left+1; col < left+TS-1 && col < width-4; col++) {
-						pix = image + row*width+col;
-						rix = &rgb[d][row-top][col-left];
-						lix = &lab[d][row-top][col-left];
-						if ((c = 2 - FC(row, col, filters)) == 1) {
-							c = FC(row+1, col, filters);
-							val = pix[0][1] + (( pix[-1][2-c] + pix[1][2-c]
-							- rix[-1][1] - rix[1][1] + 1) >> 1);
-							if (val < 0 || val > 65535)
-								val = (pix[-1][2-c] + pix[1][2-c] + 1) >> 1;
-							rix[0][2-c] = val;
-							val = pix[0][1] + (( pix[-width][c] + pix[width][c]
-							- rix[-TS][1] - rix[TS][1] + 1) >> 1);
-							if (val < 0 || val > 65535)
-								val = (pix[-width][c] + pix[width][c] + 1) >> 1;
-						} else {
-							val = rix[0][1] + (( pix[-width-1][c] + pix[-width+1][c]
-							+ pix[+width-1][c] + pix[+width+1][c]
-							- rix[-TS-1][1] - rix[-TS+1][1]
-							- rix[+TS-1][1] - rix[+TS+1][1] + 2) >> 2);
-							if (val < 0 || val > 65535)
-								val = (pix[-width-1][c] + pix[-width+1][c] +
-								pix[ width-1][c] + pix[ width+1][c] + 2) >> 2; }
-						rix[0][c] = val;
-						c = FC(row, col, filters);
-						rix[0][c] = pix[0][c];
-						xyz[0] = xyz[1] = xyz[2] = 0.5;
-						FORCC {
-							xyz[0] += xyz_cam[0][c] * rix[0][c];
-							xyz[1] += xyz_cam[1][c] * rix[0][c];
-							xyz[2] += xyz_cam[2][c] * rix[0][c];
-						}
-						xyz[0] = cbrt[CLIP((int) xyz[0])];
-						xyz[1] = cbrt[CLIP((int) xyz[1])];
-						xyz[2] = cbrt[CLIP((int) xyz[2])];
-						lix[0][0] = 64 * (116 * xyz[1] - 16);
-						lix[0][1] = 64 * 500 * (xyz[0] - xyz[1]);
-						lix[0][2] = 64 * 200 * (xyz[1] - xyz[2]);
-					}
-			
-					/*  Build homogeneity maps from the CIELab images: */
-					memset (homo, 0, 2*TS*TS);
-					for (row=top+2; row < top+TS-2 && row < height-5; row++) {
-						tr = row-top;
-						for (col=left+2; col < left+TS-2 && col < width-5; col++) {
-							tc = col-left;
-							for (d=0; d < 2; d++) {
-								lix = &lab[d][tr][tc];
-								for (i=0; i < 4; i++) {
-									ldiff[d][i] = ABS(lix[0][0]-lix[dir[i]][0]);
-									abdiff[d][i] = SQR(lix[0][1]-lix[dir[i]][1])
-										+ SQR(lix[0][2]-lix[dir[i]][2]);
-								}
-							}
-							leps = MIN(MAX(ldiff[0][0],ldiff[0][1]),
-								MAX(ldiff[1][2],ldiff[1][3]));
-							abeps = MIN(MAX(abdiff[0][0],abdiff[0][1]),
-								MAX(abdiff[1][2],abdiff[1][3]));
-							for (d=0; d < 2; d++)
-								for (i=0; i < 4; i++)
-									if (ldiff[d][i] <= leps && abdiff[d][i] <= abeps)
-										homo[d][tr][tc]++;
-						}
-					}
-			
-					/* Combine the most homogenous pixels for the final result: */
-					for (row=top+3; row < top+TS-3 && row < height-6; row++) {
-						tr = row-top;
-						for (col=left+3; col < left+TS-3 && col < width-6; col++) {
-							tc = col-left;
-							for (d=0; d < 2; d++)
-								for (hm[d]=0, i=tr-1; i <= tr+1; i++)
-									for (j=tc-1; j <= tc+1; j++)
-										hm[d] += homo[d][i][j];
-							if (hm[0] != hm[1])
-								FORC3 image[row*width+col][c] = rgb[hm[1] > hm[0]][tr][tc][c];
-							else
-								FORC3 image[row*width+col][c] =
-								(rgb[0][tr][tc][c] + rgb[1][tr][tc][c] + 1) >> 1;
-						}
-					}
+	for (top=3; top < st.height-6; top += TS-7)
+		for (left=3; left < st.width-6; left += TS-7) {
+			ahd_interpolate_tile(&st, top, left, buffer);
 		}
 	
+	free(buffer);
+}
+
+/**
+ * Performs the same interpolation as ahd_interpolate_mod(), but distributes
+ * the tiles across a pool of worker threads; each worker has its own scratch
+ * buffer and pulls the next unprocessed tile until there are none left. The
+ * output is identical to that of the serial version.
+ *
+ * @param imageData Pointer to the libraw structure
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
+ * @param cbrt Cube root table, as built by ahd_build_cbrt_table()
+ */
+void ahd_interpolate_mod_parallel(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4], const float *cbrt) {
+	ahd_state_t st;
+	
+	// tiles are only independent for three colour Bayer data
+	if(imageData->idata.colors != 3) {
+		ahd_interpolate_mod(imageData, bayer, image, cbrt);
+		return;
+	}
+	
+	ahd_prepare(imageData, bayer, image, cbrt, &st);
+	
+	// figure out how many tiles there are in each direction
+	const int step = TS - 7;
+	const int tilesX = (st.width - 9 + step - 1) / step;
+	const int tilesY = (st.height - 9 + step - 1) / step;
+	
+	if(tilesX <= 0 || tilesY <= 0) {
+		return;
+	}
+	
+	const int numTiles = tilesX * tilesY;
+	
+	// use at most one worker per core, and no more workers than tiles
+	long numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	numWorkers = LIM(numWorkers, 1, numTiles);
+	
+	atomic_int nextTile = 0;
+	atomic_int *nextTilePtr = &nextTile;
+	const ahd_state_t *stPtr = &st;
+	
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(numWorkers, q, ^(size_t worker) {
+		char *buffer = (char *) malloc (26*TS*TS);		/* 1664 kB */
+		int tile;
+		
+		while((tile = atomic_fetch_add(nextTilePtr, 1)) < numTiles) {
+			int top = 3 + ((tile / tilesX) * step);
+			int left = 3 + ((tile % tilesX) * step);
+			
+			ahd_interpolate_tile(stPtr, top, left, buffer);
+		}
+		
 		free(buffer);
+	});
 }
 
 #undef TS
\ No newline at end of file
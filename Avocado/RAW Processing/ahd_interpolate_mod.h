@@ -16,12 +16,34 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
-	
+
+/**
+ * Builds the cube root lookup table used by the CIELab conversion. It only
+ * depends on constants, so it should be built once, and then shared.
+ *
+ * @param cbrt Table to fill, with 0x10000 entries
+ */
+void ahd_build_cbrt_table(float *cbrt);
+
+/**
+ * @param imageData Pointer to the libraw structure
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
+ * @param cbrt Cube root table, as built by ahd_build_cbrt_table()
+ */
+void ahd_interpolate_mod(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4], const float *cbrt);
+
 /**
+ * Performs the same interpolation as ahd_interpolate_mod(), but processes the
+ * independent tiles of the image on all available cores. The output is
+ * identical to that of the serial version.
+ *
  * @param imageData Pointer to the libraw structure
- * @param image Image pointer, input
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
+ * @param cbrt Cube root table, as built by ahd_build_cbrt_table()
  */
-void ahd_interpolate_mod(libraw_data_t *imageData, uint16_t (*image)[4]);
+void ahd_interpolate_mod_parallel(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4], const float *cbrt);
 
 #ifdef __cplusplus
 }
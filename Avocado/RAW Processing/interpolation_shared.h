@@ -9,6 +9,8 @@
 #ifndef interpolation_shared_h
 #define interpolation_shared_h
 
+#include <string.h>
+
 // undefine any previous definitions of these macros
 #undef MIN
 #undef MAX
@@ -118,4 +120,40 @@ static inline int fcol(size_t row, size_t col, unsigned int filters, ushort top_
 	return FC(row, col, filters);
 }
 
+/**
+ * Interpolates the pixels within the given distance of the image's edges by
+ * averaging the samples of each colour in the surrounding 3x3 block. This
+ * reads single component Bayer data, and writes every component of the border
+ * pixels to the output image: the pixel's own colour is copied from the
+ * mosaic, the others are averaged.
+ */
+static inline void border_interpolate_bayer(int border, int width, int height, const ushort *bayer, ushort (*image)[4], int filters, ushort top_margin, ushort left_margin, ushort colors) {
+	unsigned row, col, y, x, f, c, sum[8];
+	
+	for(row=0; row < height; row++)
+		for(col=0; col < width; col++) {
+			if(col==border && row >= border && row < height-border)
+				col = width-border;
+			memset(sum, 0, sizeof sum);
+			for(y=row-1; y != row+2; y++)
+				for(x=col-1; x != col+2; x++)
+					if(y < height && x < width) {
+						f = fcol(y,x, filters, top_margin, left_margin);
+						sum[f] += bayer[y*width+x];
+						sum[f+4]++;
+					}
+			f = fcol(row, col, filters, top_margin, left_margin);
+			
+			FORC4 {
+				if(c == f) {
+					image[row*width+col][c] = bayer[row*width+col];
+				} else if(c < colors && sum[c+4]) {
+					image[row*width+col][c] = sum[c] / sum[c+4];
+				} else {
+					image[row*width+col][c] = 0;
+				}
+			}
+		}
+}
+
 #endif /* interpolation_shared_h */
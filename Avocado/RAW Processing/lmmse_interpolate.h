@@ -18,12 +18,14 @@ extern "C" {
 	
 /**
  * Interpolates missing colour components in a Bayer image, using the LSMME
- * algorithm, as demonstrated by Wu-Zhang.
+ * algorithm, as demonstrated by Wu-Zhang. The image is processed in bands of
+ * rows, in parallel.
  *
  * @param imageData Pointer to the libraw structure
- * @param image Image pointer, input
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
  */
-void lmmse_interpolate(libraw_data_t *imageData, uint16_t (*image)[4]);
+void lmmse_interpolate(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4]);
 
 
 #ifdef __cplusplus
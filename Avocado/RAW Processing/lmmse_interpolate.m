@@ -21,73 +21,179 @@
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#include <dispatch/dispatch.h>
 
 #include "interpolation_shared.h"
 #include "libraw.h"
 
 /**
- * Set to 1 to evaluate the time taken for various subcomponents of the LMMSE
- * interpolation.
+ * Set to 1 to evaluate the time taken for the LMMSE interpolation.
  */
 #define DEBUG_TIME_PROFILE	1
 
 /**
- * Set to 0 to disable the median filter. It takes up a _massive_ amount of
- * processing time (more than thrice than every other part of the algorithm)
- * but has a very negligible impact on the final image.
+ * Set to 0 to disable the median filter. It refines the colour differences
+ * in three passes, which used to take up more than thrice the time of every
+ * other part of the algorithm; with the branch-free sorting network and the
+ * image being processed in parallel, this is no longer a concern.
+ */
+#define USE_MEDIAN_FILTER	1
+
+/**
+ * Number of image rows in each band. Each band is interpolated independently
+ * in its own buffer, which additionally holds LMMSE_BAND_HALO rows above and
+ * below the band.
  */
-#define USE_MEDIAN_FILTER	0
+#define LMMSE_BAND_ROWS		128
+
+/**
+ * Number of extra rows that are computed above and below each band. Every
+ * stage of the algorithm reads a few rows around the pixel it computes, so
+ * rows close to the edge of a band's buffer are computed from incomplete data;
+ * adding up the vertical reach of all stages (2 + 4 + 4 + 1 + 1, plus 1 for
+ * each of the three median passes) gives 15 rows. As long as the halo is
+ * at least that large, the rows of the band itself are identical to what
+ * would be computed if the entire image were processed at once.
+ */
+#define LMMSE_BAND_HALO		16
 
 // LSMME demosaicing algorithm
 // L. Zhang and X. Wu,
 // Color demosaicking via directional linear minimum mean square-error
 // estimation, IEEE Trans. on Image Processing, vol. 14, pp. 2167-2178,
 // Dec. 2005.
-#define PIX_SORT(a,b) { if ((a)>(b)) {temp=(a);(a)=(b);(b)=temp;} }
 
 /**
- * Interpolates missing colour components in a Bayer image, using the LSMME
- * algorithm, as demonstrated by Wu-Zhang.
+ * Compare-exchange step of the median sorting network; unlike a swap, this is
+ * branch-free, so that loops using it can be vectorized.
+ */
+#define PIX_SORT(a,b) { float t_ = MIN((a),(b)); (b) = MAX((a),(b)); (a) = t_; }
+
+/**
+ * State shared between all bands of a single LMMSE run. It's read-only once
+ * the bands start being processed.
+ */
+typedef struct {
+	/// single component Bayer data being interpolated
+	const uint16_t *bayer;
+	/// output image buffer
+	uint16_t (*image)[4];
+	
+	/// width of the image
+	int width;
+	/// height of the image
+	int height;
+	/// filter pattern
+	unsigned int filters;
+	
+	/// size of the border added around the image
+	int ba;
+	/// number of rows of the image, including the border
+	int rr1;
+	/// number of columns of the image, including the border
+	int cc1;
+	
+	/// low pass filter coefficients
+	float h0, h1, h2, h3, h4;
+} lmmse_state_t;
+
+/**
+ * Calculates the range of rows that a stage computes in a band. A stage that
+ * computes the rows [start, end) in the entire image, and reads up to reach
+ * rows above and below each row, computes the intersection of that range and
+ * the rows of the band's buffer whose neighbours are all in the buffer.
  *
- * @param imageData Pointer to the libraw structure
- * @param image Image pointer, input
- * @param gamma_apply Whether gamma should be applied
+ * @param g0 First row (including the border) in the band's buffer
+ * @param g1 Row (including the border) at which the band's buffer ends
+ */
+static inline void lmmse_band_rows(int g0, int g1, int start, int end, int reach, int *lo, int *hi) {
+	*lo = MAX(start, g0 + reach);
+	*hi = MIN(end, g1 - reach);
+}
+
+#if USE_MEDIAN_FILTER
+/**
+ * Computes the median of each 3x3 neighbourhood in a row of a single plane.
+ * The values are sorted with the same network as before, but the comparisons
+ * are done with min/max rather than branches, so the compiler vectorizes the
+ * loop; the results are identical.
+ *
+ * @param above Row above the one being filtered
+ * @param mid Row being filtered
+ * @param below Row below the one being filtered
+ * @param out Output for the median values
+ * @param count Number of values to compute; above, mid and below must be
+ * readable from index -1 to count (inclusive.)
  */
-void lmmse_interpolate(libraw_data_t *imageData, uint16_t (*image)[4]) {
+static inline void lmmse_median_row(const float *above, const float *mid, const float *below, float *out, int count) {
+	int i;
+	
+#if defined(__clang__)
+#pragma clang loop vectorize(enable)
+#endif
+	for(i = 0; i < count; i++) {
+		float p1 = above[i-1], p2 = above[i], p3 = above[i+1];
+		float p4 = mid[i-1], p5 = mid[i], p6 = mid[i+1];
+		float p7 = below[i-1], p8 = below[i], p9 = below[i+1];
+		
+		// Sort for median of 9 values
+		PIX_SORT(p2,p3); PIX_SORT(p5,p6); PIX_SORT(p8,p9);
+		PIX_SORT(p1,p2); PIX_SORT(p4,p5); PIX_SORT(p7,p8);
+		PIX_SORT(p2,p3); PIX_SORT(p5,p6); PIX_SORT(p8,p9);
+		PIX_SORT(p1,p4); PIX_SORT(p6,p9); PIX_SORT(p5,p8);
+		PIX_SORT(p4,p7); PIX_SORT(p2,p5); PIX_SORT(p3,p6);
+		PIX_SORT(p5,p8); PIX_SORT(p5,p3); PIX_SORT(p7,p5);
+		PIX_SORT(p5,p3);
+		
+		out[i] = p5;
+	}
+}
+#endif
+
+/**
+ * Interpolates a band of image rows. The band's buffer holds the rows (with
+ * the border added around the image) [g0, g1); only the image rows
+ * [rowStart, rowEnd) are written back to the image.
+ *
+ * @param st Shared interpolation state
+ * @param rowStart First image row of the band
+ * @param rowEnd Image row at which the band ends
+ * @param qix Buffer for the band; (LMMSE_BAND_ROWS + 2*LMMSE_BAND_HALO) * cc1
+ * pixels of six floats each.
+ * @param planes Scratch buffer for the median filter; one row of cc1 floats,
+ * plus (LMMSE_BAND_ROWS + 2*LMMSE_BAND_HALO) * cc1 floats.
+ */
+static void lmmse_interpolate_band(const lmmse_state_t *st, int rowStart, int rowEnd, float (*qix)[6], float *planes) {
 	ushort (*pix)[4];
-	int row, col, c, w1, w2, w3, w4, ii, ba, rr1, cc1, rr, cc;
-	float h0, h1, h2, h3, h4, hs;
+	int row, col, c, w1, w2, w3, w4, ii, rr, cc, lo, hi;
 	float p1, p2, p3, p4, p5, p6, p7, p8, p9;
 	float Y, v0, mu, vx, vn, xh, vh, xv, vv;
-	float (*rix)[6], (*qix)[6];
-	char  *buffer;
+	float (*rix)[6];
 	
 #if USE_MEDIAN_FILTER
 	int d, pass;
-	float temp;
-#endif
-	
-#if DEBUG_TIME_PROFILE
-	clock_t t1, t2;
-	t2 = clock();
-	
-	DDLogDebug(@"Begin lmmse_interpolate");
+	float *diff, *med;
 #endif
 	
 	// read out a bunch of data
-	ushort width = imageData->sizes.width;
-	ushort height = imageData->sizes.height;
-	unsigned int filters = imageData->idata.filters;
-	
-	// allocate work with boundary
-	ba = 10;
-	rr1 = height + (2 * ba);
-	cc1 = width + (2 * ba);
-	
-	buffer = (char *) calloc(rr1*cc1*6*sizeof(float), 1);
-	
-	// merror(buffer,"lmmse_interpolate()");
-	qix = (float (*)[6])buffer;
+	const uint16_t *bayer = st->bayer;
+	uint16_t (*image)[4] = st->image;
+	const int width = st->width;
+	const int height = st->height;
+	const unsigned int filters = st->filters;
+	const int ba = st->ba, rr1 = st->rr1, cc1 = st->cc1;
+	const float h0 = st->h0, h1 = st->h1, h2 = st->h2, h3 = st->h3, h4 = st->h4;
+	
+	// rows (including the border) held in the buffer
+	const int g0 = MAX(0, rowStart + ba - LMMSE_BAND_HALO);
+	const int g1 = MIN(rr1, rowEnd + ba + LMMSE_BAND_HALO);
+	const int numPixels = (g1 - g0) * cc1;
+	
+	// the buffer is expected to be zeroed, like the single image buffer was
+	memset(qix, 0, numPixels * 6 * sizeof(float));
 	
 	// indices
 	w1 = cc1;
@@ -95,50 +201,27 @@ void lmmse_interpolate(libraw_data_t *imageData, uint16_t (*image)[4]) {
 	w3 = 3*w1;
 	w4 = 4*w1;
 	
-	// define low pass filter (sigma=2, L=4)
-	h0 = 1.0;
-	h1 = exp( -1.0/8.0);
-	h2 = exp( -4.0/8.0);
-	h3 = exp( -9.0/8.0);
-	h4 = exp(-16.0/8.0);
-	hs = h0 + 2.0*(h1 + h2 + h3 + h4);
-	h0 /= hs;
-	h1 /= hs;
-	h2 /= hs;
-	h3 /= hs;
-	h4 /= hs;
-	
 	// copy CFA values
-#if DEBUG_TIME_PROFILE
-	t1 = clock();
-#endif
-	
-	for(rr = 0; rr < rr1; rr++) {
+	for(rr = g0; rr < g1; rr++) {
 		for(cc = 0, row = (rr - ba); cc < cc1; cc++) {
 			col = cc - ba;
-			rix = qix + rr*cc1 + cc;
+			rix = qix + (rr - g0)*cc1 + cc;
 			
 			if((row >= 0) & (row < height) & (col >= 0) & (col < width)) {
-				rix[0][4] = (double)image[row*width+col][FC(row,col,filters)]/65535.0;
+				rix[0][4] = (double)bayer[row*width+col]/65535.0;
 			} else {
 				rix[0][4] = 0;
 			}
 		}
 	}
 	
-#if DEBUG_TIME_PROFILE
-	DDLogDebug(@"\tcopy CFA values: %f s", ((double)(clock() - t1)) / CLOCKS_PER_SEC);
-#endif
-	
 	// G-R(B)
-#if DEBUG_TIME_PROFILE
-	t1 = clock();
-#endif
+	lmmse_band_rows(g0, g1, 2, rr1 - 2, 2, &lo, &hi);
 	
-	for(rr = 2; rr < (rr1 - 2); rr++) {
+	for(rr = lo; rr < hi; rr++) {
 		// G-R(B) at R(B) location
 		for(cc = 2+(FC(rr,2,filters)&1); cc < (cc1 - 2); cc += 2) {
-			rix = qix + rr*cc1 + cc;
+			rix = qix + (rr - g0)*cc1 + cc;
 			
 			// v0 = 0.25R + 0.25B, Y = 0.25R + 0.5B + 0.25B
 			v0 = 0.0625*(rix[-w1-1][4]+rix[-w1+1][4]+rix[w1-1][4]+rix[w1+1][4]) +
@@ -172,7 +255,7 @@ void lmmse_interpolate(libraw_data_t *imageData, uint16_t (*image)[4]) {
 		
 		// G-R(B) at G location
 		for(cc = 2+(FC(rr,3,filters)&1); cc < (cc1 - 2); cc += 2) {
-			rix = qix + rr*cc1 + cc;
+			rix = qix + (rr - g0)*cc1 + cc;
 			rix[0][0] = 0.25*(rix[ -2][4] + rix[ 2][4])
 			- 0.5*(rix[ -1][4] + rix[0][4] + rix[ 1][4]);
 			rix[0][1] = 0.25*(rix[-w2][4] + rix[w2][4])
@@ -182,18 +265,12 @@ void lmmse_interpolate(libraw_data_t *imageData, uint16_t (*image)[4]) {
 		}
 	}
 	
-#if DEBUG_TIME_PROFILE
-	DDLogDebug(@"\tG-R(B): %f s", ((double)(clock() - t1)) / CLOCKS_PER_SEC);
-#endif
-	
 	// apply low pass filter on differential colors
-#if DEBUG_TIME_PROFILE
-	t1 = clock();
-#endif
+	lmmse_band_rows(g0, g1, 4, rr1 - 4, 4, &lo, &hi);
 	
-	for(rr = 4; rr < (rr1 - 4); rr++) {
+	for(rr = lo; rr < hi; rr++) {
 		for (cc = 4; cc < (cc1 - 4); cc++) {
-			rix = qix + rr*cc1 + cc;
+			rix = qix + (rr - g0)*cc1 + cc;
 			rix[0][2] = h0*rix[0][0] +
 			h1*(rix[ -1][0] + rix[ 1][0]) + h2*(rix[ -2][0] + rix[ 2][0]) +
 			h3*(rix[ -3][0] + rix[ 3][0]) + h4*(rix[ -4][0] + rix[ 4][0]);
@@ -203,18 +280,12 @@ void lmmse_interpolate(libraw_data_t *imageData, uint16_t (*image)[4]) {
 		}
 	}
 	
-#if DEBUG_TIME_PROFILE
-	DDLogDebug(@"\tLow pass filter on differential colors: %f s", ((double)(clock() - t1)) / CLOCKS_PER_SEC);
-#endif
-	
 	// interpolate G-R(B) at R(B)
-#if DEBUG_TIME_PROFILE
-	t1 = clock();
-#endif
+	lmmse_band_rows(g0, g1, 4, rr1 - 4, 4, &lo, &hi);
 	
-	for (rr = 4; rr < (rr1 - 4); rr++) {
+	for (rr = lo; rr < hi; rr++) {
 		for (cc = 4+(FC(rr,4,filters)&1); cc < (cc1 - 4); cc += 2) {
-			rix = qix + rr*cc1 + cc;
+			rix = qix + (rr - g0)*cc1 + cc;
 			// horizontal
 			mu = (rix[-4][2] + rix[-3][2] + rix[-2][2] + rix[-1][2] + rix[0][2]+
 				  rix[ 1][2] + rix[ 2][2] + rix[ 3][2] + rix[ 4][2]) / 9.0;
@@ -271,23 +342,15 @@ void lmmse_interpolate(libraw_data_t *imageData, uint16_t (*image)[4]) {
 		}
 	}
 	
-#if DEBUG_TIME_PROFILE
-	DDLogDebug(@"\tInterpolate G-R(B) at R(B): %f s", ((double)(clock() - t1)) / CLOCKS_PER_SEC);
-#endif
-	
 	// copy CFA values
-#if DEBUG_TIME_PROFILE
-	t1 = clock();
-#endif
-	
-	for(rr = 0; rr < rr1; rr++) {
+	for(rr = g0; rr < g1; rr++) {
 		for(cc = 0, row = (rr-ba); cc < cc1; cc++) {
 			col=cc-ba;
-			rix = qix + rr*cc1 + cc;
+			rix = qix + (rr - g0)*cc1 + cc;
 			c = FC(rr,cc,filters);
 			
 			if ((row >= 0) & (row < height) & (col >= 0) & (col < width)) {
-				rix[0][c] = (double)image[row*width+col][c]/65535.0;
+				rix[0][c] = (double)bayer[row*width+col]/65535.0;
 			} else {
 				rix[0][c] = 0;
 			}
@@ -298,19 +361,13 @@ void lmmse_interpolate(libraw_data_t *imageData, uint16_t (*image)[4]) {
 		}
 	}
 	
-#if DEBUG_TIME_PROFILE
-	DDLogDebug(@"\tCopy CFA values: %f s", ((double)(clock() - t1)) / CLOCKS_PER_SEC);
-#endif
-	
 	// bilinear interpolation for R/B
 	// interpolate R/B at G location
-#if DEBUG_TIME_PROFILE
-	t1 = clock();
-#endif
+	lmmse_band_rows(g0, g1, 1, rr1 - 1, 1, &lo, &hi);
 	
-	for(rr = 1; rr < (rr1 - 1); rr++) {
+	for(rr = lo; rr < hi; rr++) {
 		for(cc=1+(FC(rr,2,filters)&1), c=FC(rr,cc+1,filters); cc < cc1-1; cc+=2) {
-			rix = qix + rr*cc1 + cc;
+			rix = qix + (rr - g0)*cc1 + cc;
 			rix[0][c] = rix[0][1]
 			+ 0.5*(rix[ -1][c] - rix[ -1][1] + rix[ 1][c] - rix[ 1][1]);
 			c = 2 - c;
@@ -320,118 +377,168 @@ void lmmse_interpolate(libraw_data_t *imageData, uint16_t (*image)[4]) {
 		}
 	}
 	
-#if DEBUG_TIME_PROFILE
-	DDLogDebug(@"\tInterpolate R/B at G location: %f s", ((double)(clock() - t1)) / CLOCKS_PER_SEC);
-#endif
-	
 	// interpolate R/B at B/R location
-#if DEBUG_TIME_PROFILE
-	t1 = clock();
-#endif
-	
-	for(rr = 1; rr < (rr1 -1 ); rr++) {
+	for(rr = lo; rr < hi; rr++) {
 		for(cc=1+(FC(rr,1,filters)&1), c=2-FC(rr,cc,filters); cc < cc1-1; cc+=2) {
-			rix = qix + rr*cc1 + cc;
+			rix = qix + (rr - g0)*cc1 + cc;
 			rix[0][c] = rix[0][1]
 			+ 0.25*(rix[-w1][c] - rix[-w1][1] + rix[ -1][c] - rix[ -1][1]+
 					rix[  1][c] - rix[  1][1] + rix[ w1][c] - rix[ w1][1]);
 		}
 	}
 	
-#if DEBUG_TIME_PROFILE
-	DDLogDebug(@"\tInterpolate R/B at B/R location: %f s", ((double)(clock() - t1)) / CLOCKS_PER_SEC);
-#endif
-	
 #if USE_MEDIAN_FILTER
-#if DEBUG_TIME_PROFILE
-	// median filter
-	t1 = clock();
-#endif
+	// median filter; the differences are filtered as a separate plane
+	med = planes;
+	diff = planes + cc1;
 	
 	for(pass = 1; pass <= 3; pass++) {
 		for(c = 0; c < 3; c += 2) {
 			// Compute median(R-G) and median(B-G)
 			d = c + 3;
-			for(ii = 0; ii < (rr1 * cc1); ii++) {
-				qix[ii][d] = qix[ii][c] - qix[ii][1];
+			for(ii = 0; ii < numPixels; ii++) {
+				qix[ii][d] = diff[ii] = qix[ii][c] - qix[ii][1];
 			}
 			
-			// Apply 3x3 median fileter
-			for(rr = 1; rr < (rr1 - 1); rr++) {
-				for(cc = 1; cc < (cc1 - 1); cc++) {
-					rix = qix + rr*cc1 + cc;
-					// Assign 3x3 differential color values
-					p1 = rix[-w1-1][d]; p2 = rix[-w1][d]; p3 = rix[-w1+1][d];
-					p4 = rix[   -1][d]; p5 = rix[  0][d]; p6 = rix[    1][d];
-					p7 = rix[ w1-1][d]; p8 = rix[ w1][d]; p9 = rix[ w1+1][d];
-					
-					// Sort for median of 9 values
-					PIX_SORT(p2,p3); PIX_SORT(p5,p6); PIX_SORT(p8,p9);
-					PIX_SORT(p1,p2); PIX_SORT(p4,p5); PIX_SORT(p7,p8);
-					PIX_SORT(p2,p3); PIX_SORT(p5,p6); PIX_SORT(p8,p9);
-					PIX_SORT(p1,p4); PIX_SORT(p6,p9); PIX_SORT(p5,p8);
-					PIX_SORT(p4,p7); PIX_SORT(p2,p5); PIX_SORT(p3,p6);
-					PIX_SORT(p5,p8); PIX_SORT(p5,p3); PIX_SORT(p7,p5);
-					PIX_SORT(p5,p3);
-					
-					rix[0][4] = p5;
+			// Apply 3x3 median filter
+			for(rr = lo; rr < hi; rr++) {
+				float *dix = diff + (rr - g0)*cc1 + 1;
+				lmmse_median_row(dix - w1, dix, dix + w1, med, cc1 - 2);
+				
+				rix = qix + (rr - g0)*cc1 + 1;
+				for(cc = 0; cc < (cc1 - 2); cc++) {
+					rix[cc][4] = med[cc];
 				}
 			}
 			
-			for(ii = 0; ii < (rr1 * cc1); ii++) {
+			for(ii = 0; ii < numPixels; ii++) {
 				qix[ii][d] = qix[ii][4];
 			}
 		}
 		
 		// red/blue at GREEN pixel locations
-		for(rr = 0; rr < rr1; rr++) {
+		for(rr = g0; rr < g1; rr++) {
 			for(cc=(FC(rr,1,filters)&1), c=FC(rr,cc+1,filters); cc < cc1; cc+=2) {
-				rix = qix + rr*cc1 + cc;
+				rix = qix + (rr - g0)*cc1 + cc;
 				rix[0][0] = rix[0][1] + rix[0][3];
 				rix[0][2] = rix[0][1] + rix[0][5];
 			}
 		}
 		
 		// red/blue and green at BLUE/RED pixel locations
-		for(rr = 0; rr < rr1; rr++) {
+		for(rr = g0; rr < g1; rr++) {
 			for(cc=(FC(rr,0,filters)&1), c=2-FC(rr,cc,filters), d=c+3; cc < cc1; cc+=2) {
-				rix = qix + rr*cc1 + cc;
+				rix = qix + (rr - g0)*cc1 + cc;
 				rix[0][c] = rix[0][1] + rix[0][d];
 				rix[0][1] = 0.5*(rix[0][0] - rix[0][3] + rix[0][2] - rix[0][5]); }
 		}
 	}
-	
-#if DEBUG_TIME_PROFILE
-	DDLogDebug(@"\tMedian filter: %f s", ((double)(clock() - t1)) / CLOCKS_PER_SEC);
-#endif
 #endif
 	
 	// copy result back to image matrix
-#if DEBUG_TIME_PROFILE
-	t1 = clock();
-#endif
-	
-	for(row = 0; row < height; row++) {
+	for(row = rowStart; row < rowEnd; row++) {
 		for(col = 0, rr= (row + ba); col < width; col++) {
 			cc = col + ba;
 			pix = image + row*width + col;
-			rix = qix + rr*cc1 + cc;
+			rix = qix + (rr - g0)*cc1 + cc;
 			c = FC(row, col, filters);
 			
 			for(ii = 0; ii < 3; ii++) {
 				if(ii != c) {
 					pix[0][ii] = CLIP((int) (65535.0 * rix[0][ii] + 0.5));
+				} else {
+					pix[0][ii] = bayer[row*width+col];
 				}
 			}
+			
+			pix[0][3] = 0;
 		}
 	}
+}
+
+/**
+ * Interpolates missing colour components in a Bayer image, using the LSMME
+ * algorithm, as demonstrated by Wu-Zhang.
+ *
+ * The image is split into bands of rows, which are distributed across a pool
+ * of worker threads; each worker has its own buffer, which holds a band and
+ * the halo around it, and pulls the next unprocessed band until there are
+ * none left.
+ *
+ * @param imageData Pointer to the libraw structure
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
+ */
+void lmmse_interpolate(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4]) {
+	lmmse_state_t st;
+	float hs;
 	
 #if DEBUG_TIME_PROFILE
-	DDLogDebug(@"\tCopy result to image matrix: %f s", ((double)(clock() - t1)) / CLOCKS_PER_SEC);
+	clock_t t2 = clock();
 	
-	DDLogDebug(@"Total time for lmmse_interpolate: %f s", ((double)(clock() - t2)) / CLOCKS_PER_SEC);
+	DDLogDebug(@"Begin lmmse_interpolate");
 #endif
 	
-	// Done
-	free(buffer);
-}
\ No newline at end of file
+	// read out a bunch of data
+	st.bayer = bayer;
+	st.image = image;
+	st.width = imageData->sizes.width;
+	st.height = imageData->sizes.height;
+	st.filters = imageData->idata.filters;
+	
+	// allocate work with boundary
+	st.ba = 10;
+	st.rr1 = st.height + (2 * st.ba);
+	st.cc1 = st.width + (2 * st.ba);
+	
+	// define low pass filter (sigma=2, L=4)
+	st.h0 = 1.0;
+	st.h1 = exp( -1.0/8.0);
+	st.h2 = exp( -4.0/8.0);
+	st.h3 = exp( -9.0/8.0);
+	st.h4 = exp(-16.0/8.0);
+	hs = st.h0 + 2.0*(st.h1 + st.h2 + st.h3 + st.h4);
+	st.h0 /= hs;
+	st.h1 /= hs;
+	st.h2 /= hs;
+	st.h3 /= hs;
+	st.h4 /= hs;
+	
+	// figure out the number of bands, and workers to process them
+	const int numBands = (st.height + LMMSE_BAND_ROWS - 1) / LMMSE_BAND_ROWS;
+	
+	if(numBands <= 0) {
+		return;
+	}
+	
+	long numWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	numWorkers = LIM(numWorkers, 1, numBands);
+	
+	const size_t bandPixels = (LMMSE_BAND_ROWS + (2 * LMMSE_BAND_HALO)) * st.cc1;
+	
+	atomic_int nextBand = 0;
+	atomic_int *nextBandPtr = &nextBand;
+	const lmmse_state_t *stPtr = &st;
+	
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(numWorkers, q, ^(size_t worker) {
+		float (*buffer)[6] = (float (*)[6]) malloc(bandPixels * 6 * sizeof(float));
+		float *planes = (float *) malloc((bandPixels + stPtr->cc1) * sizeof(float));
+		int band;
+		
+		while((band = atomic_fetch_add(nextBandPtr, 1)) < numBands) {
+			int rowStart = band * LMMSE_BAND_ROWS;
+			int rowEnd = MIN(rowStart + LMMSE_BAND_ROWS, stPtr->height);
+			
+			lmmse_interpolate_band(stPtr, rowStart, rowEnd, buffer, planes);
+		}
+		
+		free(planes);
+		free(buffer);
+	});
+	
+#if DEBUG_TIME_PROFILE
+	DDLogDebug(@"Total time for lmmse_interpolate: %f s", ((double)(clock() - t2)) / CLOCKS_PER_SEC);
+#endif
+}
@@ -0,0 +1,1013 @@
+//
+//  pixel_convert_kernels.cpp
+//  Avocado
+//
+//  Created by Tristan Seifert on 20160802.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#include "pixel_convert_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PIXEL_CONVERT_NEON	1
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+/// size of the tiles in which transposing orientations are applied, in pixels
+const size_t kOrientTileSize = 64;
+/// number of pixels of half precision planes that are converted at a time
+const size_t kHalfChunkPixels = 256;
+
+#pragma mark SIMD Abstraction
+/**
+ * Four floats, held in a vector register if the machine has them.
+ */
+struct vec4f {
+#if defined(__SSE2__)
+	__m128 v;
+#elif PIXEL_CONVERT_NEON
+	float32x4_t v;
+#else
+	float v[4];
+#endif
+};
+
+#if defined(__SSE2__)
+inline vec4f load(const float *p) { return { _mm_loadu_ps(p) }; }
+inline void store(float *p, vec4f a) { _mm_storeu_ps(p, a.v); }
+inline vec4f splat(float f) { return { _mm_set1_ps(f) }; }
+
+inline vec4f add(vec4f a, vec4f b) { return { _mm_add_ps(a.v, b.v) }; }
+inline vec4f sub(vec4f a, vec4f b) { return { _mm_sub_ps(a.v, b.v) }; }
+inline vec4f mul(vec4f a, vec4f b) { return { _mm_mul_ps(a.v, b.v) }; }
+inline vec4f vmin(vec4f a, vec4f b) { return { _mm_min_ps(a.v, b.v) }; }
+inline vec4f vmax(vec4f a, vec4f b) { return { _mm_max_ps(a.v, b.v) }; }
+
+/**
+ * Reverses the order of the components.
+ */
+inline vec4f reverse(vec4f a) {
+	return { _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(0, 1, 2, 3)) };
+}
+
+/**
+ * Loads eight unsigned 16 bit values, and converts them to floats.
+ */
+inline void load_u16x8(const uint16_t *p, vec4f &lo, vec4f &hi) {
+	__m128i in = _mm_loadu_si128((const __m128i *) p);
+	__m128i zero = _mm_setzero_si128();
+	
+	lo.v = _mm_cvtepi32_ps(_mm_unpacklo_epi16(in, zero));
+	hi.v = _mm_cvtepi32_ps(_mm_unpackhi_epi16(in, zero));
+}
+
+/**
+ * Splits four RGB pixels, held in three vectors, into their components.
+ */
+inline void deinterleave_rgb(vec4f in0, vec4f in1, vec4f in2, vec4f &r, vec4f &g, vec4f &b) {
+	// a0 = r0 g0 b0 r1, a1 = g1 b1 r2 g2, a2 = b2 r3 g3 b3
+	__m128 a0 = in0.v, a1 = in1.v, a2 = in2.v;
+	
+	__m128 rLo = _mm_shuffle_ps(a0, a0, _MM_SHUFFLE(0, 0, 3, 0));
+	__m128 rHi = _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(1, 1, 2, 2));
+	r.v = _mm_shuffle_ps(rLo, rHi, _MM_SHUFFLE(2, 0, 1, 0));
+	
+	__m128 gLo = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(0, 0, 1, 1));
+	__m128 gHi = _mm_shuffle_ps(a1, a2, _MM_SHUFFLE(2, 2, 3, 3));
+	g.v = _mm_shuffle_ps(gLo, gHi, _MM_SHUFFLE(2, 0, 2, 0));
+	
+	__m128 bLo = _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(1, 1, 2, 2));
+	__m128 bHi = _mm_shuffle_ps(a2, a2, _MM_SHUFFLE(3, 3, 0, 0));
+	b.v = _mm_shuffle_ps(bLo, bHi, _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+/**
+ * Transposes a 4x4 block, held in four vectors.
+ */
+inline void transpose(vec4f &a, vec4f &b, vec4f &c, vec4f &d) {
+	_MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+}
+#elif PIXEL_CONVERT_NEON
+inline vec4f load(const float *p) { return { vld1q_f32(p) }; }
+inline void store(float *p, vec4f a) { vst1q_f32(p, a.v); }
+inline vec4f splat(float f) { return { vdupq_n_f32(f) }; }
+
+inline vec4f add(vec4f a, vec4f b) { return { vaddq_f32(a.v, b.v) }; }
+inline vec4f sub(vec4f a, vec4f b) { return { vsubq_f32(a.v, b.v) }; }
+inline vec4f mul(vec4f a, vec4f b) { return { vmulq_f32(a.v, b.v) }; }
+inline vec4f vmin(vec4f a, vec4f b) { return { vminq_f32(a.v, b.v) }; }
+inline vec4f vmax(vec4f a, vec4f b) { return { vmaxq_f32(a.v, b.v) }; }
+
+/**
+ * Reverses the order of the components.
+ */
+inline vec4f reverse(vec4f a) {
+	float32x4_t rev = vrev64q_f32(a.v);
+	return { vcombine_f32(vget_high_f32(rev), vget_low_f32(rev)) };
+}
+
+/**
+ * Loads eight unsigned 16 bit values, and converts them to floats.
+ */
+inline void load_u16x8(const uint16_t *p, vec4f &lo, vec4f &hi) {
+	uint16x8_t in = vld1q_u16(p);
+	
+	lo.v = vcvtq_f32_u32(vmovl_u16(vget_low_u16(in)));
+	hi.v = vcvtq_f32_u32(vmovl_u16(vget_high_u16(in)));
+}
+
+/**
+ * Loads four RGB pixels, and splits them into their components.
+ */
+inline void load_rgb(const float *p, vec4f &r, vec4f &g, vec4f &b) {
+	float32x4x3_t in = vld3q_f32(p);
+	
+	r.v = in.val[0];
+	g.v = in.val[1];
+	b.v = in.val[2];
+}
+
+/**
+ * Loads eight RGB pixels with 16 bit components, splits them into their
+ * components, and converts those to floats.
+ */
+inline void load_rgb_u16x8(const uint16_t *p, vec4f r[2], vec4f g[2], vec4f b[2]) {
+	uint16x8x3_t in = vld3q_u16(p);
+	
+	r[0].v = vcvtq_f32_u32(vmovl_u16(vget_low_u16(in.val[0])));
+	r[1].v = vcvtq_f32_u32(vmovl_u16(vget_high_u16(in.val[0])));
+	g[0].v = vcvtq_f32_u32(vmovl_u16(vget_low_u16(in.val[1])));
+	g[1].v = vcvtq_f32_u32(vmovl_u16(vget_high_u16(in.val[1])));
+	b[0].v = vcvtq_f32_u32(vmovl_u16(vget_low_u16(in.val[2])));
+	b[1].v = vcvtq_f32_u32(vmovl_u16(vget_high_u16(in.val[2])));
+}
+
+/**
+ * Transposes a 4x4 block, held in four vectors.
+ */
+inline void transpose(vec4f &a, vec4f &b, vec4f &c, vec4f &d) {
+	float32x4x2_t ab = vtrnq_f32(a.v, b.v);
+	float32x4x2_t cd = vtrnq_f32(c.v, d.v);
+	
+	a.v = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+	b.v = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+	c.v = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+	d.v = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+#else
+inline vec4f load(const float *p) { vec4f r; memcpy(r.v, p, sizeof(r.v)); return r; }
+inline void store(float *p, vec4f a) { memcpy(p, a.v, sizeof(a.v)); }
+inline vec4f splat(float f) { return { { f, f, f, f } }; }
+
+inline vec4f add(vec4f a, vec4f b) { for(int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+inline vec4f sub(vec4f a, vec4f b) { for(int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+inline vec4f mul(vec4f a, vec4f b) { for(int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+inline vec4f vmin(vec4f a, vec4f b) { for(int i = 0; i < 4; i++) a.v[i] = std::min(a.v[i], b.v[i]); return a; }
+inline vec4f vmax(vec4f a, vec4f b) { for(int i = 0; i < 4; i++) a.v[i] = std::max(a.v[i], b.v[i]); return a; }
+
+/**
+ * Reverses the order of the components.
+ */
+inline vec4f reverse(vec4f a) {
+	return { { a.v[3], a.v[2], a.v[1], a.v[0] } };
+}
+
+/**
+ * Loads eight unsigned 16 bit values, and converts them to floats.
+ */
+inline void load_u16x8(const uint16_t *p, vec4f &lo, vec4f &hi) {
+	for(int i = 0; i < 4; i++) {
+		lo.v[i] = (float) p[i];
+		hi.v[i] = (float) p[i + 4];
+	}
+}
+
+/**
+ * Splits four RGB pixels, held in three vectors, into their components.
+ */
+inline void deinterleave_rgb(vec4f in0, vec4f in1, vec4f in2, vec4f &r, vec4f &g, vec4f &b) {
+	float p[12];
+	
+	memcpy(p, in0.v, sizeof(in0.v));
+	memcpy(p + 4, in1.v, sizeof(in1.v));
+	memcpy(p + 8, in2.v, sizeof(in2.v));
+	
+	for(int i = 0; i < 4; i++) {
+		r.v[i] = p[(i * 3) + 0];
+		g.v[i] = p[(i * 3) + 1];
+		b.v[i] = p[(i * 3) + 2];
+	}
+}
+
+/**
+ * Transposes a 4x4 block, held in four vectors.
+ */
+inline void transpose(vec4f &a, vec4f &b, vec4f &c, vec4f &d) {
+	vec4f *rows[4] = { &a, &b, &c, &d };
+	
+	for(int i = 0; i < 4; i++) {
+		for(int j = i + 1; j < 4; j++) {
+			std::swap(rows[i]->v[j], rows[j]->v[i]);
+		}
+	}
+}
+#endif
+
+#if !PIXEL_CONVERT_NEON
+/**
+ * Loads four RGB pixels, and splits them into their components.
+ */
+inline void load_rgb(const float *p, vec4f &r, vec4f &g, vec4f &b) {
+	deinterleave_rgb(load(p), load(p + 4), load(p + 8), r, g, b);
+}
+
+/**
+ * Loads eight RGB pixels with 16 bit components, splits them into their
+ * components, and converts those to floats.
+ */
+inline void load_rgb_u16x8(const uint16_t *p, vec4f r[2], vec4f g[2], vec4f b[2]) {
+	vec4f f[6];
+	
+	load_u16x8(p, f[0], f[1]);
+	load_u16x8(p + 8, f[2], f[3]);
+	load_u16x8(p + 16, f[4], f[5]);
+	
+	deinterleave_rgb(f[0], f[1], f[2], r[0], g[0], b[0]);
+	deinterleave_rgb(f[3], f[4], f[5], r[1], g[1], b[1]);
+}
+#endif
+
+/**
+ * Loads eight RGBX pixels with 16 bit components, splits them into their
+ * components (discarding X), and converts those to floats.
+ */
+inline void load_rgbx_u16x8(const uint16_t *p, vec4f r[2], vec4f g[2], vec4f b[2]) {
+	for(int i = 0; i < 2; i++) {
+		vec4f p0, p1, p2, p3;
+		
+		load_u16x8(p + (i * 16), p0, p1);
+		load_u16x8(p + (i * 16) + 8, p2, p3);
+		
+		// after transposing, each vector holds one component of four pixels
+		transpose(p0, p1, p2, p3);
+		
+		r[i] = p0;
+		g[i] = p1;
+		b[i] = p2;
+	}
+}
+
+/**
+ * Stores four pixels as RGBX, given each of their components.
+ */
+inline void store_rgbx(float *p, vec4f r, vec4f g, vec4f b, vec4f x) {
+	transpose(r, g, b, x);
+	
+	store(p, r);
+	store(p + 4, g);
+	store(p + 8, b);
+	store(p + 12, x);
+}
+
+#pragma mark Helpers
+/**
+ * Returns a pointer to the given row of a buffer.
+ */
+template <typename T> inline T *row(T *base, size_t stride, size_t y) {
+	typedef typename std::conditional<std::is_const<T>::value, const uint8_t, uint8_t>::type byte;
+	return (T *) (((byte *) base) + (stride * y));
+}
+
+/**
+ * Returns a pointer to the pixel at (x, y) of a plane.
+ */
+template <typename T> inline T *pixel(T *base, size_t stride, size_t x, size_t y) {
+	return row(base, stride, y) + x;
+}
+
+/**
+ * The steps that produce the output of an EXIF orientation from its input:
+ * the input is optionally transposed, and the result then mirrored
+ * horizontally and/or vertically.
+ */
+struct orientation_steps {
+	bool transpose;
+	bool mirrorX;
+	bool mirrorY;
+};
+
+/**
+ * Splits an EXIF orientation (1 through 8) into its steps.
+ */
+inline orientation_steps orientation_decompose(int orientation) {
+	switch(orientation) {
+		case 2: return { false, true, false };
+		case 3: return { false, true, true };
+		case 4: return { false, false, true };
+		case 5: return { true, false, false };
+		case 6: return { true, true, false };
+		case 7: return { true, true, true };
+		case 8: return { true, false, true };
+		default: return { false, false, false };
+	}
+}
+
+/**
+ * Maps the coordinates of an input pixel to its location in the output.
+ */
+inline void orient_coords(size_t x, size_t y, size_t width, size_t height, orientation_steps steps, size_t &outX, size_t &outY) {
+	size_t outWidth = width, outHeight = height;
+	
+	outX = x;
+	outY = y;
+	
+	if(steps.transpose) {
+		std::swap(outX, outY);
+		std::swap(outWidth, outHeight);
+	}
+	
+	if(steps.mirrorX) {
+		outX = outWidth - 1 - outX;
+	}
+	if(steps.mirrorY) {
+		outY = outHeight - 1 - outY;
+	}
+}
+
+/**
+ * Transposes a 4x4 block whose top left corner is at (x, y) in the input into
+ * the output, mirroring it as needed.
+ */
+inline void transpose_block(const float *in, size_t inStride, float *out, size_t outStride, size_t x, size_t y, size_t width, size_t height, orientation_steps steps) {
+	vec4f a = load(pixel(in, inStride, x, y));
+	vec4f b = load(pixel(in, inStride, x, y + 1));
+	vec4f c = load(pixel(in, inStride, x, y + 2));
+	vec4f d = load(pixel(in, inStride, x, y + 3));
+	
+	// after transposing, each vector holds one input column
+	transpose(a, b, c, d);
+	vec4f cols[4] = { a, b, c, d };
+	
+	// input column x + i becomes an output row; input rows become columns
+	for(size_t i = 0; i < 4; i++) {
+		size_t outY = steps.mirrorY ? (width - 1 - x - i) : (x + i);
+		
+		if(steps.mirrorX) {
+			store(pixel(out, outStride, height - 4 - y, outY), reverse(cols[i]));
+		} else {
+			store(pixel(out, outStride, y, outY), cols[i]);
+		}
+	}
+}
+
+/**
+ * Widens the range [lo, hi] such that it contains all values of a row.
+ */
+inline void row_range(const float *src, size_t width, float &lo, float &hi) {
+	size_t x = 0;
+	
+	if(width >= 4) {
+		vec4f vLo = load(src), vHi = vLo;
+		
+		for(; (x + 4) <= width; x += 4) {
+			vec4f v = load(src + x);
+			
+			vLo = vmin(vLo, v);
+			vHi = vmax(vHi, v);
+		}
+		
+		float los[4], his[4];
+		store(los, vLo);
+		store(his, vHi);
+		
+		for(int i = 0; i < 4; i++) {
+			lo = std::min(lo, los[i]);
+			hi = std::max(hi, his[i]);
+		}
+	}
+	
+	for(; x < width; x++) {
+		lo = std::min(lo, src[x]);
+		hi = std::max(hi, src[x]);
+	}
+}
+
+/**
+ * Maps the values of a row from [lo, hi] to [min, max], given the scale
+ * between the two ranges.
+ */
+inline void row_stretch(float *dst, size_t width, float lo, float scale, float min) {
+	const vec4f vLo = splat(lo), vMin = splat(min), vScale = splat(scale);
+	size_t x = 0;
+	
+	for(; (x + 4) <= width; x += 4) {
+		vec4f v = load(dst + x);
+		store(dst + x, add(mul(sub(v, vLo), vScale), vMin));
+	}
+	
+	for(; x < width; x++) {
+		dst[x] = ((dst[x] - lo) * scale) + min;
+	}
+}
+
+} // namespace
+
+#pragma mark Format Conversions
+/**
+ * Converts unsigned 16 bit components to floats, multiplying each by the
+ * given scale; eight components are converted at a time.
+ */
+void pixel_convert_16u_to_f(const uint16_t *in, size_t inStride, float *out, size_t outStride, size_t count, size_t height, float scale) {
+	const vec4f vScale = splat(scale);
+	
+	for(size_t y = 0; y < height; y++) {
+		const uint16_t *src = row(in, inStride, y);
+		float *dst = row(out, outStride, y);
+		
+		size_t i = 0;
+		
+		for(; (i + 8) <= count; i += 8) {
+			vec4f lo, hi;
+			load_u16x8(src + i, lo, hi);
+			
+			store(dst + i, mul(lo, vScale));
+			store(dst + i + 4, mul(hi, vScale));
+		}
+		
+		for(; i < count; i++) {
+			dst[i] = ((float) src[i]) * scale;
+		}
+	}
+}
+
+/**
+ * Converts RGB or RGBX pixels with unsigned 16 bit components directly into
+ * three planes of floats, eight pixels at a time. Each component is converted
+ * exactly like pixel_convert_16u_to_f() would.
+ */
+void pixel_convert_16u_to_planar_f(const uint16_t *in, size_t inStride, int components, float *planes[3], size_t planeStride, size_t width, size_t height, float scale) {
+	const vec4f vScale = splat(scale);
+	
+	for(size_t y = 0; y < height; y++) {
+		const uint16_t *src = row(in, inStride, y);
+		
+		float *r = row(planes[0], planeStride, y);
+		float *g = row(planes[1], planeStride, y);
+		float *b = row(planes[2], planeStride, y);
+		
+		size_t x = 0;
+		
+		for(; (x + 8) <= width; x += 8) {
+			vec4f vr[2], vg[2], vb[2];
+			
+			if(components == 4) {
+				load_rgbx_u16x8(src + (x * 4), vr, vg, vb);
+			} else {
+				load_rgb_u16x8(src + (x * 3), vr, vg, vb);
+			}
+			
+			for(int i = 0; i < 2; i++) {
+				store(r + x + (i * 4), mul(vr[i], vScale));
+				store(g + x + (i * 4), mul(vg[i], vScale));
+				store(b + x + (i * 4), mul(vb[i], vScale));
+			}
+		}
+		
+		for(; x < width; x++) {
+			r[x] = ((float) src[(x * components) + 0]) * scale;
+			g[x] = ((float) src[(x * components) + 1]) * scale;
+			b[x] = ((float) src[(x * components) + 2]) * scale;
+		}
+	}
+}
+
+/**
+ * Splits interleaved RGB floats into three planes, four pixels at a time.
+ */
+void pixel_convert_fff_to_planar_f(const float *in, size_t inStride, float *planes[3], size_t planeStride, size_t width, size_t height) {
+	for(size_t y = 0; y < height; y++) {
+		const float *src = row(in, inStride, y);
+		
+		float *r = row(planes[0], planeStride, y);
+		float *g = row(planes[1], planeStride, y);
+		float *b = row(planes[2], planeStride, y);
+		
+		size_t x = 0;
+		
+		for(; (x + 4) <= width; x += 4) {
+			vec4f vr, vg, vb;
+			load_rgb(src + (x * 3), vr, vg, vb);
+			
+			store(r + x, vr);
+			store(g + x, vg);
+			store(b + x, vb);
+		}
+		
+		for(; x < width; x++) {
+			r[x] = src[(x * 3) + 0];
+			g[x] = src[(x * 3) + 1];
+			b[x] = src[(x * 3) + 2];
+		}
+	}
+}
+
+/**
+ * Interleaves three planes into RGBX floats, four pixels at a time.
+ */
+void pixel_convert_planar_f_to_ffff(const float *planes[3], size_t planeStride, float x, float *out, size_t outStride, size_t width, size_t height) {
+	const vec4f vX = splat(x);
+	
+	for(size_t y = 0; y < height; y++) {
+		const float *r = row(planes[0], planeStride, y);
+		const float *g = row(planes[1], planeStride, y);
+		const float *b = row(planes[2], planeStride, y);
+		
+		float *dst = row(out, outStride, y);
+		
+		size_t i = 0;
+		
+		for(; (i + 4) <= width; i += 4) {
+			store_rgbx(dst + (i * 4), load(r + i), load(g + i), load(b + i), vX);
+		}
+		
+		for(; i < width; i++) {
+			dst[(i * 4) + 0] = r[i];
+			dst[(i * 4) + 1] = g[i];
+			dst[(i * 4) + 2] = b[i];
+			dst[(i * 4) + 3] = x;
+		}
+	}
+}
+
+#pragma mark Geometric Operations
+/**
+ * Applies an EXIF orientation to a band of input rows.
+ *
+ * Orientations that don't transpose the image copy each input row to an
+ * output row, reversing it four pixels at a time if needed. The others are
+ * processed in tiles, so that both the rows read from the input and the rows
+ * written to the output of a tile stay in the cache (and TLB); inside each
+ * tile, 4x4 blocks are loaded, transposed in registers and stored. Pixels that
+ * don't fill a block are moved one at a time.
+ */
+void pixel_orient_planar_f(const float *in, size_t inStride, float *out, size_t outStride, size_t width, size_t height, int orientation, size_t firstRow, size_t numRows) {
+	const orientation_steps steps = orientation_decompose(orientation);
+	const size_t lastRow = std::min(firstRow + numRows, height);
+	
+	if(!steps.transpose) {
+		for(size_t y = firstRow; y < lastRow; y++) {
+			const float *src = row(in, inStride, y);
+			float *dst = row(out, outStride, steps.mirrorY ? (height - 1 - y) : y);
+			
+			if(!steps.mirrorX) {
+				memcpy(dst, src, width * sizeof(float));
+				continue;
+			}
+			
+			size_t x = 0;
+			
+			for(; (x + 4) <= width; x += 4) {
+				store(dst + (width - 4 - x), reverse(load(src + x)));
+			}
+			
+			for(; x < width; x++) {
+				dst[width - 1 - x] = src[x];
+			}
+		}
+		
+		return;
+	}
+	
+	const size_t blockWidth = width & ~3UL;
+	const size_t blockEnd = firstRow + ((lastRow - firstRow) & ~3UL);
+	
+	// transpose all full blocks, tile by tile
+	for(size_t tileY = firstRow; tileY < blockEnd; tileY += kOrientTileSize) {
+		size_t tileYEnd = std::min(tileY + kOrientTileSize, blockEnd);
+		
+		for(size_t tileX = 0; tileX < blockWidth; tileX += kOrientTileSize) {
+			size_t tileXEnd = std::min(tileX + kOrientTileSize, blockWidth);
+			
+			for(size_t y = tileY; y < tileYEnd; y += 4) {
+				for(size_t x = tileX; x < tileXEnd; x += 4) {
+					transpose_block(in, inStride, out, outStride, x, y, width, height, steps);
+				}
+			}
+		}
+	}
+	
+	// move the remaining pixels along the right and bottom edges of the band
+	for(size_t y = firstRow; y < lastRow; y++) {
+		const float *src = row(in, inStride, y);
+		size_t x = (y < blockEnd) ? blockWidth : 0;
+		
+		for(; x < width; x++) {
+			size_t outX, outY;
+			orient_coords(x, y, width, height, steps, outX, outY);
+			
+			*pixel(out, outStride, outX, outY) = src[x];
+		}
+	}
+}
+
+#pragma mark Histogram Operations
+/**
+ * Stretches the values of a plane in place. The range of values is found in
+ * a first pass, and the plane is then scaled in a second.
+ */
+void pixel_contrast_stretch_planar_f(float *plane, size_t stride, size_t width, size_t height, float min, float max) {
+	if(width == 0 || height == 0) {
+		return;
+	}
+	
+	// find the smallest and largest values
+	float lo = plane[0], hi = plane[0];
+	
+	for(size_t y = 0; y < height; y++) {
+		row_range(row(plane, stride, y), width, lo, hi);
+	}
+	
+	lo = std::max(lo, min);
+	hi = std::min(hi, max);
+	
+	// a flat plane can't be stretched
+	if(hi <= lo) {
+		return;
+	}
+	
+	// map [lo, hi] to [min, max]
+	const float scale = (max - min) / (hi - lo);
+	
+	for(size_t y = 0; y < height; y++) {
+		row_stretch(row(plane, stride, y), width, lo, scale, min);
+	}
+}
+
+#pragma mark - Half Precision
+namespace {
+
+/**
+ * Converts a float to half precision, rounding to nearest even. Values that
+ * are too large become infinity, and all NaNs become the same quiet NaN.
+ */
+inline uint16_t float_to_half(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, sizeof(bits));
+	
+	const uint16_t sign = (bits >> 16) & 0x8000;
+	const uint32_t mag = bits & 0x7FFFFFFF;
+	
+	// infinity and NaN
+	if(mag >= 0x7F800000) {
+		return sign | 0x7C00 | ((mag > 0x7F800000) ? 0x200 : 0);
+	}
+	// anything at or above 65520 rounds to infinity
+	if(mag >= 0x477FF000) {
+		return sign | 0x7C00;
+	}
+	// below 2^-14, the result is subnormal; scaling by 2^24 is exact
+	if(mag < 0x38800000) {
+		float val;
+		memcpy(&val, &mag, sizeof(val));
+		
+		return sign | (uint16_t) lrintf(val * 16777216.f);
+	}
+	
+	// rebias the exponent, and round the mantissa from 23 to 10 bits
+	uint32_t half = (mag - 0x38000000) >> 13;
+	uint32_t rest = mag & 0x1FFF;
+	
+	if(rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+		half++;
+	}
+	
+	return sign | (uint16_t) half;
+}
+
+/**
+ * Converts a half precision value to a float.
+ */
+inline float half_to_float(uint16_t h) {
+	const uint32_t sign = ((uint32_t) (h & 0x8000)) << 16;
+	const uint32_t exponent = (h >> 10) & 0x1F;
+	const uint32_t mantissa = h & 0x3FF;
+	
+	uint32_t bits;
+	
+	if(exponent == 0) {
+		// zero and subnormals are exactly representable as scaled integers
+		float val = ((float) mantissa) * (1.f / 16777216.f);
+		return sign ? -val : val;
+	} else if(exponent == 0x1F) {
+		bits = sign | 0x7F800000 | (mantissa << 13);
+	} else {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+/**
+ * Reference implementation of the conversion of a row to floats.
+ */
+void h_to_f_scalar(const uint16_t *in, float *out, size_t count) {
+	for(size_t i = 0; i < count; i++) {
+		out[i] = half_to_float(in[i]);
+	}
+}
+
+/**
+ * Reference implementation of the conversion of a row to half precision.
+ */
+void f_to_h_scalar(const float *in, uint16_t *out, size_t count) {
+	for(size_t i = 0; i < count; i++) {
+		out[i] = float_to_half(in[i]);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Converts a row to floats with F16C, eight values at a time.
+ */
+__attribute__((target("avx,f16c"))) void h_to_f_f16c(const uint16_t *in, float *out, size_t count) {
+	size_t i = 0;
+	
+	for(; (i + 8) <= count; i += 8) {
+		__m128i h = _mm_loadu_si128((const __m128i *) (in + i));
+		_mm256_storeu_ps(out + i, _mm256_cvtph_ps(h));
+	}
+	
+	h_to_f_scalar(in + i, out + i, count - i);
+}
+
+/**
+ * Converts a row to half precision with F16C, eight values at a time.
+ */
+__attribute__((target("avx,f16c"))) void f_to_h_f16c(const float *in, uint16_t *out, size_t count) {
+	size_t i = 0;
+	
+	for(; (i + 8) <= count; i += 8) {
+		__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+		_mm_storeu_si128((__m128i *) (out + i), h);
+	}
+	
+	f_to_h_scalar(in + i, out + i, count - i);
+}
+#elif defined(__aarch64__)
+/**
+ * Converts a row to floats with NEON, four values at a time.
+ */
+void h_to_f_neon(const uint16_t *in, float *out, size_t count) {
+	size_t i = 0;
+	
+	for(; (i + 4) <= count; i += 4) {
+		float16x4_t h = vreinterpret_f16_u16(vld1_u16(in + i));
+		vst1q_f32(out + i, vcvt_f32_f16(h));
+	}
+	
+	h_to_f_scalar(in + i, out + i, count - i);
+}
+
+/**
+ * Converts a row to half precision with NEON, four values at a time.
+ */
+void f_to_h_neon(const float *in, uint16_t *out, size_t count) {
+	size_t i = 0;
+	
+	for(; (i + 4) <= count; i += 4) {
+		float16x4_t h = vcvt_f16_f32(vld1q_f32(in + i));
+		vst1_u16(out + i, vreinterpret_u16_f16(h));
+	}
+	
+	f_to_h_scalar(in + i, out + i, count - i);
+}
+#endif
+
+/**
+ * Conversions of rows between half precision and floats.
+ */
+struct half_converters {
+	void (*toFloat)(const uint16_t *in, float *out, size_t count);
+	void (*toHalf)(const float *in, uint16_t *out, size_t count);
+};
+
+/**
+ * Returns the fastest conversions supported by the CPU the code is running
+ * on. They're selected the first time this is called.
+ */
+const half_converters &half_converters_select() {
+	static const half_converters converters = []() -> half_converters {
+#if defined(__x86_64__) || defined(__i386__)
+		if(__builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c")) {
+			return { h_to_f_f16c, f_to_h_f16c };
+		}
+#elif defined(__aarch64__)
+		return { h_to_f_neon, f_to_h_neon };
+#endif
+		
+		return { h_to_f_scalar, f_to_h_scalar };
+	}();
+	
+	return converters;
+}
+
+} // namespace
+
+/**
+ * Converts floats to half precision.
+ */
+void pixel_convert_f_to_h(const float *in, uint16_t *out, size_t count) {
+	half_converters_select().toHalf(in, out, count);
+}
+
+/**
+ * Converts half precision values to floats.
+ */
+void pixel_convert_h_to_f(const uint16_t *in, float *out, size_t count) {
+	half_converters_select().toFloat(in, out, count);
+}
+
+/**
+ * Converts RGB or RGBX pixels with unsigned 16 bit components to three half
+ * precision planes. Each row is converted in chunks: they're first converted
+ * to floats in a small buffer that stays in the cache, and then rounded to
+ * half precision.
+ */
+void pixel_convert_16u_to_planar_h(const uint16_t *in, size_t inStride, int components, uint16_t *planes[3], size_t planeStride, size_t width, size_t height, float scale) {
+	const half_converters &cvt = half_converters_select();
+	
+	float buf[3][kHalfChunkPixels];
+	float *bufPlanes[3] = { buf[0], buf[1], buf[2] };
+	
+	for(size_t y = 0; y < height; y++) {
+		const uint16_t *src = row(in, inStride, y);
+		
+		for(size_t x = 0; x < width; x += kHalfChunkPixels) {
+			size_t count = std::min(kHalfChunkPixels, width - x);
+			
+			pixel_convert_16u_to_planar_f(src + (x * components), 0, components, bufPlanes, 0, count, 1, scale);
+			
+			for(int c = 0; c < 3; c++) {
+				cvt.toHalf(buf[c], row(planes[c], planeStride, y) + x, count);
+			}
+		}
+	}
+}
+
+/**
+ * Interleaves three half precision planes into RGBX, eight pixels at a time.
+ */
+void pixel_convert_planar_h_to_hhhh(const uint16_t *planes[3], size_t planeStride, uint16_t x, uint16_t *out, size_t outStride, size_t width, size_t height) {
+	for(size_t y = 0; y < height; y++) {
+		const uint16_t *r = row(planes[0], planeStride, y);
+		const uint16_t *g = row(planes[1], planeStride, y);
+		const uint16_t *b = row(planes[2], planeStride, y);
+		
+		uint16_t *dst = row(out, outStride, y);
+		
+		size_t i = 0;
+
+#if defined(__SSE2__)
+		const __m128i vX = _mm_set1_epi16((short) x);
+		
+		for(; (i + 8) <= width; i += 8) {
+			__m128i vr = _mm_loadu_si128((const __m128i *) (r + i));
+			__m128i vg = _mm_loadu_si128((const __m128i *) (g + i));
+			__m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+			
+			// pairs of RG and BX, which are then interleaved into pixels
+			__m128i rgLo = _mm_unpacklo_epi16(vr, vg), rgHi = _mm_unpackhi_epi16(vr, vg);
+			__m128i bxLo = _mm_unpacklo_epi16(vb, vX), bxHi = _mm_unpackhi_epi16(vb, vX);
+			
+			_mm_storeu_si128((__m128i *) (dst + (i * 4)), _mm_unpacklo_epi32(rgLo, bxLo));
+			_mm_storeu_si128((__m128i *) (dst + (i * 4) + 8), _mm_unpackhi_epi32(rgLo, bxLo));
+			_mm_storeu_si128((__m128i *) (dst + (i * 4) + 16), _mm_unpacklo_epi32(rgHi, bxHi));
+			_mm_storeu_si128((__m128i *) (dst + (i * 4) + 24), _mm_unpackhi_epi32(rgHi, bxHi));
+		}
+#elif PIXEL_CONVERT_NEON
+		const uint16x8_t vX = vdupq_n_u16(x);
+		
+		for(; (i + 8) <= width; i += 8) {
+			uint16x8x4_t px = { { vld1q_u16(r + i), vld1q_u16(g + i), vld1q_u16(b + i), vX } };
+			vst4q_u16(dst + (i * 4), px);
+		}
+#endif
+		
+		for(; i < width; i++) {
+			dst[(i * 4) + 0] = r[i];
+			dst[(i * 4) + 1] = g[i];
+			dst[(i * 4) + 2] = b[i];
+			dst[(i * 4) + 3] = x;
+		}
+	}
+}
+
+/**
+ * Applies an EXIF orientation to a band of input rows of a plane of 16 bit
+ * values. The values are only moved, so this works for any 16 bit format;
+ * transposing orientations are applied in tiles, like the float kernel.
+ */
+void pixel_orient_planar_16(const uint16_t *in, size_t inStride, uint16_t *out, size_t outStride, size_t width, size_t height, int orientation, size_t firstRow, size_t numRows) {
+	const orientation_steps steps = orientation_decompose(orientation);
+	const size_t lastRow = std::min(firstRow + numRows, height);
+	
+	if(!steps.transpose) {
+		for(size_t y = firstRow; y < lastRow; y++) {
+			const uint16_t *src = row(in, inStride, y);
+			uint16_t *dst = row(out, outStride, steps.mirrorY ? (height - 1 - y) : y);
+			
+			if(!steps.mirrorX) {
+				memcpy(dst, src, width * sizeof(uint16_t));
+			} else {
+				std::reverse_copy(src, src + width, dst);
+			}
+		}
+		
+		return;
+	}
+	
+	for(size_t tileY = firstRow; tileY < lastRow; tileY += kOrientTileSize) {
+		size_t tileYEnd = std::min(tileY + kOrientTileSize, lastRow);
+		
+		for(size_t tileX = 0; tileX < width; tileX += kOrientTileSize) {
+			size_t tileXEnd = std::min(tileX + kOrientTileSize, width);
+			
+			for(size_t y = tileY; y < tileYEnd; y++) {
+				const uint16_t *src = row(in, inStride, y);
+				
+				for(size_t x = tileX; x < tileXEnd; x++) {
+					size_t outX, outY;
+					orient_coords(x, y, width, height, steps, outX, outY);
+					
+					*pixel(out, outStride, outX, outY) = src[x];
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Stretches the values of a half precision plane in place. Both passes
+ * convert each row to floats in chunks, and the second one converts the
+ * stretched values back.
+ */
+void pixel_contrast_stretch_planar_h(uint16_t *plane, size_t stride, size_t width, size_t height, float min, float max) {
+	if(width == 0 || height == 0) {
+		return;
+	}
+	
+	const half_converters &cvt = half_converters_select();
+	float buf[kHalfChunkPixels];
+	
+	// find the smallest and largest values
+	float lo = half_to_float(plane[0]), hi = lo;
+	
+	for(size_t y = 0; y < height; y++) {
+		const uint16_t *src = row(plane, stride, y);
+		
+		for(size_t x = 0; x < width; x += kHalfChunkPixels) {
+			size_t count = std::min(kHalfChunkPixels, width - x);
+			
+			cvt.toFloat(src + x, buf, count);
+			row_range(buf, count, lo, hi);
+		}
+	}
+	
+	lo = std::max(lo, min);
+	hi = std::min(hi, max);
+	
+	// a flat plane can't be stretched
+	if(hi <= lo) {
+		return;
+	}
+	
+	// map [lo, hi] to [min, max]
+	const float scale = (max - min) / (hi - lo);
+	
+	for(size_t y = 0; y < height; y++) {
+		uint16_t *dst = row(plane, stride, y);
+		
+		for(size_t x = 0; x < width; x += kHalfChunkPixels) {
+			size_t count = std::min(kHalfChunkPixels, width - x);
+			
+			cvt.toFloat(dst + x, buf, count);
+			row_stretch(buf, count, lo, scale, min);
+			cvt.toHalf(buf, dst + x, count);
+		}
+	}
+}
@@ -0,0 +1,206 @@
+//
+//  pixel_convert_kernels.h
+//  Avocado
+//
+//	Portable implementations of the pixel format conversions, orientation and
+//	contrast stretch performed by the pixel format converter. They're written
+//	against a small SIMD abstraction with SSE2 and NEON paths (and a scalar
+//	fallback), and depend on nothing but the C++ standard library, so they
+//	can be built and benchmarked on any platform.
+//
+//	All strides are in bytes, like the rowBytes of a vImage buffer.
+//
+//	Half precision planes hold IEEE 754 binary16 values in uint16_t storage.
+//	They're converted to floats (with F16C or NEON, if the CPU has them) as
+//	they're loaded, and all arithmetic is done on 32-bit floats.
+//
+//  Created by Tristan Seifert on 20160802.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#ifndef pixel_convert_kernels_h
+#define pixel_convert_kernels_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Converts unsigned 16 bit components to floats, multiplying each by the
+ * given scale.
+ *
+ * @param in Input components.
+ * @param inStride Bytes per row of the input.
+ * @param out Output components.
+ * @param outStride Bytes per row of the output.
+ * @param count Number of components in each row.
+ * @param height Number of rows.
+ * @param scale Value by which each component is multiplied.
+ */
+void pixel_convert_16u_to_f(const uint16_t *in, size_t inStride, float *out, size_t outStride, size_t count, size_t height, float scale);
+
+/**
+ * Converts RGB or RGBX pixels with unsigned 16 bit components directly into
+ * three planes of floats, multiplying each component by the given scale. This
+ * is equivalent to pixel_convert_16u_to_f() followed by
+ * pixel_convert_fff_to_planar_f(), but without the intermediate buffer.
+ *
+ * @param in Interleaved input.
+ * @param inStride Bytes per row of the input.
+ * @param components Number of components per input pixel; 3 or 4. The fourth
+ * component, if any, is ignored.
+ * @param planes Red, green and blue output planes.
+ * @param planeStride Bytes per row of each plane.
+ * @param width Width of the image, in pixels.
+ * @param height Height of the image, in pixels.
+ * @param scale Value by which each component is multiplied.
+ */
+void pixel_convert_16u_to_planar_f(const uint16_t *in, size_t inStride, int components, float *planes[3], size_t planeStride, size_t width, size_t height, float scale);
+
+/**
+ * Splits interleaved RGB floats into three planes.
+ *
+ * @param in Interleaved input, three floats per pixel.
+ * @param inStride Bytes per row of the input.
+ * @param planes Red, green and blue output planes.
+ * @param planeStride Bytes per row of each plane.
+ * @param width Width of the image, in pixels.
+ * @param height Height of the image, in pixels.
+ */
+void pixel_convert_fff_to_planar_f(const float *in, size_t inStride, float *planes[3], size_t planeStride, size_t width, size_t height);
+
+/**
+ * Interleaves three planes into RGBX floats, with X set to the given value.
+ *
+ * @param planes Red, green and blue input planes.
+ * @param planeStride Bytes per row of each plane.
+ * @param x Value of the fourth component of each pixel.
+ * @param out Interleaved output, four floats per pixel.
+ * @param outStride Bytes per row of the output.
+ * @param width Width of the image, in pixels.
+ * @param height Height of the image, in pixels.
+ */
+void pixel_convert_planar_f_to_ffff(const float *planes[3], size_t planeStride, float x, float *out, size_t outStride, size_t width, size_t height);
+
+/**
+ * Applies an EXIF orientation to a band of rows of a plane. The plane is
+ * transposed if the orientation requires it (5 through 8), and then mirrored
+ * horizontally and/or vertically. Since every input pixel maps to a single
+ * output pixel, disjoint bands can be processed in parallel. The input and
+ * output may not overlap.
+ *
+ * @param in Input plane.
+ * @param inStride Bytes per row of the input.
+ * @param out Output plane; its width and height are swapped for transposing
+ * orientations.
+ * @param outStride Bytes per row of the output.
+ * @param width Width of the input, in pixels.
+ * @param height Height of the input, in pixels.
+ * @param orientation EXIF orientation; 1 through 8.
+ * @param firstRow First input row to process.
+ * @param numRows Number of input rows to process; works best as a multiple of
+ * four.
+ */
+void pixel_orient_planar_f(const float *in, size_t inStride, float *out, size_t outStride, size_t width, size_t height, int orientation, size_t firstRow, size_t numRows);
+
+/**
+ * Stretches the values of a plane in place, such that the smallest value
+ * (clamped to [min, max]) becomes min, and the largest one becomes max.
+ *
+ * @param plane Plane to stretch.
+ * @param stride Bytes per row of the plane.
+ * @param width Width of the plane, in pixels.
+ * @param height Height of the plane, in pixels.
+ * @param min Lower bound of the output values.
+ * @param max Upper bound of the output values.
+ */
+void pixel_contrast_stretch_planar_f(float *plane, size_t stride, size_t width, size_t height, float min, float max);
+
+#pragma mark Half Precision
+/**
+ * Converts floats to half precision, rounding to nearest even.
+ *
+ * @param in Input values.
+ * @param out Output values.
+ * @param count Number of values to convert.
+ */
+void pixel_convert_f_to_h(const float *in, uint16_t *out, size_t count);
+
+/**
+ * Converts half precision values to floats.
+ *
+ * @param in Input values.
+ * @param out Output values.
+ * @param count Number of values to convert.
+ */
+void pixel_convert_h_to_f(const uint16_t *in, float *out, size_t count);
+
+/**
+ * Converts RGB or RGBX pixels with unsigned 16 bit components directly into
+ * three half precision planes. The components are scaled exactly like in
+ * pixel_convert_16u_to_planar_f(), before they're rounded to half precision.
+ *
+ * @param in Interleaved input.
+ * @param inStride Bytes per row of the input.
+ * @param components Number of components per input pixel; 3 or 4. The fourth
+ * component, if any, is ignored.
+ * @param planes Red, green and blue output planes.
+ * @param planeStride Bytes per row of each plane.
+ * @param width Width of the image, in pixels.
+ * @param height Height of the image, in pixels.
+ * @param scale Value by which each component is multiplied.
+ */
+void pixel_convert_16u_to_planar_h(const uint16_t *in, size_t inStride, int components, uint16_t *planes[3], size_t planeStride, size_t width, size_t height, float scale);
+
+/**
+ * Interleaves three half precision planes into RGBX, with X set to the given
+ * value. The values are copied without being converted.
+ *
+ * @param planes Red, green and blue input planes.
+ * @param planeStride Bytes per row of each plane.
+ * @param x Value of the fourth component of each pixel, in half precision.
+ * @param out Interleaved output, four half precision values per pixel.
+ * @param outStride Bytes per row of the output.
+ * @param width Width of the image, in pixels.
+ * @param height Height of the image, in pixels.
+ */
+void pixel_convert_planar_h_to_hhhh(const uint16_t *planes[3], size_t planeStride, uint16_t x, uint16_t *out, size_t outStride, size_t width, size_t height);
+
+/**
+ * Applies an EXIF orientation to a band of rows of a plane of 16 bit values,
+ * like pixel_orient_planar_f().
+ *
+ * @param in Input plane.
+ * @param inStride Bytes per row of the input.
+ * @param out Output plane; its width and height are swapped for transposing
+ * orientations.
+ * @param outStride Bytes per row of the output.
+ * @param width Width of the input, in pixels.
+ * @param height Height of the input, in pixels.
+ * @param orientation EXIF orientation; 1 through 8.
+ * @param firstRow First input row to process.
+ * @param numRows Number of input rows to process.
+ */
+void pixel_orient_planar_16(const uint16_t *in, size_t inStride, uint16_t *out, size_t outStride, size_t width, size_t height, int orientation, size_t firstRow, size_t numRows);
+
+/**
+ * Stretches the values of a half precision plane in place, like
+ * pixel_contrast_stretch_planar_f().
+ *
+ * @param plane Plane to stretch.
+ * @param stride Bytes per row of the plane.
+ * @param width Width of the plane, in pixels.
+ * @param height Height of the plane, in pixels.
+ * @param min Lower bound of the output values.
+ * @param max Upper bound of the output values.
+ */
+void pixel_contrast_stretch_planar_h(uint16_t *plane, size_t stride, size_t width, size_t height, float min, float max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* pixel_convert_kernels_h */
@@ -0,0 +1,149 @@
+//
+//  simple_interpolate.c
+//  Avocado
+//
+//  Created by Tristan Seifert on 20160722.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#include "simple_interpolate.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <dispatch/dispatch.h>
+
+#include "interpolation_shared.h"
+
+/// number of rows processed by each iteration of the bilinear interpolation
+#define BILINEAR_BAND_ROWS	64
+
+/**
+ * Interpolates missing colour components by averaging the neighbouring pixels
+ * of that colour in a 3x3 block; this is the same as dcraw's lin_interpolate.
+ *
+ * For each position in the 16x16 filter pattern, a list of the neighbours to
+ * sum (weighted by their distance) and the factors to divide the sums by is
+ * built ahead of time. Each pixel only reads the mosaic, and only writes its
+ * own output pixel, so rows may be processed in any order.
+ *
+ * @param imageData Pointer to the libraw structure
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
+ */
+void bilinear_interpolate(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4]) {
+	int code[16][16][32], *ip, sum[4];
+	int f, c, x, y, row, col, shift, color;
+	const int size = 16;
+	
+	// read out a bunch of data
+	const int width = imageData->sizes.width;
+	const int height = imageData->sizes.height;
+	const unsigned int filters = imageData->idata.filters;
+	const int colors = imageData->idata.colors;
+	
+	ushort top_margin = imageData->sizes.top_margin;
+	ushort left_margin = imageData->sizes.left_margin;
+	
+	border_interpolate_bayer(1, width, height, bayer, image, filters, top_margin, left_margin, colors);
+	
+	// build the neighbour lists for each position in the pattern
+	for (row=0; row < size; row++)
+		for (col=0; col < size; col++) {
+			// the first two entries are the number of neighbours, and the colour
+			ip = code[row][col]+2;
+			f = fcol(row, col, filters, top_margin, left_margin);
+			memset(sum, 0, sizeof sum);
+			for (y=-1; y <= 1; y++)
+				for (x=-1; x <= 1; x++) {
+					shift = (y==0) + (x==0);
+					color = fcol(row+y+size, col+x+size, filters, top_margin, left_margin);
+					if (color == f) continue;
+					*ip++ = (width*y + x);
+					*ip++ = shift;
+					*ip++ = color;
+					sum[color] += 1 << shift;
+				}
+			code[row][col][0] = (int) (ip - code[row][col] - 2) / 3;
+			code[row][col][1] = f;
+			FORCC
+				if (c != f) {
+					*ip++ = c;
+					*ip++ = sum[c] ? (256 / sum[c]) : 0;
+				}
+		}
+	
+	// interpolate the interior of the image, in bands of rows
+	int (*codePtr)[16][32] = code;
+	const size_t numBands = (height + BILINEAR_BAND_ROWS - 1) / BILINEAR_BAND_ROWS;
+	
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(numBands, q, ^(size_t band) {
+		int row, col, i, sum[4];
+		const int *ip;
+		const uint16_t *src;
+		uint16_t *pix;
+		
+		int rowStart = MAX(1, (int) band * BILINEAR_BAND_ROWS);
+		int rowEnd = MIN((int) (band + 1) * BILINEAR_BAND_ROWS, height - 1);
+		
+		for (row=rowStart; row < rowEnd; row++)
+			for (col=1; col < width-1; col++) {
+				src = bayer + row*width + col;
+				pix = image[row*width+col];
+				ip = codePtr[row % size][col % size];
+				memset(sum, 0, sizeof sum);
+				pix[3] = 0;
+				pix[ip[1]] = *src;
+				for (i=*ip, ip+=2; i--; ip+=3)
+					sum[ip[2]] += src[ip[0]] << ip[1];
+				for (i=colors; --i; ip+=2)
+					pix[ip[0]] = sum[ip[0]] * ip[1] >> 8;
+			}
+	});
+}
+
+/**
+ * Combines each 2x2 block of Bayer samples into a single RGB pixel; colours
+ * that appear more than once in the block (i.e. green) are averaged. Since the
+ * output is separate from the mosaic, rows are processed on all cores.
+ *
+ * @param imageData Pointer to the libraw structure
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
+ */
+void superpixel_interpolate(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4]) {
+	// read out a bunch of data
+	const int width = imageData->sizes.width;
+	const int height = imageData->sizes.height;
+	const unsigned int filters = imageData->idata.filters;
+	
+	ushort top_margin = imageData->sizes.top_margin;
+	ushort left_margin = imageData->sizes.left_margin;
+	
+	const int outWidth = width / 2;
+	const int outHeight = height / 2;
+	
+	dispatch_queue_t q = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+	
+	dispatch_apply(outHeight, q, ^(size_t row) {
+		int col, x, y, c, sum[4], count[4];
+		
+		for (col=0; col < outWidth; col++) {
+			memset(sum, 0, sizeof sum);
+			memset(count, 0, sizeof count);
+			
+			for (y=0; y < 2; y++)
+				for (x=0; x < 2; x++) {
+					c = fcol(2*row+y, 2*col+x, filters, top_margin, left_margin);
+					sum[c] += bayer[(2*row+y)*width + (2*col+x)];
+					count[c]++;
+				}
+			
+			FORC3 image[row*outWidth+col][c] = count[c] ? ((sum[c] + (count[c] >> 1)) / count[c]) : 0;
+			image[row*outWidth+col][3] = 0;
+		}
+	});
+}
@@ -0,0 +1,52 @@
+//
+//  simple_interpolate.h
+//  Avocado
+//
+//	Fast, low quality interpolation methods, which are used when speed matters
+//	more than the quality of the output.
+//
+//  Created by Tristan Seifert on 20160722.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#ifndef simple_interpolate_h
+#define simple_interpolate_h
+
+#include <stdint.h>
+
+#include "libraw.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Interpolates missing colour components by averaging the neighbouring pixels
+ * of that colour in a 3x3 block. Rows are processed on all available cores.
+ *
+ * @param imageData Pointer to the libraw structure
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
+ */
+void bilinear_interpolate(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4]);
+
+/**
+ * Combines each 2x2 block of Bayer samples into a single RGB pixel, without
+ * interpolating anything; the output is half the width and height of the
+ * input.
+ *
+ * Unlike LibRaw's half size mode, the sizes in the libraw struct are left
+ * alone, since they're shared by every job on the image; the size of the
+ * output is given by TSRawDemosaicGetOutputSize.
+ *
+ * @param imageData Pointer to the libraw structure
+ * @param bayer Single component Bayer data, input
+ * @param image Image pointer, output
+ */
+void superpixel_interpolate(libraw_data_t *imageData, const uint16_t *bayer, uint16_t (*image)[4]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* simple_interpolate_h */
@@ -10,6 +10,7 @@
 
 #import "TSMainLibraryWindowController.h"
 #import "TSCoreDataStore.h"
+#import "TSLFDatabase.h"
 
 @interface TSAppDelegate ()
 
@@ -37,6 +38,11 @@
 	// Force the CoreData stack to be set up
 	[TSCoreDataStore sharedInstance];
 	
+	// Load the lens database in the background, before it's needed
+	dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{
+		[TSLFDatabase sharedInstance];
+	});
+	
 	// Create the window controller
 	self.mainWindow = [[TSMainLibraryWindowController alloc] initWithWindowNibName:@"TSMainLibraryWindow"];
 	[self.mainWindow showWindow:NSApp];
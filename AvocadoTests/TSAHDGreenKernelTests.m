@@ -0,0 +1,165 @@
+//
+//  TSAHDGreenKernelTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20160715.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSTestFrames.h"
+#import "ahd_green_kernels.h"
+
+/// filter pattern of the test frames (RGGB)
+static const unsigned int filters = 0x94949494;
+
+@interface TSAHDGreenKernelTests : XCTestCase
+
+/// synthetic Bayer frame (RGGB, four components per pixel)
+@property (nonatomic) uint16_t (*image)[4];
+/// the same frame as a single component mosaic
+@property (nonatomic) uint16_t *bayer;
+
+/// output of the reference kernel
+@property (nonatomic) uint16_t (*refOut)[3];
+/// output of the kernel under test
+@property (nonatomic) uint16_t (*testOut)[3];
+
+- (void) compareKernel:(ahd_green_row_fn) kernel named:(NSString *) name;
+
+@end
+
+@implementation TSAHDGreenKernelTests
+
+/**
+ * Allocates the image and output buffers.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	const int imgWidth = TSTestFrameWidth, imgHeight = TSTestFrameHeight;
+	
+	self.image = (uint16_t (*)[4]) valloc(imgWidth * imgHeight * 4 * sizeof(uint16_t));
+	self.bayer = (uint16_t *) valloc(imgWidth * imgHeight * sizeof(uint16_t));
+	
+	// two outputs (horizontal and vertical) per row
+	self.refOut = (uint16_t (*)[3]) calloc(imgWidth * imgHeight * 2, 3 * sizeof(uint16_t));
+	self.testOut = (uint16_t (*)[3]) calloc(imgWidth * imgHeight * 2, 3 * sizeof(uint16_t));
+}
+
+/**
+ * Cleans up memory.
+ */
+- (void) tearDown {
+	free(self.image);
+	free(self.bayer);
+	free(self.refOut);
+	free(self.testOut);
+	
+	[super tearDown];
+}
+
+#pragma mark Helpers
+/**
+ * Runs the given kernel and the scalar reference kernel over every non-green
+ * pixel that the AHD code would interpolate, for each test pattern, and
+ * ensures that the interpolated green of all of them is identical.
+ */
+- (void) compareKernel:(ahd_green_row_fn) kernel named:(NSString *) name {
+	const int imgWidth = TSTestFrameWidth, imgHeight = TSTestFrameHeight;
+	
+	for(TSTestFramePattern pattern = 0; pattern < TSTestFramePatternCount; pattern++) {
+		TSTestFrameFill(self.image, imgWidth, imgHeight, pattern, filters);
+		TSTestFrameGetMosaic(self.image, self.bayer, imgWidth, imgHeight, filters);
+		
+		memset(self.refOut, 0, imgWidth * imgHeight * 2 * 3 * sizeof(uint16_t));
+		memset(self.testOut, 0, imgWidth * imgHeight * 2 * 3 * sizeof(uint16_t));
+		
+		for(int row = 3; row < (imgHeight - 3); row++) {
+			// the first non-green pixel at or after column 3
+			int col = 3 + ((row & 1) ? 0 : 1);
+			int count = ((imgWidth - 3) - col + 1) / 2;
+			
+			const uint16_t *pix = self.bayer + (row * imgWidth) + col;
+			size_t outOff = (row * imgWidth * 2) + col;
+			
+			ahd_green_row_scalar(pix, imgWidth, count, self.refOut + outOff, self.refOut + outOff + imgWidth);
+			kernel(pix, imgWidth, count, self.testOut + outOff, self.testOut + outOff + imgWidth);
+		}
+		
+		// compare the green component of every pixel
+		NSString *diff = TSTestFrameCompare(&self.testOut[0][1], &self.refOut[0][1], imgWidth * imgHeight * 2, 3, 1);
+		
+		if(diff) {
+			XCTFail(@"%@, %@ pattern: %@", name, TSTestFramePatternName(pattern), diff);
+			return;
+		}
+	}
+}
+
+#pragma mark Tests
+/**
+ * Tests the kernel that is selected at runtime against the reference.
+ */
+- (void) testSelectedKernel {
+	[self compareKernel:ahd_green_row_select() named:@"selected"];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Tests the SSE4.1 kernel against the reference.
+ */
+- (void) testSSE41Kernel {
+	if(!__builtin_cpu_supports("sse4.1")) {
+		DDLogWarn(@"SSE4.1 not supported; skipping test");
+		return;
+	}
+	
+	[self compareKernel:ahd_green_row_sse41 named:@"SSE4.1"];
+}
+
+/**
+ * Tests the AVX2 kernel against the reference.
+ */
+- (void) testAVX2Kernel {
+	if(!__builtin_cpu_supports("avx2")) {
+		DDLogWarn(@"AVX2 not supported; skipping test");
+		return;
+	}
+	
+	[self compareKernel:ahd_green_row_avx2 named:@"AVX2"];
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+/**
+ * Tests the NEON kernel against the reference.
+ */
+- (void) testNEONKernel {
+	[self compareKernel:ahd_green_row_neon named:@"NEON"];
+}
+#endif
+
+/**
+ * Measures the selected kernel over a frame.
+ */
+- (void) testSelectedKernelPerformance {
+	const int imgWidth = TSTestFrameWidth, imgHeight = TSTestFrameHeight;
+	ahd_green_row_fn kernel = ahd_green_row_select();
+	
+	TSTestFrameFill(self.image, imgWidth, imgHeight, TSTestFramePatternRandom, filters);
+	TSTestFrameGetMosaic(self.image, self.bayer, imgWidth, imgHeight, filters);
+	
+	[self measureBlock:^{
+		for(int row = 3; row < (imgHeight - 3); row++) {
+			int col = 3 + ((row & 1) ? 0 : 1);
+			int count = ((imgWidth - 3) - col + 1) / 2;
+			size_t outOff = (row * imgWidth * 2) + col;
+			
+			kernel(self.bayer + (row * imgWidth) + col, imgWidth, count, self.testOut + outOff, self.testOut + outOff + imgWidth);
+		}
+	}];
+}
+
+@end
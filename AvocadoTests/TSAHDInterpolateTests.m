@@ -0,0 +1,328 @@
+//
+//  TSAHDInterpolateTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20161018.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSTestFrames.h"
+#import "libraw.h"
+#import "ahd_interpolate_mod.h"
+#import "interpolation_shared.h"
+
+/// sets the size of the test frames; spans several tiles in each direction
+static const int imgWidth = 601;
+static const int imgHeight = 523;
+
+/// tile size of the reference implementation
+#define TS 256
+
+/**
+ * Border interpolation of the reference implementation: it works in place on
+ * the four component frame, and only fills in the components other than the
+ * pixel's own colour.
+ */
+static void ahd_reference_border(int border, int width, int height, ushort (*image)[4], int filters, int colors) {
+	unsigned row, col, y, x, f, c, sum[8];
+	
+	for(row=0; row < height; row++)
+		for(col=0; col < width; col++) {
+			if(col==border && row >= border && row < height-border)
+				col = width-border;
+			memset(sum, 0, sizeof sum);
+			for(y=row-1; y != row+2; y++)
+				for(x=col-1; x != col+2; x++)
+					if(y < height && x < width) {
+						f = FC(y, x, filters);
+						sum[f] += image[y*width+x][f];
+						sum[f+4]++;
+					}
+			f = FC(row, col, filters);
+			
+			FORCC {
+				if(c != f && sum[c+4]) {
+					image[row*width+col][c] = sum[c] / sum[c+4];
+				}
+			}
+		}
+}
+
+/**
+ * Reference implementation of AHD: this is the serial, per-pixel code that
+ * the tiled implementation replaced, with its floating point CIELab
+ * conversion and homogeneity maps.
+ */
+static void ahd_reference(libraw_data_t *imageData, uint16_t (*image)[4]) {
+	int i, j, k, top, left, row, col, tr, tc, c, d, val, hm[2];
+	ushort (*pix)[4], (*rix)[3];
+	static const int dir[4] = { -1, 1, -TS, TS };
+	static const float d65_white[3] =  { 0.950456f, 1.0f, 1.088754f };
+	unsigned ldiff[2][4], abdiff[2][4], leps, abeps;
+	float r, xyz[3], xyz_cam[3][4];
+	ushort (*rgb)[TS][TS][3];
+	short (*lab)[TS][TS][3], (*lix)[3];
+	char (*homo)[TS][TS], *buffer;
+	
+	int width = imageData->sizes.width;
+	int height = imageData->sizes.height;
+	unsigned int filters = imageData->idata.filters;
+	int colors = imageData->idata.colors;
+	
+	float *cbrt = (float *) malloc(0x10000 * sizeof(float));
+	
+	for (i=0; i < 0x10000; i++) {
+		r = i / 65535.0;
+		cbrt[i] = r > 0.008856 ? pow((double)r,1/3.0) : 7.787*r + 16/116.0;
+	}
+	
+	for (i=0; i < 3; i++)
+		for (j=0; j < colors; j++)
+			for (xyz_cam[i][j] = k=0; k < 3; k++)
+				xyz_cam[i][j] += xyz_rgb[i][k] * imageData->color.rgb_cam[k][j] / d65_white[i];
+	
+	ahd_reference_border(6, width, height, image, filters, colors);
+	
+	buffer = (char *) malloc (26*TS*TS);
+	rgb  = (ushort(*)[TS][TS][3]) buffer;
+	lab  = (short (*)[TS][TS][3])(buffer + 12*TS*TS);
+	homo = (char  (*)[TS][TS])   (buffer + 24*TS*TS);
+	
+	for (top=3; top < height-6; top += TS-7)
+		for (left=3; left < width-6; left += TS-7) {
+			/*  Interpolate green horizontally and vertically: */
+			for (row = top; row < top+TS && row < height-3; row++) {
+				col = left + (FC(row, left, filters) & 1);
+				for (c = FC(row, col, filters); col < left+TS && col < width-3; col+=2) {
+					pix = image + row*width+col;
+					val = ((pix[-1][1] + pix[0][c] + pix[1][1]) * 2
+						- pix[-2][c] - pix[2][c] + 2) >> 2;
+					if (val < 0 || val > 65535) {
+						val = (pix[-3][1] + pix[3][1] +
+							18*(2*pix[0][c] - pix[-2][c] - pix[2][c]) +
+							63*(pix[-1][1] + pix[1][1]) + 64) >> 7;
+						if (val < 0 || val > 65535) {
+							val = (4*(pix[-1][1] + pix[1][1]) +
+								2*pix[0][c]-pix[-2][c]-pix[2][c] + 4) >> 3;
+							if (val < 0 || val > 65535)
+								val = (pix[-1][1] + pix[1][1] + 1) >> 1; }}
+					rgb[0][row-top][col-left][1] = val;
+					val = ((pix[-width][1] + pix[0][c] + pix[width][1]) * 2
+						- pix[-2*width][c] - pix[2*width][c] + 2) >> 2;
+					if (val < 0 || val > 65535) {
+						val = (pix[-3*width][1] + pix[3*width][1] +
+							18*(2*pix[0][c] - pix[-2*width][c] - pix[2*width][c]) +
+							63*(pix[-width][1] + pix[width][1]) + 64) >> 7;
+						if (val < 0 || val > 65535) {
+							val = (4*(pix[-width][1] + pix[width][1]) +
+								2*pix[0][c]-pix[-2*width][c]-pix[2*width][c] + 4) >> 3;
+							if (val < 0 || val > 65535)
+								val = (pix[-width][1] + pix[width][1] + 1) >> 1; }}
+					rgb[1][row-top][col-left][1] = val;
+				}
+			}
+			
+			/*  Interpolate red and blue, and convert to CIELab: */
+			for (d=0; d < 2; d++)
+				for (row=top+1; row < top+TS-1 && row < height-4; row++)
+					for (col=left+1; col < left+TS-1 && col < width-4; col++) {
+						pix = image + row*width+col;
+						rix = &rgb[d][row-top][col-left];
+						lix = &lab[d][row-top][col-left];
+						if ((c = 2 - FC(row, col, filters)) == 1) {
+							c = FC(row+1, col, filters);
+							val = pix[0][1] + (( pix[-1][2-c] + pix[1][2-c]
+							- rix[-1][1] - rix[1][1] + 1) >> 1);
+							if (val < 0 || val > 65535)
+								val = (pix[-1][2-c] + pix[1][2-c] + 1) >> 1;
+							rix[0][2-c] = val;
+							val = pix[0][1] + (( pix[-width][c] + pix[width][c]
+							- rix[-TS][1] - rix[TS][1] + 1) >> 1);
+							if (val < 0 || val > 65535)
+								val = (pix[-width][c] + pix[width][c] + 1) >> 1;
+						} else {
+							val = rix[0][1] + (( pix[-width-1][c] + pix[-width+1][c]
+							+ pix[+width-1][c] + pix[+width+1][c]
+							- rix[-TS-1][1] - rix[-TS+1][1]
+							- rix[+TS-1][1] - rix[+TS+1][1] + 2) >> 2);
+							if (val < 0 || val > 65535)
+								val = (pix[-width-1][c] + pix[-width+1][c] +
+								pix[ width-1][c] + pix[ width+1][c] + 2) >> 2; }
+						rix[0][c] = val;
+						c = FC(row, col, filters);
+						rix[0][c] = pix[0][c];
+						xyz[0] = xyz[1] = xyz[2] = 0.5;
+						FORCC {
+							xyz[0] += xyz_cam[0][c] * rix[0][c];
+							xyz[1] += xyz_cam[1][c] * rix[0][c];
+							xyz[2] += xyz_cam[2][c] * rix[0][c];
+						}
+						xyz[0] = cbrt[CLIP((int) xyz[0])];
+						xyz[1] = cbrt[CLIP((int) xyz[1])];
+						xyz[2] = cbrt[CLIP((int) xyz[2])];
+						lix[0][0] = 64 * (116 * xyz[1] - 16);
+						lix[0][1] = 64 * 500 * (xyz[0] - xyz[1]);
+						lix[0][2] = 64 * 200 * (xyz[1] - xyz[2]);
+					}
+			
+			/*  Build homogeneity maps from the CIELab images: */
+			memset (homo, 0, 2*TS*TS);
+			for (row=top+2; row < top+TS-2 && row < height-5; row++) {
+				tr = row-top;
+				for (col=left+2; col < left+TS-2 && col < width-5; col++) {
+					tc = col-left;
+					for (d=0; d < 2; d++) {
+						lix = &lab[d][tr][tc];
+						for (i=0; i < 4; i++) {
+							ldiff[d][i] = ABS(lix[0][0]-lix[dir[i]][0]);
+							abdiff[d][i] = SQR((unsigned) (lix[0][1]-lix[dir[i]][1]))
+								+ SQR((unsigned) (lix[0][2]-lix[dir[i]][2]));
+						}
+					}
+					leps = MIN(MAX(ldiff[0][0],ldiff[0][1]),
+						MAX(ldiff[1][2],ldiff[1][3]));
+					abeps = MIN(MAX(abdiff[0][0],abdiff[0][1]),
+						MAX(abdiff[1][2],abdiff[1][3]));
+					for (d=0; d < 2; d++)
+						for (i=0; i < 4; i++)
+							if (ldiff[d][i] <= leps && abdiff[d][i] <= abeps)
+								homo[d][tr][tc]++;
+				}
+			}
+			
+			/* Combine the most homogenous pixels for the final result: */
+			for (row=top+3; row < top+TS-3 && row < height-6; row++) {
+				tr = row-top;
+				for (col=left+3; col < left+TS-3 && col < width-6; col++) {
+					tc = col-left;
+					for (d=0; d < 2; d++)
+						for (hm[d]=0, i=tr-1; i <= tr+1; i++)
+							for (j=tc-1; j <= tc+1; j++)
+								hm[d] += homo[d][i][j];
+					if (hm[0] != hm[1])
+						FORC3 image[row*width+col][c] = rgb[hm[1] > hm[0]][tr][tc][c];
+					else
+						FORC3 image[row*width+col][c] =
+						(rgb[0][tr][tc][c] + rgb[1][tr][tc][c] + 1) >> 1;
+				}
+			}
+		}
+	
+	free(buffer);
+	free(cbrt);
+}
+
+#undef TS
+
+@interface TSAHDInterpolateTests : XCTestCase
+
+/// libraw struct describing the test frames
+@property (nonatomic) libraw_data_t *libRaw;
+
+/// input frame; only the component of each pixel's filter colour is set
+@property (nonatomic) uint16_t (*image)[4];
+/// the input frame as a single component mosaic
+@property (nonatomic) uint16_t *bayer;
+/// output of the reference implementation
+@property (nonatomic) uint16_t (*refOut)[4];
+/// output of the implementation under test
+@property (nonatomic) uint16_t (*testOut)[4];
+
+/// cube root table for the implementation under test
+@property (nonatomic) float *cbrt;
+
+@end
+
+@implementation TSAHDInterpolateTests
+
+/**
+ * Sets up an RGGB sensor with a colour matrix, and allocates the buffers.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	static const float rgb_cam[3][4] = {
+		{ 1.62f, -0.51f, -0.11f, 0.f },
+		{ -0.19f, 1.48f, -0.29f, 0.f },
+		{ 0.02f, -0.43f, 1.41f, 0.f }
+	};
+	
+	self.libRaw = (libraw_data_t *) calloc(1, sizeof(libraw_data_t));
+	
+	self.libRaw->sizes.width = imgWidth;
+	self.libRaw->sizes.height = imgHeight;
+	self.libRaw->idata.filters = 0x94949494;
+	self.libRaw->idata.colors = 3;
+	
+	memcpy(self.libRaw->color.rgb_cam, rgb_cam, sizeof(rgb_cam));
+	
+	self.image = (uint16_t (*)[4]) calloc(imgWidth * imgHeight, 4 * sizeof(uint16_t));
+	self.bayer = (uint16_t *) calloc(imgWidth * imgHeight, sizeof(uint16_t));
+	self.refOut = (uint16_t (*)[4]) calloc(imgWidth * imgHeight, 4 * sizeof(uint16_t));
+	self.testOut = (uint16_t (*)[4]) calloc(imgWidth * imgHeight, 4 * sizeof(uint16_t));
+	
+	self.cbrt = (float *) malloc(0x10000 * sizeof(float));
+	ahd_build_cbrt_table(self.cbrt);
+}
+
+/**
+ * Cleans up memory.
+ */
+- (void) tearDown {
+	free(self.libRaw);
+	free(self.image);
+	free(self.bayer);
+	free(self.refOut);
+	free(self.testOut);
+	free(self.cbrt);
+	
+	[super tearDown];
+}
+
+#pragma mark Tests
+/**
+ * Interpolates each test pattern with both the reference, which works in
+ * place on the four component frame, and the parallel tiled implementation,
+ * which reads the mosaic, and ensures that the difference between them is
+ * bounded. The output buffer of the latter is filled with garbage first, so
+ * any pixel it doesn't write also shows up as a difference. Since the CIELab conversion does the same arithmetic as the
+ * reference, the bound is zero: every sample must be identical. On the
+ * gradient, the homogeneity of both directions is often tied, so even a one
+ * LSB difference in the CIELab values changes the output.
+ */
+- (void) testMatchesReference {
+	const size_t bytes = imgWidth * imgHeight * 4 * sizeof(uint16_t);
+	
+	for(TSTestFramePattern pattern = 0; pattern < TSTestFramePatternCount; pattern++) {
+		TSTestFrameFill(self.image, imgWidth, imgHeight, pattern, self.libRaw->idata.filters);
+		
+		TSTestFrameGetMosaic(self.image, self.bayer, imgWidth, imgHeight, self.libRaw->idata.filters);
+		
+		memcpy(self.refOut, self.image, bytes);
+		memset(self.testOut, 0xA5, bytes);
+		
+		ahd_reference(self.libRaw, self.refOut);
+		ahd_interpolate_mod_parallel(self.libRaw, self.bayer, self.testOut, self.cbrt);
+		
+		// count the samples that differ, and by how much
+		NSUInteger differing = 0;
+		int maxDiff = 0;
+		
+		for(int i = 0; i < (imgWidth * imgHeight); i++) {
+			for(int c = 0; c < 4; c++) {
+				int diff = abs(self.refOut[i][c] - self.testOut[i][c]);
+				
+				if(diff != 0) {
+					differing++;
+					maxDiff = MAX(maxDiff, diff);
+				}
+			}
+		}
+		
+		XCTAssertEqual(differing, 0, @"%@ pattern: %lu samples differ, by up to %i", TSTestFramePatternName(pattern), (unsigned long) differing, maxDiff);
+	}
+}
+
+@end
@@ -0,0 +1,114 @@
+//
+//  TSLFDatabaseTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20160801.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSLFDatabase.h"
+
+#import "lensfun.h"
+
+// TODO: Find a better way to expose this
+@interface TSLFDatabase ()
+@property (nonatomic) lfDatabase *lensDb;
+@end
+
+/**
+ * Archives a lens in the same way as TSLFLens' persistentData, but with the
+ * given maker and model.
+ */
+static NSData *TSLFLensPersistentData(NSString *maker, NSString *model, CGFloat cropFactor) {
+	NSMutableData *data = [NSMutableData new];
+	NSKeyedArchiver *archiver = [[NSKeyedArchiver alloc] initForWritingWithMutableData:data];
+	
+	archiver.requiresSecureCoding = YES;
+	
+	[archiver encodeObject:[maker dataUsingEncoding:NSUTF8StringEncoding] forKey:TSLFLensKeyMake];
+	[archiver encodeObject:[model dataUsingEncoding:NSUTF8StringEncoding] forKey:TSLFLensKeyModel];
+	[archiver encodeDouble:cropFactor forKey:TSLFLensKeyCropFactor];
+	
+	[archiver finishEncoding];
+	return [data copy];
+}
+
+@interface TSLFDatabaseTests : XCTestCase
+
+@end
+
+@implementation TSLFDatabaseTests
+
+#pragma mark Tests
+/**
+ * Ensures that a lens is found from its persistent data, even if its name
+ * differs from the one in the database in case and spacing, as it does if
+ * the lens was renamed that way since the data was archived.
+ */
+- (void) testLensWithDifferentCaseAndSpacing {
+	TSLFDatabase *db = [TSLFDatabase sharedInstance];
+	
+	const lfLens *const *lenses = lf_db_get_lenses(db.lensDb);
+	const lfCamera *const *cameras = lf_db_get_cameras(db.lensDb);
+	
+	// find a lens with a plain ASCII name, and a camera with the same mount
+	const lfLens *lens = NULL;
+	const lfCamera *camera = NULL;
+	
+	for(NSUInteger i = 0; lenses != NULL && lenses[i] != NULL && lens == NULL; i++) {
+		NSString *model = @(lenses[i]->Model);
+		
+		if(lenses[i]->Mounts == NULL || lenses[i]->Mounts[0] == NULL ||
+		   [model canBeConvertedToEncoding:NSASCIIStringEncoding] == NO ||
+		   [model containsString:@" "] == NO) {
+			continue;
+		}
+		
+		for(NSUInteger j = 0; cameras != NULL && cameras[j] != NULL; j++) {
+			if(cameras[j]->Mount != NULL && strcmp(cameras[j]->Mount, lenses[i]->Mounts[0]) == 0) {
+				lens = lenses[i];
+				camera = cameras[j];
+				break;
+			}
+		}
+	}
+	
+	XCTAssertTrue(lens != NULL, @"no lens that fits one of the cameras");
+	
+	if(lens == NULL) {
+		return;
+	}
+	
+	// archive it with its model in upper case, and its spaces doubled up
+	NSString *model = [@(lens->Model).uppercaseString stringByReplacingOccurrencesOfString:@" " withString:@"  "];
+	NSData *data = TSLFLensPersistentData(@(lens->Maker), model, lens->CropFactor);
+	
+	lfCamera *cameraCopy = lf_camera_new();
+	lf_camera_copy(cameraCopy, camera);
+	
+	lfLens *lensCopy = lf_lens_new();
+	lf_lens_copy(lensCopy, lens);
+	
+	TSLFCamera *cameraObj = [[TSLFCamera alloc] initWithCamera:cameraCopy];
+	TSLFLens *expected = [[TSLFLens alloc] initWithLens:lensCopy];
+	
+	TSLFLens *found = [db findLensWithPersistentData:data andCamera:cameraObj];
+	
+	XCTAssertNotNil(found, @"couldn't find %@ (as %@) for %@", expected.model, model, cameraObj);
+	XCTAssertEqualObjects(found.persistentData, expected.persistentData);
+}
+
+/**
+ * Measures a cold start of the database, parsing all of the database files
+ * and indexing them; this is what the app does in the background at launch.
+ */
+- (void) testColdStart {
+	[self measureBlock:^{
+		TSLFDatabase *db = [TSLFDatabase new];
+		XCTAssertNotNil(db);
+	}];
+}
+
+@end
@@ -0,0 +1,239 @@
+//
+//  TSLensRemapKernelTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20160731.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSTestFrames.h"
+#import "lens_remap_kernels.h"
+
+/**
+ * Where the source coordinates of a row are placed.
+ */
+typedef NS_ENUM(NSUInteger, TSLensRemapTestCoords) {
+	/// Random coordinates inside the image, and random gains
+	TSLensRemapTestCoordsInside,
+	/// Random coordinates up to 10% outside of the image on all sides, and
+	/// large gains that cause the output to clip
+	TSLensRemapTestCoordsOutside,
+	/// Integer coordinates along the edges and corners of the image
+	TSLensRemapTestCoordsEdges,
+	
+	/// number of coordinate layouts
+	TSLensRemapTestCoordsCount
+};
+
+/// names of the coordinate layouts, for failure messages
+static NSString *const TSLensRemapTestCoordsNames[TSLensRemapTestCoordsCount] = {
+	@"inside", @"outside", @"edges"
+};
+
+@interface TSLensRemapKernelTests : XCTestCase
+
+/// input image, four components per pixel
+@property (nonatomic) uint16_t *image;
+
+/// source coordinates for one row; six per pixel
+@property (nonatomic) float *coords;
+/// gains for one row; three per pixel
+@property (nonatomic) float *gains;
+
+/// output of the reference kernel
+@property (nonatomic) uint16_t *refOut;
+/// output of the kernel under test
+@property (nonatomic) uint16_t *testOut;
+
+- (void) fillRowWithCoords:(TSLensRemapTestCoords) coords;
+- (void) compareKernel:(lens_remap_row_fn) kernel named:(NSString *) name;
+- (void) checkKernelReproducesInput:(lens_remap_row_fn) kernel named:(NSString *) name;
+
+@end
+
+@implementation TSLensRemapKernelTests
+
+/**
+ * Allocates the image and output buffers, and fills all components of the
+ * image with random values.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	self.image = (uint16_t *) valloc(TSTestFrameWidth * TSTestFrameHeight * 4 * sizeof(uint16_t));
+	
+	self.coords = (float *) valloc(TSTestFrameWidth * 6 * sizeof(float));
+	self.gains = (float *) valloc(TSTestFrameWidth * 3 * sizeof(float));
+	
+	self.refOut = (uint16_t *) valloc(TSTestFrameWidth * 4 * sizeof(uint16_t));
+	self.testOut = (uint16_t *) valloc(TSTestFrameWidth * 4 * sizeof(uint16_t));
+	
+	TSTestFrameFill((uint16_t (*)[4]) self.image, TSTestFrameWidth, TSTestFrameHeight, TSTestFramePatternRandom, 0);
+}
+
+/**
+ * Cleans up memory.
+ */
+- (void) tearDown {
+	free(self.image);
+	free(self.coords);
+	free(self.gains);
+	free(self.refOut);
+	free(self.testOut);
+	
+	[super tearDown];
+}
+
+#pragma mark Helpers
+/**
+ * Fills the coordinates and gains of a row with the given layout.
+ */
+- (void) fillRowWithCoords:(TSLensRemapTestCoords) coords {
+	srand(0x52454D41);
+	
+	for(int i = 0; i < TSTestFrameWidth; i++) {
+		for(int c = 0; c < 3; c++) {
+			float x = 0.f, y = 0.f, gain = 1.f;
+			float rx = ((float) rand()) / RAND_MAX;
+			float ry = ((float) rand()) / RAND_MAX;
+			
+			switch(coords) {
+				case TSLensRemapTestCoordsInside:
+					x = rx * (TSTestFrameWidth - 1);
+					y = ry * (TSTestFrameHeight - 1);
+					gain = 0.5f + ((float) rand()) / RAND_MAX;
+					break;
+				
+				case TSLensRemapTestCoordsOutside:
+					x = ((rx * 1.2f) - 0.1f) * TSTestFrameWidth;
+					y = ((ry * 1.2f) - 0.1f) * TSTestFrameHeight;
+					gain = 1.f + ((float) rand()) / RAND_MAX * 3.f;
+					break;
+				
+				case TSLensRemapTestCoordsEdges:
+					x = (i & 1) ? (TSTestFrameWidth - 1) : 0;
+					y = (i & 2) ? (TSTestFrameHeight - 1) : (i % TSTestFrameHeight);
+					break;
+				
+				default:
+					break;
+			}
+			
+			self.coords[(i * 6) + (c * 2) + 0] = x;
+			self.coords[(i * 6) + (c * 2) + 1] = y;
+			self.gains[(i * 3) + c] = gain;
+		}
+	}
+}
+
+/**
+ * Runs the given kernel and the scalar bilinear kernel over a row for each
+ * coordinate layout, and ensures that the outputs are identical.
+ */
+- (void) compareKernel:(lens_remap_row_fn) kernel named:(NSString *) name {
+	for(TSLensRemapTestCoords coords = 0; coords < TSLensRemapTestCoordsCount; coords++) {
+		[self fillRowWithCoords:coords];
+		
+		memset(self.refOut, 0xFF, TSTestFrameWidth * 4 * sizeof(uint16_t));
+		memset(self.testOut, 0xFF, TSTestFrameWidth * 4 * sizeof(uint16_t));
+		
+		lens_remap_row_bilinear_scalar(self.image, TSTestFrameWidth, TSTestFrameHeight, self.coords, self.gains, TSTestFrameWidth, self.refOut);
+		kernel(self.image, TSTestFrameWidth, TSTestFrameHeight, self.coords, self.gains, TSTestFrameWidth, self.testOut);
+		
+		NSString *diff = TSTestFrameCompare(self.testOut, self.refOut, TSTestFrameWidth, 4, 4);
+		
+		if(diff) {
+			XCTFail(@"%@, %@ coordinates: %@", name, TSLensRemapTestCoordsNames[coords], diff);
+			return;
+		}
+	}
+}
+
+/**
+ * Resamples a row at integer coordinates with the given kernel, with a gain of
+ * one; each output component must be exactly the input sample.
+ */
+- (void) checkKernelReproducesInput:(lens_remap_row_fn) kernel named:(NSString *) name {
+	[self fillRowWithCoords:TSLensRemapTestCoordsEdges];
+	
+	kernel(self.image, TSTestFrameWidth, TSTestFrameHeight, self.coords, self.gains, TSTestFrameWidth, self.testOut);
+	
+	for(int i = 0; i < TSTestFrameWidth; i++) {
+		for(int c = 0; c < 3; c++) {
+			int x = (int) self.coords[(i * 6) + (c * 2) + 0];
+			int y = (int) self.coords[(i * 6) + (c * 2) + 1];
+			
+			uint16_t expected = self.image[(((y * TSTestFrameWidth) + x) * 4) + c];
+			
+			if(self.testOut[(i * 4) + c] != expected) {
+				XCTFail(@"%@: pixel %i component %i at (%i, %i) is %u (expected %u)", name, i, c, x, y, self.testOut[(i * 4) + c], expected);
+				return;
+			}
+		}
+	}
+}
+
+#pragma mark Tests
+/**
+ * Tests the bilinear kernel that is selected at runtime against the
+ * reference.
+ */
+- (void) testSelectedBilinearKernel {
+	[self compareKernel:lens_remap_row_select(LENS_REMAP_BILINEAR) named:@"selected"];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/**
+ * Tests the AVX2 kernel against the reference.
+ */
+- (void) testAVX2Kernel {
+	if(!__builtin_cpu_supports("avx2")) {
+		DDLogWarn(@"AVX2 not supported; skipping test");
+		return;
+	}
+	
+	[self compareKernel:lens_remap_row_bilinear_avx2 named:@"AVX2"];
+}
+#endif
+
+/**
+ * Ensures that all kernels return the input samples at integer coordinates,
+ * including along the edges of the image.
+ */
+- (void) testKernelsReproduceInput {
+	[self checkKernelReproducesInput:lens_remap_row_bilinear_scalar named:@"bilinear"];
+	[self checkKernelReproducesInput:lens_remap_row_bicubic named:@"bicubic"];
+	[self checkKernelReproducesInput:lens_remap_row_lanczos3 named:@"Lanczos-3"];
+}
+
+/**
+ * Measures the selected bilinear kernel over a frame.
+ */
+- (void) testBilinearPerformance {
+	lens_remap_row_fn kernel = lens_remap_row_select(LENS_REMAP_BILINEAR);
+	[self fillRowWithCoords:TSLensRemapTestCoordsInside];
+	
+	[self measureBlock:^{
+		for(int row = 0; row < TSTestFrameHeight; row++) {
+			kernel(self.image, TSTestFrameWidth, TSTestFrameHeight, self.coords, self.gains, TSTestFrameWidth, self.testOut);
+		}
+	}];
+}
+
+/**
+ * Measures the Lanczos-3 kernel over a frame.
+ */
+- (void) testLanczos3Performance {
+	lens_remap_row_fn kernel = lens_remap_row_select(LENS_REMAP_LANCZOS3);
+	[self fillRowWithCoords:TSLensRemapTestCoordsInside];
+	
+	[self measureBlock:^{
+		for(int row = 0; row < TSTestFrameHeight; row++) {
+			kernel(self.image, TSTestFrameWidth, TSTestFrameHeight, self.coords, self.gains, TSTestFrameWidth, self.testOut);
+		}
+	}];
+}
+
+@end
@@ -0,0 +1,382 @@
+//
+//  TSPixelConverterBackendTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20160802.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSPixelFormatConverter.h"
+#import "pixel_convert_kernels.h"
+
+/// sets the size of the test image; both are odd to exercise the tail loops
+static const NSUInteger imgWidth = 3001;
+static const NSUInteger imgHeight = 2003;
+
+@interface TSPixelConverterBackendTests : XCTestCase
+
+/// input image, three components per pixel
+@property (nonatomic) uint16_t *imageBuffer;
+
+/// converter using vImage
+@property (nonatomic) TSPixelConverterRef vImageConverter;
+/// converter using the portable kernels
+@property (nonatomic) TSPixelConverterRef portableConverter;
+/// converter with half precision planes
+@property (nonatomic) TSPixelConverterRef halfConverter;
+
+- (void) convertToPlanar:(TSPixelConverterRef) converter;
+- (void) comparePlanesWithAccuracy:(float) accuracy;
+- (void) compareHalfPlanesWithAccuracy:(float) accuracy;
+- (void) measureConversionWithConverter:(TSPixelConverterRef) converter;
+- (void) measureRotationWithConverter:(TSPixelConverterRef) converter;
+
+@end
+
+@implementation TSPixelConverterBackendTests
+
+/**
+ * Allocates an image filled with random values, a converter for each of the
+ * backends, and one with half precision planes.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	self.imageBuffer = (uint16_t *) valloc(imgWidth * imgHeight * 3 * sizeof(uint16_t));
+	
+	srand(0x50495843);
+	
+	for(NSUInteger i = 0; i < (imgWidth * imgHeight * 3); i++) {
+		self.imageBuffer[i] = rand() & 0xFFFF;
+	}
+	
+	self.vImageConverter = TSPixelConverterCreate(self.imageBuffer, imgWidth, imgHeight);
+	TSPixelConverterSetBackend(self.vImageConverter, TSPixelConverterBackendvImage);
+	
+	self.portableConverter = TSPixelConverterCreate(self.imageBuffer, imgWidth, imgHeight);
+	TSPixelConverterSetBackend(self.portableConverter, TSPixelConverterBackendPortable);
+	
+	self.halfConverter = TSPixelConverterCreate(self.imageBuffer, imgWidth, imgHeight);
+	TSPixelConverterSetPlaneFormat(self.halfConverter, TSPixelConverterPlaneFormatFloat16);
+}
+
+/**
+ * Cleans up memory.
+ */
+- (void) tearDown {
+	TSPixelConverterFree(self.vImageConverter);
+	TSPixelConverterFree(self.portableConverter);
+	TSPixelConverterFree(self.halfConverter);
+	
+	free(self.imageBuffer);
+	
+	[super tearDown];
+}
+
+#pragma mark Helpers
+/**
+ * Converts the input image of the converter to planar floating point.
+ */
+- (void) convertToPlanar:(TSPixelConverterRef) converter {
+	XCTAssertTrue(TSPixelConverterRGB16UToFloat(converter, 0xFFFF));
+	XCTAssertTrue(TSPixelConverterRGBFFFToPlanarF(converter));
+}
+
+/**
+ * Ensures that the planes of both converters have the same size, and that all
+ * of their values are within the given accuracy.
+ */
+- (void) comparePlanesWithAccuracy:(float) accuracy {
+	for(NSUInteger c = 0; c < 3; c++) {
+		vImage_Buffer a = TSPixelConverterGetPlanevImageBufferBuffer(self.vImageConverter, c);
+		vImage_Buffer b = TSPixelConverterGetPlanevImageBufferBuffer(self.portableConverter, c);
+		
+		XCTAssertEqual(a.width, b.width);
+		XCTAssertEqual(a.height, b.height);
+		
+		for(NSUInteger y = 0; y < a.height; y++) {
+			const Pixel_F *rowA = (const Pixel_F *) (((uint8_t *) a.data) + (y * a.rowBytes));
+			const Pixel_F *rowB = (const Pixel_F *) (((uint8_t *) b.data) + (y * b.rowBytes));
+			
+			for(NSUInteger x = 0; x < a.width; x++) {
+				if(fabsf(rowA[x] - rowB[x]) > accuracy) {
+					XCTFail(@"plane %lu differs at (%lu, %lu): %f (expected %f)", (unsigned long) c, (unsigned long) x, (unsigned long) y, rowB[x], rowA[x]);
+					return;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Ensures that the half precision planes have the same size as the planes of
+ * the vImage converter, and that all of their values are within the given
+ * accuracy.
+ */
+- (void) compareHalfPlanesWithAccuracy:(float) accuracy {
+	Pixel_F *rowHalf = (Pixel_F *) valloc(MAX(imgWidth, imgHeight) * sizeof(Pixel_F));
+	
+	for(NSUInteger c = 0; c < 3; c++) {
+		vImage_Buffer a = TSPixelConverterGetPlanevImageBufferBuffer(self.vImageConverter, c);
+		vImage_Buffer b = TSPixelConverterGetPlanevImageBufferBuffer(self.halfConverter, c);
+		
+		XCTAssertEqual(a.width, b.width);
+		XCTAssertEqual(a.height, b.height);
+		
+		for(NSUInteger y = 0; y < a.height; y++) {
+			const Pixel_F *rowA = (const Pixel_F *) (((uint8_t *) a.data) + (y * a.rowBytes));
+			pixel_convert_h_to_f((const uint16_t *) (((uint8_t *) b.data) + (y * b.rowBytes)), rowHalf, b.width);
+			
+			for(NSUInteger x = 0; x < a.width; x++) {
+				if(fabsf(rowA[x] - rowHalf[x]) > accuracy) {
+					XCTFail(@"half plane %lu differs at (%lu, %lu): %f (expected %f)", (unsigned long) c, (unsigned long) x, (unsigned long) y, rowHalf[x], rowA[x]);
+					
+					free(rowHalf);
+					return;
+				}
+			}
+		}
+	}
+	
+	free(rowHalf);
+}
+
+/**
+ * Measures conversion of the input image to planar floating point, and back
+ * to interleaved RGBX, with the given converter.
+ */
+- (void) measureConversionWithConverter:(TSPixelConverterRef) converter {
+	[self measureBlock:^{
+		[self convertToPlanar:converter];
+		XCTAssertTrue(TSPixelConverterPlanarFToRGBXFFFF(converter));
+	}];
+}
+
+/**
+ * Measures rotation of the planes by 90° with the given converter. The
+ * converter is reset before each run, so every run rotates the same way.
+ */
+- (void) measureRotationWithConverter:(TSPixelConverterRef) converter {
+	[self measureMetrics:[[self class] defaultPerformanceMetrics] automaticallyStartMeasuring:NO forBlock:^{
+		TSPixelConverterResize(converter, imgWidth, imgHeight);
+		
+		[self startMeasuring];
+		XCTAssertTrue(TSPixelConverterRotate90(converter, 1));
+		[self stopMeasuring];
+	}];
+}
+
+#pragma mark Tests
+/**
+ * Ensures that the portable backend produces the same planes and RGBX output
+ * as vImage.
+ */
+- (void) testConversionsMatchvImage {
+	[self convertToPlanar:self.vImageConverter];
+	[self convertToPlanar:self.portableConverter];
+	
+	[self comparePlanesWithAccuracy:1e-6f];
+	
+	XCTAssertTrue(TSPixelConverterPlanarFToRGBXFFFF(self.vImageConverter));
+	XCTAssertTrue(TSPixelConverterPlanarFToRGBXFFFF(self.portableConverter));
+	
+	const Pixel_F *a = (const Pixel_F *) TSPixelConverterGetRGBXPointer(self.vImageConverter);
+	const Pixel_F *b = (const Pixel_F *) TSPixelConverterGetRGBXPointer(self.portableConverter);
+	size_t stride = TSPixelConverterGetRGBXStride(self.vImageConverter);
+	
+	XCTAssertEqual(stride, TSPixelConverterGetRGBXStride(self.portableConverter));
+	
+	for(NSUInteger y = 0; y < imgHeight; y++) {
+		const Pixel_F *rowA = (const Pixel_F *) (((uint8_t *) a) + (y * stride));
+		const Pixel_F *rowB = (const Pixel_F *) (((uint8_t *) b) + (y * stride));
+		
+		for(NSUInteger i = 0; i < (imgWidth * 4); i++) {
+			if(fabsf(rowA[i] - rowB[i]) > 1e-6f) {
+				XCTFail(@"RGBX differs at pixel (%lu, %lu) component %lu: %f (expected %f)", (unsigned long) (i / 4), (unsigned long) y, (unsigned long) (i % 4), rowB[i], rowA[i]);
+				return;
+			}
+		}
+	}
+}
+
+/**
+ * Ensures that rotating by each multiple of 90° produces the same planes
+ * with both backends.
+ */
+- (void) testRotationMatchesvImage {
+	for(ssize_t rotation = 0; rotation < 4; rotation++) {
+		TSPixelConverterResize(self.vImageConverter, imgWidth, imgHeight);
+		TSPixelConverterResize(self.portableConverter, imgWidth, imgHeight);
+		
+		[self convertToPlanar:self.vImageConverter];
+		[self convertToPlanar:self.portableConverter];
+		
+		XCTAssertTrue(TSPixelConverterRotate90(self.vImageConverter, rotation));
+		XCTAssertTrue(TSPixelConverterRotate90(self.portableConverter, rotation));
+		
+		[self comparePlanesWithAccuracy:0.f];
+	}
+}
+
+/**
+ * Ensures that the fused conversion to planar floating point produces the
+ * same planes as converting in two steps.
+ */
+- (void) testFusedConversionMatchesTwoStep {
+	[self convertToPlanar:self.vImageConverter];
+	XCTAssertTrue(TSPixelConverterRGB16UToPlanarF(self.portableConverter, 0xFFFF));
+	
+	[self comparePlanesWithAccuracy:1e-6f];
+}
+
+/**
+ * Ensures that half precision planes hold the same values as 32 bit planes,
+ * rounded to half precision; values below 1.0 are off by at most 2^-12.
+ */
+- (void) testHalfPrecisionConversionMatchesFloat {
+	[self convertToPlanar:self.vImageConverter];
+	XCTAssertTrue(TSPixelConverterRGB16UToPlanarF(self.halfConverter, 0xFFFF));
+	
+	[self compareHalfPlanesWithAccuracy:(1.f / 4096.f)];
+	
+	// the interleaved output holds the same half precision values, and X = 1
+	XCTAssertTrue(TSPixelConverterPlanarFToRGBXFFFF(self.halfConverter));
+	
+	const uint8_t *out = (const uint8_t *) TSPixelConverterGetRGBXPointer(self.halfConverter);
+	size_t stride = TSPixelConverterGetRGBXStride(self.halfConverter);
+	
+	for(NSUInteger y = 0; y < imgHeight; y++) {
+		const uint16_t *px = (const uint16_t *) (out + (y * stride));
+		
+		for(NSUInteger c = 0; c < 3; c++) {
+			vImage_Buffer plane = TSPixelConverterGetPlanevImageBufferBuffer(self.halfConverter, c);
+			const uint16_t *planeRow = (const uint16_t *) (((uint8_t *) plane.data) + (y * plane.rowBytes));
+			
+			for(NSUInteger x = 0; x < imgWidth; x++) {
+				if(px[(x * 4) + c] != planeRow[x] || px[(x * 4) + 3] != 0x3C00) {
+					XCTFail(@"half RGBX differs at pixel (%lu, %lu) component %lu", (unsigned long) x, (unsigned long) y, (unsigned long) c);
+					return;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Ensures that rotating half precision planes moves their values to the same
+ * places as rotating 32 bit planes.
+ */
+- (void) testHalfPrecisionRotationMatchesFloat {
+	for(ssize_t rotation = 0; rotation < 4; rotation++) {
+		TSPixelConverterResize(self.vImageConverter, imgWidth, imgHeight);
+		TSPixelConverterResize(self.halfConverter, imgWidth, imgHeight);
+		
+		[self convertToPlanar:self.vImageConverter];
+		XCTAssertTrue(TSPixelConverterRGB16UToPlanarF(self.halfConverter, 0xFFFF));
+		
+		XCTAssertTrue(TSPixelConverterRotate90(self.vImageConverter, rotation));
+		XCTAssertTrue(TSPixelConverterRotate90(self.halfConverter, rotation));
+		
+		[self compareHalfPlanesWithAccuracy:(1.f / 4096.f)];
+	}
+}
+
+/**
+ * Ensures that full precision planes can be produced from a converter with
+ * half precision planes, and loaded back into it.
+ */
+- (void) testHalfPrecisionFloatPlaneRoundTrip {
+	[self convertToPlanar:self.vImageConverter];
+	
+	size_t stride = TSPixelConverterGetFloatPlaneStride(self.halfConverter);
+	XCTAssertEqual(stride, TSPixelConverterGetPlanevImageBufferBuffer(self.vImageConverter, 0).rowBytes);
+	
+	Pixel_F *planes[3];
+	
+	for(NSUInteger c = 0; c < 3; c++) {
+		planes[c] = (Pixel_F *) valloc(stride * imgHeight);
+	}
+	
+	// the float planes are identical to those of the 32 bit converter
+	XCTAssertTrue(TSPixelConverterRGB16UToPlanarFBuffers(self.halfConverter, 0xFFFF, planes, stride));
+	
+	for(NSUInteger c = 0; c < 3; c++) {
+		vImage_Buffer a = TSPixelConverterGetPlanevImageBufferBuffer(self.vImageConverter, c);
+		
+		for(NSUInteger y = 0; y < imgHeight; y++) {
+			XCTAssertEqual(memcmp(((uint8_t *) a.data) + (y * stride), ((uint8_t *) planes[c]) + (y * stride), imgWidth * sizeof(Pixel_F)), 0);
+		}
+		
+		TSPixelConverterLoadPlaneF(self.halfConverter, c, planes[c], stride);
+		free(planes[c]);
+	}
+	
+	[self compareHalfPlanesWithAccuracy:(1.f / 4096.f)];
+}
+
+/**
+ * Measures the conversions with half precision planes.
+ */
+- (void) testHalfPrecisionConversionPerformance {
+	[self measureBlock:^{
+		XCTAssertTrue(TSPixelConverterRGB16UToPlanarF(self.halfConverter, 0xFFFF));
+		XCTAssertTrue(TSPixelConverterPlanarFToRGBXFFFF(self.halfConverter));
+	}];
+}
+
+/**
+ * Measures rotation of half precision planes.
+ */
+- (void) testHalfPrecisionRotationPerformance {
+	[self measureRotationWithConverter:self.halfConverter];
+}
+
+/**
+ * Measures the two step conversion to planar floating point with vImage.
+ */
+- (void) testTwoStepPlanarConversionPerformance {
+	[self measureBlock:^{
+		[self convertToPlanar:self.vImageConverter];
+	}];
+}
+
+/**
+ * Measures the fused conversion to planar floating point.
+ */
+- (void) testFusedPlanarConversionPerformance {
+	[self measureBlock:^{
+		XCTAssertTrue(TSPixelConverterRGB16UToPlanarF(self.portableConverter, 0xFFFF));
+	}];
+}
+
+/**
+ * Measures the conversions with vImage.
+ */
+- (void) testvImageConversionPerformance {
+	[self measureConversionWithConverter:self.vImageConverter];
+}
+
+/**
+ * Measures the conversions with the portable backend.
+ */
+- (void) testPortableConversionPerformance {
+	[self measureConversionWithConverter:self.portableConverter];
+}
+
+/**
+ * Measures rotation with vImage.
+ */
+- (void) testvImageRotationPerformance {
+	[self measureRotationWithConverter:self.vImageConverter];
+}
+
+/**
+ * Measures rotation with the portable backend.
+ */
+- (void) testPortableRotationPerformance {
+	[self measureRotationWithConverter:self.portableConverter];
+}
+
+@end
@@ -0,0 +1,257 @@
+//
+//  TSPixelConverterOrientationTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20160806.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSPixelFormatConverter.h"
+
+/// sets the size of the image used to check correctness; both are odd, and not
+/// multiples of the tile or band size
+static const NSUInteger imgWidth = 517;
+static const NSUInteger imgHeight = 311;
+
+/// sets the size of the image used for benchmarks
+static const NSUInteger benchWidth = 6001;
+static const NSUInteger benchHeight = 4003;
+
+@interface TSPixelConverterOrientationTests : XCTestCase
+
+/// input image, three components per pixel
+@property (nonatomic) uint16_t *imageBuffer;
+
+- (TSPixelConverterRef) converterWithFormat:(TSPixelConverterPlaneFormat) format width:(NSUInteger) width height:(NSUInteger) height;
+- (void) checkOrientationsWithFormat:(TSPixelConverterPlaneFormat) format;
+- (void) measureOrientation:(TSPixelConverterOrientation) orientation withFormat:(TSPixelConverterPlaneFormat) format;
+
+@end
+
+@implementation TSPixelConverterOrientationTests
+
+/**
+ * Allocates an image filled with random values, large enough for the
+ * benchmarks.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	self.imageBuffer = (uint16_t *) valloc(benchWidth * benchHeight * 3 * sizeof(uint16_t));
+	
+	srand(0x4F524945);
+	
+	for(NSUInteger i = 0; i < (benchWidth * benchHeight * 3); i++) {
+		self.imageBuffer[i] = rand() & 0xFFFF;
+	}
+}
+
+/**
+ * Cleans up memory.
+ */
+- (void) tearDown {
+	free(self.imageBuffer);
+	
+	[super tearDown];
+}
+
+#pragma mark Helpers
+/**
+ * Creates a converter using the portable backend with the given plane format,
+ * and converts the input image to planar.
+ */
+- (TSPixelConverterRef) converterWithFormat:(TSPixelConverterPlaneFormat) format width:(NSUInteger) width height:(NSUInteger) height {
+	TSPixelConverterRef converter = TSPixelConverterCreate(self.imageBuffer, width, height);
+	
+	TSPixelConverterSetBackend(converter, TSPixelConverterBackendPortable);
+	TSPixelConverterSetPlaneFormat(converter, format);
+	
+	XCTAssertTrue(TSPixelConverterRGB16UToPlanarF(converter, 0xFFFF));
+	
+	return converter;
+}
+
+/**
+ * Applies each orientation to the planes, and compares the result against a
+ * straightforward reference implementation of the EXIF orientations. Since
+ * the values are only moved around, the output must match exactly.
+ */
+- (void) checkOrientationsWithFormat:(TSPixelConverterPlaneFormat) format {
+	const size_t componentSize = (format == TSPixelConverterPlaneFormatFloat16) ? sizeof(uint16_t) : sizeof(Pixel_F);
+	const size_t planeSize = imgWidth * imgHeight * componentSize;
+	uint8_t *original = (uint8_t *) valloc(planeSize * 3);
+	
+	for(NSUInteger o = TSPixelConverterOrientationNormal; o <= TSPixelConverterOrientationRotate90CCW; o++) {
+		TSPixelConverterRef converter = [self converterWithFormat:format width:imgWidth height:imgHeight];
+		
+		// copy the planes before applying the orientation
+		for(NSUInteger c = 0; c < 3; c++) {
+			vImage_Buffer in = TSPixelConverterGetPlanevImageBufferBuffer(converter, c);
+			
+			for(NSUInteger y = 0; y < imgHeight; y++) {
+				memcpy(original + (c * planeSize) + (y * imgWidth * componentSize), ((uint8_t *) in.data) + (y * in.rowBytes), imgWidth * componentSize);
+			}
+		}
+		
+		XCTAssertTrue(TSPixelConverterApplyOrientation(converter, (TSPixelConverterOrientation) o));
+		
+		for(NSUInteger c = 0; c < 3; c++) {
+			// check the size of the output
+			vImage_Buffer out = TSPixelConverterGetPlanevImageBufferBuffer(converter, c);
+			BOOL transposed = (o >= TSPixelConverterOrientationTranspose);
+			
+			NSUInteger width, height;
+			TSPixelConverterGetSize(converter, &width, &height);
+			
+			XCTAssertEqual(width, transposed ? imgHeight : imgWidth);
+			XCTAssertEqual(height, transposed ? imgWidth : imgHeight);
+			XCTAssertEqual(out.width, width);
+			XCTAssertEqual(out.height, height);
+			
+			// compare each output pixel to the input pixel it should come from
+			for(NSUInteger oy = 0; oy < height; oy++) {
+				for(NSUInteger ox = 0; ox < width; ox++) {
+					NSUInteger x = 0, y = 0;
+					
+					switch(o) {
+						case TSPixelConverterOrientationNormal:
+							x = ox; y = oy;
+							break;
+						case TSPixelConverterOrientationMirrorHorizontal:
+							x = imgWidth - 1 - ox; y = oy;
+							break;
+						case TSPixelConverterOrientationRotate180:
+							x = imgWidth - 1 - ox; y = imgHeight - 1 - oy;
+							break;
+						case TSPixelConverterOrientationMirrorVertical:
+							x = ox; y = imgHeight - 1 - oy;
+							break;
+						case TSPixelConverterOrientationTranspose:
+							x = oy; y = ox;
+							break;
+						case TSPixelConverterOrientationRotate90CW:
+							x = oy; y = imgHeight - 1 - ox;
+							break;
+						case TSPixelConverterOrientationTransverse:
+							x = imgWidth - 1 - oy; y = imgHeight - 1 - ox;
+							break;
+						case TSPixelConverterOrientationRotate90CCW:
+							x = imgWidth - 1 - oy; y = ox;
+							break;
+					}
+					
+					const uint8_t *expected = original + (c * planeSize) + (((y * imgWidth) + x) * componentSize);
+					const uint8_t *actual = ((uint8_t *) out.data) + (oy * out.rowBytes) + (ox * componentSize);
+					
+					if(memcmp(expected, actual, componentSize) != 0) {
+						XCTFail(@"orientation %lu, plane %lu differs at (%lu, %lu)", (unsigned long) o, (unsigned long) c, (unsigned long) ox, (unsigned long) oy);
+						
+						TSPixelConverterFree(converter);
+						free(original);
+						return;
+					}
+				}
+			}
+		}
+		
+		TSPixelConverterFree(converter);
+	}
+	
+	free(original);
+}
+
+/**
+ * Measures applying the given orientation to a large image. The converter is
+ * reset before each run, so every run starts from the same planes.
+ */
+- (void) measureOrientation:(TSPixelConverterOrientation) orientation withFormat:(TSPixelConverterPlaneFormat) format {
+	TSPixelConverterRef converter = [self converterWithFormat:format width:benchWidth height:benchHeight];
+	
+	[self measureMetrics:[[self class] defaultPerformanceMetrics] automaticallyStartMeasuring:NO forBlock:^{
+		TSPixelConverterResize(converter, benchWidth, benchHeight);
+		
+		[self startMeasuring];
+		XCTAssertTrue(TSPixelConverterApplyOrientation(converter, orientation));
+		[self stopMeasuring];
+	}];
+	
+	TSPixelConverterFree(converter);
+}
+
+#pragma mark Tests
+/**
+ * Checks all orientations with single precision planes.
+ */
+- (void) testOrientationsFloat {
+	[self checkOrientationsWithFormat:TSPixelConverterPlaneFormatFloat32];
+}
+
+/**
+ * Checks all orientations with half precision planes.
+ */
+- (void) testOrientationsHalf {
+	[self checkOrientationsWithFormat:TSPixelConverterPlaneFormatFloat16];
+}
+
+/**
+ * Ensures that invalid orientations are rejected.
+ */
+- (void) testInvalidOrientation {
+	TSPixelConverterRef converter = [self converterWithFormat:TSPixelConverterPlaneFormatFloat32 width:imgWidth height:imgHeight];
+	
+	XCTAssertFalse(TSPixelConverterApplyOrientation(converter, (TSPixelConverterOrientation) 0));
+	XCTAssertFalse(TSPixelConverterApplyOrientation(converter, (TSPixelConverterOrientation) 9));
+	
+	TSPixelConverterFree(converter);
+}
+
+#pragma mark Performance
+/**
+ * Measures a 90° clockwise rotation with single precision planes.
+ */
+- (void) testRotate90FloatPerformance {
+	[self measureOrientation:TSPixelConverterOrientationRotate90CW withFormat:TSPixelConverterPlaneFormatFloat32];
+}
+
+/**
+ * Measures a 90° clockwise rotation with half precision planes.
+ */
+- (void) testRotate90HalfPerformance {
+	[self measureOrientation:TSPixelConverterOrientationRotate90CW withFormat:TSPixelConverterPlaneFormatFloat16];
+}
+
+/**
+ * Measures a horizontal mirror with single precision planes.
+ */
+- (void) testMirrorFloatPerformance {
+	[self measureOrientation:TSPixelConverterOrientationMirrorHorizontal withFormat:TSPixelConverterPlaneFormatFloat32];
+}
+
+/**
+ * Measures a horizontal mirror with half precision planes.
+ */
+- (void) testMirrorHalfPerformance {
+	[self measureOrientation:TSPixelConverterOrientationMirrorHorizontal withFormat:TSPixelConverterPlaneFormatFloat16];
+}
+
+/**
+ * Measures a 90° clockwise rotation with vImage, for comparison.
+ */
+- (void) testvImageRotate90Performance {
+	TSPixelConverterRef converter = [self converterWithFormat:TSPixelConverterPlaneFormatFloat32 width:benchWidth height:benchHeight];
+	TSPixelConverterSetBackend(converter, TSPixelConverterBackendvImage);
+	
+	[self measureMetrics:[[self class] defaultPerformanceMetrics] automaticallyStartMeasuring:NO forBlock:^{
+		TSPixelConverterResize(converter, benchWidth, benchHeight);
+		
+		[self startMeasuring];
+		XCTAssertTrue(TSPixelConverterRotate90(converter, 3));
+		[self stopMeasuring];
+	}];
+	
+	TSPixelConverterFree(converter);
+}
+
+@end
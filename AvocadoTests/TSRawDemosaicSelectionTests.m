@@ -0,0 +1,127 @@
+//
+//  TSRawDemosaicSelectionTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20161018.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSRawPipeline.h"
+#import "TSRawPipelineState.h"
+#import "TSRawDemosaic.h"
+
+/// size of a typical (about 24 megapixel) image
+static const NSSize imgSize = { 6000, 4000 };
+
+// TODO: Find a better way to expose this
+@interface TSRawPipeline ()
+- (BOOL) setUpDemosaicEngineWithState:(TSRawPipelineState *) state;
+@end
+
+@interface TSRawDemosaicSelectionTests : XCTestCase
+
+/// pipeline whose engine selection is tested
+@property (nonatomic) TSRawPipeline *pipeline;
+
+- (TSRawPipelineState *) stateWithIntent:(TSRawPipelineIntent) intent shouldCache:(BOOL) cache;
+
+@end
+
+@implementation TSRawDemosaicSelectionTests
+
+/**
+ * Creates the pipeline.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	self.pipeline = [TSRawPipeline new];
+}
+
+/**
+ * Frees the pipeline.
+ */
+- (void) tearDown {
+	self.pipeline = nil;
+	
+	[super tearDown];
+}
+
+#pragma mark Helpers
+/**
+ * Creates the state of a job on an image of the test size, as it is before
+ * the demosaic engine is selected.
+ */
+- (TSRawPipelineState *) stateWithIntent:(TSRawPipelineIntent) intent shouldCache:(BOOL) cache {
+	TSRawPipelineState *state = [TSRawPipelineState new];
+	
+	state.intent = intent;
+	state.shouldCache = cache;
+	
+	state.rawSize = imgSize;
+	state.outputSize = imgSize;
+	
+	return state;
+}
+
+#pragma mark Tests
+/**
+ * Ensures that a fast display job that caches its output still uses the half
+ * size engine, and leaves filling the cache to a separate job.
+ */
+- (void) testCachedDisplayFastUsesHalfSizeEngine {
+	TSRawPipelineState *state = [self stateWithIntent:TSRawPipelineIntentDisplayFast shouldCache:YES];
+	
+	BOOL fillCache = [self.pipeline setUpDemosaicEngineWithState:state];
+	
+	XCTAssertEqual(state.demosaicEngine, TSRawDemosaicEngineForIntent(TSRawPipelineIntentDisplayFast));
+	XCTAssertEqual(TSRawDemosaicGetEngine(state.demosaicEngine)->shrink, 1);
+	
+	XCTAssertTrue(NSEqualSizes(state.rawSize, NSMakeSize(3000, 2000)), @"raw size is %@", NSStringFromSize(state.rawSize));
+	XCTAssertTrue(NSEqualSizes(state.outputSize, NSMakeSize(3000, 2000)), @"output size is %@", NSStringFromSize(state.outputSize));
+	
+	// its output is too small to be cached
+	XCTAssertTrue(fillCache);
+	XCTAssertFalse(state.shouldCache);
+}
+
+/**
+ * Ensures that the job that fills the cache for fast display jobs produces a
+ * full size image, and stores it.
+ */
+- (void) testCacheFillUsesFullSizeEngine {
+	TSRawPipelineState *state = [self stateWithIntent:TSRawPipelineIntentDisplayFast shouldCache:YES];
+	state.fillsCache = YES;
+	
+	BOOL fillCache = [self.pipeline setUpDemosaicEngineWithState:state];
+	
+	XCTAssertEqual(state.demosaicEngine, TSRawDemosaicEngineForCacheFill(TSRawPipelineIntentDisplayFast));
+	XCTAssertEqual(TSRawDemosaicGetEngine(state.demosaicEngine)->shrink, 0);
+	
+	XCTAssertTrue(NSEqualSizes(state.rawSize, imgSize), @"raw size is %@", NSStringFromSize(state.rawSize));
+	
+	XCTAssertFalse(fillCache);
+	XCTAssertTrue(state.shouldCache);
+}
+
+/**
+ * Ensures that jobs whose engine outputs a full size image cache their own
+ * output, and that jobs that don't cache never ask for the cache to be
+ * filled.
+ */
+- (void) testOtherJobs {
+	TSRawPipelineState *state = [self stateWithIntent:TSRawPipelineIntentDisplaySlow shouldCache:YES];
+	
+	XCTAssertFalse([self.pipeline setUpDemosaicEngineWithState:state]);
+	XCTAssertTrue(state.shouldCache);
+	XCTAssertTrue(NSEqualSizes(state.rawSize, imgSize), @"raw size is %@", NSStringFromSize(state.rawSize));
+	
+	state = [self stateWithIntent:TSRawPipelineIntentDisplayFast shouldCache:NO];
+	
+	XCTAssertFalse([self.pipeline setUpDemosaicEngineWithState:state]);
+	XCTAssertEqual(TSRawDemosaicGetEngine(state.demosaicEngine)->shrink, 1);
+}
+
+@end
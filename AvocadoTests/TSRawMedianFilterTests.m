@@ -0,0 +1,141 @@
+//
+//  TSRawMedianFilterTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20160726.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSTestFrames.h"
+#import "TSRawImageDataHelpers.h"
+
+/**
+ * Reference implementation of the median filter; this is the original scalar
+ * implementation, as in LibRaw's median_filter(). The fourth component of the
+ * image is used as scratch space.
+ */
+static void TSRawMedianFilterReference(int width, int height, uint16_t (*image)[4], int med_passes) {
+	uint16_t (*pix)[4];
+	int pass, c, i, j, k, med[9], tmp;
+	
+	static const unsigned char opt[] =	/* Optimal 9-element median search */
+	{ 1,2, 4,5, 7,8, 0,1, 3,4, 6,7, 1,2, 4,5, 7,8,
+		0,3, 5,8, 4,7, 3,6, 1,4, 2,5, 4,7, 4,2, 6,4, 4,2 };
+	
+	for (pass=1; pass <= med_passes; pass++) {
+		for (c = 0; c < 3; c += 2) {
+			for (pix = image; pix < image+width*height; pix++)
+				pix[0][3] = pix[0][c];
+			for (pix = image+width; pix < image+width*(height-1); pix++) {
+				if ((pix-image+1) % width < 2) continue;
+				for (k=0, i = -width; i <= width; i += width)
+					for (j = i-1; j <= i+1; j++)
+						med[k++] = pix[j][3] - pix[j][1];
+				for (i=0; i < sizeof opt; i+=2)
+					if (med[opt[i]] > med[opt[i+1]]) {
+						tmp = med[opt[i]];
+						med[opt[i]] = med[opt[i+1]];
+						med[opt[i+1]] = tmp;
+					}
+				tmp = med[4] + pix[0][1];
+				pix[0][c] = (tmp < 0) ? 0 : ((tmp > 65535) ? 65535 : tmp);
+			}
+		}
+	}
+}
+
+@interface TSRawMedianFilterTests : XCTestCase
+
+/// libraw struct holding the image size
+@property (nonatomic) libraw_data_t *libRaw;
+
+/// input image, four components per pixel
+@property (nonatomic) uint16_t (*image)[4];
+
+/// output of the reference implementation
+@property (nonatomic) uint16_t (*refOut)[4];
+/// output of the implementation under test
+@property (nonatomic) uint16_t (*testOut)[4];
+
+@end
+
+@implementation TSRawMedianFilterTests
+
+/**
+ * Allocates the image buffers.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	const int imgWidth = TSTestFrameWidth, imgHeight = TSTestFrameHeight;
+	
+	self.libRaw = (libraw_data_t *) calloc(1, sizeof(libraw_data_t));
+	self.libRaw->sizes.width = imgWidth;
+	self.libRaw->sizes.height = imgHeight;
+	
+	self.image = (uint16_t (*)[4]) valloc(imgWidth * imgHeight * 4 * sizeof(uint16_t));
+	self.refOut = (uint16_t (*)[4]) valloc(imgWidth * imgHeight * 4 * sizeof(uint16_t));
+	self.testOut = (uint16_t (*)[4]) valloc(imgWidth * imgHeight * 4 * sizeof(uint16_t));
+}
+
+/**
+ * Cleans up memory.
+ */
+- (void) tearDown {
+	free(self.libRaw);
+	
+	free(self.image);
+	free(self.refOut);
+	free(self.testOut);
+	
+	[super tearDown];
+}
+
+#pragma mark Tests
+/**
+ * Runs the median filter and the reference implementation with one to three
+ * passes over each pattern, and ensures that the red, green and blue
+ * components of the outputs are identical. With the extremes pattern, the
+ * differences to green, and the results, cover the entire range.
+ */
+- (void) testMatchesReference {
+	const int imgWidth = TSTestFrameWidth, imgHeight = TSTestFrameHeight;
+	const size_t bytes = imgWidth * imgHeight * 4 * sizeof(uint16_t);
+	
+	for(TSTestFramePattern pattern = 0; pattern < TSTestFramePatternCount; pattern++) {
+		TSTestFrameFill(self.image, imgWidth, imgHeight, pattern, 0);
+		
+		for(int passes = 1; passes <= 3; passes++) {
+			memcpy(self.refOut, self.image, bytes);
+			memcpy(self.testOut, self.image, bytes);
+			
+			TSRawMedianFilterReference(imgWidth, imgHeight, self.refOut, passes);
+			TSRawPostInterpolationMedianFilter(self.libRaw, self.testOut, passes);
+			
+			NSString *diff = TSTestFrameCompare(self.testOut[0], self.refOut[0], imgWidth * imgHeight, 4, 3);
+			
+			if(diff) {
+				XCTFail(@"%@ pattern, %i passes: %@", TSTestFramePatternName(pattern), passes, diff);
+				return;
+			}
+		}
+	}
+}
+
+/**
+ * Measures three passes of the median filter over a frame.
+ */
+- (void) testPerformance {
+	const int imgWidth = TSTestFrameWidth, imgHeight = TSTestFrameHeight;
+	
+	TSTestFrameFill(self.image, imgWidth, imgHeight, TSTestFramePatternRandom, 0);
+	
+	[self measureBlock:^{
+		memcpy(self.testOut, self.image, imgWidth * imgHeight * 4 * sizeof(uint16_t));
+		TSRawPostInterpolationMedianFilter(self.libRaw, self.testOut, 3);
+	}];
+}
+
+@end
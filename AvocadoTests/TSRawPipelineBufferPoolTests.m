@@ -0,0 +1,141 @@
+//
+//  TSRawPipelineBufferPoolTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20160807.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSRawPipelineBufferPool.h"
+
+/// size of a typical (about 24 megapixel) image
+static const NSSize imgSize = { 6000, 4000 };
+
+@interface TSRawPipelineBufferPoolTests : XCTestCase
+
+/// pool under test; it keeps up to two idle sets of buffers
+@property (nonatomic) TSRawPipelineBufferPool *pool;
+
+@end
+
+@implementation TSRawPipelineBufferPoolTests
+
+/**
+ * Creates the pool.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	self.pool = [[TSRawPipelineBufferPool alloc] initWithMaxIdleBuffers:2];
+}
+
+/**
+ * Frees the pool and its buffers.
+ */
+- (void) tearDown {
+	self.pool = nil;
+	
+	[super tearDown];
+}
+
+#pragma mark Tests
+/**
+ * Ensures that checked out buffers are large enough for the image, and that
+ * the converter is set up as requested.
+ */
+- (void) testBuffersFitImage {
+	NSSize converterSize = NSMakeSize(imgSize.width / 2, imgSize.height / 2);
+	
+	TSRawPipelineBuffers *buffers = [self.pool checkOutBuffersForImageSize:imgSize converterSize:converterSize planeFormat:TSPixelConverterPlaneFormatFloat16];
+	
+	XCTAssertGreaterThanOrEqual(buffers.interpolatedColourBufSz, imgSize.width * imgSize.height * 4 * sizeof(uint16_t));
+	XCTAssertGreaterThanOrEqual(buffers.bayerBufSz, imgSize.width * imgSize.height * sizeof(uint16_t));
+	
+	NSUInteger w, h;
+	TSPixelConverterGetSize(buffers.converter, &w, &h);
+	
+	XCTAssertEqual(w, converterSize.width);
+	XCTAssertEqual(h, converterSize.height);
+	XCTAssertEqual(TSPixelConverterGetPlaneFormat(buffers.converter), TSPixelConverterPlaneFormatFloat16);
+	
+	[self.pool checkInBuffers:buffers];
+}
+
+/**
+ * Ensures that returned buffers are re-used for an image in the same bucket,
+ * but that concurrent jobs get distinct buffers.
+ */
+- (void) testBuffersAreReused {
+	TSRawPipelineBuffers *a = [self.pool checkOutBuffersForImageSize:imgSize converterSize:imgSize planeFormat:TSPixelConverterPlaneFormatFloat32];
+	TSRawPipelineBuffers *b = [self.pool checkOutBuffersForImageSize:imgSize converterSize:imgSize planeFormat:TSPixelConverterPlaneFormatFloat32];
+	
+	XCTAssertNotEqual(a, b);
+	XCTAssertNotEqual(a.interpolatedColourBuf, b.interpolatedColourBuf);
+	
+	[self.pool checkInBuffers:a];
+	
+	// a slightly smaller image still falls into the same bucket
+	NSSize smaller = NSMakeSize(imgSize.width - 8, imgSize.height - 8);
+	TSRawPipelineBuffers *c = [self.pool checkOutBuffersForImageSize:smaller converterSize:smaller planeFormat:TSPixelConverterPlaneFormatFloat32];
+	
+	XCTAssertEqual(a, c);
+	
+	[self.pool checkInBuffers:b];
+	[self.pool checkInBuffers:c];
+}
+
+/**
+ * Ensures that a much larger image doesn't get buffers from a smaller bucket.
+ */
+- (void) testBucketsAreSeparate {
+	TSRawPipelineBuffers *a = [self.pool checkOutBuffersForImageSize:imgSize converterSize:imgSize planeFormat:TSPixelConverterPlaneFormatFloat32];
+	[self.pool checkInBuffers:a];
+	
+	NSSize larger = NSMakeSize(imgSize.width * 2, imgSize.height * 2);
+	TSRawPipelineBuffers *b = [self.pool checkOutBuffersForImageSize:larger converterSize:larger planeFormat:TSPixelConverterPlaneFormatFloat32];
+	
+	XCTAssertNotEqual(a, b);
+	XCTAssertGreaterThanOrEqual(b.bayerBufSz, larger.width * larger.height * sizeof(uint16_t));
+	
+	[self.pool checkInBuffers:b];
+}
+
+/**
+ * Ensures that a re-used converter no longer treats its planes as rotated.
+ */
+- (void) testReusedConverterIsReset {
+	NSSize small = NSMakeSize(301, 201);
+	
+	TSRawPipelineBuffers *a = [self.pool checkOutBuffersForImageSize:small converterSize:small planeFormat:TSPixelConverterPlaneFormatFloat32];
+	XCTAssertTrue(TSPixelConverterApplyOrientation(a.converter, TSPixelConverterOrientationRotate90CW));
+	[self.pool checkInBuffers:a];
+	
+	TSRawPipelineBuffers *b = [self.pool checkOutBuffersForImageSize:small converterSize:small planeFormat:TSPixelConverterPlaneFormatFloat32];
+	
+	NSUInteger w, h;
+	TSPixelConverterGetSize(b.converter, &w, &h);
+	
+	XCTAssertEqual(w, small.width);
+	XCTAssertEqual(h, small.height);
+	
+	[self.pool checkInBuffers:b];
+}
+
+/**
+ * Measures checking out and returning buffers for a typical image, once the
+ * pool holds them.
+ */
+- (void) testCheckOutPerformance {
+	[self.pool checkInBuffers:[self.pool checkOutBuffersForImageSize:imgSize converterSize:imgSize planeFormat:TSPixelConverterPlaneFormatFloat32]];
+	
+	[self measureBlock:^{
+		for(NSUInteger i = 0; i < 100; i++) {
+			TSRawPipelineBuffers *buffers = [self.pool checkOutBuffersForImageSize:imgSize converterSize:imgSize planeFormat:TSPixelConverterPlaneFormatFloat32];
+			[self.pool checkInBuffers:buffers];
+		}
+	}];
+}
+
+@end
@@ -0,0 +1,197 @@
+//
+//  TSRawPipelineTelemetryTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20160810.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSRawPipelineTelemetry.h"
+
+@interface TSRawPipelineTelemetryTests : XCTestCase
+
+/// telemetry under test; it keeps up to four recent jobs
+@property (nonatomic) TSRawPipelineTelemetry *telemetry;
+
+- (TSRawPipelineJobMetrics *) finishedJobWithCacheResult:(TSRawPipelineCacheResult) result;
+- (TSRawPipelineJobMetrics *) finishedJobOverlappingAnother;
+
+@end
+
+@implementation TSRawPipelineTelemetryTests
+
+/**
+ * Creates the telemetry.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	self.telemetry = [[TSRawPipelineTelemetry alloc] initWithMaxRecentJobs:4];
+}
+
+/**
+ * Frees the telemetry.
+ */
+- (void) tearDown {
+	self.telemetry = nil;
+	
+	[super tearDown];
+}
+
+#pragma mark Helpers
+/**
+ * Creates the metrics of a 24 megapixel job with two stages: one that sleeps,
+ * and one that allocates and touches some memory.
+ */
+- (TSRawPipelineJobMetrics *) finishedJobWithCacheResult:(TSRawPipelineCacheResult) result {
+	TSRawPipelineJobMetrics *job = [[TSRawPipelineJobMetrics alloc] initWithImageUuid:[NSUUID UUID].UUIDString megapixels:24];
+	job.cacheResult = result;
+	
+	TSRawPipelineSample begin = TSRawPipelineSampleNow();
+	usleep(10000);
+	[job recordStage:@"Sleep" since:begin];
+	
+	begin = TSRawPipelineSampleNow();
+	
+	const size_t size = 16 * 1024 * 1024;
+	uint8_t *buf = (uint8_t *) malloc(size);
+	memset(buf, 0xA5, size);
+	
+	[job recordStage:@"Allocate" since:begin];
+	
+	free(buf);
+	
+	[job finish];
+	return job;
+}
+
+/**
+ * Creates the metrics of a job with a single stage, during which a second
+ * job is in flight.
+ */
+- (TSRawPipelineJobMetrics *) finishedJobOverlappingAnother {
+	TSRawPipelineJobMetrics *job = [[TSRawPipelineJobMetrics alloc] initWithImageUuid:[NSUUID UUID].UUIDString megapixels:24];
+	
+	TSRawPipelineSample begin = TSRawPipelineSampleNow();
+	
+	TSRawPipelineJobMetrics *other = [[TSRawPipelineJobMetrics alloc] initWithImageUuid:[NSUUID UUID].UUIDString megapixels:24];
+	usleep(10000);
+	[other finish];
+	
+	[job recordStage:@"Sleep" since:begin];
+	
+	[job finish];
+	return job;
+}
+
+#pragma mark Tests
+/**
+ * Ensures that each stage measures its wall time and heap growth, and that the
+ * job's totals add up.
+ */
+- (void) testStageMetrics {
+	TSRawPipelineJobMetrics *job = [self finishedJobWithCacheResult:TSRawPipelineCacheResultMiss];
+	
+	XCTAssertEqual(job.stages.count, 2);
+	
+	TSRawPipelineStageMetrics *sleep = job.stages[0];
+	TSRawPipelineStageMetrics *alloc = job.stages[1];
+	
+	XCTAssertEqualObjects(sleep.name, @"Sleep");
+	XCTAssertGreaterThanOrEqual(sleep.wallTime, 0.01);
+	XCTAssertLessThan(sleep.processCpuTime, sleep.wallTime);
+	XCTAssertTrue(sleep.exclusive);
+	
+	XCTAssertGreaterThanOrEqual(alloc.heapGrowth, 16 * 1024 * 1024);
+	XCTAssertEqual(alloc.megapixels, 24);
+	XCTAssertEqual(alloc.cacheResult, TSRawPipelineCacheResultMiss);
+	
+	XCTAssertGreaterThanOrEqual(job.wallTime, sleep.wallTime + alloc.wallTime);
+	XCTAssertEqualWithAccuracy(job.processCpuTime, sleep.processCpuTime + alloc.processCpuTime, 1e-9);
+	XCTAssertEqual(job.heapGrowth, sleep.heapGrowth + alloc.heapGrowth);
+	XCTAssertTrue(job.exclusive);
+}
+
+/**
+ * Ensures that a stage during which another job was in flight isn't treated
+ * as exclusive, even if the other job finished before the stage did, and
+ * that its process CPU time and heap growth are left out of the aggregates.
+ */
+- (void) testOverlappingJobs {
+	TSRawPipelineJobMetrics *overlapped = [self finishedJobOverlappingAnother];
+	
+	XCTAssertFalse(overlapped.stages[0].exclusive);
+	XCTAssertFalse(overlapped.exclusive);
+	
+	[self.telemetry addJob:overlapped];
+	
+	TSRawPipelineStageAggregate *sleep = self.telemetry.stageAggregates[@"Sleep"];
+	XCTAssertEqual(sleep.count, 1);
+	XCTAssertEqual(sleep.exclusiveCount, 0);
+	XCTAssertEqual(sleep.meanProcessCpuTime, 0);
+	XCTAssertNil(sleep.dictionaryRepresentation[@"meanProcessCpuTime"]);
+	
+	// an exclusive run is included
+	[self.telemetry addJob:[self finishedJobWithCacheResult:TSRawPipelineCacheResultMiss]];
+	
+	sleep = self.telemetry.stageAggregates[@"Sleep"];
+	XCTAssertEqual(sleep.count, 2);
+	XCTAssertEqual(sleep.exclusiveCount, 1);
+	XCTAssertNotNil(sleep.dictionaryRepresentation[@"meanProcessCpuTime"]);
+}
+
+/**
+ * Ensures that stages are aggregated over the recent jobs only.
+ */
+- (void) testAggregates {
+	for(NSUInteger i = 0; i < 6; i++) {
+		TSRawPipelineCacheResult result = (i % 2) ? TSRawPipelineCacheResultHit : TSRawPipelineCacheResultMiss;
+		[self.telemetry addJob:[self finishedJobWithCacheResult:result]];
+	}
+	
+	XCTAssertEqual(self.telemetry.recentJobs.count, 4);
+	
+	NSDictionary<NSString *, TSRawPipelineStageAggregate *> *aggregates = self.telemetry.stageAggregates;
+	TSRawPipelineStageAggregate *sleep = aggregates[@"Sleep"];
+	
+	XCTAssertEqual(aggregates.count, 2);
+	XCTAssertEqual(sleep.count, 4);
+	XCTAssertEqual(sleep.cacheHits, 2);
+	XCTAssertEqual(sleep.cacheMisses, 2);
+	
+	XCTAssertLessThanOrEqual(sleep.minWallTime, sleep.meanWallTime);
+	XCTAssertLessThanOrEqual(sleep.meanWallTime, sleep.maxWallTime);
+	XCTAssertEqualWithAccuracy(sleep.meanWallTimePerMegapixel, sleep.meanWallTime / 24, 1e-9);
+	
+	[self.telemetry reset];
+	XCTAssertEqual(self.telemetry.stageAggregates.count, 0);
+}
+
+/**
+ * Ensures that the JSON dump can be read back, and contains the aggregates
+ * and all recent jobs.
+ */
+- (void) testJSONOutput {
+	[self.telemetry addJob:[self finishedJobWithCacheResult:TSRawPipelineCacheResultNotApplicable]];
+	
+	NSURL *url = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[NSUUID UUID].UUIDString];
+	
+	NSError *err = nil;
+	XCTAssertTrue([self.telemetry writeJSONToURL:url error:&err], @"%@", err);
+	
+	NSData *data = [NSData dataWithContentsOfURL:url];
+	NSDictionary *dict = [NSJSONSerialization JSONObjectWithData:data options:0 error:&err];
+	
+	XCTAssertNotNil(dict, @"%@", err);
+	XCTAssertEqual([dict[@"jobs"] count], 1);
+	XCTAssertEqual([dict[@"jobs"][0][@"stages"] count], 2);
+	XCTAssertEqualObjects(dict[@"jobs"][0][@"cache"], @"n/a");
+	XCTAssertNotNil(dict[@"stages"][@"Allocate"][@"meanHeapGrowth"]);
+	XCTAssertEqualObjects(dict[@"jobs"][0][@"exclusive"], @YES);
+	
+	[[NSFileManager defaultManager] removeItemAtURL:url error:nil];
+}
+
+@end
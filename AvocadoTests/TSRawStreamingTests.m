@@ -0,0 +1,228 @@
+//
+//  TSRawStreamingTests.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20160809.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+
+#import "TSRawStreaming.h"
+#import "TSRawImageDataHelpers.h"
+
+/// sets the size of the test frames; neither is a multiple of the strip size
+static const int imgWidth = 389;
+static const int imgHeight = 301;
+
+/// number of rows in each strip; small, so the image is split into many strips
+static const NSUInteger stripRows = 32;
+
+@interface TSRawStreamingTests : XCTestCase
+
+/// raw data shared by all libraw structs
+@property (nonatomic) uint16_t *rawData;
+
+- (libraw_data_t *) createLibRaw;
+- (void) compareEngine:(TSRawDemosaicEngine) engine;
+
+@end
+
+@implementation TSRawStreamingTests
+
+/**
+ * Fills the raw data with noise, in the range of a 12 bit sensor.
+ */
+- (void) setUp {
+	[super setUp];
+	
+	self.rawData = (uint16_t *) malloc(imgWidth * imgHeight * sizeof(uint16_t));
+	
+	srand(0x5742);
+	
+	for(size_t i = 0; i < (imgWidth * imgHeight); i++) {
+		self.rawData[i] = 64 + (rand() % 4032);
+	}
+}
+
+/**
+ * Frees the raw data.
+ */
+- (void) tearDown {
+	free(self.rawData);
+	
+	[super tearDown];
+}
+
+#pragma mark Helpers
+/**
+ * Creates a libraw struct describing an RGGB sensor with the test raw data,
+ * a black level, camera white balance and colour matrix.
+ */
+- (libraw_data_t *) createLibRaw {
+	static const float rgb_cam[3][4] = {
+		{ 1.62f, -0.51f, -0.11f, 0.f },
+		{ -0.19f, 1.48f, -0.29f, 0.f },
+		{ 0.02f, -0.43f, 1.41f, 0.f }
+	};
+	
+	libraw_data_t *libRaw = (libraw_data_t *) calloc(1, sizeof(libraw_data_t));
+	
+	libRaw->sizes.raw_width = libRaw->sizes.width = libRaw->sizes.iwidth = imgWidth;
+	libRaw->sizes.raw_height = libRaw->sizes.height = libRaw->sizes.iheight = imgHeight;
+	libRaw->sizes.raw_pitch = imgWidth * sizeof(uint16_t);
+	
+	libRaw->rawdata.raw_image = self.rawData;
+	
+	libRaw->idata.filters = 0x94949494;
+	libRaw->idata.colors = 3;
+	
+	libRaw->color.black = 64;
+	libRaw->color.maximum = 4095;
+	
+	libRaw->color.cam_mul[0] = 2.07f;
+	libRaw->color.cam_mul[1] = 1.f;
+	libRaw->color.cam_mul[2] = 1.38f;
+	
+	memcpy(libRaw->color.rgb_cam, rgb_cam, sizeof(rgb_cam));
+	
+	return libRaw;
+}
+
+/**
+ * Runs the given engine over the image both on the entire image, and in
+ * strips; then ensures that the planes, histograms and the resulting image
+ * info are identical.
+ */
+- (void) compareEngine:(TSRawDemosaicEngine) engine {
+	const TSRawDemosaicEngineInfo *info = TSRawDemosaicGetEngine(engine);
+	
+	const NSUInteger outWidth = imgWidth >> info->shrink;
+	const NSUInteger outHeight = imgHeight >> info->shrink;
+	
+	int *refHisto = (int *) calloc(0x2000 * 4, sizeof(int));
+	int *testHisto = (int *) calloc(0x2000 * 4, sizeof(int));
+	
+	// process the entire image, as the pipeline does without streaming
+	libraw_data_t *ref = [self createLibRaw];
+	
+	uint16_t *refBayer = (uint16_t *) malloc(imgWidth * imgHeight * sizeof(uint16_t));
+	uint16_t (*refImage)[4] = (uint16_t (*)[4]) malloc(imgWidth * imgHeight * 4 * sizeof(uint16_t));
+	TSPixelConverterRef refConverter = TSPixelConverterCreate(NULL, outWidth, outHeight);
+	
+	TSRawAdjustBlackLevel(ref, NULL);
+	TSRawPrepareBayerData(ref, refBayer);
+	info->interpolate(ref, refBayer, refImage);
+	TSRawConvertToRGB(ref, refImage, (uint16_t (*)[3]) refImage, outWidth, outHeight, refHisto, NULL);
+	
+	TSPixelConverterSetInData(refConverter, refImage);
+	TSPixelConverterRGB16UToPlanarF(refConverter, 0xFFFF);
+	
+	// process it again in strips, with buffers that only fit a single strip
+	libraw_data_t *test = [self createLibRaw];
+	
+	const NSUInteger sourceRows = TSRawStreamGetSourceRows(engine, stripRows);
+	
+	uint16_t *testBayer = (uint16_t *) malloc(imgWidth * sourceRows * sizeof(uint16_t));
+	uint16_t (*testImage)[4] = (uint16_t (*)[4]) malloc(imgWidth * sourceRows * 4 * sizeof(uint16_t));
+	TSPixelConverterRef testConverter = TSPixelConverterCreate(NULL, outWidth, outHeight);
+	
+	TSRawAdjustBlackLevel(test, NULL);
+	TSRawStreamToPlanar(test, engine, stripRows, testBayer, testImage, testConverter, testHisto, NULL);
+	
+	// the image info should have been updated in the same way, and the size
+	// of the image should be left alone, even if the engine shrinks it
+	XCTAssertEqual(test->sizes.width, imgWidth);
+	XCTAssertEqual(test->sizes.height, imgHeight);
+	XCTAssertEqual(ref->sizes.width, imgWidth);
+	XCTAssertEqual(ref->sizes.height, imgHeight);
+	XCTAssertEqual(test->sizes.iwidth, ref->sizes.iwidth);
+	XCTAssertEqual(test->sizes.iheight, ref->sizes.iheight);
+	XCTAssertEqual(test->idata.filters, ref->idata.filters);
+	XCTAssertEqual(test->color.maximum, ref->color.maximum);
+	XCTAssertEqual(test->color.data_maximum, ref->color.data_maximum);
+	
+	XCTAssertEqual(memcmp(testHisto, refHisto, 0x2000 * 4 * sizeof(int)), 0, @"histograms differ for %s", info->name);
+	
+	// compare the planes row by row
+	for(NSUInteger p = 0; p < 3; p++) {
+		vImage_Buffer refPlane = TSPixelConverterGetPlanevImageBufferBuffer(refConverter, p);
+		vImage_Buffer testPlane = TSPixelConverterGetPlanevImageBufferBuffer(testConverter, p);
+		
+		XCTAssertEqual(testPlane.width, refPlane.width);
+		XCTAssertEqual(testPlane.height, refPlane.height);
+		
+		const size_t rowBytes = MIN(refPlane.rowBytes, testPlane.rowBytes);
+		
+		for(NSUInteger y = 0; y < refPlane.height; y++) {
+			const void *refRow = ((const uint8_t *) refPlane.data) + (y * refPlane.rowBytes);
+			const void *testRow = ((const uint8_t *) testPlane.data) + (y * testPlane.rowBytes);
+			
+			if(memcmp(refRow, testRow, rowBytes) != 0) {
+				XCTFail(@"plane %lu differs in row %lu for %s", p, y, info->name);
+				break;
+			}
+		}
+	}
+	
+	// clean up
+	TSPixelConverterFree(refConverter);
+	TSPixelConverterFree(testConverter);
+	
+	free(refBayer);
+	free(refImage);
+	free(testBayer);
+	free(testImage);
+	
+	free(refHisto);
+	free(testHisto);
+	
+	free(ref);
+	free(test);
+}
+
+#pragma mark Tests
+/**
+ * Ensures that the strip buffers are smaller than the image, but have room
+ * for the halos.
+ */
+- (void) testSourceRows {
+	for(NSUInteger i = 0; i < TSRawDemosaicEngineCount; i++) {
+		const TSRawDemosaicEngineInfo *info = TSRawDemosaicGetEngine(i);
+		const NSUInteger rows = TSRawStreamGetSourceRows(i, stripRows);
+		
+		XCTAssertGreaterThanOrEqual(rows, stripRows + (2 * info->support), @"no room for the halos of %s", info->name);
+		XCTAssertLessThan(rows, (NSUInteger) imgHeight);
+	}
+}
+
+/**
+ * Ensures that streaming doesn't change the output of AHD.
+ */
+- (void) testStreamedAHD {
+	[self compareEngine:TSRawDemosaicEngineAHD];
+}
+
+/**
+ * Ensures that streaming doesn't change the output of LMMSE.
+ */
+- (void) testStreamedLMMSE {
+	[self compareEngine:TSRawDemosaicEngineLMMSE];
+}
+
+/**
+ * Ensures that streaming doesn't change the output of bilinear interpolation.
+ */
+- (void) testStreamedBilinear {
+	[self compareEngine:TSRawDemosaicEngineBilinear];
+}
+
+/**
+ * Ensures that streaming doesn't change the output of the superpixel engine,
+ * which halves the size of the image.
+ */
+- (void) testStreamedSuperpixel {
+	[self compareEngine:TSRawDemosaicEngineSuperpixel];
+}
+
+@end
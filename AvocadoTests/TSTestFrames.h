@@ -0,0 +1,81 @@
+//
+//  TSTestFrames.h
+//  AvocadoTests
+//
+//	Synthetic test frames shared by the tests that compare an optimised
+//	kernel against a reference implementation, and a helper to find the first
+//	sample in which two outputs differ.
+//
+//  Created by Tristan Seifert on 20161018.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/// width of the test frames; odd, to exercise the tail loops of the kernels
+#define TSTestFrameWidth 1021
+/// height of the test frames
+#define TSTestFrameHeight 173
+
+/**
+ * Patterns with which a test frame can be filled.
+ */
+typedef NS_ENUM(NSUInteger, TSTestFramePattern) {
+	/// Uniformly random values
+	TSTestFramePatternRandom,
+	/// Random values that are either black or fully saturated; these push
+	/// interpolation out of range, and thus exercise all the fallbacks.
+	TSTestFramePatternExtremes,
+	/// Smooth horizontal and vertical gradients, with a bit of noise
+	TSTestFramePatternGradient,
+	
+	/// number of patterns
+	TSTestFramePatternCount
+};
+
+/**
+ * Returns a human-readable name for the pattern, for failure messages.
+ */
+NSString *TSTestFramePatternName(TSTestFramePattern pattern);
+
+/**
+ * Fills a frame of four component pixels with the given pattern. The random
+ * number generator is seeded with the pattern, so the frame is the same each
+ * time it is filled.
+ *
+ * @param image Frame to fill
+ * @param width Width of the frame, in pixels
+ * @param height Height of the frame, in pixels
+ * @param pattern Pattern to fill the frame with
+ * @param filters If nonzero, the frame is a Bayer mosaic with this filter
+ * pattern: only the component for each pixel's filter colour is set, and all
+ * others are zero. Otherwise, all four components are set.
+ */
+void TSTestFrameFill(uint16_t (*image)[4], int width, int height, TSTestFramePattern pattern, unsigned int filters);
+
+/**
+ * Extracts the single component Bayer mosaic from a frame that was filled as
+ * a mosaic; that is, the component of each pixel's filter colour.
+ *
+ * @param image Frame filled with a filter pattern
+ * @param bayer Output for the mosaic, one sample per pixel
+ * @param width Width of the frame, in pixels
+ * @param height Height of the frame, in pixels
+ * @param filters Filter pattern with which the frame was filled
+ */
+void TSTestFrameGetMosaic(const uint16_t (*image)[4], uint16_t *bayer, int width, int height, unsigned int filters);
+
+/**
+ * Compares the given components of two buffers of pixels.
+ *
+ * @param test Output of the implementation under test
+ * @param ref Output of the reference implementation
+ * @param count Number of pixels to compare
+ * @param stride Number of components per pixel
+ * @param components Number of components to compare in each pixel, starting
+ * with the first one.
+ *
+ * @return nil if the buffers are identical; otherwise, a description of the
+ * first sample that differs.
+ */
+NSString *TSTestFrameCompare(const uint16_t *test, const uint16_t *ref, size_t count, size_t stride, size_t components);
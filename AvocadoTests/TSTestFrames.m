@@ -0,0 +1,98 @@
+//
+//  TSTestFrames.m
+//  AvocadoTests
+//
+//  Created by Tristan Seifert on 20161018.
+//  Copyright © 2016 Tristan Seifert. All rights reserved.
+//
+
+#import "TSTestFrames.h"
+
+/**
+ * Returns a human-readable name for the pattern.
+ */
+NSString *TSTestFramePatternName(TSTestFramePattern pattern) {
+	switch(pattern) {
+		case TSTestFramePatternRandom:
+			return @"random";
+		
+		case TSTestFramePatternExtremes:
+			return @"extremes";
+		
+		case TSTestFramePatternGradient:
+			return @"gradient";
+		
+		default:
+			return [NSString stringWithFormat:@"%lu", (unsigned long) pattern];
+	}
+}
+
+/**
+ * Fills a frame with the given pattern.
+ */
+void TSTestFrameFill(uint16_t (*image)[4], int width, int height, TSTestFramePattern pattern, unsigned int filters) {
+	srand(0x46524D00 + (unsigned int) pattern);
+	
+	memset(image, 0, width * height * 4 * sizeof(uint16_t));
+	
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) {
+			for(int c = 0; c < 4; c++) {
+				int val = 0;
+				
+				// in a mosaic, only the filter colour of the pixel is set
+				if(filters && c != (filters >> ((((y << 1) & 14) + (x & 1)) << 1) & 3)) {
+					continue;
+				}
+				
+				switch(pattern) {
+					case TSTestFramePatternRandom:
+						val = rand() & 0xFFFF;
+						break;
+					
+					case TSTestFramePatternExtremes:
+						val = (rand() & 1) ? 0xFFFF : 0;
+						break;
+					
+					case TSTestFramePatternGradient:
+						val = ((x * 0xC000) / width + (y * 0x2000) / height + (c * 0x800) + (rand() & 0x3FF)) & 0xFFFF;
+						break;
+					
+					default:
+						break;
+				}
+				
+				image[(y * width) + x][c] = val;
+			}
+		}
+	}
+}
+
+/**
+ * Extracts the Bayer mosaic from a frame.
+ */
+void TSTestFrameGetMosaic(const uint16_t (*image)[4], uint16_t *bayer, int width, int height, unsigned int filters) {
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) {
+			int c = (filters >> ((((y << 1) & 14) + (x & 1)) << 1) & 3);
+			bayer[(y * width) + x] = image[(y * width) + x][c];
+		}
+	}
+}
+
+/**
+ * Compares the given components of two buffers of pixels.
+ */
+NSString *TSTestFrameCompare(const uint16_t *test, const uint16_t *ref, size_t count, size_t stride, size_t components) {
+	for(size_t i = 0; i < count; i++) {
+		for(size_t c = 0; c < components; c++) {
+			const size_t idx = (i * stride) + c;
+			
+			if(test[idx] != ref[idx]) {
+				return [NSString stringWithFormat:@"pixel %zu component %zu is %u (expected %u)", i, c, test[idx], ref[idx]];
+			}
+		}
+	}
+	
+	return nil;
+}